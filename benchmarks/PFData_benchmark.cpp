@@ -0,0 +1,480 @@
+/**
+ * Throughput benchmarks of the PFData I/O paths.
+ * The benchmarks run on synthetic files written by generatePfbFile() on first use, in the working directory, and removed on exit.
+ * The grid and processor topology default to a 50x200x200 (ZYX, 16 MB) grid with P=4, Q=4, R=1, and can be changed with
+ * the environment variables PARFLOWIO_BENCH_GRID="nz,ny,nx" and PARFLOWIO_BENCH_PQR="p,q,r".
+ * Every benchmark reports bytes/s and points/s.
+ */
+#include "benchmark/benchmark.h"
+#include "parflow/pfbufferpool.hpp"
+#include "parflow/pfclm.hpp"
+#include "parflow/pfdata.hpp"
+#include "parflow/pfgenerator.hpp"
+#include "parflow/pftyped.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+//Reads "a,b,c" from an environment variable, keeps the defaults if unset or malformed
+std::array<int, 3> readTriple(const char* name, std::array<int, 3> values){
+    const char* env = std::getenv(name);
+    if(env == nullptr){
+        return values;
+    }
+
+    std::array<int, 3> parsed{};
+    char sep1 = 0, sep2 = 0;
+    std::istringstream stream(env);
+    if(stream >> parsed[0] >> sep1 >> parsed[1] >> sep2 >> parsed[2] && sep1 == ',' && sep2 == ','
+       && parsed[0] > 0 && parsed[1] > 0 && parsed[2] > 0){
+        return parsed;
+    }
+    std::fprintf(stderr, "Ignoring malformed %s=%s\n", name, env);
+    return values;
+}
+
+/**
+ * Synthetic input shared by all benchmarks: a generated pfb file with the configured grid and topology, and the same data in memory.
+ */
+class BenchFiles {
+public:
+    static BenchFiles& get(){
+        static BenchFiles files;
+        return files;
+    }
+
+    const std::string source = "parflowio_bench.pfb";
+    const std::string written = "parflowio_bench_write.pfb";
+    const std::string distributed = "parflowio_bench_dist.pfb";
+    const std::string compressed = "parflowio_bench.pfbz";
+    const std::string typed = "parflowio_bench.pfbt";
+
+    std::array<int, 3> grid;
+    std::array<int, 3> pqr;
+    std::vector<double> data;
+
+    long long numPoints() const{
+        return static_cast<long long>(grid[0]) * grid[1] * grid[2];
+    }
+
+    long long numBytes() const{
+        return 8 * numPoints();
+    }
+
+    //Wraps the in-memory data, for the write benchmarks
+    PFData makeInMemory(){
+        PFData pfData(data.data(), grid[0], grid[1], grid[2]);
+        pfData.setP(pqr[0]);
+        pfData.setQ(pqr[1]);
+        pfData.setR(pqr[2]);
+        return pfData;
+    }
+
+    ~BenchFiles(){
+        std::remove(source.c_str());
+        std::remove(written.c_str());
+        std::remove(distributed.c_str());
+        std::remove((distributed + ".dist").c_str());
+        std::remove(compressed.c_str());
+    }
+
+private:
+    BenchFiles() : grid(readTriple("PARFLOWIO_BENCH_GRID", {{50, 200, 200}})), pqr(readTriple("PARFLOWIO_BENCH_PQR", {{4, 4, 1}})){
+        const int numThreads = std::max(1u, std::thread::hardware_concurrency());
+        if(generatePfbFile(source, grid[0], grid[1], grid[2], pqr[0], pqr[1], pqr[2], 0, numThreads)){
+            std::fprintf(stderr, "Could not write %s\n", source.c_str());
+            std::exit(1);
+        }
+
+        //The same values in memory, for the write and compare benchmarks
+        data.resize(numPoints());
+        for(int z = 0; z < grid[0]; ++z){
+            for(int y = 0; y < grid[1]; ++y){
+                for(int x = 0; x < grid[2]; ++x){
+                    data[(static_cast<std::size_t>(z) * grid[1] + y) * grid[2] + x] = generatePfbValue(z, y, x, grid[1], grid[2]);
+                }
+            }
+        }
+    }
+};
+
+void setCounters(benchmark::State& state, long long bytesPerIteration, long long pointsPerIteration){
+    state.SetBytesProcessed(state.iterations() * bytesPerIteration);
+    state.counters["points"] = benchmark::Counter(static_cast<double>(state.iterations() * pointsPerIteration), benchmark::Counter::kIsRate);
+}
+
+void BM_loadData(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    for(auto _ : state){
+        PFData pfData(files.source);
+        if(pfData.loadHeader() || pfData.loadPQR() || pfData.loadData()){
+            state.SkipWithError("loadData failed");
+            break;
+        }
+        benchmark::DoNotOptimize(pfData.getData());
+    }
+    setCounters(state, files.numBytes(), files.numPoints());
+}
+BENCHMARK(BM_loadData)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+//loadData of a typed file. Floats take the benchmark values, the integer types a 0/1 mask. Bytes are those read.
+template<typename T>
+void BM_loadTypedData(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    std::vector<double> values(files.data);
+    if(std::is_integral<T>::value){
+        for(std::size_t i = 0; i < values.size(); ++i){
+            values[i] = values[i] > 0.5 * static_cast<double>(values.size()) ? 1.0 : 0.0;
+        }
+    }
+    PFData source(values.data(), files.grid[0], files.grid[1], files.grid[2]);
+    source.setP(files.pqr[0]);
+    source.setQ(files.pqr[1]);
+    source.setR(files.pqr[2]);
+    PFTypedData<T> typed;
+    if(typed.assign(source) || typed.writeFile(files.typed)){
+        state.SkipWithError("writing the typed file failed");
+        return;
+    }
+
+    for(auto _ : state){
+        PFTypedData<T> pfData(files.typed);
+        if(pfData.loadHeader() || pfData.loadData()){
+            state.SkipWithError("loadData failed");
+            break;
+        }
+        benchmark::DoNotOptimize(pfData.getData());
+    }
+    setCounters(state, files.numPoints() * static_cast<long long>(sizeof(T)), files.numPoints());
+    std::remove(files.typed.c_str());
+}
+BENCHMARK_TEMPLATE(BM_loadTypedData, float)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_loadTypedData, int32_t)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_loadTypedData, uint8_t)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+//loadData with the given number of blocks in flight, 1 is fully synchronous
+void BM_loadDataPrefetch(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    for(auto _ : state){
+        PFData pfData(files.source);
+        pfData.setPrefetchDepth(static_cast<int>(state.range(0)));
+        if(pfData.loadHeader() || pfData.loadPQR() || pfData.loadData()){
+            state.SkipWithError("loadData failed");
+            break;
+        }
+        benchmark::DoNotOptimize(pfData.getData());
+    }
+    setCounters(state, files.numBytes(), files.numPoints());
+}
+BENCHMARK(BM_loadDataPrefetch)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+//Same as BM_loadData, but the buffer is recycled from one iteration to the next
+void BM_loadDataPooled(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    PFBufferPool::shared().setCapacity(static_cast<std::size_t>(files.numBytes()));
+    for(auto _ : state){
+        PFData pfData(files.source);
+        if(pfData.loadHeader() || pfData.loadPQR() || pfData.loadData()){
+            state.SkipWithError("loadData failed");
+            break;
+        }
+        benchmark::DoNotOptimize(pfData.getData());
+    }
+    PFBufferPool::shared().setCapacity(0);
+    setCounters(state, files.numBytes(), files.numPoints());
+}
+BENCHMARK(BM_loadDataPooled)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+//loadData served from the native cache written by the first iteration. The mapping is paged in lazily, so every value is read.
+void BM_loadDataNativeCache(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    for(auto _ : state){
+        PFData pfData(files.source);
+        pfData.setNativeCache(true);
+        if(pfData.loadHeader() || pfData.loadPQR() || pfData.loadData()){
+            state.SkipWithError("loadData failed");
+            break;
+        }
+        const double* data = pfData.getData();
+        double sum = 0.0;
+        for(long long i = 0; i < files.numPoints(); ++i){
+            sum += data[i];
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    std::remove((files.source + ".pfbn").c_str());
+    setCounters(state, files.numBytes(), files.numPoints());
+}
+BENCHMARK(BM_loadDataNativeCache)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_loadDataThreaded(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    const int numThreads = static_cast<int>(state.range(0));
+    for(auto _ : state){
+        PFData pfData(files.source);
+        if(pfData.loadHeader() || pfData.loadPQR() || pfData.loadDataThreaded(numThreads)){
+            state.SkipWithError("loadDataThreaded failed");
+            break;
+        }
+        benchmark::DoNotOptimize(pfData.getData());
+    }
+    setCounters(state, files.numBytes(), files.numPoints());
+}
+BENCHMARK(BM_loadDataThreaded)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_loadClipOfData(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    //A quarter of the X/Y plane, away from the origin so it crosses subgrid boundaries
+    const int extentX = std::max(1, files.grid[2] / 2);
+    const int extentY = std::max(1, files.grid[1] / 2);
+    const int clipX = (files.grid[2] - extentX) / 2;
+    const int clipY = (files.grid[1] - extentY) / 2;
+    for(auto _ : state){
+        PFData pfData(files.source);
+        if(pfData.loadHeader() || pfData.loadPQR() || pfData.loadClipOfData(clipX, clipY, extentX, extentY)){
+            state.SkipWithError("loadClipOfData failed");
+            break;
+        }
+        benchmark::DoNotOptimize(pfData.getData());
+    }
+    const long long points = static_cast<long long>(extentX) * extentY * files.grid[0];
+    setCounters(state, 8 * points, points);
+}
+BENCHMARK(BM_loadClipOfData)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+//One layer of the stack read as a CLM variable, the way land surface post-processing reads a .c.pfb
+void BM_clmReadVariable(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    PFClmData clm(files.source);
+    if(clm.loadHeader()){
+        state.SkipWithError("loadHeader failed");
+        return;
+    }
+    const std::string name = clm.getVariableNames()[files.grid[0] / 2];
+    std::vector<double> values(static_cast<std::size_t>(files.grid[1]) * files.grid[2]);
+    for(auto _ : state){
+        if(clm.readVariable(name, values.data())){
+            state.SkipWithError("readVariable failed");
+            break;
+        }
+        benchmark::DoNotOptimize(values.data());
+    }
+    setCounters(state, 8 * static_cast<long long>(values.size()), static_cast<long long>(values.size()));
+}
+BENCHMARK(BM_clmReadVariable)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_fileReadPoint(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    PFData pfData(files.source);
+    if(pfData.loadHeader() || pfData.loadPQR()){
+        state.SkipWithError("loadHeader failed");
+        return;
+    }
+
+    //Scattered points, the same sequence for every run
+    unsigned int seed = 12345;
+    long long numRead = 0;
+    for(auto _ : state){
+        seed = seed * 1103515245u + 12345u;
+        const int z = static_cast<int>((seed >> 4) % files.grid[0]);
+        const int y = static_cast<int>((seed >> 8) % files.grid[1]);
+        const int x = static_cast<int>((seed >> 12) % files.grid[2]);
+        benchmark::DoNotOptimize(pfData.fileReadPoint(z, y, x));
+        numRead++;
+    }
+    state.SetBytesProcessed(8 * numRead);
+    state.counters["points"] = benchmark::Counter(static_cast<double>(numRead), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_fileReadPoint);
+
+void BM_fileReadSubgridAtGridIndex(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    PFData pfData(files.source);
+    if(pfData.loadHeader() || pfData.loadPQR()){
+        state.SkipWithError("loadHeader failed");
+        return;
+    }
+
+    //Cycle over every subgrid
+    const int numSubgrids = files.pqr[0] * files.pqr[1] * files.pqr[2];
+    long long numPoints = 0;
+    int subgrid = 0;
+    for(auto _ : state){
+        const int gridX = subgrid % files.pqr[0];
+        const int gridY = (subgrid / files.pqr[0]) % files.pqr[1];
+        const int gridZ = subgrid / (files.pqr[0] * files.pqr[1]);
+        std::vector<double> values = pfData.fileReadSubgridAtGridIndex(gridZ, gridY, gridX);
+        benchmark::DoNotOptimize(values.data());
+        numPoints += static_cast<long long>(values.size());
+        subgrid = (subgrid + 1) % numSubgrids;
+    }
+    state.SetBytesProcessed(8 * numPoints);
+    state.counters["points"] = benchmark::Counter(static_cast<double>(numPoints), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_fileReadSubgridAtGridIndex)->Unit(benchmark::kMicrosecond);
+
+void BM_writeFile(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    PFData pfData = files.makeInMemory();
+    for(auto _ : state){
+        if(pfData.writeFile(files.written)){
+            state.SkipWithError("writeFile failed");
+            break;
+        }
+    }
+    setCounters(state, files.numBytes(), files.numPoints());
+}
+BENCHMARK(BM_writeFile)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_writeFileThreaded(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    PFData pfData = files.makeInMemory();
+    const int numThreads = static_cast<int>(state.range(0));
+    for(auto _ : state){
+        if(pfData.writeFileThreaded(files.written, numThreads)){
+            state.SkipWithError("writeFileThreaded failed");
+            break;
+        }
+    }
+    setCounters(state, files.numBytes(), files.numPoints());
+}
+BENCHMARK(BM_writeFileThreaded)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_writeCompressedFile(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    PFData pfData = files.makeInMemory();
+    const int numThreads = static_cast<int>(state.range(0));
+    for(auto _ : state){
+        if(pfData.writeCompressedFile(files.compressed, numThreads)){
+            state.SkipWithError("writeCompressedFile failed");
+            break;
+        }
+    }
+    setCounters(state, files.numBytes(), files.numPoints());
+    std::ifstream written(files.compressed, std::ios::binary | std::ios::ate);
+    state.counters["ratio"] = static_cast<double>(files.numBytes()) / static_cast<double>(written.tellg());
+}
+BENCHMARK(BM_writeCompressedFile)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+//Reads the file written by BM_writeCompressedFile
+void BM_loadCompressedData(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    const int numThreads = static_cast<int>(state.range(0));
+    for(auto _ : state){
+        PFData pfData(files.compressed);
+        if(pfData.loadHeader() || pfData.loadDataThreaded(numThreads)){
+            state.SkipWithError("loading the compressed file failed");
+            break;
+        }
+        benchmark::DoNotOptimize(pfData.getData());
+    }
+    setCounters(state, files.numBytes(), files.numPoints());
+}
+BENCHMARK(BM_loadCompressedData)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+//Error bounded compression, the argument is the bound as a negative power of 10
+void BM_writeCompressedFileErrorBound(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    PFData pfData = files.makeInMemory();
+    const double errorBound = std::pow(10.0, -static_cast<double>(state.range(0)));
+    for(auto _ : state){
+        if(pfData.writeCompressedFile(files.compressed, 1, errorBound)){
+            state.SkipWithError("writeCompressedFile failed");
+            break;
+        }
+    }
+    setCounters(state, files.numBytes(), files.numPoints());
+    std::ifstream written(files.compressed, std::ios::binary | std::ios::ate);
+    state.counters["ratio"] = static_cast<double>(files.numBytes()) / static_cast<double>(written.tellg());
+}
+BENCHMARK(BM_writeCompressedFileErrorBound)->Arg(3)->Arg(6)->Arg(9)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_distFile(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    //Redistribute onto twice as many subgrids in X and Y
+    const int p = std::min(files.grid[2], 2 * files.pqr[0]);
+    const int q = std::min(files.grid[1], 2 * files.pqr[1]);
+    for(auto _ : state){
+        PFData pfData(files.source);
+        if(pfData.distFile(p, q, files.pqr[2], files.distributed)){
+            state.SkipWithError("distFile failed");
+            break;
+        }
+    }
+    setCounters(state, files.numBytes(), files.numPoints());
+}
+BENCHMARK(BM_distFile)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_compare(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    PFData first(files.source);
+    PFData second(files.source);
+    if(first.loadHeader() || first.loadPQR() || first.loadData() ||
+       second.loadHeader() || second.loadPQR() || second.loadData()){
+        state.SkipWithError("loadData failed");
+        return;
+    }
+
+    for(auto _ : state){
+        std::array<int, 3> diffIndex{};
+        benchmark::DoNotOptimize(first.compare(second, &diffIndex));
+    }
+    //Both arrays are read
+    setCounters(state, 2 * files.numBytes(), files.numPoints());
+}
+BENCHMARK(BM_compare)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_compareTolerance(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    PFData first(files.source);
+    PFData second(files.source);
+    if(first.loadHeader() || first.loadPQR() || first.loadData() ||
+       second.loadHeader() || second.loadPQR() || second.loadData()){
+        state.SkipWithError("loadData failed");
+        return;
+    }
+
+    PFCompareTolerance tolerance;
+    tolerance.ulps = 4;
+    for(auto _ : state){
+        PFCompareReport report;
+        benchmark::DoNotOptimize(first.compare(second, tolerance, &report, static_cast<int>(state.range(0))));
+    }
+    setCounters(state, 2 * files.numBytes(), files.numPoints());
+}
+BENCHMARK(BM_compareTolerance)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_computeStatistics(benchmark::State& state){
+    BenchFiles& files = BenchFiles::get();
+    PFData test(files.source);
+    if(test.loadHeader() || test.loadPQR()){
+        state.SkipWithError("loadHeader failed");
+        return;
+    }
+
+    for(auto _ : state){
+        PFStatisticsReport report;
+        if(test.computeStatistics(report, static_cast<int>(state.range(0)), 64, -1.0, 1.0)){
+            state.SkipWithError("computeStatistics failed");
+            return;
+        }
+        benchmark::DoNotOptimize(report.total.mean);
+    }
+    setCounters(state, files.numBytes(), files.numPoints());
+}
+BENCHMARK(BM_computeStatistics)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+} //namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,101 @@
+#ifndef PARFLOWIO_PFBUFFERPOOL_HPP
+#define PARFLOWIO_PFBUFFERPOOL_HPP
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * class: PFBufferPool
+ * Allocator of the data arrays owned by PFData. Every buffer is aligned to 64 bytes (a cache line, and an AVX-512 vector).
+ * Pooling is off by default. With a non-zero capacity, released buffers are kept and handed out again to later requests
+ * of the same size, so a loop loading one timestep after the other allocates its buffer once.
+ * Large buffers can optionally be backed by transparent huge pages (Linux only).
+ * All functions are thread safe.
+ */
+class PFBufferPool {
+public:
+    //Alignment of every buffer, in bytes
+    static const std::size_t ALIGNMENT = 64;
+
+    /** Returns the pool used by PFData.
+     */
+    static PFBufferPool& shared();
+
+    PFBufferPool() = default;
+    PFBufferPool(const PFBufferPool&) = delete;
+    PFBufferPool& operator=(const PFBufferPool&) = delete;
+
+    //Frees the idle buffers, buffers still in use must not be released afterwards
+    ~PFBufferPool();
+
+    /** Returns a buffer of at least `bytes` bytes aligned to ALIGNMENT, reusing an idle buffer of the same size if there is one.
+     * \param   bytes   Size of the buffer.
+     * \return          The buffer, nullptr if the allocation failed.
+     */
+    void* allocate(std::size_t bytes);
+
+    /** Gives a buffer back. Buffers from allocate() are kept for reuse if they fit in the capacity, and freed otherwise.
+     * Buffers passed to adopt() are freed with std::free(). Any other pointer is not owned by the pool: it is left alone and an
+     * error is logged.
+     * \param   buffer  The buffer, nothing is done if nullptr.
+     */
+    void release(void* buffer);
+
+    /** Takes ownership of an array allocated with std::malloc(), std::calloc() or std::realloc(), so that it can be given
+     * to release(), e.g. by a PFData owning it. Adopted arrays are never kept for reuse.
+     * \param   buffer  The array, nothing is done if nullptr.
+     * \param   bytes   Size of the array.
+     */
+    void adopt(void* buffer, std::size_t bytes);
+
+    /** Sets the maximum number of bytes of idle buffers kept for reuse, 0 (the default) disables pooling.
+     * Idle buffers beyond the new capacity are freed.
+     */
+    void setCapacity(std::size_t bytes);
+
+    //Maximum number of bytes of idle buffers kept for reuse
+    std::size_t getCapacity() const;
+
+    //Number of bytes of idle buffers currently kept for reuse
+    std::size_t getIdleBytes() const;
+
+    /** Backs newly allocated buffers of at least 2 MiB with transparent huge pages. Only has an effect on Linux.
+     * \param   hugePages   True to request huge pages.
+     */
+    void setHugePages(bool hugePages);
+
+    //True if huge pages are requested
+    bool getHugePages() const;
+
+    //Frees every idle buffer
+    void trim();
+
+private:
+    struct Block {
+        std::size_t bytes;
+        bool mapped;    //Allocated with mmap, for huge pages
+        bool adopted;   //Allocated by the caller with std::malloc(), see adopt()
+    };
+
+    //Frees idle buffers until at most `bytes` are left, m_mutex must be held
+    void trimTo(std::size_t bytes);
+
+    //Allocates and frees memory from the system
+    static void* allocateBlock(std::size_t bytes, bool hugePages, bool& mapped);
+    static void freeBlock(void* buffer, const Block& block);
+
+    mutable std::mutex m_mutex;
+
+    //Every buffer handed out by allocate() or adopted and not freed yet, in use or idle
+    std::unordered_map<void*, Block> m_blocks;
+
+    //Idle buffers by size
+    std::multimap<std::size_t, void*> m_idle;
+
+    std::size_t m_idleBytes = 0;
+    std::size_t m_capacity = 0;
+    bool m_hugePages = false;
+};
+
+#endif //PARFLOWIO_PFBUFFERPOOL_HPP
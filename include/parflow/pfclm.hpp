@@ -0,0 +1,91 @@
+#ifndef PARFLOWIO_PFCLM_HPP
+#define PARFLOWIO_PFCLM_HPP
+#include "parflow/pfdata.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * class: PFClmData
+ * A ParFlow-CLM single file output (`.c.pfb`), which stacks the 2D land surface variables of a timestep along Z, one
+ * variable per layer. Variables are read by name straight from the file with hyperslab reads, so reading one variable
+ * only touches its layer of every subgrid, and never the rest of the stack.
+ * The default layout is the one written by ParFlow-CLM: 13 surface variables followed by the soil temperature of every
+ * soil layer, see defaultVariableNames(). Other layouts can be described with setVariableNames().
+ */
+class PFClmData {
+public:
+    /**
+     * PFClmData
+     * @param filename path of the `.c.pfb` file
+     */
+    explicit PFClmData(const std::string& filename);
+
+    PFClmData(const PFClmData&) = delete;
+    PFClmData& operator=(const PFClmData&) = delete;
+
+    /** Loads the header and subgrid layout of the file, and names its layers with defaultVariableNames().
+     * The subgrid layout is taken from a `.pfidx` or `.dist` sidecar when one exists.
+     * \return  0 on success, non-zero on failure.
+     */
+    int loadHeader();
+
+    /** Names of the layers of a ParFlow-CLM output with `numLayers` layers: eflx_lh_tot, eflx_lwrad_out, eflx_sh_tot,
+     * eflx_soil_grnd, qflx_evap_tot, qflx_evap_grnd, qflx_evap_soi, qflx_evap_veg, qflx_tran_veg, qflx_infl, swe_out, t_grnd,
+     * qflx_qirr, then t_soil_1 (top) to t_soil_N for the remaining layers.
+     */
+    static std::vector<std::string> defaultVariableNames(int numLayers);
+
+    /** Replaces the names of the layers, for files with a different layout.
+     * \pre             loadHeader()
+     * \param   names   One unique name per layer, NZ names.
+     * \return          0 on success, EINVAL if the number of names does not match NZ or a name is repeated.
+     */
+    int setVariableNames(const std::vector<std::string>& names);
+
+    //Names of the layers, in layer order
+    const std::vector<std::string>& getVariableNames() const;
+
+    //Number of variables, NZ of the file
+    int getNumVariables() const;
+
+    //Layer of a variable, -1 if there is no variable of that name
+    int getVariableIndex(const std::string& name) const;
+
+    /** Reads a single variable.
+     * \pre                 loadHeader()
+     * \param   name        Name of the variable.
+     * \param   buffer      Destination, NY * NX values, X fastest.
+     * \return              0 on success, EINVAL for an unknown variable, other values on read errors.
+     */
+    int readVariable(const std::string& name, double* buffer) const;
+
+    /** Reads a subset of the variables. Variables on consecutive layers are read together.
+     * \pre                 loadHeader()
+     * \param   names       Names of the variables.
+     * \param   buffer      Destination, names.size() * NY * NX values, the variables in the order of `names`.
+     * \return              0 on success, EINVAL for an unknown variable, other values on read errors.
+     */
+    int readVariables(const std::vector<std::string>& names, double* buffer) const;
+
+    /** Same as readVariable(), but returns the variable.
+     * \return  NY * NX values, empty on error.
+     */
+    std::vector<double> loadVariable(const std::string& name) const;
+
+    /** Same as readVariables(), but returns the variables.
+     * \return  Flattened [variable][y][x] array of names.size() * NY * NX values, empty on error.
+     */
+    std::vector<double> loadVariables(const std::vector<std::string>& names) const;
+
+    /** The file, with its header and subgrid layout loaded.
+     * \pre     loadHeader()
+     */
+    const PFData& getHeader() const;
+
+private:
+    PFData m_file;
+    std::vector<std::string> m_names;
+};
+
+#endif //PARFLOWIO_PFCLM_HPP
@@ -2,20 +2,339 @@
 #define PARFLOWIO_PFDATA_HPP
 #include <array>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+/**
+ * struct: PFSubgridView
+ * A zero-copy view of a single subgrid inside a memory mapped pfb file (see PFData::mapFile()).
+ * The view points directly into the mapping, so the values are still stored big endian and are converted on access.
+ * A view is only valid while the PFData object that created it stays mapped.
+ */
+struct PFSubgridView {
+    //Start of the big endian subgrid data inside the mapping, nullptr if the view is invalid.
+    const unsigned char* data = nullptr;
+
+    //Global index of the first element of the subgrid
+    int startZ = 0;
+    int startY = 0;
+    int startX = 0;
+
+    //Extents of the subgrid
+    int nz = 0;
+    int ny = 0;
+    int nx = 0;
+
+    /** Returns the value at the specified index, relative to the start of the subgrid.
+     * \pre         isValid()
+     * \param   z   Z index inside the subgrid, [0, nz)
+     * \param   y   Y index inside the subgrid, [0, ny)
+     * \param   x   X index inside the subgrid, [0, nx)
+     * \return      Value at the specified index, converted to native byte order.
+     */
+    double operator()(int z, int y, int x) const;
+
+    /** Returns true if the view points at data.
+     */
+    bool isValid() const;
+};
+
+/**
+ * struct: PFSubgridHeader
+ * The header of a single subgrid, as stored in the pfb file, together with the location of the subgrid in the file.
+ */
+struct PFSubgridHeader {
+    //Lower left corner of the subgrid
+    int ix = 0;
+    int iy = 0;
+    int iz = 0;
+
+    //Extents of the subgrid
+    int nx = 0;
+    int ny = 0;
+    int nz = 0;
+
+    //Refinement level
+    int rx = 0;
+    int ry = 0;
+    int rz = 0;
+
+    //Absolute offset from the start of the file to the start of the subgrid header
+    long long offset = 0;
+};
+
+/**
+ * class: SubgridIndex
+ * Records the header and absolute byte offset of every subgrid in a pfb file, so that subgrids can be located in O(1)
+ * without seeking through the file. The index is built with a single pass over the subgrid headers, and can be saved
+ * to and loaded from a sidecar file. It can also be reconstructed from the `.dist` file written by PFData::distFile(),
+ * which only requires reading a couple of subgrid headers.
+ */
+class SubgridIndex {
+private:
+    std::vector<PFSubgridHeader> m_headers;
+    int m_p = 0;
+    int m_q = 0;
+    int m_r = 0;
+
+    //Derives P, Q, and R from the recorded headers
+    void calcPQR();
+
+public:
+    /** Builds the index by reading every subgrid header of the file.
+     * \param   fp              Open pfb file. The position of fp is restored before returning.
+     * \param   numSubgrids     Number of subgrids, from the file header.
+     * \return                  0 on success, non-zero on error. The index is empty on error.
+     */
+    int build(std::FILE* fp, int numSubgrids);
+
+    /** Reconstructs the index from the block offsets in a `.dist` file, assuming the regular ParFlow layout.
+     * Only the headers of the first and last subgrid are read, to choose between candidate processor topologies.
+     * \param   distFilename    Path of the `.dist` file.
+     * \param   fp              Open pfb file the `.dist` file belongs to. The position of fp is restored before returning.
+     * \param   nz              NZ of the file.
+     * \param   ny              NY of the file.
+     * \param   nx              NX of the file.
+     * \param   numSubgrids     Number of subgrids, from the file header.
+     * \return                  0 on success, non-zero if the `.dist` file can not be used. The index is empty on error.
+     */
+    int loadDist(const std::string& distFilename, std::FILE* fp, int nz, int ny, int nx, int numSubgrids);
+
+    /** Saves the index to a sidecar file. The size and modification time of the pfb, and a checksum of its header and of
+     * the headers of the first and last subgrid are recorded to detect stale sidecars.
+     * \param   filename            Path of the sidecar file.
+     * \param   fp                  Open pfb file the index belongs to. The position of fp is restored before returning.
+     * \param   modificationTime    Modification time of the pfb file.
+     * \return                      0 on success, non-zero on error.
+     */
+    int save(const std::string& filename, std::FILE* fp, long long modificationTime) const;
+
+    /** Loads the index from a sidecar file written by save(), after checking that it still describes the file.
+     * \param   filename            Path of the sidecar file.
+     * \param   fp                  Open pfb file. The position of fp is restored before returning.
+     * \param   numSubgrids         Number of subgrids, from the file header.
+     * \param   modificationTime    Modification time of the pfb file.
+     * \return                      0 on success, non-zero if the sidecar is missing, invalid, or does not match the file. The index is empty on error.
+     */
+    int load(const std::string& filename, std::FILE* fp, int numSubgrids, long long modificationTime);
+
+    //Removes all entries
+    void clear();
+
+    //True if the index has no entries
+    bool empty() const;
+
+    //Number of subgrids in the index
+    int size() const;
+
+    /** Returns the header of the subgrid with the flattened subgrid index.
+     * \pre             !empty()
+     * \param   index   Flattened subgrid index, in the order the subgrids are stored in the file, [0, size())
+     */
+    const PFSubgridHeader& at(int index) const;
+
+    /** Returns the header of the subgrid at the specified subgrid index.
+     * \pre             !empty()
+     */
+    const PFSubgridHeader& at(int gridZ, int gridY, int gridX) const;
+
+    //Processor topology of the indexed file, 0 if the index is empty
+    int getP() const;
+    int getQ() const;
+    int getR() const;
+};
+
+/**
+ * class: SubgridCache
+ * Least recently used cache of decoded subgrids, used by PFData::get() to page subgrids in on demand.
+ * The cache holds at most its byte budget, except that the most recently inserted subgrid is always kept.
+ */
+class SubgridCache {
+private:
+    struct Entry {
+        std::vector<double> values;
+        unsigned long long lastUse = 0;
+    };
+
+    std::unordered_map<int, Entry> m_entries;
+    std::size_t m_budget = 256u << 20;
+    std::size_t m_size = 0;
+    unsigned long long m_clock = 0;
+
+    //Evicts the least recently used subgrids until `extra` more bytes fit in the budget
+    void makeRoom(std::size_t extra);
+
+public:
+    /** Sets the byte budget, evicting subgrids if the cache holds more.
+     * \param   bytes   Maximum number of bytes of subgrid data to keep.
+     */
+    void setBudget(std::size_t bytes);
+
+    //The byte budget
+    std::size_t getBudget() const;
+
+    //Number of bytes of subgrid data held
+    std::size_t getSize() const;
+
+    //Number of subgrids held
+    int getNumEntries() const;
+
+    /** Looks up a subgrid, and marks it as most recently used.
+     * \param   subgrid Flattened subgrid index.
+     * \return          The values of the subgrid, nullptr if it is not cached.
+     */
+    const std::vector<double>* find(int subgrid);
+
+    /** Adds a subgrid, evicting the least recently used subgrids to stay within the budget.
+     * \param   subgrid Flattened subgrid index.
+     * \param   values  The values of the subgrid, moved into the cache.
+     * \return          The cached values, valid until the next call to insert(), setBudget(), or clear().
+     */
+    const std::vector<double>& insert(int subgrid, std::vector<double>&& values);
+
+    //Removes all subgrids
+    void clear();
+};
+
+/**
+ * struct: PFSubgridExtent
+ * Location and extents of a subgrid, handed to the callback of PFData::forEachSubgrid().
+ */
+struct PFSubgridExtent {
+    //Flattened subgrid index, see PFData::unflattenGridIndex()
+    int index = 0;
+
+    //Subgrid indices
+    int gridZ = 0;
+    int gridY = 0;
+    int gridX = 0;
+
+    //Global index of the first element of the subgrid
+    int startZ = 0;
+    int startY = 0;
+    int startX = 0;
+
+    //Extents of the subgrid
+    int nz = 0;
+    int ny = 0;
+    int nx = 0;
+};
+
+/**
+ * struct: PFCompareTolerance
+ * Tolerances used by PFData::compare() when given a report. Two values match if any one of the tolerances accepts them.
+ * NaNs match other NaNs, and never match a number. With every tolerance left at 0 only identical values match.
+ */
+struct PFCompareTolerance {
+    //Largest accepted |a - b|
+    double absolute = 0.0;
+    //Largest accepted |a - b| / max(|a|, |b|)
+    double relative = 0.0;
+    //Largest accepted distance in units in the last place, the number of doubles between a and b
+    long long ulps = 0;
+};
+
+/**
+ * struct: PFDifferenceSummary
+ * Differences found by PFData::compare() within a single layer or subgrid.
+ */
+struct PFDifferenceSummary {
+    //Number of cells outside of the tolerance
+    long long numDifferent = 0;
+    //Largest absolute error of any cell, including cells within the tolerance
+    double maxAbsError = 0.0;
+};
+
+/**
+ * struct: PFCompareReport
+ * Full result of PFData::compare() with tolerances. Locations are {z, y, x}, {-1, -1, -1} if there is none.
+ */
+struct PFCompareReport {
+    //Number of cells compared
+    long long numCompared = 0;
+    //Number of cells outside of the tolerance, including NaN mismatches
+    long long numDifferent = 0;
+    //Number of cells where only one of the values is NaN
+    long long numNaNMismatches = 0;
+
+    //Largest errors of any cell, including cells within the tolerance, and where they occur first
+    double maxAbsError = 0.0;
+    std::array<int, 3> maxAbsErrorIndex{{-1, -1, -1}};
+    double maxRelError = 0.0;
+    std::array<int, 3> maxRelErrorIndex{{-1, -1, -1}};
+    unsigned long long maxUlpError = 0;
+
+    //First cell outside of the tolerance, in file order
+    std::array<int, 3> firstDifferenceIndex{{-1, -1, -1}};
+
+    //Summary of every Z layer
+    std::vector<PFDifferenceSummary> layers;
+    //Summary of every subgrid, indexed like unflattenGridIndex(). A single entry if the topology is not known.
+    std::vector<PFDifferenceSummary> subgrids;
+};
+
+/**
+ * struct: PFStatistics
+ * Summary statistics of a set of values, computed by PFData::computeStatistics(). NaNs are counted, but excluded from the rest.
+ */
+struct PFStatistics {
+    //Number of values that are not NaN
+    long long count = 0;
+    long long numNaN = 0;
+    //NaN if there are no values
+    double min = std::nan("");
+    double max = std::nan("");
+    double sum = 0.0;
+    double mean = 0.0;
+    //Population variance, sum((v - mean)^2) / count
+    double variance = 0.0;
+    //Counts of the values in equal width bins over the requested range, values outside of it count in the first or last bin
+    std::vector<long long> histogram;
+};
+
+/**
+ * struct: PFStatisticsReport
+ * Statistics of a whole file, of every Z layer, and of every subgrid.
+ */
+struct PFStatisticsReport {
+    PFStatistics total;
+    std::vector<PFStatistics> layers;
+    //Indexed like PFData::unflattenGridIndex(). A single entry if the topology is not known.
+    std::vector<PFStatistics> subgrids;
+};
+
+/**
+ * struct: PFSparseData
+ * The points of a scattered binary (.pfsb) file. Only the listed points are stored, every other point of the grid is zero.
+ */
+struct PFSparseData {
+    //Flat ZYX index of every point, (z * NY + y) * NX + x, in the order of the file
+    std::vector<long long> indices;
+    std::vector<double> values;
+};
+
 /**
  * class: PFData
  * The PFData class refers to the contents of ParflowBinary File. This class provides several methods to read
  * and write those files as well as export the data.
  */
 class PFData {
+    //Shares the header and subgrid layout of one file across a series of files
+    friend class PFSeries;
+
 private:
     std::string m_filename;
     std::FILE* m_fp = nullptr;
 
+    //Second descriptor of the same file, used with readFileAt() by the const readers so they never move m_fp
+    int m_fd = -1;
+
     // The following information is available only after the file is opened
     // main header information
     double m_Z = 0.0;
@@ -43,6 +362,35 @@ private:
 
     double* m_data = nullptr;
 
+    //Single precision copy of the data, filled instead of m_data when m_loadAsFloat is set. Always owned.
+    float* m_floatData = nullptr;
+    bool m_loadAsFloat = false;
+
+    //Number of blocks loadData() keeps in flight, see setPrefetchDepth()
+    int m_prefetchDepth = 4;
+
+    //Location of every subgrid in the file, filled by loadPQR() or loadSubgridIndex()
+    SubgridIndex m_subgridIndex;
+
+    //Subgrids paged in by get() when no data is loaded, guarded by m_subgridCacheMutex so get() can be called concurrently
+    mutable SubgridCache m_subgridCache;
+    mutable std::mutex m_subgridCacheMutex;
+
+    //Read-only mapping of the file, only set after mapFile()
+    const unsigned char* m_map = nullptr;
+    std::size_t m_mapSize = 0;
+
+    //Set by loadHeader() for compressed files, with the offset of every chunk and the end of the last one
+    bool m_compressed = false;
+    std::vector<long long> m_chunkOffsets;
+    //Error bound of the chunks, 0 if they are lossless
+    double m_errorBound = 0.0;
+
+    //Private mapping of the `.pfbn` sidecar m_data points into, only set after loadNativeCache()
+    unsigned char* m_nativeMap = nullptr;
+    std::size_t m_nativeMapSize = 0;
+    bool m_nativeCache = false;
+
 	/**
 	 * writeFile
 	 * @param string filename
@@ -78,26 +426,114 @@ private:
      */
     long getPointOffset(int z, int y, int x) const;
 
-    /** Read in the subgrid at the specified subgrid index.
+    /** Read in the subgrid at the specified subgrid index, with readRaw().
      * \pre             loadHeader() and loadPQR()
      * \param           buffer  Pointer to an array of size: getSubgridSizeX(gridX) * getSubgridSizeY(gridY) * getSubgridSizeZ(gridZ), 1d
-     * \param   fp      File pointer to use. No requirement on current position, as it will seek to the appropriate location. If no error has occurred, fp will point after the last element read.
      * \param   gridZ   The Z index of the subgrid to read.
      * \param   gridY   The Y index of the subgrid to read
      * \param   gridX   The X index of the subgrid to read.
      * \return          0 if success, non-zero if error.
      */
-    int fileReadSubgridAtGridIndexInternal(double* buffer, std::FILE* fp, int gridZ, int gridY, int gridX) const;
+    int fileReadSubgridAtGridIndexInternal(double* buffer, int gridZ, int gridY, int gridX) const;
+
+    /** Reads a range of pencils (rows along X) of a subgrid, emplacing them into the m_data array. The pencils of a subgrid
+     * are stored contiguously in the file, so the range is read with a single positional read.
+     * \pre                 loadHeader() and loadPQR()
+     * \param   fd          Descriptor to read from with readFileAt(), unused if the file is mapped.
+     * \param   scratch     Buffer to read into, resized as needed. Unused if the file is mapped.
+     * \param   gridZ       Z index of the target subgrid
+     * \param   gridY       Y index of the target subgrid
+     * \param   gridX       X index of the target subgrid
+     * \param   pencilBegin Index of the first pencil to read, pencil `i` is at z = i / sizeY, y = i % sizeY inside the subgrid.
+     * \param   pencilEnd   One past the last pencil to read.
+     * \return              0 if success, non-zero on error.
+     */
+    int emplacePencilsFromFile(int fd, std::vector<uint64_t>& scratch, int gridZ, int gridY, int gridX, int pencilBegin, int pencilEnd);
+
+    /** Reads raw bytes from the file, out of the mapping if the file is mapped, otherwise with a positional read on m_fd.
+     * Safe to call from several threads at once.
+     * \param   dst     Destination, at least `count` bytes.
+     * \param   count   Number of bytes to read.
+     * \param   offset  Absolute offset in the file.
+     * \return          0 on success, non-zero on error.
+     */
+    int readRaw(void* dst, std::size_t count, long long offset) const;
 
-    /** Reads in the subgrid from the file pointer, emplacing it into the m_data array.
-     * \pre             loadHeader() and loadPQR()
-     * \param   fp      The file pointer to use.
-     * \param   gridZ   Z index of the target subgrid
-     * \param   gridY   Y index of the target subgrid
-     * \param   gridX   X index of the target subgrid
-     * \return          0 if success, non-zero on error.
+    /** Releases the data arrays owned by this object to PFBufferPool::shared().
+     */
+    void releaseData();
+
+    /** Returns true if P, Q, and R describe the subgrids of the file (loadPQR(), or set to match the number of subgrids).
+     */
+    bool hasTopology() const;
+
+    /** Takes over the file, mapping, data arrays, and header of another object, leaving it empty.
+     */
+    void moveFrom(PFData& other);
+
+    /** Allocates the array loadData() and friends fill: m_floatData if m_loadAsFloat is set, m_data otherwise.
+     * \param   count   Number of elements.
+     * \return          0 on success, 2 if the allocation failed.
+     */
+    int allocateLoadBuffer(std::size_t count);
+
+    /** Converts `count` big endian doubles into the loaded array at the flattened `index`, as doubles or floats depending on m_loadAsFloat.
+     */
+    void storePencil(const uint64_t* src, long long index, int count);
+
+    /** Shared implementation of both readHyperslab() overloads, T is double or float.
+     */
+    template<typename T>
+    int readHyperslabInto(T* buffer, int z0, int y0, int x0, int nz, int ny, int nx, int strideZ, int strideY, int strideX, int numThreads) const;
+
+    /** Shared implementation of both writeFileThreaded() overloads.
+     * \param   source  Produces the values, if nullptr they are read from m_data.
+     */
+    int writeFileParallel(const std::string& filename, int numThreads, const std::function<void(double*, int, int, int, int)>* source);
+
+    /** Encodes the 64 byte file header, big endian, as written by writeFile().
+     * \param   dst     Destination, at least 64 bytes.
+     */
+    void encodeFileHeader(unsigned char* dst) const;
+
+    /** Encodes the 36 byte header of the subgrid at the specified subgrid index, big endian, as written by writeFile().
+     * \param   dst     Destination, at least 36 bytes.
+     */
+    void encodeSubgridHeader(unsigned char* dst, int gridZ, int gridY, int gridX) const;
+
+    /** Performs the same functionality as loadData(), but reads the subgrids out of the file mapping.
+     * \pre     mapFile()
+     * \return  0 if success, non-zero on error.
+     */
+    int loadDataFromMap();
+
+    /** The body of loadData() when the file is not mapped: reads the file through the prefetch ring.
+     * \return  0 if success, non-zero on error.
+     */
+    int loadDataFromFile();
+
+    /** Writes a scattered binary (.pfsb) file with the header and processor topology of this object.
+     * \param   emitPoints  Called once per subgrid, in file order, with the flattened subgrid index, to append the points of
+     *                      the subgrid in file format.
+     * \return              0 on success, non-zero on error.
+     */
+    int writeScattered(const std::string& filename, const std::function<void(int, std::vector<unsigned char>&)>& emitPoints) const;
+
+    /** Reads the container header and chunk table of a compressed file, the rest of loadHeader() for such files.
+     * \return  0 on success, non-zero on error.
      */
-    int emplaceSubgridFromFile(std::FILE* fp, int gridZ, int gridY, int gridX);
+    int loadCompressedHeader();
+
+    /** Reads and decompresses the chunk of a subgrid of a compressed file.
+     * \param   buffer  Destination, the values of the subgrid, X fastest.
+     * \return          0 on success, otherwise an errno value.
+     */
+    int readCompressedSubgrid(double* buffer, int gridZ, int gridY, int gridX) const;
+
+    /** The body of loadData() and loadDataThreaded() for compressed files. The chunks are decompressed on the shared thread pool.
+     * \return  0 on success, non-zero on error.
+     */
+    int loadCompressedData(int numThreads);
 
 public:
 
@@ -125,17 +561,65 @@ public:
      */
     PFData(double * data, int nz, int ny, int nx);
 
-    //Closes the file descriptor, if open. If we own the backing data memory, it is freed.
+    //Closes the file descriptor, if open. If we own the backing data memory, it is released.
     ~PFData();
 
+    //Copying would share the file and the data arrays, objects can only be moved
+    PFData(const PFData&) = delete;
+    PFData& operator=(const PFData&) = delete;
+
+    /** Takes over the open file, mapping, and data of `other`, which is left as a default constructed object.
+     * Copies are not allowed, as only one object may own the file and data.
+     */
+    PFData(PFData&& other) noexcept;
+
+    /** Releases the file and data of this object, then takes over those of `other`, which is left as a default constructed object.
+     */
+    PFData& operator=(PFData&& other) noexcept;
+
+    /** Maps the whole file read-only into memory. While mapped, fileReadPoint(), fileReadSubgridAtGridIndex(), loadData()
+     * and loadDataThreaded() are served from the mapping instead of stdio, and getMappedSubgrid() can be used for zero-copy access.
+     * The mapping is shared with the page cache, so several processes mapping the same file only hold it in memory once.
+     * \return  0 on success, non-zero on failure (sets errno). On failure the object keeps using stdio.
+     */
+    int mapFile();
+
+    /** Releases the mapping created by mapFile(), if any. Views returned by getMappedSubgrid() become invalid.
+     */
+    void unmapFile();
+
+    /** Returns true if the file is currently mapped.
+     */
+    bool isMapped() const;
+
+    /** Returns a zero-copy view of the subgrid at the specified subgrid index.
+     * \pre             mapFile(), loadHeader() and loadPQR()
+     * \param   gridZ   The Z index of the subgrid.
+     * \param   gridY   The Y index of the subgrid.
+     * \param   gridX   The X index of the subgrid.
+     * \return          View of the subgrid, the view is invalid if the file is not mapped or the subgrid is out of range.
+     */
+    PFSubgridView getMappedSubgrid(int gridZ, int gridY, int gridX) const;
+
     /** Read a single point from the file, without loading it all into memory.
+     * Like the other const readers (fileReadPoints(), fileReadSubgridAtGridIndex(), readHyperslab()), this uses positional reads
+     * and may be called from several threads at once on the same object.
      * \pre             loadHeader() and loadPQR()
      * \param   z       Z index of the point
      * \param   y       Y index of the point
      * \param   x       X index of the point
      * \return          Value of the data at the specified point.
      */
-    double fileReadPoint(int z, int y, int x);
+    double fileReadPoint(int z, int y, int x) const;
+
+    /** Read many points from the file at once, without loading it all into memory.
+     * The points are sorted by their position in the file, and points close to each other (within a page) are fetched with
+     * a single read, so extracting thousands of points costs far fewer requests than calling fileReadPoint() for each.
+     * \pre             loadHeader() and loadPQR()
+     * \param   points  {z, y, x} indices of the points, in any order. Duplicates are allowed.
+     * \return          Values of the points, in the same order as `points`. Empty if a point is out of range or a read failed.
+     */
+    std::vector<double> fileReadPoints(const std::vector<std::array<int, 3>>& points) const;
 
     /** Read in the subgrid containing the specified point from the file.
      * \pre         loadHeader() and loadPQR()
@@ -144,7 +628,7 @@ public:
      * \param   x   X index of the point inside the desired subgrid.
      * \return      The subgrid containing the specified point.
      */
-    std::vector<double> fileReadSubgridAtPointIndex(int z, int y, int x);
+    std::vector<double> fileReadSubgridAtPointIndex(int z, int y, int x) const;
 
     /** Read in the subgrid at the specified subgrid index. Note that this is different than the point indicies.
      * \pre             loadHeader() and loadPQR()
@@ -153,7 +637,7 @@ public:
      * \param   gridX   The X index of the subgrid.
      * \return          Value of the subgrid at the specified index.
      */
-    std::vector<double> fileReadSubgridAtGridIndex(int gridZ, int gridY, int gridX);
+    std::vector<double> fileReadSubgridAtGridIndex(int gridZ, int gridY, int gridX) const;
 
 
     /** Returns the Z subgrid index of the point at the specified Z index.
@@ -269,30 +753,216 @@ public:
 
 
     /** This function loads the subgrid headers in order to calculate PQR. The only way to do this is by reading all of the subgrids and counting them, so this function incurs an performance penalty proportional to seeking and reading each subgrid header.
+     * The headers are recorded in the subgrid index while doing so, see getSubgridIndex().
      * \pre     loadHeader() must have been previously called.
      * \return  0 on success. Other values indicate an error.
      */
     int loadPQR();
 
+    /** Same as loadPQR(), but avoids seeking through the file when possible. The subgrid index is loaded from the
+     * sidecar written by saveSubgridIndex() if it is present and matches the file, otherwise it is reconstructed from
+     * the `.dist` file next to the pfb, and only if neither is usable are all subgrid headers read.
+     * \pre     loadHeader()
+     * \return  0 on success. Other values indicate an error.
+     */
+    int loadSubgridIndex();
+
+    /** Saves the subgrid index to a sidecar file, named after the pfb with a `.pfidx` extension appended.
+     * \pre     loadPQR() or loadSubgridIndex()
+     * \return  0 on success, non-zero on error.
+     */
+    int saveSubgridIndex() const;
+
+    /** Returns the subgrid index of the file. The index is empty until loadPQR() or loadSubgridIndex() is called.
+     */
+    const SubgridIndex& getSubgridIndex() const;
+
+    /** Enables the native cache: loadData() and loadDataThreaded() first try loadNativeCache(), and after reading the pfb they
+     * write the cache with saveNativeCache() for the next time. Ignored when loading single precision. Off by default.
+     */
+    void setNativeCache(bool enabled);
+
+    //True if loadData() and loadDataThreaded() use the native cache
+    bool getNativeCache() const;
+
+    /** Loads the data from the native cache of the file, a sidecar named after the pfb with a `.pfbn` extension appended.
+     * The sidecar holds the values in native byte order and in ZYX order, starting at a page boundary, so it is mapped
+     * and used as the data array as is: nothing is read until it is touched, and nothing is converted.
+     * The data can be modified, but the changes are private to this object and never reach the sidecar.
+     * The sidecar is only used if its header matches the current pfb: the pfb header, size and modification time.
+     * \pre     loadHeader()
+     * \return  0 on success, non-zero if there is no sidecar, or it does not match the pfb.
+     */
+    int loadNativeCache();
+
+    /** Writes the native cache of the file, see loadNativeCache(). The sidecar is written next to the pfb under a temporary
+     * name and renamed into place, so other processes never see a partial sidecar.
+     * \pre     loadHeader(), and the data is loaded in double precision.
+     * \return  0 on success, non-zero on error.
+     */
+    int saveNativeCache() const;
+
+    //True if the data is served from the native cache, see loadNativeCache()
+    bool isNativeCacheLoaded() const;
+
     std::string getFilename() const;
 
     /**
      * loadData
      * @retval 0 on success, non-0 on failure
      * This function reads all of the data from the pfb file into memory.
+     * The file is read front to back in large blocks, with the next blocks in flight while one is converted (see setPrefetchDepth()).
+     * With setNativeCache(true) the data is mapped from the native cache instead when it is up to date, see loadNativeCache().
      */
      int loadData();
 
-     int loadClipOfData(int clip_x, int clip_y, int extent_x, int extent_y);
+     /**
+      * loadClipOfData
+      * Loads a 2D clip of the X/Y plane, with all Z values, replacing the data of this object. Afterwards X, Y, NX, and NY
+      * describe the clip, the file is closed, and the object describes a single subgrid. See loadHyperslab() for general 3D reads.
+      * @param clip_x X index of the first element of the clip
+      * @param clip_y Y index of the first element of the clip
+      * @param extent_x Number of elements of the clip in the X direction
+      * @param extent_y Number of elements of the clip in the Y direction
+      * @param numThreads Number of threads reading the subgrids intersecting the clip, see readHyperslab()
+      * @retval 0 on success, EINVAL if the clip extends past the domain, other non-0 values on failure
+      */
+     int loadClipOfData(int clip_x, int clip_y, int extent_x, int extent_y, int numThreads = 1);
+
+     /** Reads a 3D hyperslab of the file, with optional strides, without loading the file. Only the subgrids intersecting the
+      * hyperslab are touched, and only the needed X range of each pencil is read. When whole rows of a subgrid are selected,
+      * consecutive rows are read at once.
+      * Element (k, j, i) of the result is the point (z0 + k*strideZ, y0 + j*strideY, x0 + i*strideX) of the file.
+      * \pre                 loadHeader() and loadPQR()
+      * \param   buffer      Destination, flattened ZYX array of nz * ny * nx elements (X is most contiguous).
+      * \param   z0          Z index of the first point.
+      * \param   y0          Y index of the first point.
+      * \param   x0          X index of the first point.
+      * \param   nz          Number of points to read in the Z direction.
+      * \param   ny          Number of points to read in the Y direction.
+      * \param   nx          Number of points to read in the X direction.
+      * \param   strideZ     Distance between two points read in the Z direction, at least 1.
+      * \param   strideY     Distance between two points read in the Y direction, at least 1.
+      * \param   strideX     Distance between two points read in the X direction, at least 1.
+      * \param   numThreads  Number of threads of the shared PFThreadPool reading the subgrids intersecting the hyperslab.
+      * \return              0 on success, EINVAL if the hyperslab does not fit inside the file, other values on read errors.
+      */
+     int readHyperslab(double* buffer, int z0, int y0, int x0, int nz, int ny, int nx, int strideZ = 1, int strideY = 1, int strideX = 1, int numThreads = 1) const;
+
+     /** Same as readHyperslab(), but converts the values to single precision while reading them.
+     */
+    int readHyperslab(float* buffer, int z0, int y0, int x0, int nz, int ny, int nx, int strideZ = 1, int strideY = 1, int strideX = 1, int numThreads = 1) const;
+
+    /** Same as readHyperslab(), but returns the hyperslab.
+      * \pre     loadHeader() and loadPQR()
+      * \return  The flattened ZYX hyperslab, empty on error.
+      */
+     std::vector<double> loadHyperslab(int z0, int y0, int x0, int nz, int ny, int nx, int strideZ = 1, int strideY = 1, int strideX = 1, int numThreads = 1) const;
+
+    /** Same as loadHyperslab(), but returns single precision values.
+     */
+    std::vector<float> loadHyperslabFloat(int z0, int y0, int x0, int nz, int ny, int nx, int strideZ = 1, int strideY = 1, int strideX = 1, int numThreads = 1) const;
 
      /**
       * Performs the same functionality as loadData(), but loads the file in parallel, using the supplied number of threads.
+      * Subgrids, and slabs of large subgrids, are handed out as jobs to the library's work-stealing thread pool, which is reused across calls.
       * \pre                loadPQR(). @@TODO maybe we want a way to enforce this in the future.
       * \param  numThreads  The number of threads to use, must be at least one.
       * \return             0 if success, non-zero if error.
       */
      int loadDataThreaded(int numThreads);
 
+    /** Callback of forEachSubgrid().
+     * \param   extent  Location and extents of the subgrid.
+     * \param   values  The nz * ny * nx values of the subgrid in native byte order, X fastest. Only valid during the call.
+     * \param   worker  Index of the thread running the callback, [0, numThreads), for per-thread accumulators.
+     * \return          0 to continue, non-zero to stop visiting further subgrids.
+     */
+    typedef std::function<int(const PFSubgridExtent& extent, const double* values, int worker)> SubgridVisitor;
+
+    /** Visits every subgrid without loading the whole data. Each subgrid is read and byte swapped into a scratch buffer owned by
+     * the visiting thread and reused for its next subgrid, so memory stays at numThreads times the largest subgrid.
+     * The callback is called concurrently from several threads, in no particular order. If the data is loaded, it is used instead.
+     * \pre                 loadHeader() and loadPQR(), or loaded data (visited as a single subgrid without a topology)
+     * \param   visitor     Called once for every subgrid.
+     * \param   numThreads  Number of threads to use.
+     * \return              0 on success, otherwise the first non-zero value returned by the callback, or an errno value.
+     */
+    int forEachSubgrid(const SubgridVisitor& visitor, int numThreads = 1) const;
+
+    /** Computes statistics of the data without loading it. Each subgrid is read once, a few rows at a time, into a small buffer
+     * reused by every job, and the subgrids are spread over the shared thread pool. If the data is loaded, it is used instead.
+     * The results do not depend on the number of threads.
+     * \pre                        loadHeader() and loadPQR(), or loaded data
+     * \param[out]  report         Filled with the statistics of the file, of every Z layer, and of every subgrid.
+     * \param       numThreads     Number of threads to use.
+     * \param       numBins        Number of histogram bins, 0 for no histogram.
+     * \param       histogramMin   Lower edge of the first bin.
+     * \param       histogramMax   Upper edge of the last bin, must be greater than histogramMin if numBins > 0.
+     * \return                     0 on success, otherwise an errno value.
+     */
+    int computeStatistics(PFStatisticsReport& report, int numThreads = 1, int numBins = 0, double histogramMin = 0.0, double histogramMax = 0.0) const;
+
+    /** Writes the data as a compressed pfb file: the pfb header, followed by a table with the offset of every subgrid, and
+     * every subgrid compressed on its own (see isCompressed()). Each value is predicted by extrapolating along one axis,
+     * the residuals are split into byte planes, and each plane is entropy coded.
+     * By default the compression is lossless. With an error bound, values are first rounded to multiples of about twice
+     * the bound, which makes smooth fields compress many times better: every decompressed value is within errorBound of the
+     * original, except NaN and infinities, which are kept exactly.
+     * The subgrids are compressed on the shared thread pool.
+     * \pre                 The data is loaded in double precision, and P, Q, and R are set.
+     * \param   filename    Path of the file.
+     * \param   numThreads  Number of threads to use.
+     * \param   errorBound  Largest absolute error of a value, 0 for lossless compression.
+     * \return              0 on success, non-zero on error.
+     */
+    int writeCompressedFile(const std::string& filename, int numThreads = 1, double errorBound = 0.0) const;
+
+    /** Error bound the compressed file was written with, see writeCompressedFile().
+     * \pre     loadHeader()
+     * \return  The bound, 0 if the file is lossless or not compressed.
+     */
+    double getErrorBound() const;
+
+    /** True if the file is a compressed pfb, written by writeCompressedFile(). loadHeader() recognizes such files and reads
+     * their topology, so loadPQR() is not needed. loadData(), loadDataThreaded(), get(), fileReadPoint(), fileReadPoints(),
+     * fileReadSubgridAt*(), readHyperslab(), and forEachSubgrid() work as for a pfb, but only read and decompress the
+     * subgrids they need. Use get() for repeated point reads, it keeps the decompressed subgrids in the subgrid cache.
+     * \pre     loadHeader()
+     */
+    bool isCompressed() const;
+
+    /** Reads the points of a scattered binary (.pfsb) file, which has the header of a pfb, followed by every subgrid header,
+     * the number of points of the subgrid, and i, j, k, value of each point. P, Q, and R are set from the subgrid headers.
+     * \pre             loadHeader()
+     * \param[out]  sparse  The points of the file, in the order of the file.
+     * \return              0 on success, non-zero on error.
+     */
+    int loadSparse(PFSparseData& sparse);
+
+    /** Same as loadData(), but for a scattered binary (.pfsb) file: the points are stored in the data array, every other
+     * value is zero. Honors setLoadAsFloat().
+     * \pre     loadHeader()
+     * \return  0 on success, non-zero on error.
+     */
+    int loadSparseData();
+
+    /** Writes the data as a scattered binary (.pfsb) file with the processor topology of this object, storing only the points
+     * whose magnitude is greater than dropTolerance. NaN values are always stored.
+     * \param   filename        Path of the file.
+     * \param   dropTolerance   Points with |value| <= dropTolerance are left out, 0 drops the zeros.
+     * \return                  0 on success, non-zero on error.
+     */
+    int writeSparseFile(const std::string& filename, double dropTolerance = 0.0) const;
+
+    /** Writes the given points as a scattered binary (.pfsb) file, with the header and processor topology of this object.
+     * The points are grouped into their subgrids, and ordered by index within each subgrid.
+     * \param   filename    Path of the file.
+     * \param   sparse      The points, with indices inside the NZ x NY x NX grid.
+     * \return              0 on success, non-zero on error.
+     */
+    int writeSparseFile(const std::string& filename, const PFSparseData& sparse) const;
+
 	 /**
 	  * writeFile
 	  * @param string filenamee
@@ -300,15 +970,45 @@ public:
 	  */
      int writeFile(std::string filename);
 
+     /** Performs the same functionality as writeFile(), but writes the subgrids in parallel using the supplied number of threads.
+      * The offset of every subgrid is computed up front and the file is preallocated, so the workers of the library's thread pool
+      * byte swap whole subgrids (or slabs of large subgrids) and write them straight into place with positional writes.
+      * \param  filename    Path of the file to write.
+      * \param  numThreads  The number of threads to use, must be at least one.
+      * \return             0 if success, non-zero if error.
+      */
+     int writeFileThreaded(std::string filename, int numThreads);
+
+     /** Fills `count` consecutive values along X, starting at point (z, y, x), in native byte order.
+      */
+     typedef std::function<void(double* dst, int z, int y, int x, int count)> PencilSource;
+
+     /** Same as writeFileThreaded(), but the values are produced by `source` instead of being read from the data array, so files
+      * far larger than memory can be written (see generatePfbFile()). Only the header information (X, Y, Z, NX, NY, NZ, DX, DY, DZ,
+      * P, Q, R) needs to be set, the data array is not used. `source` is called concurrently from several threads.
+      * \param  filename    Path of the file to write.
+      * \param  numThreads  The number of threads to use, must be at least one.
+      * \param  source      Produces the values of each pencil.
+      * \return             0 if success, non-zero if error.
+      */
+     int writeFileThreaded(std::string filename, int numThreads, const PencilSource& source);
+
 	 /**
 	  * distFile
+	  * Redistributes the file into a new processor topology, writing `outFile` and `outFile.dist`.
+	  * The file is streamed through a bounded buffer of whole-X tiles (ranges of Z planes, or of Y rows if a single plane does
+	  * not fit), so the domain is never loaded into memory. The data is copied without byte swapping.
+	  * The new file is written under a temporary name and then replaces `outFile`, so the file can be redistributed in place.
+	  * Afterwards P, Q, R, and the number of subgrids of this object describe the new file. The data is not loaded. The file of
+	  * this object is closed, unless it was redistributed in place, in which case the new file is opened and its layout loaded.
 	  * @param int P
 	  * @param int Q
 	  * @param int R
 	  * @param string outFile
+	  * @param memoryBudget Maximum number of bytes to buffer, at least a single X row is always buffered.
 	  * @return int
 	  */
-     int distFile(int P, int Q, int R, std::string outFile);
+     int distFile(int P, int Q, int R, std::string outFile, long long memoryBudget = 256LL << 20);
 
     //Used for the compare function
     enum class differenceType {none=0, z, y, x, dZ, dY, dX, nZ, nY, nX, data};
@@ -331,6 +1031,20 @@ public:
     */
     differenceType compare(const PFData& otherObj, std::array<int, 3>* diffIndex) const;
 
+    /** Compares `this` and another PFData object with tolerances, scanning the whole data to fill a report.
+     * The headers are compared exactly, as by the overload above. Identical runs of values are skipped with SIMD compares, and
+     * the rows are split across the shared thread pool, so comparing mostly identical outputs runs at memory bandwidth.
+     * \pre                         Both objects hold double precision data (loadData(), loadDataThreaded(), or setData()).
+     * \param[in]   otherObj        Other object to compare with.
+     * \param[in]   tolerance       Accepted differences between the values.
+     * \param[out]  report          Filled with the differences of the data if non-null and the headers match.
+     * \param[in]   numThreads      Number of threads to use.
+     * \retval      none            The headers are the same and every value is within the tolerance.
+     * \retval      data            The headers are the same, but some values are outside of the tolerance.
+     * \retval      other           The header value that differs, see above.
+     */
+    differenceType compare(const PFData& otherObj, const PFCompareTolerance& tolerance, PFCompareReport* report, int numThreads = 1) const;
+
     /** Given a flattened index into `data`, unflatten it into its `ZYX` components.
      * Note: The behavior is undefined if the dimension data is not fully initialized.
      * \param[int]  index           The flattened index of the `data`
@@ -551,8 +1265,43 @@ public:
 	 * @param y
 	 * @param x
 	 * @return double
+	 * Same as get().
 	 */
-    double operator()(int z, int y, int x);
+    double operator()(int z, int y, int x) const;
+
+    /** Returns the value at the specified point.
+     * If the data is loaded (loadData(), loadDataThreaded(), or single precision), the value is read from memory. Otherwise the
+     * subgrid containing the point is read from the file on first touch and kept in an LRU cache (see setSubgridCacheBudget()),
+     * so a file can be explored without loading it, using memory proportional to the subgrids touched.
+     * The cache is locked internally, so get() may be called from several threads at once.
+     * \pre             loadHeader() and loadPQR(), or loaded data
+     * \param   z       Z index of the point
+     * \param   y       Y index of the point
+     * \param   x       X index of the point
+     * \return          Value of the data at the specified point, 0 if it could not be read.
+     */
+    double get(int z, int y, int x) const;
+
+    /** Sets the byte budget of the cache get() pages subgrids into. The default is 256 MiB.
+     * The most recently used subgrid is always kept, even if it alone exceeds the budget.
+     * \param   bytes   Maximum number of bytes of subgrid data to keep.
+     */
+    void setSubgridCacheBudget(std::size_t bytes);
+
+    //The byte budget of the subgrid cache
+    std::size_t getSubgridCacheBudget() const;
+
+    /** Sets how many 4 MiB blocks loadData() keeps in flight. While one block is byte swapped into the data array, the following
+     * ones are read with io_uring where the kernel supports it, otherwise by a background thread. The default is 4.
+     * \param   depth   Number of blocks, including the one being converted. 1 reads synchronously, without overlap.
+     */
+    void setPrefetchDepth(int depth);
+
+    //Number of blocks loadData() keeps in flight
+    int getPrefetchDepth() const;
+
+    //Number of bytes held by the subgrid cache
+    std::size_t getSubgridCacheSize() const;
 
 	/**
 	 * getSubgridData
@@ -587,19 +1336,55 @@ public:
 	/**
 	 * setData
 	 * @param data flattened ZYX array(X is most contiguous) to use as the data array.
+	 * The array is not owned by the object unless setIsDataOwner(true) is called afterwards. If the object owned the
+	 * previous array, the caller becomes responsible for releasing it with PFBufferPool::shared().release().
 	 */
     void setData(double* data);
 
+    /** Selects the precision loadData(), loadDataThreaded() and loadClipOfData() load the data in.
+     * In single precision the values are byte swapped and narrowed to float in a single pass, and stored in the array returned by
+     * getFloatData() instead of getData(), halving the memory used. getData(), operator(), compare(), and the write functions
+     * only use the double array, and are not available on data loaded in single precision.
+     * \param   loadAsFloat True to load single precision data, false (the default) for double precision.
+     */
+    void setLoadAsFloat(bool loadAsFloat);
+
+    /** Returns true if the data is loaded in single precision, see setLoadAsFloat().
+     */
+    bool getLoadAsFloat() const;
+
+    /**
+     * getFloatData
+     * @return float*
+     * Get a pointer to the single precision data as a one dimensional array, nullptr unless data was loaded with setLoadAsFloat(true).
+     */
+    float* getFloatData();
+
+    /**
+	 * see getFloatData()
+	 */
+    const float* getFloatData() const;
+
+    /** Gives up ownership of the single precision data, the caller becomes responsible for releasing it with PFBufferPool::shared().release().
+     * \return  The single precision data, nullptr if none is loaded.
+     */
+    float* releaseFloatData();
+
 	/**
-	 * close file. Destructor should automatically handle this in almost all cases.
+	 * close file, and release the file mapping if there is one. Destructor should automatically handle this in almost all cases.
 	 */
     void close();
 
     /**Sets if the class owns the backing data or not. Mostly provided for compatibility with SWIG.
+     * Owned data is released with PFBufferPool::shared().release(). Arrays allocated with std::malloc() must be handed to
+     * PFBufferPool::shared().adopt() first.
      * \param   isOwner     True if the class should free the data upon destruction, false otherwise.
      */
     void setIsDataOwner(bool isOwner);
 
+    //True if the class frees the backing data upon destruction, see setIsDataOwner()
+    bool isDataOwner() const;
+
 
 };
 
@@ -0,0 +1,36 @@
+#ifndef PARFLOWIO_PFGENERATOR_HPP
+#define PARFLOWIO_PFGENERATOR_HPP
+#include <string>
+
+/** Returns the value generatePfbFile() writes at point (z, y, x) of a grid with the given NY and NX.
+ * The value is the flattened ZYX index of the point plus a smooth, seed dependent field in [-0.25, 0.25], so every point
+ * is distinct (rounding recovers the index) while the data still varies smoothly like a simulation output.
+ * Only basic arithmetic is used, so the values are bit-for-bit reproducible and readers can verify a file without a reference copy.
+ * \param   z       Z index of the point.
+ * \param   y       Y index of the point.
+ * \param   x       X index of the point.
+ * \param   ny      NY of the grid.
+ * \param   nx      NX of the grid.
+ * \param   seed    Selects the smooth field.
+ * \return          The value at the point.
+ */
+double generatePfbValue(int z, int y, int x, int ny, int nx, unsigned int seed = 0);
+
+/** Writes a valid pfb file of the given size and processor topology, filled with generatePfbValue().
+ * Uneven topologies (NX not divisible by P, ...) produce the same remainder blocks ParFlow writes. The data is generated
+ * on the fly by the workers of the shared thread pool and written in place, so files far larger than memory can be written.
+ * The header has X = Y = Z = 0 and DX = DY = DZ = 1.
+ * \param   filename    Path of the file to write.
+ * \param   nz          Number of points in the Z direction.
+ * \param   ny          Number of points in the Y direction.
+ * \param   nx          Number of points in the X direction.
+ * \param   p           Number of subgrids in the X direction.
+ * \param   q           Number of subgrids in the Y direction.
+ * \param   r           Number of subgrids in the Z direction.
+ * \param   seed        Passed to generatePfbValue().
+ * \param   numThreads  The number of threads to use, must be at least one.
+ * \return              0 if success, non-zero if error.
+ */
+int generatePfbFile(const std::string& filename, int nz, int ny, int nx, int p, int q, int r, unsigned int seed = 0, int numThreads = 1);
+
+#endif //PARFLOWIO_PFGENERATOR_HPP
@@ -0,0 +1,93 @@
+#ifndef PARFLOWIO_PFSERIES_HPP
+#define PARFLOWIO_PFSERIES_HPP
+#include "parflow/pfdata.hpp"
+
+#include <array>
+#include <string>
+#include <vector>
+
+/**
+ * class: PFSeries
+ * A sequence of pfb files, one per timestep, as written by ParFlow (e.g. `run.out.press.00000.pfb`, `00001`, ...).
+ * The header and subgrid layout are parsed once, from the first file, and reused for every other file with the same
+ * geometry, so extracting a time series only costs a couple of reads per file instead of a full loadHeader() + loadPQR().
+ * Files are processed in parallel on the shared thread pool.
+ * A file is only read with the layout of the first file if its size and its file, first subgrid, and last subgrid headers
+ * match those of the first file. Any other file is parsed on its own. Compressed files (see PFData::writeCompressedFile())
+ * are always parsed and decompressed on their own.
+ */
+class PFSeries {
+public:
+    /**
+     * PFSeries
+     * @param pattern printf style pattern of the filenames, with a single integer conversion, e.g. "run.out.press.%05d.pfb"
+     * @param first number of the first file
+     * @param last number of the last file, inclusive
+     * @param step distance between the numbers of two consecutive files
+     */
+    PFSeries(const std::string& pattern, int first, int last, int step = 1);
+
+    /**
+     * PFSeries
+     * @param filenames the files of the series, in order
+     */
+    explicit PFSeries(const std::vector<std::string>& filenames);
+
+    PFSeries(const PFSeries&) = delete;
+    PFSeries& operator=(const PFSeries&) = delete;
+
+    /** Parses the header and subgrid layout of the first file, which are shared by the whole series.
+     * The subgrid layout is taken from a `.pfidx` or `.dist` sidecar of the first file when one exists.
+     * \return  0 on success, non-zero on failure.
+     */
+    int loadHeader();
+
+    //Number of files in the series
+    int getNumFiles() const;
+
+    //Filename of the file at the given position in the series
+    const std::string& getFilename(int index) const;
+
+    /** The first file of the series, with its header and subgrid layout loaded.
+     * \pre     loadHeader()
+     */
+    const PFData& getHeader() const;
+
+    /** Reads the same points from every file of the series.
+     * \pre                 loadHeader()
+     * \param   points      {z, y, x} indices of the points.
+     * \param   numThreads  Number of threads to use.
+     * \return              Flattened [file][point] array of getNumFiles() * points.size() values, empty on error.
+     */
+    std::vector<double> readPoints(const std::vector<std::array<int, 3>>& points, int numThreads = 1) const;
+
+    /** Reads the time series of a single point.
+     * \pre                 loadHeader()
+     * \return              One value per file, empty on error.
+     */
+    std::vector<double> readPoint(int z, int y, int x, int numThreads = 1) const;
+
+    /** Reads the time series of a column, all Z values at (y, x).
+     * \pre                 loadHeader()
+     * \return              Flattened [file][z] array of getNumFiles() * NZ values, empty on error.
+     */
+    std::vector<double> readColumn(int y, int x, int numThreads = 1) const;
+
+private:
+    std::vector<std::string> m_filenames;
+
+    //First file of the series, owns the shared header and subgrid index
+    PFData m_header;
+
+    //Raw file header, first subgrid header, and last subgrid header of the first file, other files must match it to share the layout
+    std::vector<unsigned char> m_prefix;
+
+    //Offset of the last subgrid header, and size of the first file
+    long long m_lastOffset = 0;
+    long long m_fileSize = 0;
+
+    //The first file is compressed, no plan is shared
+    bool m_compressed = false;
+};
+
+#endif //PARFLOWIO_PFSERIES_HPP
@@ -0,0 +1,91 @@
+#ifndef PARFLOWIO_PFTYPED_HPP
+#define PARFLOWIO_PFTYPED_HPP
+#include "parflow/pfdata.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * class: PFTypedData
+ * A typed sidecar of a pfb: a copy of a grid in a narrower element type, float for fields that do not need double
+ * precision, int32_t for integer indicators, and uint8_t for masks. A mask takes an eighth of the disk space and I/O of
+ * the pfb. The sidecar keeps the header of the pfb (origin, extents, spacing, and P, Q, R), so the data can be converted
+ * back with assign() and PFData.
+ *
+ * The sidecar is its own container, not a pfb, and only this class reads it. It starts with a 96 byte header: a magic,
+ * the byte order and version, the element type and size, and the grid, in the byte order of the host that wrote it. The
+ * NZ * NY * NX values follow as one array, X fastest, in the same byte order. Hosts of the other byte order swap them
+ * while loading. The values are not split into subgrids, so the sidecar is only loaded and written whole. Partial reads
+ * (points, hyperslabs, subgrids) are for the pfb itself, through PFData, which can also load it in single precision,
+ * see PFData::setLoadAsFloat().
+ *
+ * Only float, int32_t, and uint8_t are instantiated.
+ */
+template<typename T>
+class PFTypedData {
+public:
+    PFTypedData() = default;
+
+    /**
+     * PFTypedData
+     * @param filename path of the typed file, only opened by loadHeader() and loadData()
+     */
+    explicit PFTypedData(const std::string& filename);
+
+    PFTypedData(const PFTypedData&) = delete;
+    PFTypedData& operator=(const PFTypedData&) = delete;
+    PFTypedData(PFTypedData&&) = default;
+    PFTypedData& operator=(PFTypedData&&) = default;
+
+    /** Reads the header of the file.
+     * \return  0 on success, EINVAL if the file is not a typed file or holds another element type, other values on read
+     *          errors.
+     */
+    int loadHeader();
+
+    /** Reads the values of the file.
+     * \pre     loadHeader()
+     * \return  0 on success, non-zero on failure.
+     */
+    int loadData();
+
+    /** Takes the header, topology, and values of a pfb. Integer types only take values they represent exactly, float
+     * rounds them to single precision like PFData::setLoadAsFloat().
+     * \pre             The data of `source` is loaded in double precision, in "zyx" order.
+     * \param   source  The data to convert.
+     * \return          0 on success, ERANGE if a value does not fit an integer type, EINVAL without data.
+     */
+    int assign(const PFData& source);
+
+    /** Writes the header and values as a typed file.
+     * \param   filename    Path of the file.
+     * \return              0 on success, non-zero on error.
+     */
+    int writeFile(const std::string& filename) const;
+
+    //Header and topology of the grid, the data of the returned object is not loaded
+    const PFData& getHeader() const;
+
+    //NZ * NY * NX values, X fastest. nullptr before loadData() or assign().
+    T* getData();
+    const T* getData() const;
+
+    //Value at a point of the loaded data
+    T operator()(int z, int y, int x) const;
+
+    std::string getFilename() const;
+
+private:
+    std::string m_filename;
+    PFData m_header;
+    std::vector<T> m_data;
+    //The file was written on a host of the other byte order
+    bool m_swapped = false;
+};
+
+extern template class PFTypedData<float>;
+extern template class PFTypedData<int32_t>;
+extern template class PFTypedData<uint8_t>;
+
+#endif //PARFLOWIO_PFTYPED_HPP
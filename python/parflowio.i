@@ -3,7 +3,10 @@
 
 %{
 #define SWIG_FILE_WITH_INIT
+#include "parflow/pfclm.hpp"
 #include "parflow/pfdata.hpp"
+#include "parflow/pfgenerator.hpp"
+#include "parflow/pfseries.hpp"
 %}
 
 %include "std_string.i"
@@ -23,12 +26,24 @@
 //Instantiate std::array<int, 3> template
 namespace std {
     %template(IntArray3) array<int, 3>;
+    %template(IntArray3Vector) vector<array<int, 3>>;
+    %template(StringVector) vector<string>;
 }
 
 //Mark diffIndex as OUTPUT
 %apply std::array<int, 3>* OUTPUT {std::array<int, 3>* diffIndex};
 PFData::differenceType PFData::compare(const PFData& otherObj, std::array<int, 3>* diffIndex);
 
+//Expose the element accessor of subgrid views as view(z, y, x)
+%rename(__call__) PFSubgridView::operator();
+
+//Internal to PFData::get()
+%ignore SubgridCache;
+
+//Objects are not copyable, and Python has no use for moves
+%ignore PFData::PFData(PFData&&);
+%ignore PFData::operator=;
+
 //Ignore this constructor, and replace it with our own down below
 %ignore PFData::PFData(double* data, int nz, int ny, int nx);
 
@@ -36,8 +51,27 @@ PFData::differenceType PFData::compare(const PFData& otherObj, std::array<int, 3
 %ignore PFData::getData();
 %ignore PFData::getData() const;
 %ignore PFData::setData(double*);
-
+%ignore PFData::getFloatData();
+%ignore PFData::getFloatData() const;
+%ignore PFData::releaseFloatData();
+%ignore PFData::writeFileThreaded(std::string, int, const PencilSource&);
+%ignore PFData::forEachSubgrid;
+%ignore PFClmData::readVariable;
+%ignore PFClmData::readVariables;
+
+%include "parflow/pfbufferpool.hpp"
 %include "parflow/pfdata.hpp"
+%include "parflow/pfclm.hpp"
+%include "parflow/pfgenerator.hpp"
+%include "parflow/pfseries.hpp"
+
+//Per layer and per subgrid summaries of PFCompareReport and PFStatisticsReport, and the points of PFSparseData
+namespace std {
+    %template(DifferenceSummaryVector) vector<PFDifferenceSummary>;
+    %template(StatisticsVector) vector<PFStatistics>;
+    %template(LongLongVector) vector<long long>;
+    %template(DoubleVector) vector<double>;
+}
 
 %extend PFData {
     #include <cstdlib>
@@ -72,13 +106,30 @@ PFData::differenceType PFData::compare(const PFData& otherObj, std::array<int, 3
         double* data = $self->getData();
         if(!data) return Py_None;
 
+        //Only pool buffers the object owns can be handed over. Other data (a caller's array, or the mapping of the native
+        //cache, which is unmapped with the object) is copied instead.
+        const bool handOver = $self->isDataOwner() && !$self->isNativeCacheLoaded();
+
         $self->setData(nullptr);
         $self->setIsDataOwner(false);
 
         npy_intp strides[3] = {$self->getNZ(), $self->getNY(), $self->getNX()};
+        if(!handOver){
+            const int size = $self->getNZ() * $self->getNY() * $self->getNX();
+            double* dataCopy = static_cast<double*>(std::malloc(size * sizeof(double)));
+            memcpy(dataCopy, data, size*sizeof(double));
 
+            PyObject* pyarray = PyArray_SimpleNewFromData(3, strides, NPY_DOUBLE, dataCopy);
+            PyArray_ENABLEFLAGS(reinterpret_cast<PyArrayObject*>(pyarray), NPY_ARRAY_OWNDATA);
+            return pyarray;
+        }
+
+        //The buffer comes from PFBufferPool (possibly aligned or huge page backed), so numpy hands it back to the pool instead of freeing it
         PyObject* pyarray = PyArray_SimpleNewFromData(3, strides, NPY_DOUBLE, data);
-        PyArray_ENABLEFLAGS(reinterpret_cast<PyArrayObject*>(pyarray), NPY_ARRAY_OWNDATA);
+        PyObject* owner = PyCapsule_New(data, nullptr, [](PyObject* capsule){
+            PFBufferPool::shared().release(PyCapsule_GetPointer(capsule, nullptr));
+        });
+        PyArray_SetBaseObject(reinterpret_cast<PyArrayObject*>(pyarray), owner);
         return pyarray;
     }
 
@@ -104,6 +155,42 @@ PFData::differenceType PFData::compare(const PFData& otherObj, std::array<int, 3
         return PyArray_SimpleNewFromData(3, strides, NPY_DOUBLE, data);
     }
 
+    //Single precision variants of the above, for data loaded with setLoadAsFloat(True)
+    PyObject* moveFloatDataArray(){
+        float* data = $self->releaseFloatData();
+        if(!data) return Py_None;
+
+        npy_intp strides[3] = {$self->getNZ(), $self->getNY(), $self->getNX()};
+        PyObject* pyarray = PyArray_SimpleNewFromData(3, strides, NPY_FLOAT, data);
+        PyObject* owner = PyCapsule_New(data, nullptr, [](PyObject* capsule){
+            PFBufferPool::shared().release(PyCapsule_GetPointer(capsule, nullptr));
+        });
+        PyArray_SetBaseObject(reinterpret_cast<PyArrayObject*>(pyarray), owner);
+        return pyarray;
+    }
+
+    PyObject* copyFloatDataArray(){
+        float* data = $self->getFloatData();
+        if(!data) return Py_None;
+
+        const int size = $self->getNZ() * $self->getNY() * $self->getNX();
+        float* dataCopy = static_cast<float*>(std::malloc(size * sizeof(float)));
+        memcpy(dataCopy, data, size*sizeof(float));
+
+        npy_intp strides[3] = {$self->getNZ(), $self->getNY(), $self->getNX()};
+        PyObject* pyarray = PyArray_SimpleNewFromData(3, strides, NPY_FLOAT, dataCopy);
+        PyArray_ENABLEFLAGS(reinterpret_cast<PyArrayObject*>(pyarray), NPY_ARRAY_OWNDATA);
+        return pyarray;
+    }
+
+    PyObject* viewFloatDataArray(){
+        float* data = $self->getFloatData();
+        if(!data) return Py_None;
+
+        npy_intp strides[3] = {$self->getNZ(), $self->getNY(), $self->getNX()};
+        return PyArray_SimpleNewFromData(3, strides, NPY_FLOAT, data);
+    }
+
     %pythoncode %{
     def __str__(self):
         s = str(self.__class__.__name__) + "(X={}, Y={}, Z={}, NX={}, NY={}, NZ={}, DX={}, DY={}, DZ={}, indexOrder={})".format(
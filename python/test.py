@@ -422,6 +422,26 @@ class PFDataClassTests(unittest.TestCase):
         self.assertTrue(np.array_equal(data, move), 'Data obtained from PFData::moveDataArray must match given data')
         self.assertIsNone(test.viewDataArray(), 'Calling PFData::moveDataArray must invalidate the internal data pointer')
 
+    def test_move_native_cache(self):
+        test = PFData(('press.init.pfb'))
+        test.setNativeCache(True)
+        self.assertEqual(0, test.loadHeader())
+        self.assertEqual(0, test.loadPQR())
+        self.assertEqual(0, test.loadData())
+        reference = test.copyDataArray()
+        test.close()
+
+        mapped = PFData(('press.init.pfb'))
+        mapped.setNativeCache(True)
+        self.assertEqual(0, mapped.loadHeader())
+        self.assertEqual(0, mapped.loadData())
+        self.assertTrue(mapped.isNativeCacheLoaded())
+        move = mapped.moveDataArray()
+        self.assertIsNone(mapped.viewDataArray(), 'Calling PFData::moveDataArray must invalidate the internal data pointer')
+        del mapped
+        self.assertTrue(np.array_equal(reference, move), 'Data moved out of the native cache must outlive the PFData')
+        os.remove(('press.init.pfb.pfbn'))
+
     def test_loadClipTest1(self):
         test = PFData(('press.init.pfb'))
         retval = test.loadHeader()     
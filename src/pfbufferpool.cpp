@@ -0,0 +1,185 @@
+#include "parflow/pfbufferpool.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+
+#ifdef _WIN32
+    #include <malloc.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+//Smallest buffer backed by huge pages
+static const std::size_t HUGE_PAGE_SIZE = 2u << 20;
+
+const std::size_t PFBufferPool::ALIGNMENT;
+
+PFBufferPool& PFBufferPool::shared(){
+    //Never destroyed, PFData objects with static storage duration may release their buffers after it would have been
+    static PFBufferPool* pool = new PFBufferPool();
+    return *pool;
+}
+
+PFBufferPool::~PFBufferPool(){
+    trim();
+}
+
+void* PFBufferPool::allocateBlock(std::size_t bytes, bool hugePages, bool& mapped){
+    mapped = false;
+    if(bytes == 0){
+        bytes = ALIGNMENT;
+    }
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if(hugePages && bytes >= HUGE_PAGE_SIZE){
+        //Round up to whole huge pages, mmap memory is page aligned
+        const std::size_t mappedBytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        void* buffer = ::mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(buffer != MAP_FAILED){
+            ::madvise(buffer, mappedBytes, MADV_HUGEPAGE);
+            mapped = true;
+            return buffer;
+        }
+    }
+#else
+    (void)hugePages;
+#endif
+
+#ifdef _WIN32
+    return _aligned_malloc(bytes, ALIGNMENT);
+#else
+    void* buffer = nullptr;
+    if(posix_memalign(&buffer, ALIGNMENT, bytes) != 0){
+        return nullptr;
+    }
+    return buffer;
+#endif
+}
+
+void PFBufferPool::freeBlock(void* buffer, const Block& block){
+    if(block.adopted){
+        std::free(buffer);
+        return;
+    }
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if(block.mapped){
+        ::munmap(buffer, (block.bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+        return;
+    }
+#else
+    (void)block;
+#endif
+
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    std::free(buffer);
+#endif
+}
+
+void* PFBufferPool::allocate(std::size_t bytes){
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto idle = m_idle.find(bytes);
+    if(idle != m_idle.end()){
+        void* buffer = idle->second;
+        m_idle.erase(idle);
+        m_idleBytes -= bytes;
+        return buffer;
+    }
+
+    bool mapped = false;
+    void* buffer = allocateBlock(bytes, m_hugePages, mapped);
+    if(buffer == nullptr){
+        //Idle buffers of other sizes may be what is in the way
+        trimTo(0);
+        buffer = allocateBlock(bytes, m_hugePages, mapped);
+        if(buffer == nullptr){
+            return nullptr;
+        }
+    }
+
+    m_blocks[buffer] = Block{bytes, mapped, false};
+    return buffer;
+}
+
+void PFBufferPool::release(void* buffer){
+    if(buffer == nullptr){
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto block = m_blocks.find(buffer);
+    if(block == m_blocks.end()){
+        //Not ours, freeing memory of another allocator (or a mapping) would corrupt it
+        std::cerr << "PFBufferPool::release: " << buffer << " was not allocated or adopted by the pool, ignoring it\n";
+        return;
+    }
+
+    const std::size_t bytes = block->second.bytes;
+    if(!block->second.adopted && m_idleBytes + bytes <= m_capacity){
+        m_idle.emplace(bytes, buffer);
+        m_idleBytes += bytes;
+        return;
+    }
+
+    freeBlock(buffer, block->second);
+    m_blocks.erase(block);
+}
+
+void PFBufferPool::adopt(void* buffer, std::size_t bytes){
+    if(buffer == nullptr){
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_blocks[buffer] = Block{bytes, false, true};
+}
+
+void PFBufferPool::setCapacity(std::size_t bytes){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_capacity = bytes;
+    trimTo(bytes);
+}
+
+std::size_t PFBufferPool::getCapacity() const{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_capacity;
+}
+
+std::size_t PFBufferPool::getIdleBytes() const{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_idleBytes;
+}
+
+void PFBufferPool::setHugePages(bool hugePages){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_hugePages = hugePages;
+}
+
+bool PFBufferPool::getHugePages() const{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hugePages;
+}
+
+void PFBufferPool::trim(){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    trimTo(0);
+}
+
+void PFBufferPool::trimTo(std::size_t bytes){
+    //Free the largest buffers first
+    while(m_idleBytes > bytes && !m_idle.empty()){
+        auto largest = std::prev(m_idle.end());
+        void* buffer = largest->second;
+        m_idleBytes -= largest->first;
+        m_idle.erase(largest);
+
+        auto block = m_blocks.find(buffer);
+        freeBlock(buffer, block->second);
+        m_blocks.erase(block);
+    }
+}
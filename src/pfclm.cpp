@@ -0,0 +1,114 @@
+#include "parflow/pfclm.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+//Surface variables of a ParFlow-CLM single file output, in layer order. The soil temperatures follow.
+static const char* const CLM_SURFACE_VARIABLES[] = {
+    "eflx_lh_tot", "eflx_lwrad_out", "eflx_sh_tot", "eflx_soil_grnd", "qflx_evap_tot", "qflx_evap_grnd", "qflx_evap_soi",
+    "qflx_evap_veg", "qflx_tran_veg", "qflx_infl", "swe_out", "t_grnd", "qflx_qirr"
+};
+static const int NUM_CLM_SURFACE_VARIABLES = sizeof(CLM_SURFACE_VARIABLES) / sizeof(CLM_SURFACE_VARIABLES[0]);
+
+PFClmData::PFClmData(const std::string& filename)
+    : m_file(filename){
+}
+
+int PFClmData::loadHeader(){
+    m_names.clear();
+    if(int err = m_file.loadHeader()){
+        return err;
+    }
+    if(int err = m_file.loadSubgridIndex()){
+        return err;
+    }
+    m_names = defaultVariableNames(m_file.getNZ());
+    return 0;
+}
+
+std::vector<std::string> PFClmData::defaultVariableNames(int numLayers){
+    std::vector<std::string> names;
+    for(int i = 0; i < numLayers; ++i){
+        if(i < NUM_CLM_SURFACE_VARIABLES){
+            names.push_back(CLM_SURFACE_VARIABLES[i]);
+        }else{
+            names.push_back("t_soil_" + std::to_string(i - NUM_CLM_SURFACE_VARIABLES + 1));
+        }
+    }
+    return names;
+}
+
+int PFClmData::setVariableNames(const std::vector<std::string>& names){
+    if(static_cast<int>(names.size()) != m_file.getNZ() || std::set<std::string>(names.begin(), names.end()).size() != names.size()){
+        std::cerr << "setVariableNames: expected " << m_file.getNZ() << " unique names, got " << names.size() << "\n";
+        return EINVAL;
+    }
+    m_names = names;
+    return 0;
+}
+
+const std::vector<std::string>& PFClmData::getVariableNames() const{
+    return m_names;
+}
+
+int PFClmData::getNumVariables() const{
+    return static_cast<int>(m_names.size());
+}
+
+int PFClmData::getVariableIndex(const std::string& name) const{
+    const auto it = std::find(m_names.begin(), m_names.end(), name);
+    return it == m_names.end() ? -1 : static_cast<int>(it - m_names.begin());
+}
+
+int PFClmData::readVariable(const std::string& name, double* buffer) const{
+    return readVariables(std::vector<std::string>(1, name), buffer);
+}
+
+int PFClmData::readVariables(const std::vector<std::string>& names, double* buffer) const{
+    std::vector<int> layers(names.size());
+    for(std::size_t i = 0; i < names.size(); ++i){
+        layers[i] = getVariableIndex(names[i]);
+        if(layers[i] < 0){
+            std::cerr << "Error reading " << m_file.getFilename() << ", no variable named \"" << names[i] << "\"\n";
+            return EINVAL;
+        }
+    }
+
+    //Runs of consecutive layers are a single hyperslab
+    const int ny = m_file.getNY();
+    const int nx = m_file.getNX();
+    const std::size_t layerSize = static_cast<std::size_t>(ny) * nx;
+    for(std::size_t begin = 0; begin < layers.size();){
+        std::size_t end = begin + 1;
+        while(end < layers.size() && layers[end] == layers[end - 1] + 1){
+            ++end;
+        }
+
+        const int err = m_file.readHyperslab(buffer + begin * layerSize, layers[begin], 0, 0, static_cast<int>(end - begin), ny, nx);
+        if(err){
+            std::cerr << "Error reading " << m_file.getFilename() << ", error code " << err << ": " << std::strerror(err) << "\n";
+            return err;
+        }
+        begin = end;
+    }
+    return 0;
+}
+
+std::vector<double> PFClmData::loadVariable(const std::string& name) const{
+    return loadVariables(std::vector<std::string>(1, name));
+}
+
+std::vector<double> PFClmData::loadVariables(const std::vector<std::string>& names) const{
+    std::vector<double> values(names.size() * m_file.getNY() * m_file.getNX());
+    if(readVariables(names, values.data())){
+        return std::vector<double>();
+    }
+    return values;
+}
+
+const PFData& PFClmData::getHeader() const{
+    return m_file;
+}
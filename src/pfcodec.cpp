@@ -0,0 +1,512 @@
+#include "pfcodec.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+//Probabilities of the rANS coder are multiples of 1 / RANS_TOTAL
+static const int RANS_SCALE_BITS = 12;
+static const uint32_t RANS_TOTAL = 1u << RANS_SCALE_BITS;
+
+//Lower bound of the normalized coder state. The coder moves 16 bit words in and out of it, so a single step renormalizes.
+static const uint32_t RANS_LOWER = 1u << 16;
+
+//Interleaved coder states. Consecutive symbols go to different states, so the decoder is not one long dependency chain.
+static const int RANS_STATES = 4;
+
+//Residual code of a value stored as is by compressDoublesBounded(). Zigzag codes of real residuals stay far below it.
+static const uint64_t BOUNDED_ESCAPE = ~static_cast<uint64_t>(0);
+
+//Quantum of compressDoublesBounded() in units of the error bound, when 2 rounds some values out of the bound
+static const double BOUNDED_QUANTUM_REDUCED = 2.0 - 1.0 / 512;
+
+//Values further than this many quanta from 0 are stored as is, which keeps the residuals of the others below 2^53
+static const double BOUNDED_MAX_QUANTUM = 1125899906842624.0; //2^50
+
+//How a byte plane is stored
+static const unsigned char PLANE_CONSTANT = 0;
+static const unsigned char PLANE_RAW = 1;
+static const unsigned char PLANE_RANS = 2;
+
+namespace {
+
+//Scales symbol counts to frequencies summing to RANS_TOTAL, keeping every present symbol at least 1
+void normalizeFrequencies(const uint32_t* counts, std::size_t total, uint32_t* freqs){
+    uint32_t sum = 0;
+    int largest = 0;
+    for(int s = 0; s < 256; ++s){
+        freqs[s] = counts[s] == 0 ? 0 : std::max<uint32_t>(1, static_cast<uint32_t>(static_cast<uint64_t>(counts[s]) * RANS_TOTAL / total));
+        sum += freqs[s];
+        if(freqs[s] > freqs[largest]){
+            largest = s;
+        }
+    }
+
+    //Rounding down leaves some room, which goes to the most frequent symbol
+    if(sum <= RANS_TOTAL){
+        freqs[largest] += RANS_TOTAL - sum;
+        return;
+    }
+
+    //Rare symbols raised to 1 can overshoot, take it back from the most frequent ones
+    while(sum > RANS_TOTAL){
+        const int s = static_cast<int>(std::max_element(freqs, freqs + 256) - freqs);
+        const uint32_t take = std::min(sum - RANS_TOTAL, freqs[s] / 2);
+        freqs[s] -= take;
+        sum -= take;
+    }
+}
+
+void putVarint(std::vector<unsigned char>& out, uint32_t value){
+    while(value >= 0x80){
+        out.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+bool getVarint(const unsigned char*& src, const unsigned char* end, uint32_t& value){
+    value = 0;
+    for(int shift = 0; shift < 32; shift += 7){
+        if(src == end){
+            return false;
+        }
+        const unsigned char byte = *src++;
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if(!(byte & 0x80)){
+            return true;
+        }
+    }
+    return false;
+}
+
+void putUint32(std::vector<unsigned char>& out, uint32_t value){
+    for(int i = 0; i < 4; ++i){
+        out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+    }
+}
+
+uint32_t getUint32(const unsigned char* src){
+    return static_cast<uint32_t>(src[0]) | static_cast<uint32_t>(src[1]) << 8 | static_cast<uint32_t>(src[2]) << 16 | static_cast<uint32_t>(src[3]) << 24;
+}
+
+uint64_t loadUint64(const unsigned char* src){
+    return static_cast<uint64_t>(getUint32(src)) | static_cast<uint64_t>(getUint32(src + 4)) << 32;
+}
+
+//Appends a byte plane, in the smallest of the three storage modes
+void encodePlane(const unsigned char* plane, std::size_t n, std::vector<unsigned char>& out, std::vector<unsigned char>& scratch){
+    uint32_t counts[256] = {0};
+    for(std::size_t i = 0; i < n; ++i){
+        counts[plane[i]]++;
+    }
+    const int numSymbols = static_cast<int>(256 - std::count(counts, counts + 256, 0u));
+    if(numSymbols <= 1){
+        out.push_back(PLANE_CONSTANT);
+        out.push_back(n > 0 ? plane[0] : 0);
+        return;
+    }
+
+    uint32_t freqs[256];
+    uint32_t starts[256];
+    normalizeFrequencies(counts, n, freqs);
+    uint32_t start = 0;
+    for(int s = 0; s < 256; ++s){
+        starts[s] = start;
+        start += freqs[s];
+    }
+
+    //rANS codes back to front, so the decoder runs front to back. A symbol costs at most 12 bits.
+    scratch.resize(2 * n + 4 * RANS_STATES + 16);
+    unsigned char* const end = scratch.data() + scratch.size();
+    unsigned char* ptr = end;
+    uint32_t states[RANS_STATES];
+    std::fill(states, states + RANS_STATES, RANS_LOWER);
+    for(std::size_t i = n; i-- > 0;){
+        uint32_t& x = states[i % RANS_STATES];
+        const uint32_t freq = freqs[plane[i]];
+        if(x >= ((RANS_LOWER >> RANS_SCALE_BITS) << 16) * freq){
+            ptr -= 2;
+            ptr[0] = static_cast<unsigned char>(x);
+            ptr[1] = static_cast<unsigned char>(x >> 8);
+            x >>= 16;
+        }
+        x = ((x / freq) << RANS_SCALE_BITS) + (x % freq) + starts[plane[i]];
+    }
+    for(int k = RANS_STATES; k-- > 0;){
+        ptr -= 4;
+        for(int b = 0; b < 4; ++b){
+            ptr[b] = static_cast<unsigned char>(states[k] >> (8 * b));
+        }
+    }
+    const std::size_t streamSize = end - ptr;
+
+    //Frequency table: a bitmap of the present symbols, then their frequencies
+    unsigned char bitmap[32] = {0};
+    std::size_t tableSize = sizeof(bitmap);
+    for(int s = 0; s < 256; ++s){
+        if(freqs[s]){
+            bitmap[s / 8] |= 1 << (s % 8);
+            tableSize += freqs[s] < 0x80 ? 1 : 2;
+        }
+    }
+
+    if(tableSize + 4 + streamSize >= n){
+        out.push_back(PLANE_RAW);
+        out.insert(out.end(), plane, plane + n);
+        return;
+    }
+
+    out.push_back(PLANE_RANS);
+    out.insert(out.end(), bitmap, bitmap + sizeof(bitmap));
+    for(int s = 0; s < 256; ++s){
+        if(freqs[s]){
+            putVarint(out, freqs[s]);
+        }
+    }
+    putUint32(out, static_cast<uint32_t>(streamSize));
+    out.insert(out.end(), ptr, end);
+}
+
+//Decodes a byte plane written by encodePlane(), advancing src past it
+int decodePlane(const unsigned char*& src, const unsigned char* end, unsigned char* plane, std::size_t n){
+    if(src == end){
+        return EINVAL;
+    }
+    const unsigned char mode = *src++;
+
+    if(mode == PLANE_CONSTANT){
+        if(src == end){
+            return EINVAL;
+        }
+        std::memset(plane, *src++, n);
+        return 0;
+    }
+
+    if(mode == PLANE_RAW){
+        if(static_cast<std::size_t>(end - src) < n){
+            return EINVAL;
+        }
+        std::memcpy(plane, src, n);
+        src += n;
+        return 0;
+    }
+
+    if(mode != PLANE_RANS || end - src < 32){
+        return EINVAL;
+    }
+    const unsigned char* bitmap = src;
+    src += 32;
+
+    uint32_t freqs[256] = {0};
+    uint32_t starts[256] = {0};
+    unsigned char symbols[RANS_TOTAL];
+    uint32_t start = 0;
+    for(int s = 0; s < 256; ++s){
+        if(!(bitmap[s / 8] & (1 << (s % 8)))){
+            continue;
+        }
+        if(!getVarint(src, end, freqs[s]) || freqs[s] == 0 || freqs[s] > RANS_TOTAL - start){
+            return EINVAL;
+        }
+        starts[s] = start;
+        std::memset(symbols + start, s, freqs[s]);
+        start += freqs[s];
+    }
+    if(start != RANS_TOTAL || end - src < 4){
+        return EINVAL;
+    }
+
+    const uint32_t streamSize = getUint32(src);
+    src += 4;
+    if(streamSize < 4 * RANS_STATES || static_cast<std::size_t>(end - src) < streamSize){
+        return EINVAL;
+    }
+    const unsigned char* ptr = src + 4 * RANS_STATES;
+    const unsigned char* const streamEnd = src + streamSize;
+
+    //Decodes plane[i] with state x. Reads past the stream are caught by the final check, so they stop at its end instead.
+    const auto decodeSymbol = [&](uint32_t& x, std::size_t i){
+        const uint32_t slot = x & (RANS_TOTAL - 1);
+        const unsigned char s = symbols[slot];
+        plane[i] = s;
+        x = freqs[s] * (x >> RANS_SCALE_BITS) + slot - starts[s];
+        if(x < RANS_LOWER && streamEnd - ptr >= 2){
+            x = (x << 16) | static_cast<uint32_t>(ptr[1]) << 8 | ptr[0];
+            ptr += 2;
+        }
+    };
+
+    //The states in locals rather than an array, so they stay in registers
+    uint32_t x0 = getUint32(src), x1 = getUint32(src + 4), x2 = getUint32(src + 8), x3 = getUint32(src + 12);
+    std::size_t i = 0;
+    for(; i + RANS_STATES <= n; i += RANS_STATES){
+        decodeSymbol(x0, i);
+        decodeSymbol(x1, i + 1);
+        decodeSymbol(x2, i + 2);
+        decodeSymbol(x3, i + 3);
+    }
+    uint32_t* const tail[] = {&x0, &x1, &x2};
+    for(; i < n; ++i){
+        decodeSymbol(*tail[i % RANS_STATES], i);
+    }
+
+    //The encoder started from RANS_LOWER, a decoder ending anywhere else read garbage
+    if(x0 != RANS_LOWER || x1 != RANS_LOWER || x2 != RANS_LOWER || x3 != RANS_LOWER || ptr != streamEnd){
+        return EINVAL;
+    }
+    src = streamEnd;
+    return 0;
+}
+
+//Calls visit(i, prediction) for every value in order, predicting it from the two values before it along `axis`.
+//visit() may fill in values[i] before returning, so the decoder can predict from the values it just decoded.
+//T is double, or uint64_t for quantized values, where the arithmetic wraps like two's complement.
+template<typename T, typename Visit>
+void forEachPrediction(const T* values, int axis, int nz, int ny, int nx, Visit visit){
+    const std::size_t stride = axis == 0 ? static_cast<std::size_t>(ny) * nx : axis == 1 ? static_cast<std::size_t>(nx) : 1;
+    std::size_t i = 0;
+    for(int z = 0; z < nz; ++z){
+        for(int y = 0; y < ny; ++y){
+            for(int x = 0; x < nx; ++x, ++i){
+                const int coord = axis == 0 ? z : axis == 1 ? y : x;
+                T prediction;
+                if(coord >= 2){
+                    //Linear extrapolation. No multiplication, so it cannot be contracted to an FMA and rounds the same everywhere.
+                    const T a = values[i - stride];
+                    prediction = a + (a - values[i - 2 * stride]);
+                }else if(coord == 1){
+                    prediction = values[i - stride];
+                }else if(i > 0){
+                    prediction = values[i - 1];
+                }else{
+                    prediction = T(0);
+                }
+                visit(i, prediction);
+            }
+        }
+    }
+}
+
+//Extrapolates along the axis with the cheapest residuals, by the order-0 entropy of their byte planes, which is much cheaper
+//than coding them. X is the fallback, Y and Z need at least 3 values to extrapolate.
+template<typename T, typename Residual>
+int choosePredictionAxis(const T* values, int nz, int ny, int nx, Residual residualOf){
+    const double count = static_cast<double>(nz) * ny * nx;
+    int best = 2;
+    double bestBits = 0.0;
+    for(int axis = 2; axis >= 0; --axis){
+        if(axis < 2 && (axis == 0 ? nz : ny) < 3){
+            continue;
+        }
+
+        std::vector<uint32_t> counts(8 * 256, 0);
+        forEachPrediction(values, axis, nz, ny, nx, [&](std::size_t i, T prediction){
+            const uint64_t residual = residualOf(i, prediction);
+            for(int b = 0; b < 8; ++b){
+                counts[b * 256 + ((residual >> (8 * b)) & 0xff)]++;
+            }
+        });
+        double bits = 0.0;
+        for(uint32_t c : counts){
+            if(c > 0){
+                bits -= c * std::log2(c / count);
+            }
+        }
+
+        if(axis == 2 || bits < bestBits){
+            best = axis;
+            bestBits = bits;
+        }
+    }
+    return best;
+}
+
+//Appends the axis, then the residuals of its predictor split into byte planes, least significant first
+template<typename T, typename Residual>
+void encodeResiduals(const T* values, int axis, int nz, int ny, int nx, Residual residualOf, std::vector<unsigned char>& out){
+    out.push_back(static_cast<unsigned char>(axis));
+
+    const std::size_t count = static_cast<std::size_t>(nz) * ny * nx;
+    std::vector<unsigned char> planes(8 * count);
+    forEachPrediction(values, axis, nz, ny, nx, [&](std::size_t i, T prediction){
+        const uint64_t residual = residualOf(i, prediction);
+        for(int b = 0; b < 8; ++b){
+            planes[b * count + i] = static_cast<unsigned char>(residual >> (8 * b));
+        }
+    });
+
+    std::vector<unsigned char> scratch;
+    for(int b = 0; b < 8; ++b){
+        encodePlane(planes.data() + b * count, count, out, scratch);
+    }
+}
+
+//Reads back the output of encodeResiduals(), advancing src past it
+int decodeResiduals(const unsigned char*& src, const unsigned char* end, std::size_t count, int& axis, std::vector<unsigned char>& planes){
+    if(src == end || *src > 2){
+        return EINVAL;
+    }
+    axis = *src++;
+
+    planes.resize(8 * count);
+    for(int b = 0; b < 8; ++b){
+        if(int err = decodePlane(src, end, planes.data() + b * count, count)){
+            return err;
+        }
+    }
+    return 0;
+}
+
+uint64_t gatherResidual(const std::vector<unsigned char>& planes, std::size_t count, std::size_t i){
+    uint64_t residual = 0;
+    for(int b = 0; b < 8; ++b){
+        residual |= static_cast<uint64_t>(planes[b * count + i]) << (8 * b);
+    }
+    return residual;
+}
+
+uint64_t doubleBits(double value){
+    uint64_t bits;
+    std::memcpy(&bits, &value, 8);
+    return bits;
+}
+
+double bitsToDouble(uint64_t bits){
+    double value;
+    std::memcpy(&value, &bits, 8);
+    return value;
+}
+
+//Maps small negative and positive differences to small codes
+uint64_t zigzag(uint64_t value){
+    return (value << 1) ^ (0 - (value >> 63));
+}
+
+uint64_t unzigzag(uint64_t code){
+    return (code >> 1) ^ (0 - (code & 1));
+}
+
+} //namespace
+
+void compressDoubles(const double* values, int nz, int ny, int nx, std::vector<unsigned char>& out){
+    const auto residualOf = [&](std::size_t i, double prediction){
+        return doubleBits(values[i]) ^ doubleBits(prediction);
+    };
+    encodeResiduals(values, choosePredictionAxis(values, nz, ny, nx, residualOf), nz, ny, nx, residualOf, out);
+}
+
+int decompressDoubles(const unsigned char* src, std::size_t size, double* values, int nz, int ny, int nx){
+    const unsigned char* const end = src + size;
+    const std::size_t count = static_cast<std::size_t>(nz) * ny * nx;
+    int axis;
+    std::vector<unsigned char> planes;
+    if(int err = decodeResiduals(src, end, count, axis, planes)){
+        return err;
+    }
+    if(src != end){
+        return EINVAL;
+    }
+
+    forEachPrediction(values, axis, nz, ny, nx, [&](std::size_t i, double prediction){
+        values[i] = bitsToDouble(gatherResidual(planes, count, i) ^ doubleBits(prediction));
+    });
+    return 0;
+}
+
+void compressDoublesBounded(const double* values, int nz, int ny, int nx, double errorBound, std::vector<unsigned char>& out){
+    //Every value becomes the nearest multiple of the quantum. Values that would not come back within the bound, like
+    //NaN, infinities, or values too large for the quantization, are stored as they are, and quantized to 0.
+    const std::size_t count = static_cast<std::size_t>(nz) * ny * nx;
+    std::vector<uint64_t> quantized(count);
+    std::vector<bool> escaped(count);
+    std::size_t numEscaped = 0;
+    const auto quantize = [&](double step){
+        numEscaped = 0;
+        for(std::size_t i = 0; i < count; ++i){
+            const double scaled = values[i] / step;
+            const long long q = std::fabs(scaled) < BOUNDED_MAX_QUANTUM ? std::llround(scaled) : 0;
+            escaped[i] = !(std::fabs(static_cast<double>(q) * step - values[i]) <= errorBound);
+            quantized[i] = escaped[i] ? 0 : static_cast<uint64_t>(q);
+            numEscaped += escaped[i];
+        }
+    };
+
+    //Twice the bound keeps values that are round in decimal on the grid. Values exactly halfway between two quanta can
+    //then round one ulp out of the bound, and a quantum a little smaller than that leaves room for the rounding.
+    double step = 2.0 * errorBound;
+    quantize(step);
+    if(numEscaped > 0){
+        const std::size_t roundedOut = numEscaped;
+        quantize(BOUNDED_QUANTUM_REDUCED * errorBound);
+        if(numEscaped < roundedOut){
+            step = BOUNDED_QUANTUM_REDUCED * errorBound;
+        }else{
+            quantize(step);
+        }
+    }
+
+    for(int b = 0; b < 8; ++b){
+        out.push_back(static_cast<unsigned char>(doubleBits(errorBound) >> (8 * b)));
+    }
+    for(int b = 0; b < 8; ++b){
+        out.push_back(static_cast<unsigned char>(doubleBits(step) >> (8 * b)));
+    }
+    const auto residualOf = [&](std::size_t i, uint64_t prediction){
+        return escaped[i] ? BOUNDED_ESCAPE : zigzag(quantized[i] - prediction);
+    };
+    encodeResiduals(quantized.data(), choosePredictionAxis(quantized.data(), nz, ny, nx, residualOf), nz, ny, nx, residualOf, out);
+    for(std::size_t i = 0; i < count; ++i){
+        if(escaped[i]){
+            for(int b = 0; b < 8; ++b){
+                out.push_back(static_cast<unsigned char>(doubleBits(values[i]) >> (8 * b)));
+            }
+        }
+    }
+}
+
+int decompressDoublesBounded(const unsigned char* src, std::size_t size, double* values, int nz, int ny, int nx){
+    const unsigned char* const end = src + size;
+    if(size < 16 || !(boundedErrorBound(src) > 0.0)){
+        return EINVAL;
+    }
+    const double step = bitsToDouble(loadUint64(src + 8));
+    if(!(step > 0.0) || std::isinf(step)){
+        return EINVAL;
+    }
+    src += 16;
+
+    const std::size_t count = static_cast<std::size_t>(nz) * ny * nx;
+    int axis;
+    std::vector<unsigned char> planes;
+    if(int err = decodeResiduals(src, end, count, axis, planes)){
+        return err;
+    }
+
+    //Same arithmetic as the encoder, a single multiplication per value
+    std::vector<uint64_t> quantized(count);
+    bool truncated = false;
+    forEachPrediction(quantized.data(), axis, nz, ny, nx, [&](std::size_t i, uint64_t prediction){
+        const uint64_t residual = gatherResidual(planes, count, i);
+        if(residual != BOUNDED_ESCAPE){
+            quantized[i] = prediction + unzigzag(residual);
+            values[i] = static_cast<double>(static_cast<long long>(quantized[i])) * step;
+        }else if(end - src >= 8){
+            quantized[i] = 0;
+            values[i] = bitsToDouble(loadUint64(src));
+            src += 8;
+        }else{
+            truncated = true;
+        }
+    });
+    if(truncated || src != end){
+        return EINVAL;
+    }
+    return 0;
+}
+
+double boundedErrorBound(const unsigned char* src){
+    return bitsToDouble(loadUint64(src));
+}
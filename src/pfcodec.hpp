@@ -0,0 +1,61 @@
+#ifndef PARFLOWIO_PFCODEC_HPP
+#define PARFLOWIO_PFCODEC_HPP
+#include <cstddef>
+#include <vector>
+
+//First bytes of a compressed pfb file, see PFData::writeCompressedFile()
+static const unsigned char COMPRESSED_PFB_MAGIC[8] = {'P', 'F', 'B', 'Z', '\r', '\n', 0x1a, '\n'};
+
+/** Losslessly compresses a 3D block of doubles, and appends the result to `out`.
+ * Each value is predicted by linear extrapolation from the two before it along one axis, the one giving the smallest
+ * output, and XORed with its prediction, which zeroes the sign, exponent, and leading mantissa bits of smoothly varying
+ * data. The residuals are then split into 8 byte planes, and every plane is stored as a single byte if it is constant,
+ * entropy coded with an order-0 rANS coder, or as is, whichever is smallest.
+ * \param   values  The values to compress, X fastest.
+ * \param   nz      Size of the block in Z.
+ * \param   ny      Size of the block in Y.
+ * \param   nx      Size of the block in X.
+ * \param   out     Destination, the compressed bytes are appended.
+ */
+void compressDoubles(const double* values, int nz, int ny, int nx, std::vector<unsigned char>& out);
+
+/** Decompresses the output of compressDoubles().
+ * \param   src     The compressed bytes.
+ * \param   size    Number of compressed bytes.
+ * \param   values  Destination, nz * ny * nx values.
+ * \param   nz      Size of the block in Z, as passed to compressDoubles().
+ * \param   ny      Size of the block in Y, as passed to compressDoubles().
+ * \param   nx      Size of the block in X, as passed to compressDoubles().
+ * \return          0 on success, EINVAL if the data is corrupt.
+ */
+int decompressDoubles(const unsigned char* src, std::size_t size, double* values, int nz, int ny, int nx);
+
+/** Compresses a 3D block of doubles to within an absolute error bound, and appends the result to `out`.
+ * Every value is rounded to the nearest multiple of a quantum, 2 * errorBound or just under it, and the integer multiples
+ * are coded like compressDoubles() codes the values, with their differences to the prediction in place of the XOR. Values
+ * that cannot be rounded within the bound, such as NaN and infinities, are stored as they are. The output starts with the
+ * bound and the quantum, 8 bytes each.
+ * \param   values      The values to compress, X fastest.
+ * \param   nz          Size of the block in Z.
+ * \param   ny          Size of the block in Y.
+ * \param   nx          Size of the block in X.
+ * \param   errorBound  Largest absolute difference between a value and its decompressed value, greater than 0.
+ * \param   out         Destination, the compressed bytes are appended.
+ */
+void compressDoublesBounded(const double* values, int nz, int ny, int nx, double errorBound, std::vector<unsigned char>& out);
+
+/** Decompresses the output of compressDoublesBounded().
+ * \param   src     The compressed bytes.
+ * \param   size    Number of compressed bytes.
+ * \param   values  Destination, nz * ny * nx values.
+ * \param   nz      Size of the block in Z, as passed to compressDoublesBounded().
+ * \param   ny      Size of the block in Y, as passed to compressDoublesBounded().
+ * \param   nx      Size of the block in X, as passed to compressDoublesBounded().
+ * \return          0 on success, EINVAL if the data is corrupt.
+ */
+int decompressDoublesBounded(const unsigned char* src, std::size_t size, double* values, int nz, int ny, int nx);
+
+//Error bound of the output of compressDoublesBounded(), from its first 8 bytes
+double boundedErrorBound(const unsigned char* src);
+
+#endif //PARFLOWIO_PFCODEC_HPP
@@ -0,0 +1,290 @@
+#include "parflow/pfdata.hpp"
+#include "parflow/pfbufferpool.hpp"
+#include "pfcodec.hpp"
+#include "pffile.hpp"
+#include "pfthreadpool.hpp"
+#include "pfutil.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+//Version of the container written by PFData::writeCompressedFile()
+static const uint32_t COMPRESSED_PFB_VERSION = 1;
+
+//Codec of the chunks, see compressDoubles() and compressDoublesBounded()
+static const uint32_t COMPRESSED_PFB_CODEC = 1;
+static const uint32_t COMPRESSED_PFB_CODEC_BOUNDED = 2;
+
+//Magic, version, codec, the 64 byte pfb header, P, Q, R, and a reserved word. The chunk table follows.
+static const std::size_t COMPRESSED_PFB_HEADER_SIZE = 96;
+
+//The container fields are little endian, the embedded pfb header stays big endian
+static void storeLittleEndian(unsigned char* dst, uint64_t value, int size){
+    for(int i = 0; i < size; ++i){
+        dst[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+static uint64_t loadLittleEndian(const unsigned char* src, int size){
+    uint64_t value = 0;
+    for(int i = 0; i < size; ++i){
+        value |= static_cast<uint64_t>(src[i]) << (8 * i);
+    }
+    return value;
+}
+
+static int loadBigEndianInt(const unsigned char* src){
+    uint32_t tmp;
+    std::memcpy(&tmp, src, 4);
+    return static_cast<int>(bswap32(tmp));
+}
+
+static double loadBigEndianDouble(const unsigned char* src){
+    uint64_t tmp;
+    std::memcpy(&tmp, src, 8);
+    tmp = bswap64(tmp);
+    double value;
+    std::memcpy(&value, &tmp, 8);
+    return value;
+}
+
+bool PFData::isCompressed() const{
+    return m_compressed;
+}
+
+int PFData::loadCompressedHeader(){
+    unsigned char header[COMPRESSED_PFB_HEADER_SIZE];
+    if(int err = readFileAt(m_fd, header, sizeof(header), 0)){
+        std::cerr << "Error reading the header of " << m_filename << ", error code " << err << ": " << std::strerror(err) << "\n";
+        return 1;
+    }
+
+    const uint32_t version = static_cast<uint32_t>(loadLittleEndian(header + 8, 4));
+    const uint32_t codec = static_cast<uint32_t>(loadLittleEndian(header + 12, 4));
+    if(version != COMPRESSED_PFB_VERSION || (codec != COMPRESSED_PFB_CODEC && codec != COMPRESSED_PFB_CODEC_BOUNDED)){
+        std::cerr << m_filename << " is a compressed pfb of an unsupported version " << version << ", codec " << codec << "\n";
+        return 1;
+    }
+
+    //The pfb header, same layout as in a pfb file
+    const unsigned char* pfb = header + 16;
+    m_X = loadBigEndianDouble(pfb);
+    m_Y = loadBigEndianDouble(pfb + 8);
+    m_Z = loadBigEndianDouble(pfb + 16);
+    m_nx = loadBigEndianInt(pfb + 24);
+    m_ny = loadBigEndianInt(pfb + 28);
+    m_nz = loadBigEndianInt(pfb + 32);
+    m_dX = loadBigEndianDouble(pfb + 36);
+    m_dY = loadBigEndianDouble(pfb + 44);
+    m_dZ = loadBigEndianDouble(pfb + 52);
+    m_numSubgrids = loadBigEndianInt(pfb + 60);
+
+    m_p = static_cast<int>(loadLittleEndian(header + 80, 4));
+    m_q = static_cast<int>(loadLittleEndian(header + 84, 4));
+    m_r = static_cast<int>(loadLittleEndian(header + 88, 4));
+    if(m_nx < 1 || m_ny < 1 || m_nz < 1 || !hasTopology()){
+        std::cerr << "Invalid header in " << m_filename << "\n";
+        return 1;
+    }
+
+    //Offset of every chunk, and the end of the last one
+    std::vector<unsigned char> table(8 * (static_cast<std::size_t>(m_numSubgrids) + 1));
+    if(int err = readFileAt(m_fd, table.data(), table.size(), COMPRESSED_PFB_HEADER_SIZE)){
+        std::cerr << "Error reading the chunk table of " << m_filename << ", error code " << err << ": " << std::strerror(err) << "\n";
+        return 1;
+    }
+    std::vector<long long> offsets(m_numSubgrids + 1);
+    for(int i = 0; i <= m_numSubgrids; ++i){
+        offsets[i] = static_cast<long long>(loadLittleEndian(&table[8 * static_cast<std::size_t>(i)], 8));
+        const long long previous = i == 0 ? static_cast<long long>(COMPRESSED_PFB_HEADER_SIZE + table.size()) : offsets[i - 1];
+        if(offsets[i] < previous){
+            std::cerr << "Invalid chunk table in " << m_filename << "\n";
+            return 1;
+        }
+    }
+    if(offsets.back() != getFileSize(m_fd)){
+        std::cerr << "Error reading " << m_filename << ", the file is truncated\n";
+        return 1;
+    }
+
+    //Every chunk of a lossy file starts with the error bound, they all have the same
+    double errorBound = 0.0;
+    if(codec == COMPRESSED_PFB_CODEC_BOUNDED){
+        unsigned char bound[8];
+        if(offsets[1] - offsets[0] < 8 || readFileAt(m_fd, bound, 8, offsets[0]) || !((errorBound = boundedErrorBound(bound)) > 0.0)){
+            std::cerr << "Invalid error bound in " << m_filename << "\n";
+            return 1;
+        }
+    }
+
+    m_chunkOffsets = std::move(offsets);
+    m_errorBound = errorBound;
+    m_compressed = true;
+    return 0;
+}
+
+double PFData::getErrorBound() const{
+    return m_errorBound;
+}
+
+int PFData::readCompressedSubgrid(double* buffer, int gridZ, int gridY, int gridX) const{
+    if(!m_compressed || gridZ < 0 || gridZ >= m_r || gridY < 0 || gridY >= m_q || gridX < 0 || gridX >= m_p){
+        return EINVAL;
+    }
+
+    const int subgrid = (gridZ * m_q + gridY) * m_p + gridX;
+    const long long offset = m_chunkOffsets[subgrid];
+    std::vector<unsigned char> chunk(static_cast<std::size_t>(m_chunkOffsets[subgrid + 1] - offset));
+    if(int err = readRaw(chunk.data(), chunk.size(), offset)){
+        return err;
+    }
+
+    const int nz = getSubgridSizeZ(gridZ);
+    const int ny = getSubgridSizeY(gridY);
+    const int nx = getSubgridSizeX(gridX);
+    if(m_errorBound > 0.0){
+        return decompressDoublesBounded(chunk.data(), chunk.size(), buffer, nz, ny, nx);
+    }
+    return decompressDoubles(chunk.data(), chunk.size(), buffer, nz, ny, nx);
+}
+
+int PFData::loadCompressedData(int numThreads){
+    if(int err = allocateLoadBuffer(static_cast<std::size_t>(m_nx) * m_ny * m_nz)){
+        return err;
+    }
+
+    numThreads = std::max(1, std::min(numThreads, m_numSubgrids));
+    std::vector<std::vector<double>> scratch(numThreads);
+    const int err = PFThreadPool::shared().parallelFor(m_numSubgrids, numThreads, [&](int subgrid, int worker) -> int{
+        const std::array<int, 3> idx = unflattenGridIndex(subgrid);
+        const int nz = getSubgridSizeZ(idx[0]);
+        const int ny = getSubgridSizeY(idx[1]);
+        const int nx = getSubgridSizeX(idx[2]);
+        std::vector<double>& values = scratch[worker];
+        values.resize(static_cast<std::size_t>(nz) * ny * nx);
+        if(int readErr = readCompressedSubgrid(values.data(), idx[0], idx[1], idx[2])){
+            return readErr;
+        }
+
+        //Rows of the subgrid into the data array
+        const int z0 = getSubgridStartZ(idx[0]);
+        const int y0 = getSubgridStartY(idx[1]);
+        const int x0 = getSubgridStartX(idx[2]);
+        for(int z = 0; z < nz; ++z){
+            for(int y = 0; y < ny; ++y){
+                const double* src = &values[(static_cast<std::size_t>(z) * ny + y) * nx];
+                const std::size_t index = (static_cast<std::size_t>(z0 + z) * m_ny + (y0 + y)) * m_nx + x0;
+                if(m_loadAsFloat){
+                    std::copy(src, src + nx, m_floatData + index);
+                }else{
+                    std::memcpy(m_data + index, src, 8 * static_cast<std::size_t>(nx));
+                }
+            }
+        }
+        return 0;
+    });
+    if(err){
+        std::cerr << "Error loading " << m_filename << ", error code " << err << ": " << std::strerror(err) << "\n";
+        return err;
+    }
+    return 0;
+}
+
+int PFData::writeCompressedFile(const std::string& filename, int numThreads, double errorBound) const{
+    if(m_data == nullptr){
+        std::cerr << "writeCompressedFile: no double precision data to write\n";
+        return 1;
+    }
+    if(m_indexOrder != "zyx"){
+        std::cerr << "writeCompressedFile: the index order must be \"zyx\", see setIndexOrder()\n";
+        return 1;
+    }
+    if(m_p < 1 || m_q < 1 || m_r < 1 || m_p > m_nx || m_q > m_ny || m_r > m_nz){
+        std::cerr << "Invalid processor topology " << m_p << " x " << m_q << " x " << m_r << " for writing " << filename << "\n";
+        return 1;
+    }
+    if(!(errorBound >= 0.0) || std::isinf(errorBound)){
+        std::cerr << "writeCompressedFile: invalid error bound " << errorBound << "\n";
+        return 1;
+    }
+
+    //Every subgrid is compressed on its own, so they can be read back on their own
+    const int numSubgrids = m_p * m_q * m_r;
+    numThreads = std::max(1, std::min(numThreads, numSubgrids));
+    std::vector<std::vector<unsigned char>> chunks(numSubgrids);
+    std::vector<std::vector<double>> scratch(numThreads);
+    PFThreadPool::shared().parallelFor(numSubgrids, numThreads, [&](int subgrid, int worker) -> int{
+        //Not unflattenGridIndex(), in-memory data has no subgrid count
+        const std::array<int, 3> idx = {{subgrid / (m_p * m_q), subgrid / m_p % m_q, subgrid % m_p}};
+        const int nz = getSubgridSizeZ(idx[0]);
+        const int ny = getSubgridSizeY(idx[1]);
+        const int nx = getSubgridSizeX(idx[2]);
+        const int z0 = getSubgridStartZ(idx[0]);
+        const int y0 = getSubgridStartY(idx[1]);
+        const int x0 = getSubgridStartX(idx[2]);
+
+        std::vector<double>& values = scratch[worker];
+        values.resize(static_cast<std::size_t>(nz) * ny * nx);
+        for(int z = 0; z < nz; ++z){
+            for(int y = 0; y < ny; ++y){
+                const std::size_t index = (static_cast<std::size_t>(z0 + z) * m_ny + (y0 + y)) * m_nx + x0;
+                std::memcpy(&values[(static_cast<std::size_t>(z) * ny + y) * nx], m_data + index, 8 * static_cast<std::size_t>(nx));
+            }
+        }
+        if(errorBound > 0.0){
+            compressDoublesBounded(values.data(), nz, ny, nx, errorBound, chunks[subgrid]);
+        }else{
+            compressDoubles(values.data(), nz, ny, nx, chunks[subgrid]);
+        }
+        return 0;
+    });
+
+    //Header and chunk table
+    std::vector<unsigned char> header(COMPRESSED_PFB_HEADER_SIZE + 8 * (static_cast<std::size_t>(numSubgrids) + 1), 0);
+    std::memcpy(header.data(), COMPRESSED_PFB_MAGIC, sizeof(COMPRESSED_PFB_MAGIC));
+    storeLittleEndian(&header[8], COMPRESSED_PFB_VERSION, 4);
+    storeLittleEndian(&header[12], errorBound > 0.0 ? COMPRESSED_PFB_CODEC_BOUNDED : COMPRESSED_PFB_CODEC, 4);
+    encodeFileHeader(&header[16]);
+    storeLittleEndian(&header[80], static_cast<uint64_t>(m_p), 4);
+    storeLittleEndian(&header[84], static_cast<uint64_t>(m_q), 4);
+    storeLittleEndian(&header[88], static_cast<uint64_t>(m_r), 4);
+
+    long long offset = static_cast<long long>(header.size());
+    for(int i = 0; i <= numSubgrids; ++i){
+        storeLittleEndian(&header[COMPRESSED_PFB_HEADER_SIZE + 8 * static_cast<std::size_t>(i)], static_cast<uint64_t>(offset), 8);
+        if(i < numSubgrids){
+            offset += static_cast<long long>(chunks[i].size());
+        }
+    }
+
+    const int fd = openFileWrite(filename);
+    if(fd < 0){
+        std::string err{"Error opening file: \"" + filename + "\""};
+        perror(err.c_str());
+        return 1;
+    }
+
+    int err = preallocateFile(fd, offset);
+    if(!err){
+        err = writeFileAt(fd, header.data(), header.size(), 0);
+    }
+    offset = static_cast<long long>(header.size());
+    for(int i = 0; i < numSubgrids && !err; ++i){
+        err = writeFileAt(fd, chunks[i].data(), chunks[i].size(), offset);
+        offset += static_cast<long long>(chunks[i].size());
+    }
+    closeFileDescriptor(fd);
+
+    if(err){
+        std::cerr << "Error writing " << filename << ", error code " << err << ": " << std::strerror(err) << "\n";
+        return err;
+    }
+    return 0;
+}
@@ -1,4 +1,10 @@
 #include "parflow/pfdata.hpp"
+#include "parflow/pfbufferpool.hpp"
+#include "pfcodec.hpp"
+#include "pffile.hpp"
+#include "pfprefetch.hpp"
+#include "pfreadplan.hpp"
+#include "pfthreadpool.hpp"
 #include "pfutil.hpp"
 
 #include <algorithm>
@@ -11,8 +17,9 @@
 #include <cmath>
 #include <fstream>
 #include <iostream>
+#include <random>
 #include <string>
-#include <thread>
+#include <utility>
 #include <vector>
 
 
@@ -31,6 +38,53 @@
                          uint64_t temp =  bswap64(buf);\
                          V = *(double*)&temp;}
 
+//Read big endian values out of a file mapping
+static int readMappedInt(const unsigned char* src){
+    uint32_t tmp;
+    std::memcpy(&tmp, src, 4);
+    return static_cast<int>(bswap32(tmp));
+}
+
+static double readMappedDouble(const unsigned char* src){
+    uint64_t tmp;
+    std::memcpy(&tmp, src, 8);
+    tmp = bswap64(tmp);
+    double value;
+    std::memcpy(&value, &tmp, 8);
+    return value;
+}
+
+//Copies count big endian doubles out of a file mapping, converting them to native byte order
+static void copyMappedDoubles(double* dst, const unsigned char* src, std::size_t count){
+    std::memcpy(dst, src, 8 * count);
+    bswap64_array_inplace(reinterpret_cast<uint64_t*>(dst), count);
+}
+
+//Size of the reads issued by loadData()
+static const std::size_t LOAD_BLOCK_BYTES = 4u << 20;
+
+//Store big endian values into a buffer
+static void storeBigEndianInt(unsigned char* dst, int value){
+    const uint32_t tmp = bswap32(static_cast<uint32_t>(value));
+    std::memcpy(dst, &tmp, 4);
+}
+
+static void storeBigEndianDouble(unsigned char* dst, double value){
+    uint64_t tmp;
+    std::memcpy(&tmp, &value, 8);
+    tmp = bswap64(tmp);
+    std::memcpy(dst, &tmp, 8);
+}
+
+double PFSubgridView::operator()(int z, int y, int x) const{
+    const long long index = (static_cast<long long>(z) * ny + y) * nx + x;
+    return readMappedDouble(data + 8 * index);
+}
+
+bool PFSubgridView::isValid() const{
+    return data != nullptr;
+}
+
 
 PFData::PFData(std::string filename)
     : m_filename{filename} {}
@@ -39,17 +93,131 @@ PFData::PFData(double *data, int nz, int ny, int nx)
     : m_data{data}, m_nz{nz}, m_ny{ny}, m_nx{nx} {}
 
 PFData::~PFData(){
-    if(m_fp){
-        std::fclose(m_fp);
-    }
+    close();
+    releaseData();
+}
 
+PFData::PFData(PFData&& other) noexcept{
+    moveFrom(other);
+}
+
+PFData& PFData::operator=(PFData&& other) noexcept{
+    if(this != &other){
+        close();
+        releaseData();
+        moveFrom(other);
+    }
+    return *this;
+}
+
+void PFData::moveFrom(PFData& other){
+    m_filename = std::move(other.m_filename);
+    m_fp = other.m_fp;
+    m_fd = other.m_fd;
+    m_Z = other.m_Z;
+    m_Y = other.m_Y;
+    m_X = other.m_X;
+    m_nz = other.m_nz;
+    m_ny = other.m_ny;
+    m_nx = other.m_nx;
+    m_dZ = other.m_dZ;
+    m_dY = other.m_dY;
+    m_dX = other.m_dX;
+    m_numSubgrids = other.m_numSubgrids;
+    m_r = other.m_r;
+    m_q = other.m_q;
+    m_p = other.m_p;
+    m_indexOrder = std::move(other.m_indexOrder);
+    m_dataOwner = other.m_dataOwner;
+    m_data = other.m_data;
+    m_floatData = other.m_floatData;
+    m_loadAsFloat = other.m_loadAsFloat;
+    m_prefetchDepth = other.m_prefetchDepth;
+    m_subgridIndex = std::move(other.m_subgridIndex);
+    {
+        //The mutex itself stays with each object
+        std::lock_guard<std::mutex> lock(other.m_subgridCacheMutex);
+        m_subgridCache = std::move(other.m_subgridCache);
+        other.m_subgridCache.clear();
+    }
+    m_map = other.m_map;
+    m_mapSize = other.m_mapSize;
+    m_compressed = other.m_compressed;
+    m_chunkOffsets = std::move(other.m_chunkOffsets);
+    m_errorBound = other.m_errorBound;
+    m_nativeMap = other.m_nativeMap;
+    m_nativeMapSize = other.m_nativeMapSize;
+    m_nativeCache = other.m_nativeCache;
+
+    //Leave other as a default constructed object, so its destructor releases nothing
+    other.m_filename.clear();
+    other.m_fp = nullptr;
+    other.m_fd = -1;
+    other.m_Z = 0.0;
+    other.m_Y = 0.0;
+    other.m_X = 0.0;
+    other.m_nz = 0;
+    other.m_ny = 0;
+    other.m_nx = 0;
+    other.m_dZ = 1.0;
+    other.m_dY = 1.0;
+    other.m_dX = 1.0;
+    other.m_numSubgrids = 0;
+    other.m_r = 1;
+    other.m_q = 1;
+    other.m_p = 1;
+    other.m_indexOrder = "zyx";
+    other.m_dataOwner = false;
+    other.m_data = nullptr;
+    other.m_floatData = nullptr;
+    other.m_loadAsFloat = false;
+    other.m_prefetchDepth = 4;
+    other.m_subgridIndex.clear();
+    other.m_map = nullptr;
+    other.m_mapSize = 0;
+    other.m_compressed = false;
+    other.m_chunkOffsets.clear();
+    other.m_errorBound = 0.0;
+    other.m_nativeMap = nullptr;
+    other.m_nativeMapSize = 0;
+    other.m_nativeCache = false;
+}
+
+void PFData::releaseData(){
     if(m_dataOwner && m_data != nullptr){
-        //std::free(m_data);
+        PFBufferPool::shared().release(m_data);
     }
+    m_data = nullptr;
+    m_dataOwner = false;
+
+    if(m_nativeMap){
+        ::unmapFile(m_nativeMap, m_nativeMapSize);
+        m_nativeMap = nullptr;
+        m_nativeMapSize = 0;
+    }
+
+    PFBufferPool::shared().release(m_floatData);
+    m_floatData = nullptr;
 }
 
 int PFData::loadHeader() {
 
+    //Any previous index and cached subgrids belong to an older version of the file
+    m_subgridIndex.clear();
+    m_compressed = false;
+    m_chunkOffsets.clear();
+    m_errorBound = 0.0;
+    {
+        std::lock_guard<std::mutex> lock(m_subgridCacheMutex);
+        m_subgridCache.clear();
+    }
+
+    if(m_fp){
+        std::fclose(m_fp);
+    }
+    closeFileDescriptor(m_fd);
+    m_fd = -1;
+
     m_fp = fopen( m_filename.c_str(), "rb");
     if(m_fp == nullptr){
         std::string err{"Error opening file: \"" + m_filename + "\""};
@@ -57,6 +225,19 @@ int PFData::loadHeader() {
         return 1;
     }
 
+    m_fd = openFileReadOnly(m_filename);
+    if(m_fd < 0){
+        std::string err{"Error opening file: \"" + m_filename + "\""};
+        perror(err.c_str());
+        return 1;
+    }
+
+    //Compressed files start with their own magic, the pfb header follows it
+    unsigned char magic[sizeof(COMPRESSED_PFB_MAGIC)];
+    if(readFileAt(m_fd, magic, sizeof(magic), 0) == 0 && std::memcmp(magic, COMPRESSED_PFB_MAGIC, sizeof(magic)) == 0){
+        return loadCompressedHeader();
+    }
+
     /* read in header information */
     int errcheck;
     READDOUBLE(m_X,m_fp,errcheck);
@@ -84,91 +265,64 @@ int PFData::loadHeader() {
 }
 
 int PFData::loadPQR(){
-    //Read nx, ny, nz from subgrid header.
-    auto readValues = [](std::FILE* f, int& nx, int& ny, int& nz){
-        int err = std::fread(&nx, 4, 1, f);
-        if(err != 1){
-            perror("Error reading nx in subgrid header");
-            return err;
-        }
-
-        err = std::fread(&ny, 4, 1, f);
-        if(err != 1){
-            perror("Error reading ny in subgrid header");
-            return err;
-        }
-
-        err = std::fread(&nz, 4, 1, f);
-        if(err != 1){
-            perror("Error reading nz in subgrid header");
-            return err;
-        }
-
-        nx = bswap32(nx);
-        ny = bswap32(ny);
-        nz = bswap32(nz);
-
+    //The topology of compressed files is in their header
+    if(m_compressed){
         return 0;
-    };
-
-
-    std::fpos_t pos{};
-    //Save old position
-    std::fgetpos(m_fp, &pos);
-    std::fseek(m_fp, 64+12, SEEK_SET); //Skip file header and first 3 ints of the subgrid header.
-
-    //Reset
-    m_r = 0;
-    m_q = 0;
-    m_p = 0;
-
-    int yDim{};
-    int xDim{};
-
-
-    //Each iter:
-    //  if m_q == 0, m_p++
-    //  Every time xDim == m_nx, add 1 to m_q
-    //  Every time yDim == m_ny, add 1 to m_r
-
-    for(int i = 0; i < m_numSubgrids; ++i){
-        int nx, ny, nz;
-        if(int err = readValues(m_fp, nx, ny, nz)){
-            std::fsetpos(m_fp, &pos);
-            return err;
-        }
+    }
 
-        xDim += nx;
+    //A single pass over the subgrid headers, recording them in the index
+    if(int err = m_subgridIndex.build(m_fp, m_numSubgrids)){
+        return err;
+    }
 
-        if(m_q == 0){
-            m_p++;
-        }
+    m_p = m_subgridIndex.getP();
+    m_q = m_subgridIndex.getQ();
+    m_r = m_subgridIndex.getR();
+    return 0;
+}
 
-        if(xDim == m_nx){
-            yDim += ny;     //Only increase y count once per row
-            m_q++;
-            xDim = 0;
-        }
+int PFData::loadSubgridIndex(){
+    if(m_fp == nullptr){
+        return 1;
+    }
+    if(m_compressed){
+        return 0;
+    }
 
-        if(yDim == m_ny){
-            m_r++;
-            yDim = 0;
-        }
+    if(m_subgridIndex.load(m_filename + ".pfidx", m_fp, m_numSubgrids, getFileModificationTime(m_filename)) &&
+       m_subgridIndex.loadDist(m_filename + ".dist", m_fp, m_nz, m_ny, m_nx, m_numSubgrids)){
+        //Neither sidecar is usable, read the headers
+        return loadPQR();
+    }
 
-        if(i != m_numSubgrids-1){//Avoid skipping past end of file
-            //Skip the last 3 ints of the subgrid header, the data, and the first 3 ints of the next subgrid header
-            std::fseek(m_fp, 12+8*nx*ny*nz+12, SEEK_CUR);
-        }
+    m_p = m_subgridIndex.getP();
+    m_q = m_subgridIndex.getQ();
+    m_r = m_subgridIndex.getR();
+    return 0;
+}
 
+int PFData::saveSubgridIndex() const{
+    if(m_fp == nullptr || m_subgridIndex.empty()){
+        return 1;
     }
 
-    //Restore old position
-    std::fsetpos(m_fp, &pos);
-    return 0;
+    return m_subgridIndex.save(m_filename + ".pfidx", m_fp, getFileModificationTime(m_filename));
+}
+
+const SubgridIndex& PFData::getSubgridIndex() const{
+    return m_subgridIndex;
 }
 
+//Returns true if the index describes the current topology, it is stale after setP/setQ/setR
+static bool indexMatches(const SubgridIndex& index, int p, int q, int r){
+    return !index.empty() && index.getP() == p && index.getQ() == q && index.getR() == r;
+}
 
 long PFData::getSubgridOffset(int gridZ, int gridY, int gridX) const{
+    if(indexMatches(m_subgridIndex, m_p, m_q, m_r)){
+        return m_subgridIndex.at(gridZ, gridY, gridX).offset;
+    }
+
     //Number of elements
     long offset = getSubgridOffsetElements(gridZ, gridY, gridX);
 
@@ -186,6 +340,12 @@ long PFData::getSubgridOffset(int gridZ, int gridY, int gridX) const{
 }
 
 long PFData::getSubgridOffsetElements(int gridZ, int gridY, int gridX) const{
+    if(indexMatches(m_subgridIndex, m_p, m_q, m_r)){
+        //Remove the file header and the headers of all preceding subgrids
+        const long numHeaders = (static_cast<long>(gridZ) * m_q + gridY) * m_p + gridX;
+        return (m_subgridIndex.at(gridZ, gridY, gridX).offset - 64 - 36 * numHeaders) / 8;
+    }
+
     //NOTE: recall that remainder blocks come first, followed by normal blocks.
     //Grid dimensions of targeted block
     const long currBlockSizeZ = getSubgridSizeZ(gridZ);   //Size of the targeted Z block
@@ -239,76 +399,154 @@ long PFData::getPointOffset(int z, int y, int x) const{
     return subgridOffset + pointOffset;
 }
 
-int PFData::fileReadSubgridAtGridIndexInternal(double* buffer, std::FILE* fp, int gridZ, int gridY, int gridX) const{
+int PFData::mapFile(){
+    unmapFile();
+
+    std::size_t size = 0;
+    const unsigned char* map = mapFileReadOnly(m_filename, size);
+    if(map == nullptr){
+        std::string err{"Error mapping file: \"" + m_filename + "\""};
+        perror(err.c_str());
+        return errno ? errno : 1;
+    }
+
+    m_map = map;
+    m_mapSize = size;
+    return 0;
+}
+
+void PFData::unmapFile(){
+    if(m_map){
+        ::unmapFile(m_map, m_mapSize);
+        m_map = nullptr;
+        m_mapSize = 0;
+    }
+}
+
+bool PFData::isMapped() const{
+    return m_map != nullptr;
+}
+
+PFSubgridView PFData::getMappedSubgrid(int gridZ, int gridY, int gridX) const{
+    PFSubgridView view;
+    if(!m_map || m_compressed || gridZ < 0 || gridZ >= m_r || gridY < 0 || gridY >= m_q || gridX < 0 || gridX >= m_p){
+        return view;
+    }
+
+    view.nz = getSubgridSizeZ(gridZ);
+    view.ny = getSubgridSizeY(gridY);
+    view.nx = getSubgridSizeX(gridX);
+    view.startZ = getSubgridStartZ(gridZ);
+    view.startY = getSubgridStartY(gridY);
+    view.startX = getSubgridStartX(gridX);
+
+    const long long offset = getSubgridOffset(gridZ, gridY, gridX) + 36; //Skip header
+    const long long count = static_cast<long long>(view.nz) * view.ny * view.nx;
+    if(offset + 8 * count > static_cast<long long>(m_mapSize)){
+        return PFSubgridView{};
+    }
+
+    view.data = m_map + offset;
+    return view;
+}
+
+int PFData::fileReadSubgridAtGridIndexInternal(double* buffer, int gridZ, int gridY, int gridX) const{
+    if(m_compressed){
+        return readCompressedSubgrid(buffer, gridZ, gridY, gridX);
+    }
+
     const long long offset = getSubgridOffset(gridZ, gridY, gridX) + 36; //Skip header
-    std::fseek(fp, offset, SEEK_SET);
 
     static_assert(sizeof(double) == 8, "Double must be 8 bytes");
 
     //Number of elements to read
-    const long long count = getSubgridSizeX(gridZ) * getSubgridSizeY(gridY) * getSubgridSizeZ(gridX);
+    const long long count = static_cast<long long>(getSubgridSizeZ(gridZ)) * getSubgridSizeY(gridY) * getSubgridSizeX(gridX);
 
-    std::size_t numRead = std::fread(buffer, 8, count, fp);
-    if(numRead != static_cast<std::size_t>(count)){
-        return errno;
+    if(m_map){
+        if(offset + 8 * count > static_cast<long long>(m_mapSize)){
+            return EINVAL;
+        }
+        copyMappedDoubles(buffer, m_map + offset, count);
+        return 0;
     }
 
-    //Perform endian conversion
-    for(std::size_t i = 0; i < count; ++i){
-        uint64_t tmp = *reinterpret_cast<uint64_t*>(&buffer[i]);
-        tmp = bswap64(tmp);
-        buffer[i] = *reinterpret_cast<double*>(&tmp);
+    if(int err = readRaw(buffer, 8 * count, offset)){
+        return err;
     }
 
+    //Perform endian conversion
+    bswap64_array_inplace(reinterpret_cast<uint64_t*>(buffer), count);
+
     return 0;
 }
 
-double PFData::fileReadPoint(int z, int y, int x){
-    std::fpos_t pos{};
-    //Save old position
-    std::fgetpos(m_fp, &pos);
+double PFData::fileReadPoint(int z, int y, int x) const{
+    //Chunks can only be decompressed whole, keep them in the subgrid cache
+    if(m_compressed){
+        return get(z, y, x);
+    }
 
     const long offset = getPointOffset(z, y, x);
-    if(std::fseek(m_fp, offset, SEEK_SET)){
-        std::perror("Error seeking to file");
+
+    uint64_t raw = 0;
+    if(int err = readRaw(&raw, 8, offset)){
+        std::cerr << "Error reading point (ZYX): {" << z << ", " << y << ", " << x << "}, error code " << err << ": " << std::strerror(err) << "\n";
+        return 0;
+    }
+
+    raw = bswap64(raw);
+    double data;
+    std::memcpy(&data, &raw, 8);
+    return data;
+}
+
+std::vector<double> PFData::fileReadPoints(const std::vector<std::array<int, 3>>& points) const{
+    std::vector<long long> offsets(points.size());
+    for(std::size_t i = 0; i < points.size(); ++i){
+        const std::array<int, 3>& p = points[i];
+        if(p[0] < 0 || p[0] >= m_nz || p[1] < 0 || p[1] >= m_ny || p[2] < 0 || p[2] >= m_nx){
+            std::cerr << "Error reading point (ZYX): {" << p[0] << ", " << p[1] << ", " << p[2] << "}, outside of the grid\n";
+            return std::vector<double>();
+        }
+        offsets[i] = getPointOffset(p[0], p[1], p[2]);
     }
 
-    double data = 0;
-    int err = 0;
-    READDOUBLE(data, m_fp, err);
-    if(1 != err){
-        std::perror("Error reading double");
+    std::vector<double> result(points.size());
+    if(m_compressed){
+        for(std::size_t i = 0; i < points.size(); ++i){
+            result[i] = get(points[i][0], points[i][1], points[i][2]);
+        }
+        return result;
     }
 
-    //Restore old position
-    std::fsetpos(m_fp, &pos);
+    std::vector<uint64_t> scratch;
+    const PointReadPlan plan(offsets);
+    const int err = plan.execute([this](void* dst, std::size_t count, long long offset){
+        return readRaw(dst, count, offset);
+    }, result.data(), scratch);
+    if(err){
+        std::cerr << "Error reading points, error code " << err << ": " << std::strerror(err) << "\n";
+        return std::vector<double>();
+    }
 
-    return data;
+    return result;
 }
 
-std::vector<double> PFData::fileReadSubgridAtPointIndex(int z, int y, int x){
-    const int gridZ = getSubgridIndexX(z);
-    const int gridY = getSubgridIndexX(y);
+std::vector<double> PFData::fileReadSubgridAtPointIndex(int z, int y, int x) const{
+    const int gridZ = getSubgridIndexZ(z);
+    const int gridY = getSubgridIndexY(y);
     const int gridX = getSubgridIndexX(x);
 
     return fileReadSubgridAtGridIndex(gridZ, gridY, gridX);
 }
 
-std::vector<double> PFData::fileReadSubgridAtGridIndex(int gridZ, int gridY, int gridX){
+std::vector<double> PFData::fileReadSubgridAtGridIndex(int gridZ, int gridY, int gridX) const{
     const long count = getSubgridSizeZ(gridZ) * getSubgridSizeY(gridY) * getSubgridSizeX(gridX);
 
     //Fill with empty data
     std::vector<double> result(count);
 
-    std::fpos_t pos{};
-    //Save old position
-    std::fgetpos(m_fp, &pos);
-
-    int ret = fileReadSubgridAtGridIndexInternal(result.data(), m_fp, gridZ, gridY, gridX);
-
-    //Restore old position
-    std::fsetpos(m_fp, &pos);
-
+    const int ret = fileReadSubgridAtGridIndexInternal(result.data(), gridZ, gridY, gridX);
     if(ret){
         std::cerr << "Error while reading subgrid at subgrid index(ZYX): {" << gridZ << ", " << gridY << ", " << gridX << "}, error code " << ret << ": " << std::strerror(ret) << "\n";
         result.clear();
@@ -317,6 +555,67 @@ std::vector<double> PFData::fileReadSubgridAtGridIndex(int gridZ, int gridY, int
     return result;
 }
 
+bool PFData::hasTopology() const{
+    return m_numSubgrids > 0 && m_p * m_q * m_r == m_numSubgrids && m_p <= m_nx && m_q <= m_ny && m_r <= m_nz;
+}
+
+int PFData::forEachSubgrid(const SubgridVisitor& visitor, int numThreads) const{
+    const bool inMemory = m_data != nullptr || m_floatData != nullptr;
+    const bool topology = hasTopology();
+    if(!inMemory && (!topology || (m_fd < 0 && m_map == nullptr))){
+        std::cerr << "forEachSubgrid: no data is loaded, and the file is not open with a known topology (loadHeader() and loadPQR())\n";
+        return EINVAL;
+    }
+
+    const int numSubgrids = topology ? m_numSubgrids : 1;
+    numThreads = std::max(1, std::min(numThreads, numSubgrids));
+    std::vector<std::vector<double>> buffers(numThreads);
+
+    return PFThreadPool::shared().parallelFor(numSubgrids, numThreads, [&](int subgrid, int worker) -> int{
+        PFSubgridExtent extent;
+        extent.index = subgrid;
+        if(topology){
+            const std::array<int, 3> grid = unflattenGridIndex(subgrid);
+            extent.gridZ = grid[0];
+            extent.gridY = grid[1];
+            extent.gridX = grid[2];
+            extent.startZ = getSubgridStartZ(grid[0]);
+            extent.startY = getSubgridStartY(grid[1]);
+            extent.startX = getSubgridStartX(grid[2]);
+            extent.nz = getSubgridSizeZ(grid[0]);
+            extent.ny = getSubgridSizeY(grid[1]);
+            extent.nx = getSubgridSizeX(grid[2]);
+        }else{
+            extent.nz = m_nz;
+            extent.ny = m_ny;
+            extent.nx = m_nx;
+        }
+
+        std::vector<double>& buffer = buffers[worker];
+        buffer.resize(static_cast<std::size_t>(extent.nz) * extent.ny * extent.nx);
+
+        if(inMemory){
+            double* dst = buffer.data();
+            for(int z = extent.startZ; z < extent.startZ + extent.nz; ++z){
+                for(int y = extent.startY; y < extent.startY + extent.ny; ++y){
+                    const std::size_t index = (static_cast<std::size_t>(z) * m_ny + y) * m_nx + extent.startX;
+                    if(m_data){
+                        std::memcpy(dst, m_data + index, sizeof(double) * extent.nx);
+                    }else{
+                        std::copy(m_floatData + index, m_floatData + index + extent.nx, dst);
+                    }
+                    dst += extent.nx;
+                }
+            }
+        }else if(int err = fileReadSubgridAtGridIndexInternal(buffer.data(), extent.gridZ, extent.gridY, extent.gridX)){
+            std::cerr << "forEachSubgrid: error reading subgrid " << subgrid << ", error code " << err << ": " << std::strerror(err) << "\n";
+            return err;
+        }
+
+        return visitor(extent, buffer.data(), worker);
+    });
+}
+
 int PFData::getSubgridIndexZ(int idx) const{
     const int start = getNormalBlockStartZ();
     const int size = getNormalBlockSizeZ();
@@ -375,7 +674,7 @@ int PFData::getSubgridSizeX(int gridIdx) const{
 
 int PFData::getSubgridStartZ(int gridIdx) const{
     const int size = getNormalBlockSizeZ();
-    const int start = m_nx % m_r;
+    const int start = m_nz % m_r;
 
     //Remainder blocks
     int offset = (size+1) * std::min(gridIdx, start);
@@ -424,7 +723,7 @@ int PFData::getNormalBlockSizeZ() const{
 }
 
 int PFData::getNormalBlockSizeY() const{
-    return m_ny/m_p;
+    return m_ny/m_q;
 }
 
 int PFData::getNormalBlockSizeX() const{
@@ -542,8 +841,74 @@ double* PFData::getSubgridData(int grid) {
     return nullptr;
 }
 
-double PFData::operator()(int z, int y, int x) {
-    return m_data[static_cast<long long>(z)*m_ny*m_nx+y*m_nx+x];
+double PFData::operator()(int z, int y, int x) const{
+    return get(z, y, x);
+}
+
+double PFData::get(int z, int y, int x) const{
+    const long long index = static_cast<long long>(z)*m_ny*m_nx+static_cast<long long>(y)*m_nx+x;
+    if(m_data){
+        return m_data[index];
+    }
+    if(m_floatData){
+        return m_floatData[index];
+    }
+
+    const int gridZ = getSubgridIndexZ(z);
+    const int gridY = getSubgridIndexY(y);
+    const int gridX = getSubgridIndexX(x);
+    const int subgrid = (gridZ * m_q + gridY) * m_p + gridX;
+
+    const int localZ = z - getSubgridStartZ(gridZ);
+    const int localY = y - getSubgridStartY(gridY);
+    const int localX = x - getSubgridStartX(gridX);
+    const std::size_t local = (static_cast<std::size_t>(localZ) * getSubgridSizeY(gridY) + localY) * getSubgridSizeX(gridX) + localX;
+
+    {
+        std::lock_guard<std::mutex> lock(m_subgridCacheMutex);
+        if(const std::vector<double>* values = m_subgridCache.find(subgrid)){
+            return (*values)[local];
+        }
+    }
+
+    //Page the subgrid in without holding the lock, so other threads can keep hitting the cache
+    if(m_fd < 0 && m_map == nullptr){
+        std::cerr << "Error reading point (ZYX): {" << z << ", " << y << ", " << x << "}, no data is loaded and the file is not open\n";
+        return 0;
+    }
+    std::vector<double> subgridValues = fileReadSubgridAtGridIndex(gridZ, gridY, gridX);
+    if(subgridValues.empty()){
+        return 0;
+    }
+    const double value = subgridValues[local];
+
+    //Another thread may have inserted the same subgrid meanwhile, insert() then just replaces it
+    std::lock_guard<std::mutex> lock(m_subgridCacheMutex);
+    m_subgridCache.insert(subgrid, std::move(subgridValues));
+    return value;
+}
+
+void PFData::setSubgridCacheBudget(std::size_t bytes){
+    std::lock_guard<std::mutex> lock(m_subgridCacheMutex);
+    m_subgridCache.setBudget(bytes);
+}
+
+void PFData::setPrefetchDepth(int depth){
+    m_prefetchDepth = std::max(1, depth);
+}
+
+int PFData::getPrefetchDepth() const{
+    return m_prefetchDepth;
+}
+
+std::size_t PFData::getSubgridCacheBudget() const{
+    std::lock_guard<std::mutex> lock(m_subgridCacheMutex);
+    return m_subgridCache.getBudget();
+}
+
+std::size_t PFData::getSubgridCacheSize() const{
+    std::lock_guard<std::mutex> lock(m_subgridCacheMutex);
+    return m_subgridCache.getSize();
 }
 
 std::string PFData::getIndexOrder() const {
@@ -575,76 +940,148 @@ const double* PFData::getData() const{
     return m_data;
 }
 
+void PFData::setLoadAsFloat(bool loadAsFloat){
+    m_loadAsFloat = loadAsFloat;
+}
+
+bool PFData::getLoadAsFloat() const{
+    return m_loadAsFloat;
+}
+
+float* PFData::getFloatData(){
+    return m_floatData;
+}
+
+const float* PFData::getFloatData() const{
+    return m_floatData;
+}
+
+float* PFData::releaseFloatData(){
+    float* data = m_floatData;
+    m_floatData = nullptr;
+    return data;
+}
+
+int PFData::allocateLoadBuffer(std::size_t count){
+    //Hand the previous arrays back first, so a reload of the same size reuses them when pooling is enabled
+    releaseData();
+
+    if(m_loadAsFloat){
+        m_floatData = static_cast<float*>(PFBufferPool::shared().allocate(sizeof(float) * count));
+        return m_floatData == nullptr ? 2 : 0;
+    }
+
+    m_data = static_cast<double*>(PFBufferPool::shared().allocate(sizeof(double) * count));
+    m_dataOwner = m_data != nullptr;
+    return m_data == nullptr ? 2 : 0;
+}
+
+void PFData::storePencil(const uint64_t* src, long long index, int count){
+    if(m_loadAsFloat){
+        bswap64_to_float_array(src, &m_floatData[index], count);
+    }else{
+        bswap64_array(src, reinterpret_cast<uint64_t*>(&m_data[index]), count);
+    }
+}
+
 int PFData::loadData() {
-    int nsg;
-    //subgrid variables
-    int x,y,z,nx,ny,nz,rx,ry,rz;
-    if(m_fp  == nullptr){
-        return 1;
+    const bool nativeCache = m_nativeCache && !m_loadAsFloat;
+    if(nativeCache && loadNativeCache() == 0){
+        return 0;
     }
 
-    if(m_data && m_dataOwner){
-        //std::free(m_data);
+    const int err = m_compressed ? loadCompressedData(1) : m_map ? loadDataFromMap() : loadDataFromFile();
+    if(err == 0 && nativeCache){
+        //Only a cache, the data is loaded either way
+        saveNativeCache();
     }
+    return err;
+}
 
-    m_data = (double*)std::malloc(sizeof(double)*m_nx*m_ny*m_nz);
-    m_dataOwner = true;
+int PFData::loadDataFromFile() {
 
-    if(m_data == nullptr){
-        return 2;
+    if(m_fp == nullptr || m_fd < 0){
+        return 1;
     }
 
-    for (nsg = 0;nsg<m_numSubgrids; nsg++){
-        // read subgrid header
-        int errcheck;
-        READINT(x,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(y,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(z,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(nx,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(ny,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(nz,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(rx,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(ry,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(rz,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-
-        // \/ \/ Not how this works, replaced with loadPQR();
-        //if(nsg == m_numSubgrids-1){
-        //    m_p = m_nx/nx;
-        //    m_q = m_ny/ny;
-        //    m_r = m_nz/nz;
-        //}
+    if(int err = allocateLoadBuffer(static_cast<std::size_t>(m_nx)*m_ny*m_nz)){
+        return err;
+    }
+
+    //The next blocks of the file are read while the current one is converted into the data array
+    PrefetchReader reader(m_fd, 64, getFileSize(m_fd), LOAD_BLOCK_BYTES, m_prefetchDepth);
+
+    for(int nsg = 0; nsg < m_numSubgrids; nsg++){
+        // read subgrid header, rx, ry, rz are unused
+        uint32_t header[9];
+        if(int err = reader.read(header, sizeof(header))){
+            std::cerr << "Error Reading Subgrid Header, error code " << err << ": " << std::strerror(err) << "\n";
+            return 1;
+        }
+        const int x  = static_cast<int>(bswap32(header[0]));
+        const int y  = static_cast<int>(bswap32(header[1]));
+        const int z  = static_cast<int>(bswap32(header[2]));
+        const int nx = static_cast<int>(bswap32(header[3]));
+        const int ny = static_cast<int>(bswap32(header[4]));
+        const int nz = static_cast<int>(bswap32(header[5]));
 
         // read values for subgrid
         // qq is the location of the subgrid
-        long long qq = z*m_nx*m_ny + y*m_nx + x;
-        long long k,i,j;
-        //int index = qq;//+k*nx*ny+i*nx;
-        for (k=0; k<nz; k++){
-            for(i=0;i<ny;i++){
-                // read full "pencil"
-                long long index = qq+k*m_nx*m_ny+i*m_nx;
-                uint64_t* buf = (uint64_t*)&(m_data[index]);
-                int read_count = fread(buf,8,nx,m_fp);
-                if(read_count != nx){
-                    perror("Error Reading Data, File Ended Unexpectedly");
+        const long long qq = static_cast<long long>(z)*m_nx*m_ny + static_cast<long long>(y)*m_nx + x;
+        for(int k = 0; k < nz; k++){
+            for(int i = 0; i < ny; i++){
+                // read full "pencil", converting the byte order on the way out of the read buffer
+                const long long index = qq + static_cast<long long>(k)*m_nx*m_ny + static_cast<long long>(i)*m_nx;
+                const int err = m_loadAsFloat ? reader.readSwapped(&m_floatData[index], nx)
+                                              : reader.readSwapped(reinterpret_cast<uint64_t*>(&m_data[index]), nx);
+                if(err){
+                    std::cerr << "Error Reading Data, File Ended Unexpectedly, error code " << err << ": " << std::strerror(err) << "\n";
                     return 1;
                 }
-                // handle byte order
-                //uint64_t* buf = (uint64_t*)&(m_data[index]);
-                for(j=0;j<nx;j++){
-                    uint64_t tmp = buf[j];
-                    tmp = bswap64(tmp);
-                    m_data[index+j] = *(double*)(&tmp);
+            }
+        }
+    }
+    return 0;
+}
+
+int PFData::loadDataFromMap() {
+    if(int err = allocateLoadBuffer(static_cast<std::size_t>(m_nx)*m_ny*m_nz)){
+        return err;
+    }
+
+    //Skip the file header
+    std::size_t pos = 64;
+    for(int nsg = 0; nsg < m_numSubgrids; nsg++){
+        // read subgrid header
+        if(pos + 36 > m_mapSize){
+            std::cerr << "Error Reading Subgrid Header, File Ended Unexpectedly\n";
+            return 1;
+        }
+        const int x  = readMappedInt(m_map + pos);
+        const int y  = readMappedInt(m_map + pos + 4);
+        const int z  = readMappedInt(m_map + pos + 8);
+        const int nx = readMappedInt(m_map + pos + 12);
+        const int ny = readMappedInt(m_map + pos + 16);
+        const int nz = readMappedInt(m_map + pos + 20);
+        pos += 36;  //rx, ry, rz are unused
+
+        if(pos + 8ull * nx * ny * nz > m_mapSize){
+            std::cerr << "Error Reading Data, File Ended Unexpectedly\n";
+            return 1;
+        }
+
+        // qq is the location of the subgrid
+        const long long qq = static_cast<long long>(z)*m_nx*m_ny + static_cast<long long>(y)*m_nx + x;
+        for(int k = 0; k < nz; k++){
+            for(int i = 0; i < ny; i++){
+                // copy full "pencil"
+                const long long index = qq + static_cast<long long>(k)*m_nx*m_ny + static_cast<long long>(i)*m_nx;
+                if(m_loadAsFloat){
+                    storePencil(reinterpret_cast<const uint64_t*>(m_map + pos), index, nx);
+                }else{
+                    copyMappedDoubles(&m_data[index], m_map + pos, nx);
                 }
+                pos += 8 * static_cast<std::size_t>(nx);
             }
         }
     }
@@ -655,136 +1092,248 @@ int PFData::loadData() {
  * This function makes the assumption that the clipping is only in 2D and all z
  * values will be contained
 **/
-int PFData::loadClipOfData(int clip_x, int clip_y, int extent_x, int extent_y) {
-
-    int nsg;
-    //subgrid variables
-    int x,y,z,nx,ny,nz,rx,ry,rz;
+int PFData::loadClipOfData(int clip_x, int clip_y, int extent_x, int extent_y, int numThreads) {
     if(m_fp  == nullptr){
         return 1;
     }
 
-    if(m_data && m_dataOwner){
-        std::free(m_data);
+    //The hyperslab reader needs the subgrid layout
+    if(!indexMatches(m_subgridIndex, m_p, m_q, m_r)){
+        if(int err = loadSubgridIndex()){
+            return err;
+        }
     }
 
     // allocating based on size of slice.
-    m_data = (double*)std::malloc(sizeof(double)*extent_x*extent_y*m_nz);
-    m_dataOwner = true;
-
-    if(m_data == nullptr){
-        return 2;
+    if(int err = allocateLoadBuffer(static_cast<std::size_t>(extent_x)*extent_y*m_nz)){
+        return err;
     }
 
-    // this is more space than needed -- but doing it here allows us to 
-    // allocate and free only one space
-    uint64_t* buf =(uint64_t*) malloc(sizeof(uint64_t)*m_nx);
-    if(buf == nullptr){
-        return 3;
-    }
-
-    // read the data one subgrid at a time.
-    for (nsg = 0;nsg<m_numSubgrids; nsg++){
-        // read subgrid header
-        int errcheck;
-        READINT(x,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(y,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(z,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(nx,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(ny,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(nz,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(rx,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(ry,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-        READINT(rz,m_fp,errcheck);
-        if(!errcheck){perror("Error Reading Subgrid Header"); return 1;}
-
-        // is this subgrid part of our clip?
-        int x_overlap = fminl(clip_x+extent_x, x+nx) - fmaxl(clip_x,x); 
-        int y_overlap = fminl(clip_y+extent_y, y+ny) - fmaxl(clip_y,y); 
-        if(x_overlap > 0 && y_overlap >0){
-          // some of the data is in here -- will read the whole subgrid, but
-          // only save the overlap part. There is room to optimize this later.
-          
-          // read values for subgrid
-          // z will always be 0
-          long long k,i,j;
-          // iterate over the y and z portions of the subgrid
-          for (k=0; k<nz; k++){
-              for(i=0;i<ny;i++){
-                  // Determine the indices of the first element of the pencil in the
-                  // global space
-                  int gx = x;
-                  int gy = y + i;
-                  int gz = z + k;
-                  // determine the clip coordinates
-                  int cx = gx - clip_x;
-                  int cy = gy - clip_y;
-                  int cz = gz;
- 
-                  // check to see if this pencil will be in our y-range - seek if not
-                  // this only looks at the specific y point not a range of them
-                  if(gy>=clip_y && gy<clip_y+extent_y){
-                    // read full "pencil"
-                    int read_count = fread(buf,8,nx,m_fp);
-                    if(read_count != nx){
-                        perror("Error Reading Data, File Ended Unexpectedly");
-                        return 1;
-                    }
-
-                    // iterate over every value read
-                    // the j value is in the subgrid space
-                    for(j=0;j<nx;j++){
-                      // if this specific y,x coordinate is within the clip
-                      // convert it and save it in the right position
-                      if((gx+j) >= clip_x && (gx+j) < clip_x+extent_x){
-                        // these should be valid clip coordinates
-                        int cxi = cx+j;
-                        int index = cz*(extent_y*extent_x) + cy*extent_x + cxi;
-                        uint64_t tmp = buf[j];
-                        tmp = bswap64(tmp);
-                        m_data[index] = *(double*)(&tmp);
-                      } 
-                    }
-                  }else{
-                    // this y point is not of interest - so
-                    // seek a single pencil
-                    std::fseek(m_fp, 8*nx, SEEK_CUR);
-                  }
-              }
-          }
-        }else{
-          // this entire subgrid does not fit into our clip, so
-          // scan to the next subgrid
-           std::fseek(m_fp, 8*nx*ny*nz, SEEK_CUR);
-        }
+    const int err = m_loadAsFloat ? readHyperslab(m_floatData, 0, clip_y, clip_x, m_nz, extent_y, extent_x, 1, 1, 1, numThreads)
+                                  : readHyperslab(m_data, 0, clip_y, clip_x, m_nz, extent_y, extent_x, 1, 1, 1, numThreads);
+    if(err){
+        return err;
     }
-    free(buf);
 
     setX(clip_x);
     setY(clip_y);
     setNX(extent_x);
     setNY(extent_y);
     m_numSubgrids = 1;
+    m_p = 1;
+    m_q = 1;
+    m_r = 1;
 
     close();
     return 0;
 }
 
+int PFData::readRaw(void* dst, std::size_t count, long long offset) const{
+    if(m_map){
+        if(offset < 0 || offset + static_cast<long long>(count) > static_cast<long long>(m_mapSize)){
+            return EINVAL;
+        }
+        std::memcpy(dst, m_map + offset, count);
+        return 0;
+    }
+
+    if(m_fd < 0){
+        return EBADF;
+    }
 
-int PFData::emplaceSubgridFromFile(std::FILE* fp, int gridZ, int gridY, int gridX){
-    //Position file
-    const long offset = getSubgridOffset(gridZ, gridY, gridX) + 36;
-    std::fseek(fp, offset, SEEK_SET);
+    return readFileAt(m_fd, dst, count, offset);
+}
 
-    const int sizeZ = getSubgridSizeZ(gridZ);
+//Converts big endian doubles to the element type of a hyperslab
+static inline void convertBigEndian(const uint64_t* src, double* dst, std::size_t n){
+    bswap64_array(src, reinterpret_cast<uint64_t*>(dst), n);
+}
+
+static inline void convertBigEndian(const uint64_t* src, float* dst, std::size_t n){
+    bswap64_to_float_array(src, dst, n);
+}
+
+int PFData::readHyperslab(double* buffer, int z0, int y0, int x0, int nz, int ny, int nx, int strideZ, int strideY, int strideX, int numThreads) const{
+    return readHyperslabInto(buffer, z0, y0, x0, nz, ny, nx, strideZ, strideY, strideX, numThreads);
+}
+
+int PFData::readHyperslab(float* buffer, int z0, int y0, int x0, int nz, int ny, int nx, int strideZ, int strideY, int strideX, int numThreads) const{
+    return readHyperslabInto(buffer, z0, y0, x0, nz, ny, nx, strideZ, strideY, strideX, numThreads);
+}
+
+template<typename T>
+int PFData::readHyperslabInto(T* buffer, int z0, int y0, int x0, int nz, int ny, int nx, int strideZ, int strideY, int strideX, int numThreads) const{
+    if(nz < 1 || ny < 1 || nx < 1 || strideZ < 1 || strideY < 1 || strideX < 1 || z0 < 0 || y0 < 0 || x0 < 0){
+        return EINVAL;
+    }
+
+    //Last selected point in each direction
+    const long long zLast = z0 + static_cast<long long>(nz - 1) * strideZ;
+    const long long yLast = y0 + static_cast<long long>(ny - 1) * strideY;
+    const long long xLast = x0 + static_cast<long long>(nx - 1) * strideX;
+    if(zLast >= m_nz || yLast >= m_ny || xLast >= m_nx){
+        return EINVAL;
+    }
+
+    //Range [first, last] of selected points that fall inside [start, start+size), returns false if there are none
+    auto selectedRange = [](int begin, int stride, int count, int start, int size, int& first, int& last){
+        first = start <= begin ? 0 : (start - begin + stride - 1) / stride;
+        last = std::min(count - 1, (start + size - 1 - begin) / stride);
+        return start + size > begin && first <= last;
+    };
+
+    //Strided X points are read as one run if they are this close, otherwise one at a time
+    const int maxRunStride = 512;
+
+    //The part of the hyperslab inside one subgrid, with the range of selected points in each direction
+    struct Piece {
+        int gridZ, gridY, gridX;
+        int kz0, kz1, ky0, ky1, kx0, kx1;
+    };
+    std::vector<Piece> pieces;
+    for(int gridZ = getSubgridIndexZ(z0); gridZ <= getSubgridIndexZ(static_cast<int>(zLast)); ++gridZ){
+        int kz0, kz1;
+        if(!selectedRange(z0, strideZ, nz, getSubgridStartZ(gridZ), getSubgridSizeZ(gridZ), kz0, kz1)) continue;
+
+        for(int gridY = getSubgridIndexY(y0); gridY <= getSubgridIndexY(static_cast<int>(yLast)); ++gridY){
+            int ky0, ky1;
+            if(!selectedRange(y0, strideY, ny, getSubgridStartY(gridY), getSubgridSizeY(gridY), ky0, ky1)) continue;
+
+            for(int gridX = getSubgridIndexX(x0); gridX <= getSubgridIndexX(static_cast<int>(xLast)); ++gridX){
+                int kx0, kx1;
+                if(!selectedRange(x0, strideX, nx, getSubgridStartX(gridX), getSubgridSizeX(gridX), kx0, kx1)) continue;
+                pieces.push_back(Piece{gridZ, gridY, gridX, kz0, kz1, ky0, ky1, kx0, kx1});
+            }
+        }
+    }
+
+    //Pieces fill disjoint parts of the buffer, so they can be read in any order
+    numThreads = std::max(1, std::min(numThreads, static_cast<int>(pieces.size())));
+    std::vector<std::vector<uint64_t>> scratchOf(numThreads);
+    std::vector<std::vector<double>> decodedOf(numThreads);
+    return PFThreadPool::shared().parallelFor(static_cast<int>(pieces.size()), numThreads, [&](int job, int worker) -> int{
+        const int gridZ = pieces[job].gridZ, gridY = pieces[job].gridY, gridX = pieces[job].gridX;
+        const int kz0 = pieces[job].kz0, kz1 = pieces[job].kz1;
+        const int ky0 = pieces[job].ky0, ky1 = pieces[job].ky1;
+        const int kx0 = pieces[job].kx0, kx1 = pieces[job].kx1;
+        std::vector<uint64_t>& scratch = scratchOf[worker];
+        std::vector<double>& decoded = decodedOf[worker];
+
+        const int sizeY = getSubgridSizeY(gridY);
+        const int sizeX = getSubgridSizeX(gridX);
+
+        //Chunks of compressed files can only be decompressed whole
+        if(m_compressed){
+            decoded.resize(static_cast<std::size_t>(getSubgridSizeZ(gridZ)) * sizeY * sizeX);
+            if(int err = readCompressedSubgrid(decoded.data(), gridZ, gridY, gridX)){
+                return err;
+            }
+            for(int kz = kz0; kz <= kz1; ++kz){
+                const long long lz = z0 + static_cast<long long>(kz) * strideZ - getSubgridStartZ(gridZ);
+                for(int ky = ky0; ky <= ky1; ++ky){
+                    const long long ly = y0 + static_cast<long long>(ky) * strideY - getSubgridStartY(gridY);
+                    const long long row = (lz * sizeY + ly) * sizeX + x0 - getSubgridStartX(gridX);
+                    T* dst = &buffer[(static_cast<long long>(kz) * ny + ky) * nx];
+                    for(int kx = kx0; kx <= kx1; ++kx){
+                        dst[kx] = static_cast<T>(decoded[row + static_cast<long long>(kx) * strideX]);
+                    }
+                }
+            }
+            return 0;
+        }
+
+        const long long dataOffset = getSubgridOffset(gridZ, gridY, gridX) + 36;
+
+        //X range of each pencil to read, relative to the subgrid
+        const int xa = x0 + kx0 * strideX - getSubgridStartX(gridX);
+        const int xb = x0 + kx1 * strideX - getSubgridStartX(gridX);
+        const int countX = kx1 - kx0 + 1;
+        const bool singleRun = strideX <= maxRunStride;
+        //Whole, consecutive rows are contiguous in the file
+        const bool wholeRows = strideX == 1 && strideY == 1 && xa == 0 && xb == sizeX - 1;
+
+        for(int kz = kz0; kz <= kz1; ++kz){
+            const long long lz = z0 + static_cast<long long>(kz) * strideZ - getSubgridStartZ(gridZ);
+
+            if(wholeRows){
+                const long long ly0 = y0 + static_cast<long long>(ky0) - getSubgridStartY(gridY);
+                const std::size_t count = static_cast<std::size_t>(ky1 - ky0 + 1) * sizeX;
+                scratch.resize(count);
+                if(int err = readRaw(scratch.data(), 8 * count, dataOffset + 8 * ((lz * sizeY + ly0) * sizeX))){
+                    return err;
+                }
+                for(int ky = ky0; ky <= ky1; ++ky){
+                    T* dst = &buffer[(static_cast<long long>(kz) * ny + ky) * nx + kx0];
+                    convertBigEndian(&scratch[static_cast<std::size_t>(ky - ky0) * sizeX], dst, countX);
+                }
+                continue;
+            }
+
+            for(int ky = ky0; ky <= ky1; ++ky){
+                const long long ly = y0 + static_cast<long long>(ky) * strideY - getSubgridStartY(gridY);
+                const long long pencilOffset = dataOffset + 8 * ((lz * sizeY + ly) * sizeX);
+                T* dst = &buffer[(static_cast<long long>(kz) * ny + ky) * nx + kx0];
+
+                if(singleRun){
+                    const std::size_t count = xb - xa + 1;
+                    scratch.resize(count);
+                    if(int err = readRaw(scratch.data(), 8 * count, pencilOffset + 8LL * xa)){
+                        return err;
+                    }
+                    if(strideX == 1){
+                        convertBigEndian(scratch.data(), dst, countX);
+                    }else{
+                        for(int i = 0; i < countX; ++i){
+                            convertBigEndian(&scratch[static_cast<std::size_t>(i) * strideX], &dst[i], 1);
+                        }
+                    }
+                }else{
+                    for(int i = 0; i < countX; ++i){
+                        uint64_t tmp;
+                        if(int err = readRaw(&tmp, 8, pencilOffset + 8LL * (xa + static_cast<long long>(i) * strideX))){
+                            return err;
+                        }
+                        convertBigEndian(&tmp, &dst[i], 1);
+                    }
+                }
+            }
+        }
+        return 0;
+    });
+}
+
+std::vector<double> PFData::loadHyperslab(int z0, int y0, int x0, int nz, int ny, int nx, int strideZ, int strideY, int strideX, int numThreads) const{
+    std::vector<double> result;
+    if(nz < 1 || ny < 1 || nx < 1){
+        return result;
+    }
+
+    result.resize(static_cast<std::size_t>(nz) * ny * nx);
+    if(int err = readHyperslab(result.data(), z0, y0, x0, nz, ny, nx, strideZ, strideY, strideX, numThreads)){
+        std::cerr << "Error while reading hyperslab at (ZYX): {" << z0 << ", " << y0 << ", " << x0 << "}, error code " << err << ": " << std::strerror(err) << "\n";
+        result.clear();
+    }
+
+    return result;
+}
+
+std::vector<float> PFData::loadHyperslabFloat(int z0, int y0, int x0, int nz, int ny, int nx, int strideZ, int strideY, int strideX, int numThreads) const{
+    std::vector<float> result;
+    if(nz < 1 || ny < 1 || nx < 1){
+        return result;
+    }
+
+    result.resize(static_cast<std::size_t>(nz) * ny * nx);
+    if(int err = readHyperslab(result.data(), z0, y0, x0, nz, ny, nx, strideZ, strideY, strideX, numThreads)){
+        std::cerr << "Error while reading hyperslab at (ZYX): {" << z0 << ", " << y0 << ", " << x0 << "}, error code " << err << ": " << std::strerror(err) << "\n";
+        result.clear();
+    }
+
+    return result;
+}
+
+
+int PFData::emplacePencilsFromFile(int fd, std::vector<uint64_t>& scratch, int gridZ, int gridY, int gridX, int pencilBegin, int pencilEnd){
     const int sizeY = getSubgridSizeY(gridY);
     const int sizeX = getSubgridSizeX(gridX);
 
@@ -792,26 +1341,30 @@ int PFData::emplaceSubgridFromFile(std::FILE* fp, int gridZ, int gridY, int grid
     const int startY = getSubgridStartY(gridY);
     const int startX = getSubgridStartX(gridX);
 
-    //The index into m_data where the first element of the grid belongs.
-    const long long startOfGrid = startZ*m_nx*m_ny + startY * m_nx + startX;
+    //The pencils of a subgrid are contiguous in the file, so the whole range is read at once
+    const long long offset = getSubgridOffset(gridZ, gridY, gridX) + 36 + 8LL * sizeX * pencilBegin;
+    const std::size_t count = static_cast<std::size_t>(pencilEnd - pencilBegin) * sizeX;
 
-    for(int z = 0; z < sizeZ; ++z){
-        for(int y = 0; y < sizeY; ++y){
-            const long long index = startOfGrid + z * m_nx * m_ny + y * m_nx;
-            double* const dataPtr = &(m_data[index]);
-
-            const std::size_t numRead = std::fread(dataPtr, 8, sizeX, fp);
-            if(numRead != static_cast<std::size_t>(sizeX)){
-                return errno;
-            }
-
-            //Perform endian byte swap
-            for(std::size_t i = 0; i < sizeX; ++i){
-                uint64_t tmp = *reinterpret_cast<uint64_t*>(&dataPtr[i]);
-                tmp = bswap64(tmp);
-                dataPtr[i] = *reinterpret_cast<double*>(&tmp);
-            }
+    const uint64_t* src = nullptr;
+    if(m_map){
+        if(offset + 8 * static_cast<long long>(count) > static_cast<long long>(m_mapSize)){
+            return EINVAL;
+        }
+        src = reinterpret_cast<const uint64_t*>(m_map + offset);
+    }else{
+        scratch.resize(count);
+        if(int err = readFileAt(fd, scratch.data(), 8 * count, offset)){
+            return err;
         }
+        src = scratch.data();
+    }
+
+    //Convert each pencil straight into its place in the loaded array
+    for(int pencil = pencilBegin; pencil < pencilEnd; ++pencil){
+        const long long z = startZ + pencil / sizeY;
+        const long long y = startY + pencil % sizeY;
+        storePencil(src, z * m_nx * m_ny + y * m_nx + startX, sizeX);
+        src += sizeX;
     }
 
     return 0;
@@ -823,66 +1376,76 @@ int PFData::loadDataThreaded(const int numThreads){
         return EINVAL;
     }
 
-    //Note: [begin, end)
-    auto threadFunc = [this](int subgridBegin, int subgridEnd, std::FILE* fp, int& err){
-        err = 0;
+    const bool nativeCache = m_nativeCache && !m_loadAsFloat;
+    if(nativeCache && loadNativeCache() == 0){
+        return 0;
+    }
 
-        for(int i = subgridBegin; i < subgridEnd; ++i){
-            const std::array<int, 3> idx = unflattenGridIndex(i);
-            err = emplaceSubgridFromFile(fp, idx[0], idx[1], idx[2]);
-            if(err){
-                break;
-            }
+    if(m_compressed){
+        const int err = loadCompressedData(numThreads);
+        if(err == 0 && nativeCache){
+            saveNativeCache();
         }
-    };
+        return err;
+    }
 
-    if(m_data && m_dataOwner){
-        //std::free(m_data);
+    if(int err = allocateLoadBuffer(static_cast<std::size_t>(m_nx) * m_ny * m_nz)){
+        return err;
     }
 
-    m_data = reinterpret_cast<double*>(std::malloc(sizeof(double) * m_nx * m_ny * m_nz));
-    m_dataOwner = true;
+    //Upper bound on the size of a single job, larger subgrids are split into slabs of pencils
+    const long long maxJobElements = 1LL << 19;
+    //Aim for a few jobs per thread, so that stealing can balance out uneven subgrids
+    const long long jobsPerThread = 4;
+
+    const long long totalElements = static_cast<long long>(m_nx) * m_ny * m_nz;
+    const long long targetElements = std::max(1LL, std::min(maxJobElements, totalElements / (numThreads * jobsPerThread)));
 
-    std::vector<std::thread> pool(numThreads);
-    std::vector<int> retCodes(numThreads);
-    std::vector<std::FILE*> fps(numThreads);
+    struct Slab {
+        int gridZ, gridY, gridX;
+        int pencilBegin, pencilEnd;     //[begin, end)
+    };
+    std::vector<Slab> slabs;
+    for(int i = 0; i < m_numSubgrids; ++i){
+        const std::array<int, 3> idx = unflattenGridIndex(i);
+        const int sizeX = getSubgridSizeX(idx[2]);
+        const int numPencils = getSubgridSizeZ(idx[0]) * getSubgridSizeY(idx[1]);
+        const int pencilsPerSlab = static_cast<int>(std::max(1LL, targetElements / std::max(1, sizeX)));
+
+        for(int begin = 0; begin < numPencils; begin += pencilsPerSlab){
+            slabs.push_back(Slab{idx[0], idx[1], idx[2], begin, std::min(numPencils, begin + pencilsPerSlab)});
+        }
+    }
 
-    //Open separate file pointers
-    for(int i = 0; i < numThreads; ++i){
-        fps.at(i) = std::fopen(m_filename.c_str(), "rb");
-        if(!fps.at(i)){
+    //One descriptor shared by all workers, not needed if the workers read from the mapping
+    int fd = -1;
+    if(!m_map){
+        fd = openFileReadOnly(m_filename);
+        if(fd < 0){
             std::perror("Unable to open file for reading");
             return errno;
         }
+        //Every byte is read, in roughly increasing order across the workers
+        adviseSequential(fd, 0, 0);
     }
 
-    //Base number of grids
-    const int gridsPerThread = m_numSubgrids / numThreads;
-    //Number of threads that get an extra grid
-    const int numRemainderThreads = m_numSubgrids % numThreads;
+    //Per worker read buffers
+    std::vector<std::vector<uint64_t>> scratch(numThreads);
 
-    for(int i = 0; i < numThreads; ++i){
-        const int subgridBegin = gridsPerThread * i + std::min(i, numRemainderThreads);
-        int subgridEnd = subgridBegin + gridsPerThread;
-        if(i < numRemainderThreads){     //Distribute remainder grids
-            subgridEnd++;
-        }
+    const int err = PFThreadPool::shared().parallelFor(static_cast<int>(slabs.size()), numThreads, [&](int job, int worker){
+        const Slab& slab = slabs[job];
+        return emplacePencilsFromFile(fd, scratch[worker], slab.gridZ, slab.gridY, slab.gridX, slab.pencilBegin, slab.pencilEnd);
+    });
 
-        pool.at(i) = std::thread(threadFunc, subgridBegin, subgridEnd, fps.at(i), std::ref(retCodes.at(i)));
-    }
+    closeFileDescriptor(fd);
 
-    for(int i = 0; i < numThreads; ++i){
-        pool.at(i).join();
-        std::fclose(fps.at(i));
+    if(err){
+        std::cerr << "loadDataThreaded: error code " << err << ":" << strerror(err) << "\n";
+        return err;
     }
 
-    //Separate loop to ensure we join all threads and close all fps
-    for(int i = 0; i < numThreads; ++i){
-        const int err = retCodes.at(i);
-        if(err){
-            std::cerr << "loadDataThreaded: error in thread number " << i << ", error code " << err << ":" << strerror(err) << "\n";
-            return err;
-        }
+    if(nativeCache){
+        saveNativeCache();
     }
 
     return 0;
@@ -893,6 +1456,10 @@ void PFData::close() {
         std::fclose(m_fp);
         m_fp = nullptr;
     }
+    closeFileDescriptor(m_fd);
+    m_fd = -1;
+
+    unmapFile();
 }
 
 int PFData::writeFile(const std::string filename) {
@@ -965,12 +1532,7 @@ int PFData::writeFile(const std::string filename, std::vector<long> &byte_offset
                     for(iy=calcOffset(m_ny,m_q,nsg_y); iy < calcOffset(m_ny,m_q,nsg_y+1);iy++){
 
                         uint64_t* buf = (uint64_t*)&(m_data[iz*m_nx*m_ny+iy*m_nx+calcOffset(m_nx,m_p,nsg_x)]);
-                        long long j;
-                        for(j=0;j<x_extent;j++){
-                            uint64_t tmp = buf[j];
-                            tmp = bswap64(tmp);
-                            writeBuf[j] = *(double*)(&tmp);
-                        }
+                        bswap64_array(buf, reinterpret_cast<uint64_t*>(writeBuf.data()), x_extent);
                         int written = fwrite(writeBuf.data(),sizeof(double),x_extent,fp);
                         if(written != x_extent){
                             std::fclose(fp);
@@ -990,6 +1552,163 @@ int PFData::writeFile(const std::string filename, std::vector<long> &byte_offset
     return 0;
 }
 
+void PFData::encodeFileHeader(unsigned char* dst) const{
+    storeBigEndianDouble(dst,      m_X);
+    storeBigEndianDouble(dst + 8,  m_Y);
+    storeBigEndianDouble(dst + 16, m_Z);
+    storeBigEndianInt(dst + 24, m_nx);
+    storeBigEndianInt(dst + 28, m_ny);
+    storeBigEndianInt(dst + 32, m_nz);
+    storeBigEndianDouble(dst + 36, m_dX);
+    storeBigEndianDouble(dst + 44, m_dY);
+    storeBigEndianDouble(dst + 52, m_dZ);
+    storeBigEndianInt(dst + 60, m_p * m_q * m_r);
+}
+
+void PFData::encodeSubgridHeader(unsigned char* dst, int gridZ, int gridY, int gridX) const{
+    //Same values as writeFile(), x,y,z of lower lefthand corner
+    const int x = m_X + calcOffset(m_nx, m_p, gridX);
+    const int y = m_Y + calcOffset(m_ny, m_q, gridY);
+    const int z = m_Z + calcOffset(m_nz, m_r, gridZ);
+    storeBigEndianInt(dst,      x);
+    storeBigEndianInt(dst + 4,  y);
+    storeBigEndianInt(dst + 8,  z);
+    // nx,ny,nz extents of each direction
+    storeBigEndianInt(dst + 12, calcExtent(m_nx, m_p, gridX));
+    storeBigEndianInt(dst + 16, calcExtent(m_ny, m_q, gridY));
+    storeBigEndianInt(dst + 20, calcExtent(m_nz, m_r, gridZ));
+    // subgrid  location in 3D grid
+    storeBigEndianInt(dst + 24, 1);
+    storeBigEndianInt(dst + 28, 1);
+    storeBigEndianInt(dst + 32, 1);
+}
+
+int PFData::writeFileThreaded(const std::string filename, const int numThreads){
+    return writeFileParallel(filename, numThreads, nullptr);
+}
+
+int PFData::writeFileThreaded(const std::string filename, const int numThreads, const PencilSource& source){
+    return writeFileParallel(filename, numThreads, &source);
+}
+
+int PFData::writeFileParallel(const std::string& filename, const int numThreads, const PencilSource* source){
+    if(numThreads < 1){
+        std::cerr << "Number of threads must be at least 1\n";
+        return EINVAL;
+    }
+
+    // m_indexOrder must be set to "zyx" in order to write file
+    if (m_indexOrder != "zyx") {
+        perror("PFData indexOrder attribute must be set to \"zyx\" before calling writeFileThreaded(). "
+                "Please confirm that your arrays are in the right order, and call setIndexOrder() "
+                "on your PFData object to set this attribute.");
+        return 1;
+    }
+
+    m_numSubgrids = m_p * m_q * m_r;
+
+    //The location of every subgrid is known up front, so the subgrids can be written in any order
+    std::vector<long long> offsets(m_numSubgrids + 1);
+    offsets[0] = 64;
+    for(int i = 0; i < m_numSubgrids; ++i){
+        const std::array<int, 3> idx = unflattenGridIndex(i);
+        const long long count = static_cast<long long>(calcExtent(m_nz, m_r, idx[0])) * calcExtent(m_ny, m_q, idx[1]) * calcExtent(m_nx, m_p, idx[2]);
+        offsets[i+1] = offsets[i] + 36 + 8 * count;
+    }
+
+    //Upper bound on the size of a single job, larger subgrids are split into slabs of pencils
+    const long long maxJobElements = 1LL << 19;
+
+    struct Slab {
+        int subgrid;
+        int pencilBegin, pencilEnd;     //[begin, end)
+    };
+    std::vector<Slab> slabs;
+    for(int i = 0; i < m_numSubgrids; ++i){
+        const std::array<int, 3> idx = unflattenGridIndex(i);
+        const int sizeX = calcExtent(m_nx, m_p, idx[2]);
+        const int numPencils = calcExtent(m_nz, m_r, idx[0]) * calcExtent(m_ny, m_q, idx[1]);
+        const int pencilsPerSlab = static_cast<int>(std::max(1LL, maxJobElements / std::max(1, sizeX)));
+
+        for(int begin = 0; begin < numPencils; begin += pencilsPerSlab){
+            slabs.push_back(Slab{i, begin, std::min(numPencils, begin + pencilsPerSlab)});
+        }
+    }
+
+    const int fd = openFileWrite(filename);
+    if(fd < 0){
+        std::string err{"Error opening file: \"" + filename + "\""};
+        perror(err.c_str());
+        return 1;
+    }
+
+    if(int err = preallocateFile(fd, offsets.back())){
+        std::cerr << "Error allocating " << offsets.back() << " bytes for file " << filename << ": " << std::strerror(err) << "\n";
+        closeFileDescriptor(fd);
+        return err;
+    }
+
+    unsigned char header[64];
+    encodeFileHeader(header);
+    if(int err = writeFileAt(fd, header, 64, 0)){
+        std::cerr << "Error writing header to file " << filename << ": " << std::strerror(err) << "\n";
+        closeFileDescriptor(fd);
+        return err;
+    }
+
+    //Per worker conversion buffers
+    std::vector<std::vector<uint64_t>> scratch(numThreads);
+
+    const int err = PFThreadPool::shared().parallelFor(static_cast<int>(slabs.size()), numThreads, [&](int job, int worker){
+        const Slab& slab = slabs[job];
+        const std::array<int, 3> idx = unflattenGridIndex(slab.subgrid);
+        const int sizeY = calcExtent(m_ny, m_q, idx[1]);
+        const int sizeX = calcExtent(m_nx, m_p, idx[2]);
+        const long long startZ = calcOffset(m_nz, m_r, idx[0]);
+        const long long startY = calcOffset(m_ny, m_q, idx[1]);
+        const long long startX = calcOffset(m_nx, m_p, idx[2]);
+
+        //The first slab of a subgrid also writes the subgrid header
+        if(slab.pencilBegin == 0){
+            unsigned char header[36];
+            encodeSubgridHeader(header, idx[0], idx[1], idx[2]);
+            if(int err = writeFileAt(fd, header, 36, offsets[slab.subgrid])){
+                return err;
+            }
+        }
+
+        std::vector<uint64_t>& buf = scratch[worker];
+        buf.resize(static_cast<std::size_t>(slab.pencilEnd - slab.pencilBegin) * sizeX);
+        uint64_t* dst = buf.data();
+        for(int pencil = slab.pencilBegin; pencil < slab.pencilEnd; ++pencil){
+            const long long z = startZ + pencil / sizeY;
+            const long long y = startY + pencil % sizeY;
+            if(source){
+                //Generate the pencil in place, then convert it
+                (*source)(reinterpret_cast<double*>(dst), static_cast<int>(z), static_cast<int>(y), static_cast<int>(startX), sizeX);
+                bswap64_array_inplace(dst, sizeX);
+            }else{
+                //Convert each pencil straight out of m_data
+                const uint64_t* src = reinterpret_cast<const uint64_t*>(&m_data[z * m_nx * m_ny + y * m_nx + startX]);
+                bswap64_array(src, dst, sizeX);
+            }
+            dst += sizeX;
+        }
+
+        const long long offset = offsets[slab.subgrid] + 36 + 8LL * sizeX * slab.pencilBegin;
+        return writeFileAt(fd, buf.data(), 8 * buf.size(), offset);
+    });
+
+    closeFileDescriptor(fd);
+
+    if(err){
+        std::cerr << "Error writing subgrid data to file " << filename << ", error code " << err << ": " << std::strerror(err) << "\n";
+        return err;
+    }
+
+    return 0;
+}
+
 int calcExtent(int extent, int block_count, int block_idx) {
     int lx = extent % block_count;
     int bx = extent / block_count;
@@ -1012,14 +1731,179 @@ int calcOffset(int extent, int block_count, int block_idx) {
     return offset;
 }
 
-int PFData::distFile(int P, int Q, int R, const std::string outFile) {
-    loadHeader();
-    loadData();
+int PFData::distFile(int P, int Q, int R, const std::string outFile, const long long memoryBudget) {
+    if(P < 1 || Q < 1 || R < 1){
+        std::cerr << "distFile: P, Q, and R must be at least 1\n";
+        return EINVAL;
+    }
+
+    if(int err = loadHeader()){
+        return err;
+    }
+    if(m_compressed){
+        std::cerr << "distFile: " << m_filename << " is compressed, load it and use writeFile() instead\n";
+        return EINVAL;
+    }
+    if(int err = loadSubgridIndex()){
+        return err;
+    }
+
+    //Location of a subgrid, in elements, and the offset of its data in the file
+    struct Block {
+        int startZ, startY, startX;
+        int nz, ny, nx;
+        long long dataOffset;
+    };
+
+    std::vector<Block> source(m_numSubgrids);
+    for(int i = 0; i < m_numSubgrids; ++i){
+        const std::array<int, 3> idx = unflattenGridIndex(i);
+        source[i] = Block{getSubgridStartZ(idx[0]), getSubgridStartY(idx[1]), getSubgridStartX(idx[2]),
+                          getSubgridSizeZ(idx[0]),  getSubgridSizeY(idx[1]),  getSubgridSizeX(idx[2]),
+                          getSubgridOffset(idx[0], idx[1], idx[2]) + 36};
+    }
+
+    //From here on, this object describes the new file
     m_p = P;
     m_q = Q;
     m_r = R;
+    m_numSubgrids = P * Q * R;
+
+    std::vector<Block> target(m_numSubgrids);
     // create array to hold byte offset for blocks
-    std::vector<long> offsets((P*Q*R)+1);
+    std::vector<long> offsets(m_numSubgrids + 1);
+    long long offset = 64;
+    for(int i = 0; i < m_numSubgrids; ++i){
+        const std::array<int, 3> idx = unflattenGridIndex(i);
+        target[i] = Block{calcOffset(m_nz, R, idx[0]), calcOffset(m_ny, Q, idx[1]), calcOffset(m_nx, P, idx[2]),
+                          calcExtent(m_nz, R, idx[0]), calcExtent(m_ny, Q, idx[1]), calcExtent(m_nx, P, idx[2]),
+                          offset + 36};
+        offset += 36 + 8LL * target[i].nz * target[i].ny * target[i].nx;
+        offsets[i+1] = offset;
+    }
+
+    //The tile and the staging buffer for a single read or write each get half of the budget
+    const long long rowElements = m_nx;
+    const long long planeElements = static_cast<long long>(m_ny) * m_nx;
+    const long long tileElements = std::max(rowElements, memoryBudget / 16);
+    const int tileZ = planeElements <= tileElements ? static_cast<int>(std::min<long long>(m_nz, tileElements / planeElements)) : 1;
+    const int tileY = planeElements <= tileElements ? m_ny : static_cast<int>(tileElements / rowElements);
+
+    //Big endian values, in the same order as the file
+    std::vector<uint64_t> tile(static_cast<std::size_t>(tileZ) * tileY * m_nx);
+    std::vector<uint64_t> staging;
+
+    const int srcFd = openFileReadOnly(m_filename);
+    if(srcFd < 0){
+        std::string err{"Error opening file: \"" + m_filename + "\""};
+        perror(err.c_str());
+        return 1;
+    }
+
+    //Written under a unique temporary name and moved into place at the end, so outFile may be the source itself
+    std::random_device random;
+    const std::string temporary = outFile + ".tmp" + std::to_string(random()) + std::to_string(random());
+    const int dstFd = openFileWrite(temporary);
+    if(dstFd < 0){
+        std::string err{"Error opening file: \"" + temporary + "\""};
+        perror(err.c_str());
+        closeFileDescriptor(srcFd);
+        return 1;
+    }
+
+    auto finish = [&](int err){
+        closeFileDescriptor(srcFd);
+        closeFileDescriptor(dstFd);
+        if(err){
+            std::cerr << "distFile: error writing " << outFile << ", error code " << err << ": " << std::strerror(err) << "\n";
+            std::remove(temporary.c_str());
+        }
+        return err;
+    };
+
+    if(int err = preallocateFile(dstFd, offset)){
+        return finish(err);
+    }
+
+    //File header and all subgrid headers
+    unsigned char header[64];
+    encodeFileHeader(header);
+    if(int err = writeFileAt(dstFd, header, 64, 0)){
+        return finish(err);
+    }
+    for(int i = 0; i < m_numSubgrids; ++i){
+        const std::array<int, 3> idx = unflattenGridIndex(i);
+        encodeSubgridHeader(header, idx[0], idx[1], idx[2]);
+        if(int err = writeFileAt(dstFd, header, 36, target[i].dataOffset - 36)){
+            return finish(err);
+        }
+    }
+
+    for(int z0 = 0; z0 < m_nz; z0 += tileZ){
+        const int z1 = std::min(m_nz, z0 + tileZ);
+        for(int y0 = 0; y0 < m_ny; y0 += tileY){
+            const int y1 = std::min(m_ny, y0 + tileY);
+
+            //Gather the tile from the source subgrids. For a single Z plane, the rows of a subgrid are contiguous in the file
+            for(const Block& block : source){
+                const int za = std::max(z0, block.startZ), zb = std::min(z1, block.startZ + block.nz);
+                const int ya = std::max(y0, block.startY), yb = std::min(y1, block.startY + block.ny);
+                if(za >= zb || ya >= yb) continue;
+
+                for(int z = za; z < zb; ++z){
+                    const std::size_t count = static_cast<std::size_t>(yb - ya) * block.nx;
+                    const long long rows = static_cast<long long>(z - block.startZ) * block.ny + (ya - block.startY);
+                    staging.resize(count);
+                    if(int err = readFileAt(srcFd, staging.data(), 8 * count, block.dataOffset + 8 * rows * block.nx)){
+                        return finish(err);
+                    }
+                    for(int y = ya; y < yb; ++y){
+                        const std::size_t index = (static_cast<std::size_t>(z - z0) * tileY + (y - y0)) * m_nx + block.startX;
+                        std::memcpy(&tile[index], &staging[static_cast<std::size_t>(y - ya) * block.nx], 8 * block.nx);
+                    }
+                }
+            }
+
+            //Scatter the tile into the target subgrids
+            for(const Block& block : target){
+                const int za = std::max(z0, block.startZ), zb = std::min(z1, block.startZ + block.nz);
+                const int ya = std::max(y0, block.startY), yb = std::min(y1, block.startY + block.ny);
+                if(za >= zb || ya >= yb) continue;
+
+                for(int z = za; z < zb; ++z){
+                    const std::size_t count = static_cast<std::size_t>(yb - ya) * block.nx;
+                    const long long rows = static_cast<long long>(z - block.startZ) * block.ny + (ya - block.startY);
+                    staging.resize(count);
+                    for(int y = ya; y < yb; ++y){
+                        const std::size_t index = (static_cast<std::size_t>(z - z0) * tileY + (y - y0)) * m_nx + block.startX;
+                        std::memcpy(&staging[static_cast<std::size_t>(y - ya) * block.nx], &tile[index], 8 * block.nx);
+                    }
+                    if(int err = writeFileAt(dstFd, staging.data(), 8 * count, block.dataOffset + 8 * rows * block.nx)){
+                        return finish(err);
+                    }
+                }
+            }
+        }
+    }
+
+    if(int err = finish(0)){
+        return err;
+    }
+
+    //The open file and its index describe the old layout
+    close();
+    m_subgridIndex.clear();
+    {
+        std::lock_guard<std::mutex> lock(m_subgridCacheMutex);
+        m_subgridCache.clear();
+    }
+
+    if(int err = replaceFile(temporary, outFile)){
+        std::cerr << "distFile: error replacing " << outFile << ", error code " << err << ": " << std::strerror(err) << "\n";
+        std::remove(temporary.c_str());
+        return err;
+    }
+
     //create the filestream for the .dist file
     std::fstream distFile(outFile + ".dist", std::ios::trunc | std::ios::out) ;   //Clear file if it exists
     if(!distFile){
@@ -1027,30 +1911,47 @@ int PFData::distFile(int P, int Q, int R, const std::string outFile) {
         return 1;
     }
 
-    //write the blocked pfb file to disk, collecting the block offsets
-    int rtnVal = writeFile(outFile, offsets);
-
     //write the block offsets to the .dist file
     for (long long i = 0; i<=static_cast<long long>(P)*Q*R; i++){
         distFile << offsets[i] << "\n";
     }
+    distFile.close();
+
+    //Redistributed in place, reopen the new file
+    if(outFile == m_filename){
+        if(int err = loadHeader()){
+            return err;
+        }
+        return loadSubgridIndex();
+    }
 
-    return rtnVal;
+    return 0;
 }
 
-PFData::differenceType PFData::compare(const PFData& otherObj, std::array<int, 3>* diffIndex) const{
-    //Check relevant header data
-    if(otherObj.getZ()  != getZ())  return differenceType::z;
-    if(otherObj.getY()  != getY())  return differenceType::y;
-    if(otherObj.getX()  != getX())  return differenceType::x;
+//Compares the header values shared by both compare() overloads
+static PFData::differenceType compareHeaders(const PFData& self, const PFData& otherObj){
+    typedef PFData::differenceType differenceType;
+    if(otherObj.getZ()  != self.getZ())  return differenceType::z;
+    if(otherObj.getY()  != self.getY())  return differenceType::y;
+    if(otherObj.getX()  != self.getX())  return differenceType::x;
 
-    if(otherObj.getDZ() != getDZ()) return differenceType::dZ;
-    if(otherObj.getDY() != getDY()) return differenceType::dY;
-    if(otherObj.getDX() != getDX()) return differenceType::dX;
+    if(otherObj.getDZ() != self.getDZ()) return differenceType::dZ;
+    if(otherObj.getDY() != self.getDY()) return differenceType::dY;
+    if(otherObj.getDX() != self.getDX()) return differenceType::dX;
 
-    if(otherObj.getNZ() != getNZ()) return differenceType::nZ;
-    if(otherObj.getNY() != getNY()) return differenceType::nY;
-    if(otherObj.getNX() != getNX()) return differenceType::nX;
+    if(otherObj.getNZ() != self.getNZ()) return differenceType::nZ;
+    if(otherObj.getNY() != self.getNY()) return differenceType::nY;
+    if(otherObj.getNX() != self.getNX()) return differenceType::nX;
+
+    return differenceType::none;
+}
+
+PFData::differenceType PFData::compare(const PFData& otherObj, std::array<int, 3>* diffIndex) const{
+    //Check relevant header data
+    const differenceType header = compareHeaders(*this, otherObj);
+    if(header != differenceType::none){
+        return header;
+    }
 
 
     //Check for differences in the data array
@@ -1075,6 +1976,191 @@ PFData::differenceType PFData::compare(const PFData& otherObj, std::array<int, 3
     return differenceType::none;
 }
 
+//Maps a double to an integer such that adjacent doubles map to adjacent integers, for ULP distances
+static inline long long orderedBits(double value){
+    long long bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    //Negative doubles count down from the sign bit
+    return bits < 0 ? static_cast<long long>(0x8000000000000000ULL - static_cast<unsigned long long>(bits)) : bits;
+}
+
+namespace {
+
+//Differences found by a single worker of compare(), merged once every worker is done
+struct CompareAccumulator {
+    long long numDifferent = 0;
+    long long numNaNMismatches = 0;
+    double maxAbsError = 0.0;
+    long long maxAbsErrorIndex = -1;
+    double maxRelError = 0.0;
+    long long maxRelErrorIndex = -1;
+    unsigned long long maxUlpError = 0;
+    long long firstDifferenceIndex = -1;
+    std::vector<PFDifferenceSummary> layers;
+    std::vector<PFDifferenceSummary> subgrids;
+};
+
+//Keeps the larger error, the earlier location on ties, so the report does not depend on how rows were split
+inline void keepMax(double error, long long index, double& maxError, long long& maxIndex){
+    if(error > maxError || (error == maxError && maxIndex >= 0 && index < maxIndex)){
+        maxError = error;
+        maxIndex = index;
+    }
+}
+
+inline void keepFirst(long long index, long long& first){
+    if(first < 0 || index < first){
+        first = index;
+    }
+}
+
+} //namespace
+
+PFData::differenceType PFData::compare(const PFData& otherObj, const PFCompareTolerance& tolerance, PFCompareReport* report, int numThreads) const{
+    const differenceType header = compareHeaders(*this, otherObj);
+    if(header != differenceType::none){
+        return header;
+    }
+
+    assert(otherObj.getData() && getData());
+    const double* dataSelf = getData();
+    const double* dataOther = otherObj.getData();
+
+    const int nz = getNZ();
+    const int ny = getNY();
+    const int nx = getNX();
+    const long long numRows = static_cast<long long>(nz) * ny;
+
+    //Subgrid of every X index, the topology only describes the data if it matches the dimensions
+    const bool topology = hasTopology();
+    const int numSubgrids = topology ? m_numSubgrids : 1;
+    std::vector<int> gridXOf(nx, 0);
+    if(topology){
+        for(int x = 0; x < nx; ++x){
+            gridXOf[x] = getSubgridIndexX(x);
+        }
+    }
+
+    numThreads = std::max(1, numThreads);
+    std::vector<CompareAccumulator> workers(numThreads);
+    for(CompareAccumulator& worker : workers){
+        worker.layers.resize(nz);
+        worker.subgrids.resize(numSubgrids);
+    }
+
+    //A few jobs per thread, so stealing can even out rows that differ a lot
+    const int numJobs = static_cast<int>(std::max(1LL, std::min(numRows, 8LL * numThreads)));
+    PFThreadPool::shared().parallelFor(numJobs, numThreads, [&](int job, int worker) -> int{
+        CompareAccumulator& acc = workers[worker];
+        const long long rowBegin = numRows * job / numJobs;
+        const long long rowEnd = numRows * (job + 1) / numJobs;
+
+        for(long long row = rowBegin; row < rowEnd; ++row){
+            const int z = static_cast<int>(row / ny);
+            const int y = static_cast<int>(row % ny);
+            const int gridBase = topology ? (getSubgridIndexZ(z) * m_q + getSubgridIndexY(y)) * m_p : 0;
+            const long long rowStart = row * nx;
+            const uint64_t* bitsSelf = reinterpret_cast<const uint64_t*>(dataSelf + rowStart);
+            const uint64_t* bitsOther = reinterpret_cast<const uint64_t*>(dataOther + rowStart);
+            PFDifferenceSummary& layer = acc.layers[z];
+
+            //Only values with different bits need a closer look
+            std::size_t x = 0;
+            while((x += find_first_difference64(bitsSelf + x, bitsOther + x, nx - x)) < static_cast<std::size_t>(nx)){
+                const double a = dataSelf[rowStart + x];
+                const double b = dataOther[rowStart + x];
+                const long long index = rowStart + x;
+                PFDifferenceSummary& subgrid = acc.subgrids[gridBase + gridXOf[x]];
+                ++x;
+
+                const bool nanA = std::isnan(a);
+                const bool nanB = std::isnan(b);
+                if(nanA || nanB){
+                    //NaNs with different payloads are still equal
+                    if(!(nanA && nanB)){
+                        acc.numNaNMismatches++;
+                        acc.numDifferent++;
+                        layer.numDifferent++;
+                        subgrid.numDifferent++;
+                        keepFirst(index, acc.firstDifferenceIndex);
+                    }
+                    continue;
+                }
+
+                const double absError = std::fabs(a - b);
+                const double scale = std::max(std::fabs(a), std::fabs(b));
+                const double relError = std::isinf(absError) ? absError : (scale > 0.0 ? absError / scale : 0.0);
+                const long long bitsA = orderedBits(a);
+                const long long bitsB = orderedBits(b);
+                const unsigned long long ulpError = bitsA > bitsB ? static_cast<unsigned long long>(bitsA) - static_cast<unsigned long long>(bitsB)
+                                                                  : static_cast<unsigned long long>(bitsB) - static_cast<unsigned long long>(bitsA);
+
+                keepMax(absError, index, acc.maxAbsError, acc.maxAbsErrorIndex);
+                keepMax(relError, index, acc.maxRelError, acc.maxRelErrorIndex);
+                acc.maxUlpError = std::max(acc.maxUlpError, ulpError);
+                layer.maxAbsError = std::max(layer.maxAbsError, absError);
+                subgrid.maxAbsError = std::max(subgrid.maxAbsError, absError);
+
+                const bool within = absError <= tolerance.absolute || relError <= tolerance.relative
+                                 || (tolerance.ulps > 0 && ulpError <= static_cast<unsigned long long>(tolerance.ulps));
+                if(!within){
+                    acc.numDifferent++;
+                    layer.numDifferent++;
+                    subgrid.numDifferent++;
+                    keepFirst(index, acc.firstDifferenceIndex);
+                }
+            }
+        }
+        return 0;
+    });
+
+    //Merge the workers
+    CompareAccumulator total;
+    total.layers.resize(nz);
+    total.subgrids.resize(numSubgrids);
+    for(const CompareAccumulator& acc : workers){
+        total.numDifferent += acc.numDifferent;
+        total.numNaNMismatches += acc.numNaNMismatches;
+        if(acc.maxAbsErrorIndex >= 0) keepMax(acc.maxAbsError, acc.maxAbsErrorIndex, total.maxAbsError, total.maxAbsErrorIndex);
+        if(acc.maxRelErrorIndex >= 0) keepMax(acc.maxRelError, acc.maxRelErrorIndex, total.maxRelError, total.maxRelErrorIndex);
+        total.maxUlpError = std::max(total.maxUlpError, acc.maxUlpError);
+        if(acc.firstDifferenceIndex >= 0) keepFirst(acc.firstDifferenceIndex, total.firstDifferenceIndex);
+
+        for(int z = 0; z < nz; ++z){
+            total.layers[z].numDifferent += acc.layers[z].numDifferent;
+            total.layers[z].maxAbsError = std::max(total.layers[z].maxAbsError, acc.layers[z].maxAbsError);
+        }
+        for(int i = 0; i < numSubgrids; ++i){
+            total.subgrids[i].numDifferent += acc.subgrids[i].numDifferent;
+            total.subgrids[i].maxAbsError = std::max(total.subgrids[i].maxAbsError, acc.subgrids[i].maxAbsError);
+        }
+    }
+
+    if(report){
+        const long long layerSize = static_cast<long long>(ny) * nx;
+        auto unflatten = [&](long long index) -> std::array<int, 3>{
+            if(index < 0){
+                return {{-1, -1, -1}};
+            }
+            return {{static_cast<int>(index / layerSize), static_cast<int>(index % layerSize / nx), static_cast<int>(index % nx)}};
+        };
+
+        report->numCompared = numRows * nx;
+        report->numDifferent = total.numDifferent;
+        report->numNaNMismatches = total.numNaNMismatches;
+        report->maxAbsError = total.maxAbsError;
+        report->maxAbsErrorIndex = unflatten(total.maxAbsErrorIndex);
+        report->maxRelError = total.maxRelError;
+        report->maxRelErrorIndex = unflatten(total.maxRelErrorIndex);
+        report->maxUlpError = total.maxUlpError;
+        report->firstDifferenceIndex = unflatten(total.firstDifferenceIndex);
+        report->layers = std::move(total.layers);
+        report->subgrids = std::move(total.subgrids);
+    }
+
+    return total.numDifferent ? differenceType::data : differenceType::none;
+}
+
 std::array<int, 3> PFData::unflattenIndex(int index) const{
     if(index >= getNZ() * getNY() * getNX() || index < 0){  //Invalid index, @@TODO assert instead?
         return {-1, -1, -1};
@@ -1117,6 +2203,7 @@ std::string PFData::getFilename() const{
 
 void PFData::setData(double *data) {
     m_data = data;
+    m_dataOwner = false;
 }
 
 int PFData::getP() const {
@@ -1146,3 +2233,7 @@ void PFData::setR(int R) {
 void PFData::setIsDataOwner(bool isOwner){
     m_dataOwner = isOwner;
 }
+
+bool PFData::isDataOwner() const{
+    return m_dataOwner;
+}
@@ -0,0 +1,365 @@
+#include "pffile.hpp"
+
+#include <cerrno>
+#include <cstdio>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+    #include <fcntl.h>
+    #include <io.h>
+    #include <sys/stat.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+const unsigned char* mapFileReadOnly(const std::string& filename, std::size_t& size){
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE){
+        errno = ENOENT;
+        return nullptr;
+    }
+
+    LARGE_INTEGER fileSize{};
+    if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0){
+        CloseHandle(file);
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);     //The mapping keeps its own reference to the file
+    if(mapping == nullptr){
+        errno = EIO;
+        return nullptr;
+    }
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);  //The view keeps its own reference to the mapping
+    if(data == nullptr){
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    size = static_cast<std::size_t>(fileSize.QuadPart);
+    return static_cast<const unsigned char*>(data);
+}
+
+unsigned char* mapFileCopyOnWrite(const std::string& filename, std::size_t& size){
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE){
+        errno = ENOENT;
+        return nullptr;
+    }
+
+    LARGE_INTEGER fileSize{};
+    if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0){
+        CloseHandle(file);
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    CloseHandle(file);
+    if(mapping == nullptr){
+        errno = EIO;
+        return nullptr;
+    }
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    if(data == nullptr){
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    size = static_cast<std::size_t>(fileSize.QuadPart);
+    return static_cast<unsigned char*>(data);
+}
+
+void unmapFile(const unsigned char* data, std::size_t){
+    if(data){
+        UnmapViewOfFile(data);
+    }
+}
+
+int openFileReadOnly(const std::string& filename){
+    return ::_open(filename.c_str(), _O_RDONLY | _O_BINARY);
+}
+
+void closeFileDescriptor(int fd){
+    if(fd >= 0){
+        ::_close(fd);
+    }
+}
+
+int readFileAt(int fd, void* buffer, std::size_t count, long long offset){
+    HANDLE file = reinterpret_cast<HANDLE>(::_get_osfhandle(fd));
+    if(file == INVALID_HANDLE_VALUE){
+        return EBADF;
+    }
+
+    unsigned char* dst = static_cast<unsigned char*>(buffer);
+    while(count > 0){
+        //An explicit offset makes ReadFile independent of the shared file position
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFFLL);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        const DWORD chunk = count > 0x40000000 ? 0x40000000 : static_cast<DWORD>(count);
+        DWORD numRead = 0;
+        if(!ReadFile(file, dst, chunk, &numRead, &overlapped)){
+            return EIO;
+        }
+        if(numRead == 0){
+            return EIO;    //End of file
+        }
+
+        dst += numRead;
+        count -= numRead;
+        offset += numRead;
+    }
+    return 0;
+}
+
+long long getFileModificationTime(const std::string& filename){
+    struct _stat64 info{};
+    if(::_stat64(filename.c_str(), &info) != 0){
+        return -1;
+    }
+    return static_cast<long long>(info.st_mtime) * 1000000000LL;
+}
+
+int replaceFile(const std::string& from, const std::string& to){
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) ? 0 : EIO;
+}
+
+long long getFileSize(int fd){
+    return ::_filelengthi64(fd);
+}
+
+void adviseSequential(int, long long, long long){
+}
+
+void adviseWillNeed(int, long long, long long){
+}
+
+int openFileWrite(const std::string& filename){
+    return ::_open(filename.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+}
+
+int preallocateFile(int fd, long long size){
+    return ::_chsize_s(fd, size);
+}
+
+int writeFileAt(int fd, const void* buffer, std::size_t count, long long offset){
+    HANDLE file = reinterpret_cast<HANDLE>(::_get_osfhandle(fd));
+    if(file == INVALID_HANDLE_VALUE){
+        return EBADF;
+    }
+
+    const unsigned char* src = static_cast<const unsigned char*>(buffer);
+    while(count > 0){
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFFLL);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        const DWORD chunk = count > 0x40000000 ? 0x40000000 : static_cast<DWORD>(count);
+        DWORD numWritten = 0;
+        if(!WriteFile(file, src, chunk, &numWritten, &overlapped) || numWritten == 0){
+            return EIO;
+        }
+
+        src += numWritten;
+        count -= numWritten;
+        offset += numWritten;
+    }
+    return 0;
+}
+
+#else
+
+const unsigned char* mapFileReadOnly(const std::string& filename, std::size_t& size){
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0){
+        return nullptr;
+    }
+
+    struct stat info{};
+    if(::fstat(fd, &info) != 0){
+        const int err = errno;
+        ::close(fd);
+        errno = err;
+        return nullptr;
+    }
+
+    //mmap refuses zero length mappings
+    if(info.st_size <= 0){
+        ::close(fd);
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    void* data = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    const int err = errno;
+    ::close(fd);   //The mapping stays valid after the descriptor is closed
+    if(data == MAP_FAILED){
+        errno = err;
+        return nullptr;
+    }
+
+    size = static_cast<std::size_t>(info.st_size);
+    return static_cast<const unsigned char*>(data);
+}
+
+unsigned char* mapFileCopyOnWrite(const std::string& filename, std::size_t& size){
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0){
+        return nullptr;
+    }
+
+    struct stat info{};
+    if(::fstat(fd, &info) != 0 || info.st_size <= 0){
+        const int err = info.st_size <= 0 ? EINVAL : errno;
+        ::close(fd);
+        errno = err;
+        return nullptr;
+    }
+
+    void* data = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    const int err = errno;
+    ::close(fd);
+    if(data == MAP_FAILED){
+        errno = err;
+        return nullptr;
+    }
+
+    size = static_cast<std::size_t>(info.st_size);
+    return static_cast<unsigned char*>(data);
+}
+
+void unmapFile(const unsigned char* data, std::size_t size){
+    if(data){
+        ::munmap(const_cast<unsigned char*>(data), size);
+    }
+}
+
+int openFileReadOnly(const std::string& filename){
+    return ::open(filename.c_str(), O_RDONLY);
+}
+
+void closeFileDescriptor(int fd){
+    if(fd >= 0){
+        ::close(fd);
+    }
+}
+
+int readFileAt(int fd, void* buffer, std::size_t count, long long offset){
+    unsigned char* dst = static_cast<unsigned char*>(buffer);
+    while(count > 0){
+        const ssize_t numRead = ::pread(fd, dst, count, static_cast<off_t>(offset));
+        if(numRead < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return errno;
+        }
+        if(numRead == 0){
+            return EIO;    //End of file
+        }
+
+        dst += numRead;
+        count -= static_cast<std::size_t>(numRead);
+        offset += numRead;
+    }
+    return 0;
+}
+
+long long getFileModificationTime(const std::string& filename){
+    struct stat info{};
+    if(::stat(filename.c_str(), &info) != 0){
+        return -1;
+    }
+#if defined(__APPLE__)
+    return static_cast<long long>(info.st_mtimespec.tv_sec) * 1000000000LL + info.st_mtimespec.tv_nsec;
+#else
+    return static_cast<long long>(info.st_mtim.tv_sec) * 1000000000LL + info.st_mtim.tv_nsec;
+#endif
+}
+
+int replaceFile(const std::string& from, const std::string& to){
+    return std::rename(from.c_str(), to.c_str()) == 0 ? 0 : errno;
+}
+
+long long getFileSize(int fd){
+    struct stat info{};
+    if(::fstat(fd, &info) != 0){
+        return -1;
+    }
+    return static_cast<long long>(info.st_size);
+}
+
+void adviseSequential(int fd, long long offset, long long length){
+#if defined(POSIX_FADV_SEQUENTIAL)
+    ::posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_SEQUENTIAL);
+#else
+    (void)fd; (void)offset; (void)length;
+#endif
+}
+
+void adviseWillNeed(int fd, long long offset, long long length){
+#if defined(__linux__)
+    //Queues the reads and returns without waiting for them
+    ::readahead(fd, static_cast<off64_t>(offset), static_cast<std::size_t>(length));
+#elif defined(POSIX_FADV_WILLNEED)
+    ::posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+#else
+    (void)fd; (void)offset; (void)length;
+#endif
+}
+
+int openFileWrite(const std::string& filename){
+    return ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+int preallocateFile(int fd, long long size){
+#if defined(__linux__)
+    //Not every file system supports reserving space, fall back to only setting the size
+    const int err = ::posix_fallocate(fd, 0, static_cast<off_t>(size));
+    if(err == 0){
+        return 0;
+    }
+    if(err != EOPNOTSUPP && err != EINVAL){
+        return err;
+    }
+#endif
+    return ::ftruncate(fd, static_cast<off_t>(size)) == 0 ? 0 : errno;
+}
+
+int writeFileAt(int fd, const void* buffer, std::size_t count, long long offset){
+    const unsigned char* src = static_cast<const unsigned char*>(buffer);
+    while(count > 0){
+        const ssize_t numWritten = ::pwrite(fd, src, count, static_cast<off_t>(offset));
+        if(numWritten < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return errno;
+        }
+        if(numWritten == 0){
+            return EIO;
+        }
+
+        src += numWritten;
+        count -= static_cast<std::size_t>(numWritten);
+        offset += numWritten;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PARFLOWIO_PFFILE_HPP
+#define PARFLOWIO_PFFILE_HPP
+#include <cstddef>
+#include <string>
+
+/** Maps an entire file read-only into the address space of the process.
+ * \param   filename    Path of the file to map.
+ * \param   size        [out] Set to the size of the mapping in bytes on success.
+ * \return              Pointer to the first byte of the mapping, or nullptr on failure (errno is set).
+ */
+const unsigned char* mapFileReadOnly(const std::string& filename, std::size_t& size);
+
+/** Maps an entire file privately: the pages can be written, but the writes are never carried to the file or other processes.
+ * Pages are only copied when first written, so reading costs the same as with mapFileReadOnly().
+ * \param   filename    Path of the file to map.
+ * \param   size        [out] Set to the size of the mapping in bytes on success.
+ * \return              Pointer to the first byte of the mapping, or nullptr on failure (errno is set).
+ */
+unsigned char* mapFileCopyOnWrite(const std::string& filename, std::size_t& size);
+
+/** Releases a mapping created with mapFileReadOnly().
+ * \param   data        Pointer returned by mapFileReadOnly(). Does nothing if nullptr.
+ * \param   size        Size of the mapping, as reported by mapFileReadOnly().
+ */
+void unmapFile(const unsigned char* data, std::size_t size);
+
+/** Opens a file for reading, for use with readFileAt().
+ * \param   filename    Path of the file to open.
+ * \return              The file descriptor, or -1 on failure (errno is set).
+ */
+int openFileReadOnly(const std::string& filename);
+
+/** Closes a descriptor returned by openFileReadOnly(). Does nothing if fd is negative.
+ */
+void closeFileDescriptor(int fd);
+
+/** Reads exactly `count` bytes starting at `offset`. The file position is neither used nor changed,
+ * so this may be called concurrently from several threads on the same descriptor.
+ * \param   fd          Descriptor returned by openFileReadOnly().
+ * \param   buffer      Destination, at least `count` bytes.
+ * \param   count       Number of bytes to read.
+ * \param   offset      Absolute offset in the file to start reading from.
+ * \return              0 on success, otherwise an errno value. Reading past the end of the file returns EIO.
+ */
+int readFileAt(int fd, void* buffer, std::size_t count, long long offset);
+
+/** Returns the last modification time of a file.
+ * \param   filename    Path of the file.
+ * \return              Modification time in nanoseconds since the epoch (coarser where the platform is), -1 on failure.
+ */
+long long getFileModificationTime(const std::string& filename);
+
+/** Renames a file, replacing `to` if it exists. Readers that opened or mapped the old `to` keep seeing its old contents.
+ * \return              0 on success, otherwise an errno value.
+ */
+int replaceFile(const std::string& from, const std::string& to);
+
+/** Returns the size of an open file.
+ * \param   fd          Descriptor returned by openFileReadOnly() or openFileWrite().
+ * \return              Size of the file in bytes, -1 on failure (errno is set).
+ */
+long long getFileSize(int fd);
+
+/** Tells the operating system that a range of the file will be read front to back, so it can read ahead aggressively.
+ * Only a hint, does nothing where it is not supported.
+ * \param   fd          Descriptor returned by openFileReadOnly().
+ * \param   offset      Start of the range.
+ * \param   length      Length of the range in bytes, 0 for up to the end of the file.
+ */
+void adviseSequential(int fd, long long offset, long long length);
+
+/** Starts reading a range of the file into the page cache in the background, so a later read of it does not wait for the disk.
+ * Only a hint, does nothing where it is not supported.
+ * \param   fd          Descriptor returned by openFileReadOnly().
+ * \param   offset      Start of the range.
+ * \param   length      Length of the range in bytes.
+ */
+void adviseWillNeed(int fd, long long offset, long long length);
+
+/** Creates (or truncates) a file for writing, for use with writeFileAt().
+ * \param   filename    Path of the file to create.
+ * \return              The file descriptor, or -1 on failure (errno is set).
+ */
+int openFileWrite(const std::string& filename);
+
+/** Sets the size of a file opened with openFileWrite(), reserving the disk space up front where the file system supports it.
+ * \param   fd          Descriptor returned by openFileWrite().
+ * \param   size        Final size of the file in bytes.
+ * \return              0 on success, otherwise an errno value.
+ */
+int preallocateFile(int fd, long long size);
+
+/** Writes exactly `count` bytes starting at `offset`. Like readFileAt(), this may be called concurrently from several threads
+ * on the same descriptor, as long as the written ranges do not overlap.
+ * \param   fd          Descriptor returned by openFileWrite().
+ * \param   buffer      Data to write.
+ * \param   count       Number of bytes to write.
+ * \param   offset      Absolute offset in the file to start writing at.
+ * \return              0 on success, otherwise an errno value.
+ */
+int writeFileAt(int fd, const void* buffer, std::size_t count, long long offset);
+
+#endif //PARFLOWIO_PFFILE_HPP
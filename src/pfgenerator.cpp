@@ -0,0 +1,44 @@
+#include "parflow/pfgenerator.hpp"
+#include "parflow/pfdata.hpp"
+
+#include <cerrno>
+#include <iostream>
+
+//Triangle wave with period 1 and range [0, 1]
+static inline double triangle(double t){
+    t -= static_cast<double>(static_cast<long long>(t));
+    return t < 0.5 ? 2.0 * t : 2.0 - 2.0 * t;
+}
+
+//Smooth field in [-0.25, 0.25], only depends on the position and the seed
+static inline double smoothField(int z, int y, int x, unsigned int seed){
+    const double phase = 0.0625 * (seed % 16);
+    return 0.125 * (triangle(0.0137 * x + 0.0071 * y + phase) + triangle(0.0029 * z + 0.0113 * y + phase)) - 0.125;
+}
+
+double generatePfbValue(int z, int y, int x, int ny, int nx, unsigned int seed){
+    const double index = (static_cast<double>(z) * ny + y) * nx + x;
+    return index + smoothField(z, y, x, seed);
+}
+
+int generatePfbFile(const std::string& filename, int nz, int ny, int nx, int p, int q, int r, unsigned int seed, int numThreads){
+    if(nz < 1 || ny < 1 || nx < 1 || p < 1 || q < 1 || r < 1 || p > nx || q > ny || r > nz){
+        std::cerr << "Invalid grid " << nz << "x" << ny << "x" << nx << " (ZYX) with P=" << p << ", Q=" << q << ", R=" << r << "\n";
+        return EINVAL;
+    }
+
+    PFData header;
+    header.setNZ(nz);
+    header.setNY(ny);
+    header.setNX(nx);
+    header.setP(p);
+    header.setQ(q);
+    header.setR(r);
+
+    return header.writeFileThreaded(filename, numThreads, [=](double* dst, int z, int y, int x, int count){
+        const double rowIndex = (static_cast<double>(z) * ny + y) * nx;
+        for(int i = 0; i < count; ++i){
+            dst[i] = (rowIndex + (x + i)) + smoothField(z, y, x + i, seed);
+        }
+    });
+}
@@ -0,0 +1,154 @@
+#include "parflow/pfdata.hpp"
+#include "pffile.hpp"
+#include "pfutil.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+//Version of the sidecar format written by PFData::saveNativeCache()
+static const uint32_t NATIVE_CACHE_VERSION = 1;
+
+//The values start at this offset, a page boundary, and the header is padded up to it
+static const std::size_t NATIVE_CACHE_DATA_OFFSET = 4096;
+
+//Written in native byte order, a host of the other byte order reads it swapped and rejects the sidecar
+static const uint32_t NATIVE_CACHE_BYTE_ORDER = 0x01020304;
+
+namespace {
+
+struct NativeCacheHeader {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t version;
+    uint64_t dataOffset;
+    int32_t nz;
+    int32_t ny;
+    int32_t nx;
+    int32_t reserved;
+    int64_t sourceSize;
+    int64_t sourceModificationTime;
+    uint64_t sourceChecksum;    //Of the pfb header, size, and modification time
+};
+
+const char NATIVE_CACHE_MAGIC[8] = {'p', 'f', 'b', 'n', 'a', 't', 'i', 'v'};
+
+} //namespace
+
+//Identifies the current version of the pfb the sidecar was made from
+static int describeSource(const PFData& data, int fd, NativeCacheHeader& header){
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, NATIVE_CACHE_MAGIC, sizeof(header.magic));
+    header.byteOrder = NATIVE_CACHE_BYTE_ORDER;
+    header.version = NATIVE_CACHE_VERSION;
+    header.dataOffset = NATIVE_CACHE_DATA_OFFSET;
+    header.nz = data.getNZ();
+    header.ny = data.getNY();
+    header.nx = data.getNX();
+
+    header.sourceSize = getFileSize(fd);
+    header.sourceModificationTime = getFileModificationTime(data.getFilename());
+    if(header.sourceSize < 64 || header.sourceModificationTime < 0){
+        return EIO;
+    }
+
+    unsigned char fileHeader[64];
+    if(int err = readFileAt(fd, fileHeader, sizeof(fileHeader), 0)){
+        return err;
+    }
+    uint64_t checksum = fnv1a(fileHeader, sizeof(fileHeader));
+    checksum = fnv1a(&header.sourceSize, sizeof(header.sourceSize), checksum);
+    header.sourceChecksum = fnv1a(&header.sourceModificationTime, sizeof(header.sourceModificationTime), checksum);
+    return 0;
+}
+
+void PFData::setNativeCache(bool enabled){
+    m_nativeCache = enabled;
+}
+
+bool PFData::getNativeCache() const{
+    return m_nativeCache;
+}
+
+bool PFData::isNativeCacheLoaded() const{
+    return m_nativeMap != nullptr && m_data != nullptr;
+}
+
+int PFData::loadNativeCache(){
+    if(m_fd < 0 || m_nz <= 0 || m_ny <= 0 || m_nx <= 0){
+        return EBADF;
+    }
+
+    NativeCacheHeader expected;
+    if(int err = describeSource(*this, m_fd, expected)){
+        return err;
+    }
+
+    std::size_t size = 0;
+    unsigned char* map = mapFileCopyOnWrite(m_filename + ".pfbn", size);
+    if(map == nullptr){
+        return ENOENT;
+    }
+
+    //The whole header has to match, which covers the magic, version, byte order, dimensions, and the pfb itself
+    const std::size_t count = static_cast<std::size_t>(m_nz) * m_ny * m_nx;
+    if(size != NATIVE_CACHE_DATA_OFFSET + 8 * count || std::memcmp(map, &expected, sizeof(expected)) != 0){
+        ::unmapFile(map, size);
+        return EINVAL;
+    }
+
+    releaseData();
+    m_nativeMap = map;
+    m_nativeMapSize = size;
+    m_data = reinterpret_cast<double*>(map + NATIVE_CACHE_DATA_OFFSET);
+    m_dataOwner = false;
+    return 0;
+}
+
+int PFData::saveNativeCache() const{
+    if(m_data == nullptr || m_fd < 0 || m_nz <= 0 || m_ny <= 0 || m_nx <= 0){
+        return EINVAL;
+    }
+
+    std::vector<unsigned char> header(NATIVE_CACHE_DATA_OFFSET, 0);
+    NativeCacheHeader description;
+    if(int err = describeSource(*this, m_fd, description)){
+        return err;
+    }
+    std::memcpy(header.data(), &description, sizeof(description));
+
+    //A unique temporary name, so concurrent writers of the same sidecar do not interleave
+    const std::string filename = m_filename + ".pfbn";
+    std::random_device random;
+    const std::string temporary = filename + ".tmp" + std::to_string(random()) + std::to_string(random());
+
+    const int fd = openFileWrite(temporary);
+    if(fd < 0){
+        const int err = errno;
+        std::perror("Error creating native cache file");
+        return err;
+    }
+
+    const std::size_t bytes = 8 * static_cast<std::size_t>(m_nz) * m_ny * m_nx;
+    int err = preallocateFile(fd, static_cast<long long>(NATIVE_CACHE_DATA_OFFSET + bytes));
+    if(!err){
+        err = writeFileAt(fd, header.data(), header.size(), 0);
+    }
+    if(!err){
+        err = writeFileAt(fd, m_data, bytes, static_cast<long long>(NATIVE_CACHE_DATA_OFFSET));
+    }
+    closeFileDescriptor(fd);
+    if(!err){
+        err = replaceFile(temporary, filename);
+    }
+    if(err){
+        std::cerr << "saveNativeCache: error code " << err << ": " << std::strerror(err) << "\n";
+        std::remove(temporary.c_str());
+    }
+    return err;
+}
@@ -0,0 +1,371 @@
+#include "pfprefetch.hpp"
+#include "pffile.hpp"
+#include "pfutil.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+//io_uring is driven with the raw system calls, so only the kernel headers are needed. FAST_POLL marks headers with IORING_OP_READ (5.7+).
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        #if defined(IORING_FEAT_FAST_POLL)
+            #define PARFLOWIO_HAVE_IO_URING 1
+            #include <sys/mman.h>
+            #include <sys/syscall.h>
+            #include <unistd.h>
+        #endif
+    #endif
+#endif
+#ifndef PARFLOWIO_HAVE_IO_URING
+    #define PARFLOWIO_HAVE_IO_URING 0
+#endif
+
+#if PARFLOWIO_HAVE_IO_URING
+
+//A minimal io_uring with a single submitter and reaper
+struct PrefetchReader::IoUring {
+    int fd = -1;
+    void* sqRing = MAP_FAILED;
+    std::size_t sqRingSize = 0;
+    void* cqRing = MAP_FAILED;
+    std::size_t cqRingSize = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    std::size_t sqesSize = 0;
+
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    ~IoUring(){
+        if(sqes != MAP_FAILED) ::munmap(sqes, sqesSize);
+        if(cqRing != MAP_FAILED && cqRing != sqRing) ::munmap(cqRing, cqRingSize);
+        if(sqRing != MAP_FAILED) ::munmap(sqRing, sqRingSize);
+        if(fd >= 0) ::close(fd);
+    }
+
+    //Returns false if the kernel does not allow io_uring (too old, or disabled)
+    bool setup(unsigned entries){
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if(fd < 0){
+            return false;
+        }
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if(singleMap){
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+
+        sqRing = ::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if(sqRing == MAP_FAILED){
+            return false;
+        }
+        cqRing = singleMap ? sqRing : ::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(cqRing == MAP_FAILED){
+            return false;
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if(sqes == MAP_FAILED){
+            return false;
+        }
+
+        unsigned char* sq = static_cast<unsigned char*>(sqRing);
+        unsigned char* cq = static_cast<unsigned char*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    //Queues a read and submits it, returns 0 or an errno value
+    int submitRead(int file, void* buffer, unsigned length, long long offset, uint64_t userData){
+        const unsigned tail = *sqTail;
+        const unsigned index = tail & *sqMask;
+        io_uring_sqe& sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = length;
+        sqe.off = static_cast<uint64_t>(offset);
+        sqe.user_data = userData;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        while(::syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0) < 0){
+            if(errno != EINTR){
+                return errno;
+            }
+        }
+        return 0;
+    }
+
+    //Waits for the next completion, returns 0 or an errno value
+    int waitCompletion(uint64_t& userData, int& result){
+        while(true){
+            const unsigned head = *cqHead;
+            if(head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)){
+                const io_uring_cqe& cqe = cqes[head & *cqMask];
+                userData = cqe.user_data;
+                result = cqe.res;
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+            if(::syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR){
+                return errno;
+            }
+        }
+    }
+};
+
+#else
+
+struct PrefetchReader::IoUring {
+    bool setup(unsigned){ return false; }
+    int submitRead(int, void*, unsigned, long long, uint64_t){ return ENOSYS; }
+    int waitCompletion(uint64_t&, int&){ return ENOSYS; }
+};
+
+#endif
+
+PrefetchReader::PrefetchReader(int fd, long long begin, long long end, std::size_t blockSize, int queueDepth, Backend backend)
+    : m_fd{fd}, m_begin{begin}, m_end{std::max(begin, end)}, m_blockSize{std::max<std::size_t>(blockSize, 1)}, m_depth{std::max(queueDepth, 1)} {
+    m_numBlocks = static_cast<long long>((m_end - m_begin + m_blockSize - 1) / m_blockSize);
+    if(m_numBlocks == 0){
+        return;
+    }
+
+    //No point in a ring larger than the range
+    m_depth = static_cast<int>(std::min<long long>(m_depth, m_numBlocks));
+    m_slots.resize(m_depth);
+    for(Slot& slot : m_slots){
+        slot.data.resize(std::min<long long>(m_blockSize, m_end - m_begin));
+    }
+
+    adviseSequential(m_fd, m_begin, m_end - m_begin);
+
+    if(backend != Backend::thread){
+        std::unique_ptr<IoUring> ring(new IoUring());
+        if(ring->setup(static_cast<unsigned>(m_depth))){
+            m_ring = std::move(ring);
+            m_backend = Backend::ioUring;
+            for(long long block = 0; block < m_depth; ++block){
+                submit(block);
+            }
+            return;
+        }
+    }
+
+    m_backend = Backend::thread;
+    m_thread = std::thread(&PrefetchReader::produce, this);
+}
+
+PrefetchReader::~PrefetchReader(){
+    if(m_thread.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        m_thread.join();
+    }
+
+    //The kernel writes into the slots until the reads complete
+    while(m_ring && m_inFlight > 0){
+        uint64_t block;
+        int result;
+        if(m_ring->waitCompletion(block, result)){
+            break;
+        }
+        m_inFlight--;
+    }
+}
+
+PrefetchReader::Backend PrefetchReader::getBackend() const{
+    return m_backend;
+}
+
+long long PrefetchReader::blockOffset(long long block) const{
+    return m_begin + block * static_cast<long long>(m_blockSize);
+}
+
+std::size_t PrefetchReader::blockBytes(long long block) const{
+    return static_cast<std::size_t>(std::min<long long>(m_blockSize, m_end - blockOffset(block)));
+}
+
+void PrefetchReader::submit(long long block){
+    Slot& slot = m_slots[block % m_depth];
+    slot.ready = false;
+
+    const std::size_t bytes = blockBytes(block);
+    if(m_ring->submitRead(m_fd, slot.data.data(), static_cast<unsigned>(bytes), blockOffset(block), static_cast<uint64_t>(block)) == 0){
+        m_inFlight++;
+    }else{
+        //Could not queue it, read it right away instead
+        slot.size = bytes;
+        slot.err = readFileAt(m_fd, slot.data.data(), bytes, blockOffset(block));
+        slot.ready = true;
+    }
+
+    //Let the kernel start on the block after the ring as well, this one is the newest in it
+    if(block + 1 < m_numBlocks){
+        adviseWillNeed(m_fd, blockOffset(block + 1), blockBytes(block + 1));
+    }
+}
+
+void PrefetchReader::complete(long long block, int result){
+    m_inFlight--;
+    Slot& slot = m_slots[block % m_depth];
+    const std::size_t bytes = blockBytes(block);
+    slot.size = bytes;
+    slot.err = 0;
+
+    //Failed (e.g. IORING_OP_READ unsupported) or short reads are finished synchronously
+    if(result < 0){
+        slot.err = readFileAt(m_fd, slot.data.data(), bytes, blockOffset(block));
+    }else if(static_cast<std::size_t>(result) < bytes){
+        slot.err = readFileAt(m_fd, slot.data.data() + result, bytes - result, blockOffset(block) + result);
+    }
+    slot.ready = true;
+}
+
+void PrefetchReader::produce(){
+    for(long long block = 0; block < m_numBlocks; ++block){
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [&]{ return m_stop || block < m_released + m_depth; });
+            if(m_stop){
+                return;
+            }
+        }
+
+        //The consumer does not touch a slot until it is ready
+        Slot& slot = m_slots[block % m_depth];
+        const std::size_t bytes = blockBytes(block);
+        if(block + 1 < m_numBlocks){
+            adviseWillNeed(m_fd, blockOffset(block + 1), blockBytes(block + 1));
+        }
+        const int err = readFileAt(m_fd, slot.data.data(), bytes, blockOffset(block));
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            slot.size = bytes;
+            slot.err = err;
+            slot.ready = true;
+        }
+        m_cond.notify_all();
+
+        if(err){
+            return;
+        }
+    }
+}
+
+void PrefetchReader::releaseCurrent(){
+    const long long next = m_block + m_depth;
+    if(m_ring){
+        m_slots[m_block % m_depth].ready = false;
+        if(next < m_numBlocks){
+            submit(next);
+        }
+    }else{
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_slots[m_block % m_depth].ready = false;
+            m_released++;
+        }
+        m_cond.notify_all();
+    }
+    m_block++;
+    m_pos = 0;
+}
+
+int PrefetchReader::acquire(){
+    if(m_block < m_numBlocks && m_pos == blockBytes(m_block)){
+        releaseCurrent();
+    }
+    if(m_block >= m_numBlocks){
+        return EIO;    //Past the end of the range
+    }
+
+    Slot& slot = m_slots[m_block % m_depth];
+    if(m_ring){
+        while(!slot.ready){
+            uint64_t block = 0;
+            int result = 0;
+            if(int err = m_ring->waitCompletion(block, result)){
+                return err;
+            }
+            complete(static_cast<long long>(block), result);
+        }
+    }else{
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [&]{ return slot.ready; });
+    }
+    return slot.err;
+}
+
+int PrefetchReader::read(void* dst, std::size_t bytes){
+    unsigned char* out = static_cast<unsigned char*>(dst);
+    while(bytes > 0){
+        if(int err = acquire()){
+            return err;
+        }
+        const Slot& slot = m_slots[m_block % m_depth];
+        const std::size_t n = std::min(bytes, slot.size - m_pos);
+        std::memcpy(out, slot.data.data() + m_pos, n);
+        m_pos += n;
+        out += n;
+        bytes -= n;
+    }
+    return 0;
+}
+
+template<typename T>
+int PrefetchReader::readConverted(T* dst, std::size_t count, void (*convert)(const uint64_t*, T*, std::size_t)){
+    while(count > 0){
+        if(int err = acquire()){
+            return err;
+        }
+        const Slot& slot = m_slots[m_block % m_depth];
+        std::size_t n = std::min(count, (slot.size - m_pos) / 8);
+        if(n > 0){
+            //The kernels accept unaligned sources, blocks need not start on a value boundary
+            convert(reinterpret_cast<const uint64_t*>(slot.data.data() + m_pos), dst, n);
+            m_pos += 8 * n;
+        }else{
+            //A value split between two blocks
+            uint64_t value;
+            if(int err = read(&value, 8)){
+                return err;
+            }
+            convert(&value, dst, 1);
+            n = 1;
+        }
+        dst += n;
+        count -= n;
+    }
+    return 0;
+}
+
+int PrefetchReader::readSwapped(uint64_t* dst, std::size_t count){
+    return readConverted<uint64_t>(dst, count, bswap64_array);
+}
+
+int PrefetchReader::readSwapped(float* dst, std::size_t count){
+    return readConverted<float>(dst, count, bswap64_to_float_array);
+}
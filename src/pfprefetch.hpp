@@ -0,0 +1,110 @@
+#ifndef PARFLOWIO_PFPREFETCH_HPP
+#define PARFLOWIO_PFPREFETCH_HPP
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * class: PrefetchReader
+ * Reads a range of a file front to back through a ring of blocks. While the caller consumes (and converts) one block, the
+ * following blocks of the ring are already being read, so the disk and the cpu work at the same time.
+ * The reads are issued with io_uring where the kernel supports it, otherwise by a background thread.
+ * The range is also announced to the kernel with adviseSequential() and adviseWillNeed(), so its own read ahead helps too.
+ * A reader is used by a single thread.
+ */
+class PrefetchReader {
+public:
+    enum class Backend { automatic, thread, ioUring };
+
+    /** Starts reading.
+     * \param   fd          Descriptor returned by openFileReadOnly(), must stay open for the lifetime of the reader.
+     * \param   begin       Offset of the first byte to read.
+     * \param   end         Offset one past the last byte to read.
+     * \param   blockSize   Size of each read.
+     * \param   queueDepth  Number of blocks in the ring, including the one being consumed. 1 disables the overlap.
+     * \param   backend     How the reads are issued. `automatic` prefers io_uring, ioUring falls back to a thread if unavailable.
+     */
+    PrefetchReader(int fd, long long begin, long long end, std::size_t blockSize, int queueDepth, Backend backend = Backend::automatic);
+
+    //Waits for the reads still in flight
+    ~PrefetchReader();
+
+    PrefetchReader(const PrefetchReader&) = delete;
+    PrefetchReader& operator=(const PrefetchReader&) = delete;
+
+    /** Copies the next `bytes` bytes of the range.
+     * \return  0 on success, otherwise an errno value. Reading past the end of the range returns EIO.
+     */
+    int read(void* dst, std::size_t bytes);
+
+    /** Reads the next `count` big endian 64 bit values, converting them to native byte order on the way out of the ring.
+     * \return  0 on success, otherwise an errno value.
+     */
+    int readSwapped(uint64_t* dst, std::size_t count);
+
+    /** Same as above, but narrows the big endian doubles to native floats.
+     */
+    int readSwapped(float* dst, std::size_t count);
+
+    //The backend in use, never `automatic`
+    Backend getBackend() const;
+
+private:
+    struct Slot {
+        std::vector<unsigned char> data;
+        std::size_t size = 0;
+        int err = 0;
+        bool ready = false;
+    };
+
+    struct IoUring;
+
+    long long blockOffset(long long block) const;
+    std::size_t blockBytes(long long block) const;
+
+    //Makes sure the current block is ready and not used up, moving on to the next block if needed
+    int acquire();
+
+    //Hands the slot of the current block back for the block `queueDepth` further on
+    void releaseCurrent();
+
+    //io_uring backend: queues the read of a block, and records a completion
+    void submit(long long block);
+    void complete(long long block, int result);
+
+    //Thread backend: body of the reading thread
+    void produce();
+
+    //Shared by both readSwapped() overloads
+    template<typename T>
+    int readConverted(T* dst, std::size_t count, void (*convert)(const uint64_t*, T*, std::size_t));
+
+    int m_fd;
+    long long m_begin;
+    long long m_end;
+    std::size_t m_blockSize;
+    int m_depth;
+    long long m_numBlocks;
+    Backend m_backend = Backend::thread;
+
+    std::vector<Slot> m_slots;
+    long long m_block = 0;      //Block being consumed
+    std::size_t m_pos = 0;      //Bytes of it consumed
+
+    //Thread backend
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    long long m_released = 0;   //Number of blocks consumed, the thread may read up to m_released + m_depth
+    bool m_stop = false;
+
+    //io_uring backend
+    std::unique_ptr<IoUring> m_ring;
+    int m_inFlight = 0;
+};
+
+#endif //PARFLOWIO_PFPREFETCH_HPP
@@ -0,0 +1,65 @@
+#include "pfreadplan.hpp"
+#include "pfutil.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+//Points closer than this are fetched with one read, the bytes in between are read and discarded
+static const long long MAX_GAP = 4096;
+//Upper bound for a single read
+static const long long MAX_READ = 1LL << 20;
+
+PointReadPlan::PointReadPlan(const std::vector<long long>& offsets) : m_offsets(offsets), m_order(offsets.size()){
+    for(std::size_t i = 0; i < m_order.size(); ++i){
+        m_order[i] = i;
+    }
+    std::sort(m_order.begin(), m_order.end(), [&](std::size_t a, std::size_t b){ return m_offsets[a] < m_offsets[b]; });
+
+    std::size_t first = 0;
+    while(first < m_order.size()){
+        //Grow the run while the next point is close enough
+        const long long runStart = m_offsets[m_order[first]];
+        std::size_t last = first;
+        while(last + 1 < m_order.size()){
+            const long long next = m_offsets[m_order[last + 1]];
+            if(next - m_offsets[m_order[last]] > MAX_GAP || next + 8 - runStart > MAX_READ) break;
+            ++last;
+        }
+
+        Run run;
+        run.offset = runStart;
+        run.bytes = static_cast<std::size_t>(m_offsets[m_order[last]] + 8 - runStart);
+        run.first = first;
+        run.last = last;
+        m_runs.push_back(run);
+        first = last + 1;
+    }
+}
+
+std::size_t PointReadPlan::size() const{
+    return m_offsets.size();
+}
+
+std::size_t PointReadPlan::getNumReads() const{
+    return m_runs.size();
+}
+
+int PointReadPlan::execute(const Reader& read, double* values, std::vector<uint64_t>& scratch) const{
+    for(const Run& run : m_runs){
+        scratch.resize(run.bytes / 8 + 1);
+        if(int err = read(scratch.data(), run.bytes, run.offset)){
+            return err;
+        }
+
+        //Subgrid headers are 36 bytes, so points are not 8 byte aligned relative to each other across subgrids
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(scratch.data());
+        for(std::size_t k = run.first; k <= run.last; ++k){
+            const std::size_t point = m_order[k];
+            uint64_t raw;
+            std::memcpy(&raw, bytes + (m_offsets[point] - run.offset), 8);
+            raw = bswap64(raw);
+            std::memcpy(&values[point], &raw, 8);
+        }
+    }
+    return 0;
+}
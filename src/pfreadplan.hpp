@@ -0,0 +1,52 @@
+#ifndef PARFLOWIO_PFREADPLAN_HPP
+#define PARFLOWIO_PFREADPLAN_HPP
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * class: PointReadPlan
+ * Turns a list of point offsets into a short list of reads. The points are sorted by offset, and points closer than a page
+ * are grouped into a single read. The plan only depends on the offsets, so one plan can be run against many files
+ * with the same layout (see PFSeries).
+ */
+class PointReadPlan {
+public:
+    /** Reads `count` bytes at absolute `offset` into dst, returns 0 on success, otherwise an errno value.
+     */
+    typedef std::function<int(void* dst, std::size_t count, long long offset)> Reader;
+
+    /** Builds the plan.
+     * \param   offsets Absolute file offset of the big endian double of every point, in the order the values are wanted.
+     */
+    explicit PointReadPlan(const std::vector<long long>& offsets);
+
+    //Number of points
+    std::size_t size() const;
+
+    //Number of reads the plan issues
+    std::size_t getNumReads() const;
+
+    /** Runs the plan.
+     * \param   read    Reads the raw bytes from the file.
+     * \param   values  Destination, size() elements, in the order of the offsets given to the constructor.
+     * \param   scratch Buffer reused between calls, grown as needed.
+     * \return          0 on success, otherwise the first error returned by read.
+     */
+    int execute(const Reader& read, double* values, std::vector<uint64_t>& scratch) const;
+
+private:
+    struct Run {
+        long long offset;
+        std::size_t bytes;
+        std::size_t first;  //Range [first, last] of m_order covered by the read
+        std::size_t last;
+    };
+
+    std::vector<long long> m_offsets;
+    std::vector<std::size_t> m_order;
+    std::vector<Run> m_runs;
+};
+
+#endif //PARFLOWIO_PFREADPLAN_HPP
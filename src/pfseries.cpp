@@ -0,0 +1,189 @@
+#include "parflow/pfseries.hpp"
+#include "pffile.hpp"
+#include "pfreadplan.hpp"
+#include "pfthreadpool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+//File header plus the headers of the first and last subgrid, which together with the file size tell the subgrid layout apart
+static const std::size_t PREFIX_SIZE = 64 + 36 + 36;
+
+//Reads the file header and first subgrid header at the start of the file, and the last subgrid header at lastOffset
+static int readPrefix(int fd, long long lastOffset, std::vector<unsigned char>& prefix){
+    if(int err = readFileAt(fd, prefix.data(), 64 + 36, 0)){
+        return err;
+    }
+    return readFileAt(fd, prefix.data() + 64 + 36, 36, lastOffset);
+}
+
+//Expands a printf style pattern over a range of file numbers
+static std::vector<std::string> expandPattern(const std::string& pattern, int first, int last, int step){
+    std::vector<std::string> filenames;
+    if(step < 1){
+        return filenames;
+    }
+
+    std::vector<char> buffer(pattern.size() + 32);
+    for(int i = first; i <= last; i += step){
+        const int length = std::snprintf(buffer.data(), buffer.size(), pattern.c_str(), i);
+        if(length < 0){
+            break;
+        }
+        if(static_cast<std::size_t>(length) >= buffer.size()){
+            buffer.resize(length + 1);
+            std::snprintf(buffer.data(), buffer.size(), pattern.c_str(), i);
+        }
+        filenames.emplace_back(buffer.data(), length);
+    }
+    return filenames;
+}
+
+PFSeries::PFSeries(const std::string& pattern, int first, int last, int step)
+    : PFSeries(expandPattern(pattern, first, last, step)){
+}
+
+PFSeries::PFSeries(const std::vector<std::string>& filenames)
+    : m_filenames(filenames), m_header(filenames.empty() ? std::string() : filenames.front()){
+}
+
+int PFSeries::loadHeader(){
+    m_prefix.clear();
+    m_compressed = false;
+    if(m_filenames.empty()){
+        return 1;
+    }
+
+    if(int err = m_header.loadHeader()){
+        return err;
+    }
+    if(int err = m_header.loadSubgridIndex()){
+        return err;
+    }
+    //Offsets only need the index from here on
+    m_header.close();
+
+    //Points of compressed files have no offset, every file is decompressed on its own
+    if(m_header.isCompressed()){
+        m_compressed = true;
+        return 0;
+    }
+
+    const SubgridIndex& index = m_header.getSubgridIndex();
+    const long long lastOffset = index.at(index.size() - 1).offset;
+
+    const int fd = openFileReadOnly(m_filenames.front());
+    if(fd < 0){
+        perror("Error opening file");
+        return 1;
+    }
+    std::vector<unsigned char> prefix(PREFIX_SIZE);
+    const int err = readPrefix(fd, lastOffset, prefix);
+    const long long fileSize = getFileSize(fd);
+    closeFileDescriptor(fd);
+    if(err){
+        return err;
+    }
+
+    m_prefix.swap(prefix);
+    m_lastOffset = lastOffset;
+    m_fileSize = fileSize;
+    return 0;
+}
+
+int PFSeries::getNumFiles() const{
+    return static_cast<int>(m_filenames.size());
+}
+
+const std::string& PFSeries::getFilename(int index) const{
+    return m_filenames[index];
+}
+
+const PFData& PFSeries::getHeader() const{
+    return m_header;
+}
+
+std::vector<double> PFSeries::readPoints(const std::vector<std::array<int, 3>>& points, int numThreads) const{
+    if(m_prefix.empty() && !m_compressed){
+        std::cerr << "Error reading series, the header is not loaded\n";
+        return std::vector<double>();
+    }
+
+    std::vector<long long> offsets(points.size());
+    for(std::size_t i = 0; i < points.size(); ++i){
+        const std::array<int, 3>& p = points[i];
+        if(p[0] < 0 || p[0] >= m_header.getNZ() || p[1] < 0 || p[1] >= m_header.getNY() || p[2] < 0 || p[2] >= m_header.getNX()){
+            std::cerr << "Error reading point (ZYX): {" << p[0] << ", " << p[1] << ", " << p[2] << "}, outside of the grid\n";
+            return std::vector<double>();
+        }
+        offsets[i] = m_compressed ? 0 : m_header.getPointOffset(p[0], p[1], p[2]);
+    }
+
+    //The plan only depends on the layout, so it is shared by every file with the same prefix and size
+    const PointReadPlan plan(offsets);
+    const std::size_t numPoints = points.size();
+    std::vector<double> result(m_filenames.size() * numPoints);
+
+    numThreads = std::max(1, numThreads);
+    std::vector<std::vector<uint64_t>> scratch(numThreads);
+    std::vector<std::vector<unsigned char>> prefixes(numThreads, std::vector<unsigned char>(PREFIX_SIZE));
+
+    const int err = PFThreadPool::shared().parallelFor(getNumFiles(), numThreads, [&](int file, int worker){
+        double* values = result.data() + file * numPoints;
+
+        if(!m_compressed){
+            const int fd = openFileReadOnly(m_filenames[file]);
+            if(fd < 0){
+                const int openErr = errno ? errno : ENOENT;
+                std::cerr << "Error opening " << m_filenames[file] << ": " << std::strerror(openErr) << "\n";
+                return openErr;
+            }
+
+            std::vector<unsigned char>& prefix = prefixes[worker];
+            int ret = getFileSize(fd) == m_fileSize ? readPrefix(fd, m_lastOffset, prefix) : EINVAL;
+            if(ret == 0 && prefix == m_prefix){
+                ret = plan.execute([fd](void* dst, std::size_t count, long long offset){
+                    return readFileAt(fd, dst, count, offset);
+                }, values, scratch[worker]);
+                closeFileDescriptor(fd);
+                return ret;
+            }
+            closeFileDescriptor(fd);
+        }
+
+        //Different layout, or a compressed file, parse this file on its own
+        PFData other(m_filenames[file]);
+        if(other.loadHeader() || other.getNZ() != m_header.getNZ() || other.getNY() != m_header.getNY()
+           || other.getNX() != m_header.getNX() || other.loadSubgridIndex()){
+            std::cerr << "Error reading " << m_filenames[file] << ", the grid differs from the first file of the series\n";
+            return EINVAL;
+        }
+        const std::vector<double> otherValues = other.fileReadPoints(points);
+        if(otherValues.size() != numPoints){
+            return EIO;
+        }
+        std::copy(otherValues.begin(), otherValues.end(), values);
+        return 0;
+    });
+
+    if(err){
+        return std::vector<double>();
+    }
+    return result;
+}
+
+std::vector<double> PFSeries::readPoint(int z, int y, int x, int numThreads) const{
+    return readPoints(std::vector<std::array<int, 3>>(1, std::array<int, 3>{{z, y, x}}), numThreads);
+}
+
+std::vector<double> PFSeries::readColumn(int y, int x, int numThreads) const{
+    std::vector<std::array<int, 3>> points(m_header.getNZ());
+    for(int z = 0; z < m_header.getNZ(); ++z){
+        points[z] = std::array<int, 3>{{z, y, x}};
+    }
+    return readPoints(points, numThreads);
+}
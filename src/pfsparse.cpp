@@ -0,0 +1,302 @@
+#include "parflow/pfdata.hpp"
+#include "pffile.hpp"
+#include "pfprefetch.hpp"
+#include "pfutil.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Size of a point in a scattered file: big endian i, j, k, and the value
+static const std::size_t SPARSE_POINT_BYTES = 20;
+
+//Size of the reads of the scattered reader
+static const std::size_t SPARSE_READ_BYTES = 4u << 20;
+
+//Appends a point to the points of a subgrid, in file format
+static void appendPoint(std::vector<unsigned char>& points, int x, int y, int z, double value){
+    const std::size_t pos = points.size();
+    points.resize(pos + SPARSE_POINT_BYTES);
+
+    const uint32_t coords[3] = {bswap32(static_cast<uint32_t>(x)), bswap32(static_cast<uint32_t>(y)), bswap32(static_cast<uint32_t>(z))};
+    uint64_t bits;
+    std::memcpy(&bits, &value, 8);
+    bits = bswap64(bits);
+    std::memcpy(&points[pos], coords, 12);
+    std::memcpy(&points[pos + 12], &bits, 8);
+}
+
+/** Reads every subgrid of a scattered file front to back, handing each point to store(index, value).
+ * \param   headers     [out] Header of every subgrid, offset is the offset of the subgrid header.
+ * \return              0 on success, otherwise an errno value.
+ */
+template<typename Store>
+static int readScattered(int fd, int prefetchDepth, int numSubgrids, int nz, int ny, int nx, std::vector<PFSubgridHeader>& headers, Store store){
+    if(numSubgrids < 1 || nz < 1 || ny < 1 || nx < 1){
+        return EINVAL;
+    }
+
+    PrefetchReader reader(fd, 64, getFileSize(fd), SPARSE_READ_BYTES, prefetchDepth);
+    std::vector<unsigned char> points;
+    long long offset = 64;
+
+    headers.assign(numSubgrids, PFSubgridHeader());
+    for(int i = 0; i < numSubgrids; ++i){
+        //Subgrid header, followed by the number of points
+        uint32_t buf[10];
+        if(int err = reader.read(buf, sizeof(buf))){
+            return err;
+        }
+        PFSubgridHeader& header = headers[i];
+        header.ix = static_cast<int>(bswap32(buf[0]));
+        header.iy = static_cast<int>(bswap32(buf[1]));
+        header.iz = static_cast<int>(bswap32(buf[2]));
+        header.nx = static_cast<int>(bswap32(buf[3]));
+        header.ny = static_cast<int>(bswap32(buf[4]));
+        header.nz = static_cast<int>(bswap32(buf[5]));
+        header.rx = static_cast<int>(bswap32(buf[6]));
+        header.ry = static_cast<int>(bswap32(buf[7]));
+        header.rz = static_cast<int>(bswap32(buf[8]));
+        header.offset = offset;
+
+        long long numPoints = static_cast<int>(bswap32(buf[9]));
+        if(numPoints < 0 || numPoints > static_cast<long long>(nz) * ny * nx){
+            return EINVAL;
+        }
+        offset += sizeof(buf) + SPARSE_POINT_BYTES * numPoints;
+
+        while(numPoints > 0){
+            const long long batch = std::min<long long>(numPoints, SPARSE_READ_BYTES / SPARSE_POINT_BYTES);
+            points.resize(static_cast<std::size_t>(batch) * SPARSE_POINT_BYTES);
+            if(int err = reader.read(points.data(), points.size())){
+                return err;
+            }
+
+            for(const unsigned char* point = points.data(); point < points.data() + points.size(); point += SPARSE_POINT_BYTES){
+                uint32_t coords[3];
+                uint64_t bits;
+                std::memcpy(coords, point, 12);
+                std::memcpy(&bits, point + 12, 8);
+                const int x = static_cast<int>(bswap32(coords[0]));
+                const int y = static_cast<int>(bswap32(coords[1]));
+                const int z = static_cast<int>(bswap32(coords[2]));
+                if(x < 0 || x >= nx || y < 0 || y >= ny || z < 0 || z >= nz){
+                    return EINVAL;
+                }
+
+                bits = bswap64(bits);
+                double value;
+                std::memcpy(&value, &bits, 8);
+                store((static_cast<long long>(z) * ny + y) * nx + x, value);
+            }
+            numPoints -= batch;
+        }
+    }
+    return 0;
+}
+
+//Processor topology of the subgrid headers, counted the same way as SubgridIndex
+static std::array<int, 3> scatteredTopology(const std::vector<PFSubgridHeader>& headers){
+    const PFSubgridHeader& first = headers.front();
+    std::array<int, 3> pqr{{0, 0, 0}};
+    for(const PFSubgridHeader& header : headers){
+        if(header.iy == first.iy && header.iz == first.iz) pqr[0]++;
+        if(header.ix == first.ix && header.iz == first.iz) pqr[1]++;
+        if(header.ix == first.ix && header.iy == first.iy) pqr[2]++;
+    }
+    return pqr;
+}
+
+int PFData::loadSparse(PFSparseData& sparse){
+    if(m_fd < 0){
+        return 1;
+    }
+
+    sparse.indices.clear();
+    sparse.values.clear();
+    std::vector<PFSubgridHeader> headers;
+    const int err = readScattered(m_fd, m_prefetchDepth, m_numSubgrids, m_nz, m_ny, m_nx, headers, [&](long long index, double value){
+        sparse.indices.push_back(index);
+        sparse.values.push_back(value);
+    });
+    if(err){
+        std::cerr << "loadSparse: error reading " << m_filename << ", error code " << err << ": " << std::strerror(err) << "\n";
+        return err;
+    }
+
+    const std::array<int, 3> pqr = scatteredTopology(headers);
+    m_p = pqr[0];
+    m_q = pqr[1];
+    m_r = pqr[2];
+    return 0;
+}
+
+int PFData::loadSparseData(){
+    if(m_fd < 0){
+        return 1;
+    }
+
+    const std::size_t count = static_cast<std::size_t>(m_nx) * m_ny * m_nz;
+    if(int err = allocateLoadBuffer(count)){
+        return err;
+    }
+    if(m_loadAsFloat){
+        std::fill(m_floatData, m_floatData + count, 0.0f);
+    }else{
+        std::fill(m_data, m_data + count, 0.0);
+    }
+
+    std::vector<PFSubgridHeader> headers;
+    int err;
+    if(m_loadAsFloat){
+        err = readScattered(m_fd, m_prefetchDepth, m_numSubgrids, m_nz, m_ny, m_nx, headers, [&](long long index, double value){
+            m_floatData[index] = static_cast<float>(value);
+        });
+    }else{
+        err = readScattered(m_fd, m_prefetchDepth, m_numSubgrids, m_nz, m_ny, m_nx, headers, [&](long long index, double value){
+            m_data[index] = value;
+        });
+    }
+    if(err){
+        std::cerr << "loadSparseData: error reading " << m_filename << ", error code " << err << ": " << std::strerror(err) << "\n";
+        return err;
+    }
+
+    const std::array<int, 3> pqr = scatteredTopology(headers);
+    m_p = pqr[0];
+    m_q = pqr[1];
+    m_r = pqr[2];
+    return 0;
+}
+
+int PFData::writeScattered(const std::string& filename, const std::function<void(int, std::vector<unsigned char>&)>& emitPoints) const{
+    if(m_p < 1 || m_q < 1 || m_r < 1 || m_p > m_nx || m_q > m_ny || m_r > m_nz){
+        std::cerr << "Invalid processor topology " << m_p << " x " << m_q << " x " << m_r << " for writing " << filename << "\n";
+        return 1;
+    }
+
+    const int fd = openFileWrite(filename);
+    if(fd < 0){
+        std::string err{"Error opening file: \"" + filename + "\""};
+        perror(err.c_str());
+        return 1;
+    }
+
+    unsigned char header[64];
+    encodeFileHeader(header);
+    int err = writeFileAt(fd, header, 64, 0);
+    long long offset = 64;
+
+    std::vector<unsigned char> points;
+    const int numSubgrids = m_p * m_q * m_r;
+    for(int i = 0; i < numSubgrids && !err; ++i){
+        points.clear();
+        emitPoints(i, points);
+
+        //Subgrid header, followed by the number of points
+        encodeSubgridHeader(header, i / (m_p * m_q), i / m_p % m_q, i % m_p);
+        const uint32_t numPoints = bswap32(static_cast<uint32_t>(points.size() / SPARSE_POINT_BYTES));
+        std::memcpy(header + 36, &numPoints, 4);
+
+        err = writeFileAt(fd, header, 40, offset);
+        if(!err){
+            err = writeFileAt(fd, points.data(), points.size(), offset + 40);
+        }
+        offset += 40 + static_cast<long long>(points.size());
+    }
+    closeFileDescriptor(fd);
+
+    if(err){
+        std::cerr << "Error writing " << filename << ", error code " << err << ": " << std::strerror(err) << "\n";
+        return err;
+    }
+    return 0;
+}
+
+int PFData::writeSparseFile(const std::string& filename, double dropTolerance) const{
+    if(m_data == nullptr){
+        std::cerr << "writeSparseFile: no double precision data to write\n";
+        return 1;
+    }
+    if(m_indexOrder != "zyx"){
+        std::cerr << "writeSparseFile: the index order must be \"zyx\", see setIndexOrder()\n";
+        return 1;
+    }
+
+    return writeScattered(filename, [&](int subgrid, std::vector<unsigned char>& points){
+        const std::array<int, 3> idx = {{subgrid / (m_p * m_q), subgrid / m_p % m_q, subgrid % m_p}};
+        const int x0 = getSubgridStartX(idx[2]), nx = getSubgridSizeX(idx[2]);
+        const int y0 = getSubgridStartY(idx[1]), ny = getSubgridSizeY(idx[1]);
+        const int z0 = getSubgridStartZ(idx[0]), nz = getSubgridSizeZ(idx[0]);
+        for(int z = z0; z < z0 + nz; ++z){
+            for(int y = y0; y < y0 + ny; ++y){
+                const double* row = m_data + (static_cast<std::size_t>(z) * m_ny + y) * m_nx;
+                for(int x = x0; x < x0 + nx; ++x){
+                    //Written this way round so NaN values are kept
+                    if(!(std::fabs(row[x]) <= dropTolerance)){
+                        appendPoint(points, x, y, z, row[x]);
+                    }
+                }
+            }
+        }
+    });
+}
+
+int PFData::writeSparseFile(const std::string& filename, const PFSparseData& sparse) const{
+    const long long count = static_cast<long long>(m_nx) * m_ny * m_nz;
+    if(sparse.indices.size() != sparse.values.size()){
+        std::cerr << "writeSparseFile: " << sparse.indices.size() << " indices, but " << sparse.values.size() << " values\n";
+        return 1;
+    }
+    if(m_p < 1 || m_q < 1 || m_r < 1 || m_p > m_nx || m_q > m_ny || m_r > m_nz){
+        std::cerr << "Invalid processor topology " << m_p << " x " << m_q << " x " << m_r << " for writing " << filename << "\n";
+        return 1;
+    }
+
+    //Group the points by subgrid with a counting sort, then order each subgrid by index, which is the file order
+    const int numSubgrids = m_p * m_q * m_r;
+    std::vector<int> subgridOf(sparse.indices.size());
+    std::vector<std::size_t> begin(numSubgrids + 1, 0);
+    for(std::size_t i = 0; i < sparse.indices.size(); ++i){
+        const long long index = sparse.indices[i];
+        if(index < 0 || index >= count){
+            std::cerr << "writeSparseFile: index " << index << " is outside of the grid\n";
+            return 1;
+        }
+        const int x = static_cast<int>(index % m_nx);
+        const int y = static_cast<int>(index / m_nx % m_ny);
+        const int z = static_cast<int>(index / (static_cast<long long>(m_nx) * m_ny));
+        subgridOf[i] = (getSubgridIndexZ(z) * m_q + getSubgridIndexY(y)) * m_p + getSubgridIndexX(x);
+        begin[subgridOf[i] + 1]++;
+    }
+    for(int i = 0; i < numSubgrids; ++i){
+        begin[i + 1] += begin[i];
+    }
+
+    std::vector<std::size_t> order(sparse.indices.size());
+    std::vector<std::size_t> next(begin.begin(), begin.end() - 1);
+    for(std::size_t i = 0; i < sparse.indices.size(); ++i){
+        order[next[subgridOf[i]]++] = i;
+    }
+    for(int i = 0; i < numSubgrids; ++i){
+        std::sort(order.begin() + begin[i], order.begin() + begin[i + 1], [&](std::size_t a, std::size_t b){
+            return sparse.indices[a] < sparse.indices[b];
+        });
+    }
+
+    return writeScattered(filename, [&](int subgrid, std::vector<unsigned char>& points){
+        points.reserve(SPARSE_POINT_BYTES * (begin[subgrid + 1] - begin[subgrid]));
+        for(std::size_t j = begin[subgrid]; j < begin[subgrid + 1]; ++j){
+            const long long index = sparse.indices[order[j]];
+            appendPoint(points, static_cast<int>(index % m_nx), static_cast<int>(index / m_nx % m_ny),
+                        static_cast<int>(index / (static_cast<long long>(m_nx) * m_ny)), sparse.values[order[j]]);
+        }
+    });
+}
@@ -0,0 +1,275 @@
+#include "parflow/pfdata.hpp"
+#include "pfthreadpool.hpp"
+#include "pfutil.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+//Upper bound of the rows read from the file at once by a single job
+static const std::size_t STATISTICS_READ_BYTES = 1u << 20;
+
+namespace {
+
+//Running statistics, without the histogram. m2 is the sum of squared differences from the mean.
+struct Moments {
+    long long count = 0;
+    long long numNaN = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    double sum = 0.0;
+    double mean = 0.0;
+    double m2 = 0.0;
+};
+
+//Combines the moments of two disjoint sets of values (Chan et al.), which stays accurate for large counts
+void mergeMoments(Moments& into, const Moments& other){
+    into.numNaN += other.numNaN;
+    if(other.count == 0){
+        return;
+    }
+    if(into.count == 0){
+        const long long numNaN = into.numNaN;
+        into = other;
+        into.numNaN = numNaN;
+        return;
+    }
+
+    const double count = static_cast<double>(into.count + other.count);
+    const double delta = other.mean - into.mean;
+    into.mean += delta * other.count / count;
+    into.m2 += other.m2 + delta * delta * (static_cast<double>(into.count) * other.count / count);
+    into.count += other.count;
+    into.sum += other.sum;
+    into.min = std::min(into.min, other.min);
+    into.max = std::max(into.max, other.max);
+}
+
+//Moments of a single row, with a second pass over the row (still in cache) for the squared differences
+Moments rowMoments(const double* values, int n){
+    Moments row;
+    for(int i = 0; i < n; ++i){
+        const double v = values[i];
+        if(std::isnan(v)){
+            row.numNaN++;
+            continue;
+        }
+        row.count++;
+        row.sum += v;
+        row.min = std::min(row.min, v);
+        row.max = std::max(row.max, v);
+    }
+    if(row.count == 0){
+        return row;
+    }
+
+    row.mean = row.sum / row.count;
+    for(int i = 0; i < n; ++i){
+        const double v = values[i];
+        if(!std::isnan(v)){
+            row.m2 += (v - row.mean) * (v - row.mean);
+        }
+    }
+    return row;
+}
+
+PFStatistics toStatistics(const Moments& moments, std::vector<long long>&& histogram){
+    PFStatistics stats;
+    stats.count = moments.count;
+    stats.numNaN = moments.numNaN;
+    if(moments.count > 0){
+        stats.min = moments.min;
+        stats.max = moments.max;
+        stats.sum = moments.sum;
+        stats.mean = moments.mean;
+        stats.variance = moments.m2 / moments.count;
+    }
+    stats.histogram = std::move(histogram);
+    return stats;
+}
+
+//A range of Z layers of a single subgrid
+struct StatisticsJob {
+    int subgrid;
+    int zBegin;
+    int zEnd;
+};
+
+} //namespace
+
+int PFData::computeStatistics(PFStatisticsReport& report, int numThreads, int numBins, double histogramMin, double histogramMax) const{
+    if(numBins < 0 || (numBins > 0 && !(histogramMax > histogramMin))){
+        std::cerr << "computeStatistics: invalid histogram of " << numBins << " bins over [" << histogramMin << ", " << histogramMax << "]\n";
+        return EINVAL;
+    }
+
+    const bool inMemory = m_data != nullptr || m_floatData != nullptr;
+    const bool topology = hasTopology();
+    if(!inMemory && (!topology || (m_fd < 0 && m_map == nullptr))){
+        std::cerr << "computeStatistics: no data is loaded, and the file is not open with a known topology (loadHeader() and loadPQR())\n";
+        return EINVAL;
+    }
+    if(!inMemory && m_compressed){
+        std::cerr << "computeStatistics: " << m_filename << " is compressed, load the data first (loadData())\n";
+        return EINVAL;
+    }
+    if(m_nz <= 0 || m_ny <= 0 || m_nx <= 0){
+        return EINVAL;
+    }
+
+    //Loaded data without a topology is treated as a single subgrid
+    const int p = topology ? m_p : 1;
+    const int q = topology ? m_q : 1;
+    const int r = topology ? m_r : 1;
+    const int numSubgrids = p * q * r;
+    auto startX = [&](int gridX){ return topology ? getSubgridStartX(gridX) : 0; };
+    auto startY = [&](int gridY){ return topology ? getSubgridStartY(gridY) : 0; };
+    auto startZ = [&](int gridZ){ return topology ? getSubgridStartZ(gridZ) : 0; };
+    auto sizeX = [&](int gridX){ return topology ? getSubgridSizeX(gridX) : m_nx; };
+    auto sizeY = [&](int gridY){ return topology ? getSubgridSizeY(gridY) : m_ny; };
+    auto sizeZ = [&](int gridZ){ return topology ? getSubgridSizeZ(gridZ) : m_nz; };
+
+    //Moments of every layer of every subgrid, merged in a fixed order at the end so the sums do not depend on scheduling
+    std::vector<std::size_t> partialOffset(numSubgrids + 1, 0);
+    for(int i = 0; i < numSubgrids; ++i){
+        partialOffset[i + 1] = partialOffset[i] + sizeZ(i / (p * q));
+    }
+    std::vector<Moments> partials(partialOffset.back());
+
+    //Split the subgrids into layer ranges when there are too few of them to keep every thread busy
+    numThreads = std::max(1, numThreads);
+    const int splits = std::max(1, (4 * numThreads + numSubgrids - 1) / numSubgrids);
+    std::vector<StatisticsJob> jobs;
+    for(int i = 0; i < numSubgrids; ++i){
+        const int nz = sizeZ(i / (p * q));
+        const int parts = std::min(splits, nz);
+        for(int part = 0; part < parts; ++part){
+            jobs.push_back({i, nz * part / parts, nz * (part + 1) / parts});
+        }
+    }
+
+    //Histogram counts are integers, so per worker arrays can be summed in any order
+    numThreads = std::min(numThreads, static_cast<int>(jobs.size()));
+    std::vector<std::vector<long long>> layerHistograms(numThreads, std::vector<long long>(static_cast<std::size_t>(m_nz) * numBins, 0));
+    std::vector<std::vector<long long>> subgridHistograms(numThreads, std::vector<long long>(static_cast<std::size_t>(numSubgrids) * numBins, 0));
+    std::vector<std::vector<uint64_t>> buffers(numThreads);
+    const double binScale = numBins > 0 ? numBins / (histogramMax - histogramMin) : 0.0;
+
+    const int err = PFThreadPool::shared().parallelFor(static_cast<int>(jobs.size()), numThreads, [&](int jobIndex, int worker) -> int{
+        const StatisticsJob& job = jobs[jobIndex];
+        const int gridZ = job.subgrid / (p * q);
+        const int gridY = (job.subgrid / p) % q;
+        const int gridX = job.subgrid % p;
+        const int nx = sizeX(gridX);
+        const int ny = sizeY(gridY);
+        const int x0 = startX(gridX);
+        const int y0 = startY(gridY);
+        const int z0 = startZ(gridZ);
+
+        long long* layerHistogram = layerHistograms[worker].data();
+        long long* subgridHistogram = subgridHistograms[worker].data() + static_cast<std::size_t>(job.subgrid) * numBins;
+        std::vector<uint64_t>& buffer = buffers[worker];
+
+        //Rows of a subgrid are contiguous in the file, read as many as fit the buffer at once
+        const long long rowsPerRead = std::max<long long>(1, STATISTICS_READ_BYTES / (8 * static_cast<std::size_t>(nx)));
+        const long long rowBegin = static_cast<long long>(job.zBegin) * ny;
+        const long long rowEnd = static_cast<long long>(job.zEnd) * ny;
+        const long long dataOffset = inMemory ? 0 : getSubgridOffset(gridZ, gridY, gridX) + 36;
+
+        for(long long chunk = rowBegin; chunk < rowEnd; chunk += rowsPerRead){
+            const long long numRows = std::min(rowsPerRead, rowEnd - chunk);
+            buffer.resize(static_cast<std::size_t>(numRows) * nx);
+            double* values = reinterpret_cast<double*>(buffer.data());
+
+            if(inMemory){
+                for(long long row = 0; row < numRows; ++row){
+                    const int z = z0 + static_cast<int>((chunk + row) / ny);
+                    const int y = y0 + static_cast<int>((chunk + row) % ny);
+                    const std::size_t index = (static_cast<std::size_t>(z) * m_ny + y) * m_nx + x0;
+                    if(m_data){
+                        std::memcpy(values + row * nx, m_data + index, 8 * static_cast<std::size_t>(nx));
+                    }else{
+                        std::copy(m_floatData + index, m_floatData + index + nx, values + row * nx);
+                    }
+                }
+            }else{
+                if(int readErr = readRaw(buffer.data(), 8 * buffer.size(), dataOffset + 8 * chunk * nx)){
+                    return readErr;
+                }
+                bswap64_array_inplace(buffer.data(), buffer.size());
+            }
+
+            for(long long row = 0; row < numRows; ++row){
+                const int localZ = static_cast<int>((chunk + row) / ny);
+                const double* rowValues = values + row * nx;
+                mergeMoments(partials[partialOffset[job.subgrid] + localZ], rowMoments(rowValues, nx));
+
+                if(numBins > 0){
+                    long long* layerBins = layerHistogram + static_cast<std::size_t>(z0 + localZ) * numBins;
+                    for(int i = 0; i < nx; ++i){
+                        const double v = rowValues[i];
+                        if(std::isnan(v)){
+                            continue;
+                        }
+                        //Clamp before converting, the position of infinities is not representable as an int
+                        const double position = (v - histogramMin) * binScale;
+                        const int bin = position < 0.0 ? 0 : (position >= numBins ? numBins - 1 : static_cast<int>(position));
+                        layerBins[bin]++;
+                        subgridHistogram[bin]++;
+                    }
+                }
+            }
+        }
+        return 0;
+    });
+    if(err){
+        std::cerr << "computeStatistics: error code " << err << ": " << std::strerror(err) << "\n";
+        return err;
+    }
+
+    //Per subgrid, and per layer, in a fixed order
+    std::vector<Moments> layerMoments(m_nz);
+    report.subgrids.assign(numSubgrids, PFStatistics());
+    for(int i = 0; i < numSubgrids; ++i){
+        const int z0 = startZ(i / (p * q));
+        Moments subgrid;
+        for(std::size_t j = partialOffset[i]; j < partialOffset[i + 1]; ++j){
+            mergeMoments(subgrid, partials[j]);
+            mergeMoments(layerMoments[z0 + (j - partialOffset[i])], partials[j]);
+        }
+
+        std::vector<long long> histogram(numBins, 0);
+        for(const std::vector<long long>& workerHistograms : subgridHistograms){
+            for(int bin = 0; bin < numBins; ++bin){
+                histogram[bin] += workerHistograms[static_cast<std::size_t>(i) * numBins + bin];
+            }
+        }
+        report.subgrids[i] = toStatistics(subgrid, std::move(histogram));
+    }
+
+    Moments total;
+    std::vector<long long> totalHistogram(numBins, 0);
+    report.layers.assign(m_nz, PFStatistics());
+    for(int z = 0; z < m_nz; ++z){
+        mergeMoments(total, layerMoments[z]);
+
+        std::vector<long long> histogram(numBins, 0);
+        for(const std::vector<long long>& workerHistograms : layerHistograms){
+            for(int bin = 0; bin < numBins; ++bin){
+                histogram[bin] += workerHistograms[static_cast<std::size_t>(z) * numBins + bin];
+            }
+        }
+        for(int bin = 0; bin < numBins; ++bin){
+            totalHistogram[bin] += histogram[bin];
+        }
+        report.layers[z] = toStatistics(layerMoments[z], std::move(histogram));
+    }
+    report.total = toStatistics(total, std::move(totalHistogram));
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "parflow/pfdata.hpp"
+
+#include <utility>
+#include <vector>
+
+void SubgridCache::makeRoom(std::size_t extra){
+    while(!m_entries.empty() && m_size + extra > m_budget){
+        //Linear scan for the oldest entry, a miss costs a read from disk anyway
+        auto oldest = m_entries.begin();
+        for(auto it = m_entries.begin(); it != m_entries.end(); ++it){
+            if(it->second.lastUse < oldest->second.lastUse){
+                oldest = it;
+            }
+        }
+        m_size -= oldest->second.values.size() * sizeof(double);
+        m_entries.erase(oldest);
+    }
+}
+
+void SubgridCache::setBudget(std::size_t bytes){
+    m_budget = bytes;
+    makeRoom(0);
+}
+
+std::size_t SubgridCache::getBudget() const{
+    return m_budget;
+}
+
+std::size_t SubgridCache::getSize() const{
+    return m_size;
+}
+
+int SubgridCache::getNumEntries() const{
+    return static_cast<int>(m_entries.size());
+}
+
+const std::vector<double>* SubgridCache::find(int subgrid){
+    auto it = m_entries.find(subgrid);
+    if(it == m_entries.end()){
+        return nullptr;
+    }
+    it->second.lastUse = ++m_clock;
+    return &it->second.values;
+}
+
+const std::vector<double>& SubgridCache::insert(int subgrid, std::vector<double>&& values){
+    auto existing = m_entries.find(subgrid);
+    if(existing != m_entries.end()){
+        m_size -= existing->second.values.size() * sizeof(double);
+        m_entries.erase(existing);
+    }
+
+    const std::size_t bytes = values.size() * sizeof(double);
+    makeRoom(bytes);
+
+    Entry& entry = m_entries[subgrid];
+    entry.values = std::move(values);
+    entry.lastUse = ++m_clock;
+    m_size += bytes;
+    return entry.values;
+}
+
+void SubgridCache::clear(){
+    m_entries.clear();
+    m_size = 0;
+}
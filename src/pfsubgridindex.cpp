@@ -0,0 +1,307 @@
+#include "parflow/pfdata.hpp"
+#include "pfutil.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Version of the sidecar format written by SubgridIndex::save()
+static const int SUBGRID_INDEX_VERSION = 2;
+
+//Reads a 36 byte subgrid header at the current position of fp
+static int readSubgridHeader(std::FILE* fp, long long offset, PFSubgridHeader& header){
+    uint32_t buf[9];
+    if(std::fread(buf, 4, 9, fp) != 9){
+        return 1;
+    }
+
+    header.ix = static_cast<int>(bswap32(buf[0]));
+    header.iy = static_cast<int>(bswap32(buf[1]));
+    header.iz = static_cast<int>(bswap32(buf[2]));
+    header.nx = static_cast<int>(bswap32(buf[3]));
+    header.ny = static_cast<int>(bswap32(buf[4]));
+    header.nz = static_cast<int>(bswap32(buf[5]));
+    header.rx = static_cast<int>(bswap32(buf[6]));
+    header.ry = static_cast<int>(bswap32(buf[7]));
+    header.rz = static_cast<int>(bswap32(buf[8]));
+    header.offset = offset;
+    return 0;
+}
+
+//Returns the size of the file behind fp, restoring its position. -1 on error.
+static long long getFileSize(std::FILE* fp){
+    std::fpos_t pos{};
+    std::fgetpos(fp, &pos);
+    std::fseek(fp, 0, SEEK_END);
+    const long long size = std::ftell(fp);
+    std::fsetpos(fp, &pos);
+    return size;
+}
+
+//Checksum of the file header and the headers of the first and last subgrid, which together pin down the layout
+static int sourceChecksum(std::FILE* fp, long long lastOffset, uint64_t& checksum){
+    unsigned char fileHeader[64];
+    unsigned char first[36];
+    unsigned char last[36];
+
+    std::fpos_t pos{};
+    std::fgetpos(fp, &pos);
+    const bool headersRead = !std::fseek(fp, 0, SEEK_SET) && std::fread(fileHeader, 1, sizeof(fileHeader), fp) == sizeof(fileHeader)
+                          && !std::fseek(fp, 64, SEEK_SET) && std::fread(first, 1, sizeof(first), fp) == sizeof(first)
+                          && !std::fseek(fp, lastOffset, SEEK_SET) && std::fread(last, 1, sizeof(last), fp) == sizeof(last);
+    std::fsetpos(fp, &pos);
+    if(!headersRead){
+        return 1;
+    }
+
+    checksum = fnv1a(fileHeader, sizeof(fileHeader));
+    checksum = fnv1a(first, sizeof(first), checksum);
+    checksum = fnv1a(last, sizeof(last), checksum);
+    return 0;
+}
+
+void SubgridIndex::calcPQR(){
+    //Subgrids are stored X fastest, so count the subgrids sharing a row, column, and pillar with the first one
+    const PFSubgridHeader& first = m_headers.front();
+    m_p = 0;
+    m_q = 0;
+    m_r = 0;
+    for(const PFSubgridHeader& header : m_headers){
+        if(header.iy == first.iy && header.iz == first.iz) m_p++;
+        if(header.ix == first.ix && header.iz == first.iz) m_q++;
+        if(header.ix == first.ix && header.iy == first.iy) m_r++;
+    }
+}
+
+int SubgridIndex::build(std::FILE* fp, int numSubgrids){
+    clear();
+    if(fp == nullptr || numSubgrids < 1){
+        return 1;
+    }
+
+    std::fpos_t pos{};
+    //Save old position
+    std::fgetpos(fp, &pos);
+
+    m_headers.resize(numSubgrids);
+    long long offset = 64;  //Skip file header
+    for(int i = 0; i < numSubgrids; ++i){
+        PFSubgridHeader& header = m_headers[i];
+        if(std::fseek(fp, offset, SEEK_SET) || readSubgridHeader(fp, offset, header)){
+            perror("Error reading subgrid header");
+            std::fsetpos(fp, &pos);
+            clear();
+            return 1;
+        }
+
+        //Skip the subgrid header and data
+        offset += 36 + 8ll * header.nx * header.ny * header.nz;
+    }
+
+    //Restore old position
+    std::fsetpos(fp, &pos);
+
+    calcPQR();
+    return 0;
+}
+
+int SubgridIndex::loadDist(const std::string& distFilename, std::FILE* fp, int nz, int ny, int nx, int numSubgrids){
+    clear();
+    if(fp == nullptr || numSubgrids < 1){
+        return 1;
+    }
+
+    std::ifstream distFile(distFilename);
+    if(!distFile){
+        return 1;
+    }
+
+    //Entry i (i > 0) is the offset of the end of subgrid i-1, the last entry is the end of the file.
+    std::vector<long long> offsets;
+    long long value;
+    while(distFile >> value){
+        offsets.push_back(value);
+    }
+    if(static_cast<long long>(offsets.size()) != numSubgrids + 1LL || offsets.back() != getFileSize(fp)){
+        return 1;
+    }
+
+    //Number of elements in each subgrid
+    std::vector<long long> counts(numSubgrids);
+    long long start = 64;
+    for(int i = 0; i < numSubgrids; ++i){
+        const long long bytes = offsets[i+1] - start - 36;
+        if(bytes < 0 || bytes % 8){
+            return 1;
+        }
+        counts[i] = bytes / 8;
+        start = offsets[i+1];
+    }
+
+    std::fpos_t pos{};
+    std::fgetpos(fp, &pos);
+
+    //The headers of the first and last subgrid decide between topologies that produce the same offsets
+    PFSubgridHeader first;
+    PFSubgridHeader last;
+    const long long lastOffset = numSubgrids > 1 ? offsets[numSubgrids-1] : 64;
+    const bool headersRead = !std::fseek(fp, 64, SEEK_SET) && !readSubgridHeader(fp, 64, first)
+                          && !std::fseek(fp, lastOffset, SEEK_SET) && !readSubgridHeader(fp, lastOffset, last);
+    std::fsetpos(fp, &pos);
+    if(!headersRead){
+        return 1;
+    }
+
+    //Try every processor topology with the right number of subgrids
+    for(int r = 1; r <= nz && r <= numSubgrids; ++r){
+        if(numSubgrids % r) continue;
+        for(int q = 1; q <= ny && q <= numSubgrids / r; ++q){
+            if((numSubgrids / r) % q) continue;
+            const int p = numSubgrids / r / q;
+            if(p > nx) continue;
+
+            if(first.nx != calcExtent(nx, p, 0) || first.ny != calcExtent(ny, q, 0) || first.nz != calcExtent(nz, r, 0)) continue;
+            if(last.nx != calcExtent(nx, p, p-1) || last.ny != calcExtent(ny, q, q-1) || last.nz != calcExtent(nz, r, r-1)) continue;
+
+            bool matches = true;
+            for(int i = 0; i < numSubgrids && matches; ++i){
+                const int gridZ = i / (p * q);
+                const int gridY = (i / p) % q;
+                const int gridX = i % p;
+                matches = counts[i] == static_cast<long long>(calcExtent(nx, p, gridX)) * calcExtent(ny, q, gridY) * calcExtent(nz, r, gridZ);
+            }
+            if(!matches) continue;
+
+            //Found it, the headers follow the regular layout relative to the first subgrid
+            m_headers.resize(numSubgrids);
+            for(int i = 0; i < numSubgrids; ++i){
+                const int gridZ = i / (p * q);
+                const int gridY = (i / p) % q;
+                const int gridX = i % p;
+
+                PFSubgridHeader& header = m_headers[i];
+                header = first;
+                header.ix = first.ix + calcOffset(nx, p, gridX);
+                header.iy = first.iy + calcOffset(ny, q, gridY);
+                header.iz = first.iz + calcOffset(nz, r, gridZ);
+                header.nx = calcExtent(nx, p, gridX);
+                header.ny = calcExtent(ny, q, gridY);
+                header.nz = calcExtent(nz, r, gridZ);
+                header.offset = i == 0 ? 64 : offsets[i];
+            }
+            m_p = p;
+            m_q = q;
+            m_r = r;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int SubgridIndex::save(const std::string& filename, std::FILE* fp, long long modificationTime) const{
+    if(empty() || fp == nullptr){
+        return 1;
+    }
+
+    uint64_t checksum = 0;
+    if(sourceChecksum(fp, m_headers.back().offset, checksum)){
+        return 1;
+    }
+
+    std::ofstream file(filename, std::ios::trunc | std::ios::out);
+    if(!file){
+        perror("Error creating subgrid index file");
+        return 1;
+    }
+
+    file << "pfidx " << SUBGRID_INDEX_VERSION << "\n";
+    file << size() << " " << m_p << " " << m_q << " " << m_r << " " << getFileSize(fp) << " " << modificationTime << " " << checksum << "\n";
+    for(const PFSubgridHeader& h : m_headers){
+        file << h.offset << " " << h.ix << " " << h.iy << " " << h.iz << " " << h.nx << " " << h.ny << " " << h.nz
+             << " " << h.rx << " " << h.ry << " " << h.rz << "\n";
+    }
+
+    return file ? 0 : 1;
+}
+
+int SubgridIndex::load(const std::string& filename, std::FILE* fp, int numSubgrids, long long modificationTime){
+    clear();
+    if(fp == nullptr){
+        return 1;
+    }
+
+    std::ifstream file(filename);
+    if(!file){
+        return 1;
+    }
+
+    std::string magic;
+    int version = 0;
+    int count = 0;
+    long long recordedSize = 0;
+    long long recordedTime = 0;
+    uint64_t recordedChecksum = 0;
+    file >> magic >> version >> count >> m_p >> m_q >> m_r >> recordedSize >> recordedTime >> recordedChecksum;
+    if(!file || magic != "pfidx" || version != SUBGRID_INDEX_VERSION || count != numSubgrids || recordedSize != getFileSize(fp)
+       || recordedTime != modificationTime || static_cast<long long>(m_p) * m_q * m_r != count){
+        clear();
+        return 1;
+    }
+
+    m_headers.resize(count);
+    for(PFSubgridHeader& h : m_headers){
+        file >> h.offset >> h.ix >> h.iy >> h.iz >> h.nx >> h.ny >> h.nz >> h.rx >> h.ry >> h.rz;
+    }
+    if(!file){
+        clear();
+        return 1;
+    }
+
+    //A file rewritten with another topology can keep its size, and its modification time on coarse clocks
+    uint64_t checksum = 0;
+    if(sourceChecksum(fp, m_headers.back().offset, checksum) || checksum != recordedChecksum){
+        clear();
+        return 1;
+    }
+
+    return 0;
+}
+
+void SubgridIndex::clear(){
+    m_headers.clear();
+    m_p = 0;
+    m_q = 0;
+    m_r = 0;
+}
+
+bool SubgridIndex::empty() const{
+    return m_headers.empty();
+}
+
+int SubgridIndex::size() const{
+    return static_cast<int>(m_headers.size());
+}
+
+const PFSubgridHeader& SubgridIndex::at(int index) const{
+    return m_headers[index];
+}
+
+const PFSubgridHeader& SubgridIndex::at(int gridZ, int gridY, int gridX) const{
+    return m_headers[(static_cast<long long>(gridZ) * m_q + gridY) * m_p + gridX];
+}
+
+int SubgridIndex::getP() const{
+    return m_p;
+}
+
+int SubgridIndex::getQ() const{
+    return m_q;
+}
+
+int SubgridIndex::getR() const{
+    return m_r;
+}
@@ -0,0 +1,158 @@
+#include "pfthreadpool.hpp"
+
+#include <algorithm>
+
+//Set on the pool threads, and on the caller while it runs a batch, to detect nested calls
+static thread_local bool insideBatch = false;
+
+PFThreadPool& PFThreadPool::shared(){
+    static PFThreadPool pool;
+    return pool;
+}
+
+PFThreadPool::~PFThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for(std::thread& thread : m_threads){
+        thread.join();
+    }
+}
+
+int PFThreadPool::parallelFor(const int numJobs, int numThreads, const Job& job){
+    if(numJobs <= 0){
+        return 0;
+    }
+    numThreads = std::max(1, std::min(numThreads, numJobs));
+
+    //Nothing to share, or called from inside a job
+    if(numThreads == 1 || insideBatch){
+        for(int i = 0; i < numJobs; ++i){
+            if(int err = job(i, 0)){
+                return err;
+            }
+        }
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> batchLock(m_batchMutex);
+
+    //Grow the pool as needed, the calling thread is worker 0
+    while(static_cast<int>(m_threads.size()) < numThreads - 1){
+        const int index = static_cast<int>(m_threads.size());
+        m_threads.emplace_back(&PFThreadPool::threadLoop, this, index);
+    }
+    while(static_cast<int>(m_queues.size()) < numThreads){
+        m_queues.emplace_back(new WorkQueue());
+    }
+
+    //Hand every worker a contiguous range of jobs, stealing evens it out later
+    for(int worker = 0; worker < numThreads; ++worker){
+        const int begin = static_cast<int>(static_cast<long long>(numJobs) * worker / numThreads);
+        const int end = static_cast<int>(static_cast<long long>(numJobs) * (worker + 1) / numThreads);
+
+        WorkQueue& queue = *m_queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.clear();
+        for(int i = begin; i < end; ++i){
+            queue.jobs.push_back(i);
+        }
+    }
+
+    m_error = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job = &job;
+        m_numWorkers = numThreads;
+        m_numBusy = numThreads - 1;
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    insideBatch = true;
+    runWorker(0);
+    insideBatch = false;
+
+    //Wait for the pool threads to run out of work
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this]{ return m_numBusy == 0; });
+        m_job = nullptr;
+    }
+
+    return m_error;
+}
+
+void PFThreadPool::threadLoop(const int index){
+    insideBatch = true;
+    const int worker = index + 1;
+    unsigned long long seen = 0;
+
+    while(true){
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]{ return m_stop || m_generation != seen; });
+            if(m_stop){
+                return;
+            }
+            seen = m_generation;
+
+            //Not needed for this batch
+            if(worker >= m_numWorkers){
+                continue;
+            }
+        }
+
+        runWorker(worker);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_numBusy--;
+        }
+        m_done.notify_one();
+    }
+}
+
+void PFThreadPool::runWorker(const int worker){
+    int job;
+    while(takeJob(worker, job)){
+        //After an error, drain the queues without running anything
+        if(m_error != 0){
+            continue;
+        }
+
+        if(int err = (*m_job)(job, worker)){
+            int expected = 0;
+            m_error.compare_exchange_strong(expected, err);
+        }
+    }
+}
+
+bool PFThreadPool::takeJob(const int worker, int& job){
+    {
+        WorkQueue& own = *m_queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.jobs.empty()){
+            job = own.jobs.front();
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+
+    //Steal from the back of the other queues, furthest from where their owners are working
+    for(int i = 1; i < m_numWorkers; ++i){
+        WorkQueue& victim = *m_queues[(worker + i) % m_numWorkers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.jobs.empty()){
+            job = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+
+    //Jobs are never added during a batch, so the batch is finished
+    return false;
+}
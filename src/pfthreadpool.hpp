@@ -0,0 +1,84 @@
+#ifndef PARFLOWIO_PFTHREADPOOL_HPP
+#define PARFLOWIO_PFTHREADPOOL_HPP
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * class: PFThreadPool
+ * A work-stealing thread pool shared by the parallel read, write, and compare paths of the library.
+ * Threads are created on first use and reused by every later call, so a loop over many files does not pay for thread creation.
+ * Each participating worker starts with a contiguous range of the jobs, and steals from the back of the other workers' queues
+ * once its own is empty, so uneven job sizes (e.g. remainder subgrids) do not leave workers idle.
+ */
+class PFThreadPool {
+public:
+    /** Job callback.
+     * \param   job     Index of the job, [0, numJobs)
+     * \param   worker  Index of the worker running the job, [0, numThreads). Useful for per-worker scratch space.
+     * \return          0 on success, non-zero to report an error and stop handing out further jobs.
+     */
+    typedef std::function<int(int job, int worker)> Job;
+
+    /** Returns the pool shared by the whole library.
+     */
+    static PFThreadPool& shared();
+
+    PFThreadPool() = default;
+    PFThreadPool(const PFThreadPool&) = delete;
+    PFThreadPool& operator=(const PFThreadPool&) = delete;
+
+    //Stops and joins all threads
+    ~PFThreadPool();
+
+    /** Runs job(i, worker) for every i in [0, numJobs), and blocks until all of them finished.
+     * The calling thread takes part as worker 0. Only one batch runs at a time, other callers wait for it.
+     * Calls made from inside a job run serially on the calling thread.
+     * \param   numJobs     Number of jobs.
+     * \param   numThreads  Number of workers to use, including the calling thread. Values below 1 are treated as 1.
+     * \param   job         The callback to run.
+     * \return              0 if every job succeeded, otherwise the first non-zero value returned by a job.
+     */
+    int parallelFor(int numJobs, int numThreads, const Job& job);
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<int> jobs;
+    };
+
+    //Body of the pool threads, thread `index` acts as worker index+1
+    void threadLoop(int index);
+
+    //Runs jobs until none are left, as the given worker
+    void runWorker(int worker);
+
+    //Takes a job from the worker's own queue, or steals one from another queue
+    bool takeJob(int worker, int& job);
+
+    std::vector<std::thread> m_threads;
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+
+    //Serializes batches
+    std::mutex m_batchMutex;
+
+    //Protects the batch state below
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    const Job* m_job = nullptr;
+    int m_numWorkers = 0;
+    int m_numBusy = 0;
+    unsigned long long m_generation = 0;
+    bool m_stop = false;
+
+    std::atomic<int> m_error{0};
+};
+
+#endif //PARFLOWIO_PFTHREADPOOL_HPP
@@ -0,0 +1,320 @@
+#include "parflow/pftyped.hpp"
+#include "pffile.hpp"
+#include "pfutil.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <type_traits>
+
+//Version of the format written by PFTypedData::writeFile()
+static const uint32_t TYPED_PFB_VERSION = 1;
+
+//Written in native byte order, a host of the other byte order reads it swapped
+static const uint32_t TYPED_PFB_BYTE_ORDER = 0x01020304;
+
+namespace {
+
+const char TYPED_PFB_MAGIC[8] = {'P', 'F', 'B', 'T', '\r', '\n', 0x1a, '\n'};
+
+struct TypedHeader {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t version;
+    uint32_t elementType;
+    uint32_t elementSize;
+    double x, y, z;
+    int32_t nx, ny, nz;
+    int32_t p, q, r;
+    double dx, dy, dz;
+};
+static_assert(sizeof(TypedHeader) == 96, "the typed pfb header is 96 bytes");
+
+//Element type code stored in the header
+template<typename T> struct ElementType;
+template<> struct ElementType<float> { static const uint32_t code = 1; };
+template<> struct ElementType<int32_t> { static const uint32_t code = 2; };
+template<> struct ElementType<uint8_t> { static const uint32_t code = 3; };
+
+uint32_t swapped32(uint32_t value){
+    return bswap32(value);
+}
+
+int32_t swapped32(int32_t value){
+    return static_cast<int32_t>(bswap32(static_cast<uint32_t>(value)));
+}
+
+double swapped64(double value){
+    uint64_t bits;
+    std::memcpy(&bits, &value, 8);
+    bits = bswap64(bits);
+    std::memcpy(&value, &bits, 8);
+    return value;
+}
+
+void swapHeader(TypedHeader& header){
+    header.byteOrder = swapped32(header.byteOrder);
+    header.version = swapped32(header.version);
+    header.elementType = swapped32(header.elementType);
+    header.elementSize = swapped32(header.elementSize);
+    for(double* value : {&header.x, &header.y, &header.z, &header.dx, &header.dy, &header.dz}){
+        *value = swapped64(*value);
+    }
+    for(int32_t* value : {&header.nx, &header.ny, &header.nz, &header.p, &header.q, &header.r}){
+        *value = swapped32(*value);
+    }
+}
+
+//Reverses the bytes of every value, a no-op for single bytes
+template<typename T>
+void swapValues(T* values, std::size_t count){
+    if(sizeof(T) == 1){
+        return;
+    }
+    static_assert(sizeof(T) == 1 || sizeof(T) == 4, "typed pfb values are 1 or 4 bytes");
+    for(std::size_t i = 0; i < count; ++i){
+        uint32_t bits;
+        std::memcpy(&bits, &values[i], 4);
+        bits = bswap32(bits);
+        std::memcpy(&values[i], &bits, 4);
+    }
+}
+
+//Integer types only take the values they represent exactly
+template<typename T>
+bool convertValue(double value, T& out, std::true_type){
+    if(!(value >= static_cast<double>(std::numeric_limits<T>::min()) && value <= static_cast<double>(std::numeric_limits<T>::max()) && value == std::trunc(value))){
+        return false;
+    }
+    out = static_cast<T>(value);
+    return true;
+}
+
+template<typename T>
+bool convertValue(double value, T& out, std::false_type){
+    out = static_cast<T>(value);
+    return true;
+}
+
+} //namespace
+
+template<typename T>
+PFTypedData<T>::PFTypedData(const std::string& filename)
+    : m_filename(filename){
+}
+
+template<typename T>
+int PFTypedData<T>::loadHeader(){
+    const int fd = openFileReadOnly(m_filename);
+    if(fd < 0){
+        std::string err{"Error opening file: \"" + m_filename + "\""};
+        perror(err.c_str());
+        return errno;
+    }
+    TypedHeader header;
+    const int err = readFileAt(fd, &header, sizeof(header), 0);
+    const long long fileSize = getFileSize(fd);
+    closeFileDescriptor(fd);
+    if(err){
+        std::cerr << "Error reading the header of " << m_filename << ", error code " << err << ": " << std::strerror(err) << "\n";
+        return err;
+    }
+
+    if(std::memcmp(header.magic, TYPED_PFB_MAGIC, sizeof(TYPED_PFB_MAGIC)) != 0){
+        std::cerr << m_filename << " is not a typed pfb file\n";
+        return EINVAL;
+    }
+    m_swapped = header.byteOrder != TYPED_PFB_BYTE_ORDER;
+    if(m_swapped){
+        swapHeader(header);
+    }
+    if(header.byteOrder != TYPED_PFB_BYTE_ORDER || header.version != TYPED_PFB_VERSION){
+        std::cerr << m_filename << " is a typed pfb of an unsupported version " << header.version << "\n";
+        return EINVAL;
+    }
+    if(header.elementType != ElementType<T>::code || header.elementSize != sizeof(T)){
+        std::cerr << m_filename << " holds elements of type " << header.elementType << " and size " << header.elementSize << ", not of type " << ElementType<T>::code << "\n";
+        return EINVAL;
+    }
+    if(header.nx < 1 || header.ny < 1 || header.nz < 1 || header.p < 1 || header.q < 1 || header.r < 1 || header.p > header.nx || header.q > header.ny || header.r > header.nz){
+        std::cerr << "Invalid header in " << m_filename << "\n";
+        return EINVAL;
+    }
+    const long long count = static_cast<long long>(header.nx) * header.ny * header.nz;
+    if(fileSize != static_cast<long long>(sizeof(header)) + count * static_cast<long long>(sizeof(T))){
+        std::cerr << "Error reading " << m_filename << ", the file is truncated\n";
+        return EINVAL;
+    }
+
+    PFData layout;
+    layout.setX(header.x);
+    layout.setY(header.y);
+    layout.setZ(header.z);
+    layout.setNX(header.nx);
+    layout.setNY(header.ny);
+    layout.setNZ(header.nz);
+    layout.setDX(header.dx);
+    layout.setDY(header.dy);
+    layout.setDZ(header.dz);
+    layout.setP(header.p);
+    layout.setQ(header.q);
+    layout.setR(header.r);
+    layout.setNumSubgrids(header.p * header.q * header.r);
+    m_header = std::move(layout);
+    m_data.clear();
+    return 0;
+}
+
+template<typename T>
+int PFTypedData<T>::loadData(){
+    const std::size_t count = static_cast<std::size_t>(m_header.getNX()) * m_header.getNY() * m_header.getNZ();
+    if(count == 0){
+        std::cerr << "loadData: the header of " << m_filename << " is not loaded\n";
+        return EINVAL;
+    }
+
+    const int fd = openFileReadOnly(m_filename);
+    if(fd < 0){
+        std::string err{"Error opening file: \"" + m_filename + "\""};
+        perror(err.c_str());
+        return errno;
+    }
+    //One contiguous read straight into the array, the values need no conversion
+    std::vector<T> data(count);
+    adviseSequential(fd, sizeof(TypedHeader), 0);
+    const int err = readFileAt(fd, data.data(), count * sizeof(T), sizeof(TypedHeader));
+    closeFileDescriptor(fd);
+    if(err){
+        std::cerr << "Error reading " << m_filename << ", error code " << err << ": " << std::strerror(err) << "\n";
+        return err;
+    }
+
+    if(m_swapped){
+        swapValues(data.data(), count);
+    }
+    m_data = std::move(data);
+    return 0;
+}
+
+template<typename T>
+int PFTypedData<T>::assign(const PFData& source){
+    const double* values = source.getData();
+    if(values == nullptr || source.getIndexOrder() != "zyx"){
+        std::cerr << "assign: the source has no double precision data in \"zyx\" order\n";
+        return EINVAL;
+    }
+
+    const std::size_t count = static_cast<std::size_t>(source.getNX()) * source.getNY() * source.getNZ();
+    std::vector<T> data(count);
+    for(std::size_t i = 0; i < count; ++i){
+        if(!convertValue(values[i], data[i], std::is_integral<T>())){
+            std::cerr << "assign: value " << values[i] << " at index " << i << " does not fit the element type\n";
+            return ERANGE;
+        }
+    }
+
+    PFData layout;
+    layout.setX(source.getX());
+    layout.setY(source.getY());
+    layout.setZ(source.getZ());
+    layout.setNX(source.getNX());
+    layout.setNY(source.getNY());
+    layout.setNZ(source.getNZ());
+    layout.setDX(source.getDX());
+    layout.setDY(source.getDY());
+    layout.setDZ(source.getDZ());
+    layout.setP(source.getP());
+    layout.setQ(source.getQ());
+    layout.setR(source.getR());
+    layout.setNumSubgrids(source.getP() * source.getQ() * source.getR());
+    m_header = std::move(layout);
+    m_data = std::move(data);
+    m_swapped = false;
+    return 0;
+}
+
+template<typename T>
+int PFTypedData<T>::writeFile(const std::string& filename) const{
+    const std::size_t count = static_cast<std::size_t>(m_header.getNX()) * m_header.getNY() * m_header.getNZ();
+    if(count == 0 || m_data.size() != count){
+        std::cerr << "writeFile: no data to write\n";
+        return 1;
+    }
+    const int p = m_header.getP(), q = m_header.getQ(), r = m_header.getR();
+    if(p < 1 || q < 1 || r < 1 || p > m_header.getNX() || q > m_header.getNY() || r > m_header.getNZ()){
+        std::cerr << "Invalid processor topology " << p << " x " << q << " x " << r << " for writing " << filename << "\n";
+        return 1;
+    }
+
+    TypedHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, TYPED_PFB_MAGIC, sizeof(header.magic));
+    header.byteOrder = TYPED_PFB_BYTE_ORDER;
+    header.version = TYPED_PFB_VERSION;
+    header.elementType = ElementType<T>::code;
+    header.elementSize = sizeof(T);
+    header.x = m_header.getX();
+    header.y = m_header.getY();
+    header.z = m_header.getZ();
+    header.nx = m_header.getNX();
+    header.ny = m_header.getNY();
+    header.nz = m_header.getNZ();
+    header.p = p;
+    header.q = q;
+    header.r = r;
+    header.dx = m_header.getDX();
+    header.dy = m_header.getDY();
+    header.dz = m_header.getDZ();
+
+    const int fd = openFileWrite(filename);
+    if(fd < 0){
+        std::string err{"Error opening file: \"" + filename + "\""};
+        perror(err.c_str());
+        return 1;
+    }
+    int err = preallocateFile(fd, static_cast<long long>(sizeof(header) + count * sizeof(T)));
+    if(!err){
+        err = writeFileAt(fd, &header, sizeof(header), 0);
+    }
+    if(!err){
+        err = writeFileAt(fd, m_data.data(), count * sizeof(T), sizeof(header));
+    }
+    closeFileDescriptor(fd);
+
+    if(err){
+        std::cerr << "Error writing " << filename << ", error code " << err << ": " << std::strerror(err) << "\n";
+        return err;
+    }
+    return 0;
+}
+
+template<typename T>
+const PFData& PFTypedData<T>::getHeader() const{
+    return m_header;
+}
+
+template<typename T>
+T* PFTypedData<T>::getData(){
+    return m_data.empty() ? nullptr : m_data.data();
+}
+
+template<typename T>
+const T* PFTypedData<T>::getData() const{
+    return m_data.empty() ? nullptr : m_data.data();
+}
+
+template<typename T>
+T PFTypedData<T>::operator()(int z, int y, int x) const{
+    return m_data[(static_cast<std::size_t>(z) * m_header.getNY() + y) * m_header.getNX() + x];
+}
+
+template<typename T>
+std::string PFTypedData<T>::getFilename() const{
+    return m_filename;
+}
+
+template class PFTypedData<float>;
+template class PFTypedData<int32_t>;
+template class PFTypedData<uint8_t>;
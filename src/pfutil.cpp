@@ -1,8 +1,18 @@
 #include <climits>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 
 #include "pfutil.hpp"
 
+//Runtime dispatched SIMD kernels are only built for x86 with gcc or clang, which provide target attributes and cpu detection
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define PARFLOWIO_X86_DISPATCH 1
+    #include <immintrin.h>
+#else
+    #define PARFLOWIO_X86_DISPATCH 0
+#endif
+
 //Check for endianess at compile time, if possible. Otherwise fallback to runtime check
 //At least gcc, clang, and icc define this macro. 
 #ifdef __BYTE_ORDER__
@@ -44,6 +54,11 @@ bool isBigEndian(){
 uint32_t bswap32(uint32_t data){
     if(!(PARFLOWIO_LITTLE_ENDIAN)) return data;
 
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap32(data);
+#elif defined(_MSC_VER)
+    return _byteswap_ulong(data);
+#else
     static_assert(CHAR_BIT == 8, "Byte conversion requires that char be 8 bits.");
     const unsigned char* alias = reinterpret_cast<unsigned char*>(&data);
     return 
@@ -51,12 +66,18 @@ uint32_t bswap32(uint32_t data){
         (static_cast<uint32_t>( alias[1] ) << 16) | 
         (static_cast<uint32_t>( alias[2] ) <<  8) | 
         (static_cast<uint32_t>( alias[3] ) <<  0);
+#endif
 }
 
 //Note: on x86_64 compiles down to bswap
 uint64_t bswap64(uint64_t data){
     if(!(PARFLOWIO_LITTLE_ENDIAN)) return data;
 
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap64(data);
+#elif defined(_MSC_VER)
+    return _byteswap_uint64(data);
+#else
     static_assert(CHAR_BIT == 8, "Byte conversion requires that char be 8 bits.");
     const unsigned char* alias = reinterpret_cast<unsigned char*>(&data);
     return 
@@ -68,4 +89,250 @@ uint64_t bswap64(uint64_t data){
         (static_cast<uint64_t>( alias[5] ) << 16) | 
         (static_cast<uint64_t>( alias[6] ) <<  8) | 
         (static_cast<uint64_t>( alias[7] ) <<  0);
+#endif
+}
+
+namespace {
+
+typedef void (*Bswap64ArrayKernel)(const uint64_t* src, uint64_t* dst, std::size_t n);
+
+//Note: src and dst may be the same array, every kernel loads a block before storing it.
+//The arrays may point into a mapped file, where values are not 8 byte aligned, so the scalar kernels go through memcpy.
+void bswap64ArrayScalar(const uint64_t* src, uint64_t* dst, std::size_t n){
+    for(std::size_t i = 0; i < n; ++i){
+        uint64_t value;
+        std::memcpy(&value, src + i, sizeof(value));
+        value = bswap64(value);
+        std::memcpy(dst + i, &value, sizeof(value));
+    }
+}
+
+typedef void (*Bswap64ToFloatArrayKernel)(const uint64_t* src, float* dst, std::size_t n);
+
+void bswap64ToFloatArrayScalar(const uint64_t* src, float* dst, std::size_t n){
+    for(std::size_t i = 0; i < n; ++i){
+        uint64_t tmp;
+        std::memcpy(&tmp, src + i, sizeof(tmp));
+        tmp = bswap64(tmp);
+        double value;
+        std::memcpy(&value, &tmp, sizeof(value));
+        dst[i] = static_cast<float>(value);
+    }
+}
+
+typedef std::size_t (*FindFirstDifference64Kernel)(const uint64_t* a, const uint64_t* b, std::size_t n);
+
+std::size_t findFirstDifference64Scalar(const uint64_t* a, const uint64_t* b, std::size_t n){
+    for(std::size_t i = 0; i < n; ++i){
+        uint64_t valueA;
+        uint64_t valueB;
+        std::memcpy(&valueA, a + i, sizeof(valueA));
+        std::memcpy(&valueB, b + i, sizeof(valueB));
+        if(valueA != valueB){
+            return i;
+        }
+    }
+    return n;
+}
+
+#if PARFLOWIO_X86_DISPATCH
+
+__attribute__((target("ssse3")))
+void bswap64ArraySSSE3(const uint64_t* src, uint64_t* dst, std::size_t n){
+    //Reverse the bytes of each 64 bit lane
+    const __m128i mask = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+
+    std::size_t i = 0;
+    for(; i + 2 <= n; i += 2){
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(v, mask));
+    }
+    bswap64ArrayScalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void bswap64ArrayAVX2(const uint64_t* src, uint64_t* dst, std::size_t n){
+    //vpshufb shuffles within each 128 bit lane, so the same mask is used for both lanes
+    const __m256i mask = _mm256_broadcastsi128_si256(_mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7));
+
+    std::size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        const __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        const __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),     _mm256_shuffle_epi8(v0, mask));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 4), _mm256_shuffle_epi8(v1, mask));
+    }
+    for(; i + 4 <= n; i += 4){
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(v, mask));
+    }
+    bswap64ArrayScalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void bswap64ArrayAVX512(const uint64_t* src, uint64_t* dst, std::size_t n){
+    //Reverses the bytes of each 64-bit lane, built directly since broadcasting a 128-bit mask trips gcc 12 warnings
+    const __m512i mask = _mm512_set_epi64(0x08090A0B0C0D0E0FLL, 0x0001020304050607LL, 0x08090A0B0C0D0E0FLL, 0x0001020304050607LL,
+                                          0x08090A0B0C0D0E0FLL, 0x0001020304050607LL, 0x08090A0B0C0D0E0FLL, 0x0001020304050607LL);
+
+    std::size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        const __m512i v = _mm512_loadu_si512(src + i);
+        _mm512_storeu_si512(dst + i, _mm512_shuffle_epi8(v, mask));
+    }
+
+    //Handle the tail with a masked load/store instead of falling back to scalar code
+    if(i < n){
+        const __mmask8 tail = static_cast<__mmask8>((1u << (n - i)) - 1);
+        const __m512i v = _mm512_maskz_loadu_epi64(tail, src + i);
+        _mm512_mask_storeu_epi64(dst + i, tail, _mm512_shuffle_epi8(v, mask));
+    }
+}
+
+__attribute__((target("avx2")))
+void bswap64ToFloatArrayAVX2(const uint64_t* src, float* dst, std::size_t n){
+    const __m256i mask = _mm256_broadcastsi128_si256(_mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7));
+
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4){
+        const __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)), mask);
+        _mm_storeu_ps(dst + i, _mm256_cvtpd_ps(_mm256_castsi256_pd(v)));
+    }
+    bswap64ToFloatArrayScalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void bswap64ToFloatArrayAVX512(const uint64_t* src, float* dst, std::size_t n){
+    const __m512i mask = _mm512_set_epi64(0x08090A0B0C0D0E0FLL, 0x0001020304050607LL, 0x08090A0B0C0D0E0FLL, 0x0001020304050607LL,
+                                          0x08090A0B0C0D0E0FLL, 0x0001020304050607LL, 0x08090A0B0C0D0E0FLL, 0x0001020304050607LL);
+
+    std::size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        const __m512i v = _mm512_shuffle_epi8(_mm512_loadu_si512(src + i), mask);
+        //The zero-masked form converts all lanes too, without the undefined source operand gcc 12 warns about
+        _mm256_storeu_ps(dst + i, _mm512_maskz_cvtpd_ps(0xFF, _mm512_castsi512_pd(v)));
+    }
+    bswap64ToFloatArrayScalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+std::size_t findFirstDifference64AVX2(const uint64_t* a, const uint64_t* b, std::size_t n){
+    std::size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        const __m256i eq0 = _mm256_cmpeq_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                                               _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        const __m256i eq1 = _mm256_cmpeq_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 4)),
+                                               _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 4)));
+        //One bit per lane, set where the values are equal
+        const unsigned mask = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(eq0)))
+                            | static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(eq1))) << 4;
+        if(mask != 0xFF){
+            return i + __builtin_ctz(~mask);
+        }
+    }
+    return i + findFirstDifference64Scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+std::size_t findFirstDifference64AVX512(const uint64_t* a, const uint64_t* b, std::size_t n){
+    std::size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        const __mmask8 ne = _mm512_cmpneq_epu64_mask(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        if(ne){
+            return i + __builtin_ctz(ne);
+        }
+    }
+
+    if(i < n){
+        const __mmask8 tail = static_cast<__mmask8>((1u << (n - i)) - 1);
+        const __mmask8 ne = _mm512_mask_cmpneq_epu64_mask(tail, _mm512_maskz_loadu_epi64(tail, a + i), _mm512_maskz_loadu_epi64(tail, b + i));
+        if(ne){
+            return i + __builtin_ctz(ne);
+        }
+    }
+    return n;
+}
+
+#endif
+
+//Picks the widest kernel supported by the cpu we are running on
+Bswap64ArrayKernel selectBswap64ArrayKernel(){
+#if PARFLOWIO_X86_DISPATCH
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")){
+        return bswap64ArrayAVX512;
+    }
+    if(__builtin_cpu_supports("avx2")){
+        return bswap64ArrayAVX2;
+    }
+    if(__builtin_cpu_supports("ssse3")){
+        return bswap64ArraySSSE3;
+    }
+#endif
+    return bswap64ArrayScalar;
+}
+
+Bswap64ToFloatArrayKernel selectBswap64ToFloatArrayKernel(){
+#if PARFLOWIO_X86_DISPATCH
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")){
+        return bswap64ToFloatArrayAVX512;
+    }
+    if(__builtin_cpu_supports("avx2")){
+        return bswap64ToFloatArrayAVX2;
+    }
+#endif
+    return bswap64ToFloatArrayScalar;
+}
+
+FindFirstDifference64Kernel selectFindFirstDifference64Kernel(){
+#if PARFLOWIO_X86_DISPATCH
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")){
+        return findFirstDifference64AVX512;
+    }
+    if(__builtin_cpu_supports("avx2")){
+        return findFirstDifference64AVX2;
+    }
+#endif
+    return findFirstDifference64Scalar;
+}
+
+} //namespace
+
+void bswap64_array(const uint64_t* src, uint64_t* dst, std::size_t n){
+    if(!(PARFLOWIO_LITTLE_ENDIAN)){
+        if(src != dst){
+            std::memmove(dst, src, n * sizeof(uint64_t));
+        }
+        return;
+    }
+
+    //Thread safe initialization, resolved once on first use
+    static const Bswap64ArrayKernel kernel = selectBswap64ArrayKernel();
+    kernel(src, dst, n);
+}
+
+void bswap64_array_inplace(uint64_t* data, std::size_t n){
+    bswap64_array(data, data, n);
+}
+
+void bswap64_to_float_array(const uint64_t* src, float* dst, std::size_t n){
+    //The byte swap is a no-op on big endian hosts, so the scalar kernel only narrows there
+    static const Bswap64ToFloatArrayKernel kernel = (PARFLOWIO_LITTLE_ENDIAN) ? selectBswap64ToFloatArrayKernel() : bswap64ToFloatArrayScalar;
+    kernel(src, dst, n);
+}
+
+std::size_t find_first_difference64(const uint64_t* a, const uint64_t* b, std::size_t n){
+    static const FindFirstDifference64Kernel kernel = selectFindFirstDifference64Kernel();
+    return kernel(a, b, n);
+}
+
+uint64_t fnv1a(const void* data, std::size_t size, uint64_t hash){
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for(std::size_t i = 0; i < size; ++i){
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
 }
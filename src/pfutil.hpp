@@ -1,5 +1,6 @@
 #ifndef PARFLOWIO_PFUTIL_HPP
 #define PARFLOWIO_PFUTIL_HPP
+#include <cstddef>
 #include <cstdint>
 
 /** Tests if the machine is little endian.
@@ -24,4 +25,44 @@ uint32_t bswap32(uint32_t data);
  */
 uint64_t bswap64(uint64_t data);
 
+/** Converts an array of 64 bit values between big endian and native byte order.
+ * Uses an SSSE3, AVX2 or AVX-512 kernel when the cpu supports it, selected at runtime on first use.
+ * \param   src     Values to convert.
+ * \param   dst     Destination of the converted values, may be the same array as `src` but must not partially overlap it.
+ * \param   n       Number of values to convert.
+ */
+void bswap64_array(const uint64_t* src, uint64_t* dst, std::size_t n);
+
+/** Same as bswap64_array(), but converts the values in place.
+ * \param   data    Values to convert.
+ * \param   n       Number of values to convert.
+ */
+void bswap64_array_inplace(uint64_t* data, std::size_t n);
+
+/** Converts an array of big endian doubles to native floats in a single pass (byte swap and narrowing fused).
+ * Uses an AVX2 or AVX-512 kernel when the cpu supports it, selected at runtime on first use.
+ * \param   src     Big endian doubles to convert.
+ * \param   dst     Destination of the converted values. May start at the same address as `src` (the floats are written behind the
+ *                  doubles still to be read), but must not overlap it otherwise.
+ * \param   n       Number of values to convert.
+ */
+void bswap64_to_float_array(const uint64_t* src, float* dst, std::size_t n);
+
+/** Finds the first position where two arrays of 64 bit values differ bitwise.
+ * Uses an AVX2 or AVX-512 kernel when the cpu supports it, selected at runtime on first use.
+ * \param   a       First array.
+ * \param   b       Second array.
+ * \param   n       Number of values in each array.
+ * \return          Index of the first value that differs, `n` if the arrays are identical.
+ */
+std::size_t find_first_difference64(const uint64_t* a, const uint64_t* b, std::size_t n);
+
+/** 64 bit FNV-1a hash, used to recognize the source of sidecar files. Chain calls by passing the previous result as `hash`.
+ * \param   data    Bytes to hash.
+ * \param   size    Number of bytes.
+ * \param   hash    Hash to continue, the FNV offset basis to start a new one.
+ * \return          The hash of the bytes.
+ */
+uint64_t fnv1a(const void* data, std::size_t size, uint64_t hash = 14695981039346656037ull);
+
 #endif //PARFLOWIO_PFUTIL_HPP
@@ -2,10 +2,27 @@
 // Created by Catherine Olschanowsky on 7/14/20.
 //
 #include "gtest/gtest.h"
+#include "parflow/pfbufferpool.hpp"
+#include "parflow/pfclm.hpp"
 #include "parflow/pfdata.hpp"
+#include "parflow/pfgenerator.hpp"
+#include "parflow/pfseries.hpp"
+#include "parflow/pftyped.hpp"
+#include "pfcodec.hpp"
+#include "pffile.hpp"
+#include "pfprefetch.hpp"
+#include "pfthreadpool.hpp"
+#include "pfutil.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <fstream>
+#include <iterator>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <cstdlib>
+#include <cstring>
 
 class PFData_test : public ::testing::Test {
 
@@ -71,7 +88,7 @@ TEST_F(PFData_test, loadData) {
     test.close();
 }
 
-/*TEST_F(PFData_test, loadDataThreaded){
+TEST_F(PFData_test, loadDataThreaded){
     PFData base("tests/inputs/press.init.pfb");
     base.loadHeader();
     base.loadData();
@@ -96,7 +113,155 @@ TEST_F(PFData_test, loadData) {
     test40.loadPQR();
     test40.loadDataThreaded(40);
     EXPECT_EQ(base.compare(test40, nullptr), PFData::differenceType::none);
-}*/
+
+    //Uneven topology, reusing the pool threads from above
+    PFData dist("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, dist.distFile(3, 2, 4, "tests/press.init.threaded.pfb"));
+    PFData uneven("tests/press.init.threaded.pfb");
+    uneven.loadHeader();
+    uneven.loadPQR();
+    ASSERT_EQ(0, uneven.loadDataThreaded(5));
+    EXPECT_EQ(base.compare(uneven, nullptr), PFData::differenceType::none);
+    uneven.close();
+    ASSERT_EQ(0, remove("tests/press.init.threaded.pfb"));
+    ASSERT_EQ(0, remove("tests/press.init.threaded.pfb.dist"));
+}
+
+TEST_F(PFData_test, writeFileThreaded){
+    PFData base("tests/inputs/press.init.pfb");
+    base.loadHeader();
+    base.loadData();
+
+    //Compare against the serial writer byte for byte, including an uneven topology
+    const std::array<std::array<int, 3>, 3> topologies = {{{1, 1, 1}, {4, 4, 1}, {3, 2, 4}}};
+    for(const std::array<int, 3>& pqr : topologies){
+        base.setP(pqr[0]);
+        base.setQ(pqr[1]);
+        base.setR(pqr[2]);
+        ASSERT_EQ(0, base.writeFile("tests/press.init.serial.pfb"));
+        ASSERT_EQ(0, base.writeFileThreaded("tests/press.init.threaded.pfb", 4));
+
+        std::ifstream serial("tests/press.init.serial.pfb", std::ios::binary);
+        std::ifstream threaded("tests/press.init.threaded.pfb", std::ios::binary);
+        const std::string serialBytes((std::istreambuf_iterator<char>(serial)), std::istreambuf_iterator<char>());
+        const std::string threadedBytes((std::istreambuf_iterator<char>(threaded)), std::istreambuf_iterator<char>());
+        EXPECT_EQ(serialBytes.size(), threadedBytes.size());
+        EXPECT_TRUE(serialBytes == threadedBytes);
+    }
+
+    PFData test("tests/press.init.threaded.pfb");
+    test.loadHeader();
+    test.loadPQR();
+    EXPECT_EQ(3, test.getP());
+    ASSERT_EQ(0, test.loadData());
+    EXPECT_EQ(base.compare(test, nullptr), PFData::differenceType::none);
+    test.close();
+
+    EXPECT_NE(0, base.writeFileThreaded("tests/press.init.threaded.pfb", 0));
+
+    ASSERT_EQ(0, remove("tests/press.init.serial.pfb"));
+    ASSERT_EQ(0, remove("tests/press.init.threaded.pfb"));
+}
+
+TEST_F(PFData_test, prefetchReader){
+    const std::string filename = "tests/inputs/press.init.pfb";
+    const int fd = openFileReadOnly(filename);
+    ASSERT_GE(fd, 0);
+    const long long fileSize = getFileSize(fd);
+    ASSERT_GT(fileSize, 100);
+
+    //Values of the first subgrid, straight from the file
+    const long long begin = 100;
+    const std::size_t count = 5000;
+    std::vector<uint64_t> expected(count);
+    ASSERT_EQ(0, readFileAt(fd, expected.data(), 8 * count, begin));
+    bswap64_array_inplace(expected.data(), count);
+
+    //Block sizes that split values across blocks, and several ring sizes, through both backends
+    for(PrefetchReader::Backend backend : {PrefetchReader::Backend::thread, PrefetchReader::Backend::ioUring}){
+        for(std::size_t blockSize : {1000u, 4096u, 1u << 20}){
+            for(int depth : {1, 2, 3}){
+                PrefetchReader reader(fd, begin - 36, fileSize, blockSize, depth, backend);
+                if(backend == PrefetchReader::Backend::thread){
+                    EXPECT_EQ(PrefetchReader::Backend::thread, reader.getBackend());
+                }
+
+                unsigned char header[36];
+                ASSERT_EQ(0, reader.read(header, sizeof(header)));
+                std::vector<uint64_t> values(count);
+                ASSERT_EQ(0, reader.readSwapped(values.data(), 1234));
+                ASSERT_EQ(0, reader.readSwapped(values.data() + 1234, count - 1234));
+                ASSERT_EQ(expected, values);
+            }
+        }
+    }
+
+    //Narrowing to float, and reading past the end of the range
+    {
+        PrefetchReader reader(fd, begin, begin + 8 * 10, 12, 2);
+        std::vector<float> values(10);
+        ASSERT_EQ(0, reader.readSwapped(values.data(), values.size()));
+        double first;
+        std::memcpy(&first, &expected[0], 8);
+        EXPECT_EQ(static_cast<float>(first), values[0]);
+        EXPECT_NE(0, reader.readSwapped(values.data(), 1));
+    }
+
+    //Destroying a reader with reads in flight
+    {
+        PrefetchReader reader(fd, 0, fileSize, 4096, 4);
+        unsigned char byte;
+        ASSERT_EQ(0, reader.read(&byte, 1));
+    }
+
+    closeFileDescriptor(fd);
+
+    //loadData() gives the same result for every depth
+    PFData reference(filename);
+    ASSERT_EQ(0, reference.loadHeader());
+    ASSERT_EQ(0, reference.loadPQR());
+    ASSERT_EQ(0, reference.loadDataThreaded(1));
+    const std::size_t numValues = static_cast<std::size_t>(reference.getNZ()) * reference.getNY() * reference.getNX();
+    for(int depth : {1, 8}){
+        PFData test(filename);
+        test.setPrefetchDepth(depth);
+        EXPECT_EQ(depth, test.getPrefetchDepth());
+        ASSERT_EQ(0, test.loadHeader());
+        ASSERT_EQ(0, test.loadData());
+        EXPECT_EQ(0, std::memcmp(reference.getData(), test.getData(), 8 * numValues));
+    }
+}
+
+TEST_F(PFData_test, threadPool){
+    PFThreadPool& pool = PFThreadPool::shared();
+
+    //Every job runs exactly once
+    for(int numThreads : {1, 2, 7}){
+        std::vector<std::atomic<int>> counts(1000);
+        for(auto& count : counts){
+            count = 0;
+        }
+        const int err = pool.parallelFor(static_cast<int>(counts.size()), numThreads, [&](int job, int worker){
+            EXPECT_LT(worker, numThreads);
+            counts[job]++;
+            return 0;
+        });
+        EXPECT_EQ(0, err);
+        for(auto& count : counts){
+            EXPECT_EQ(1, count);
+        }
+    }
+
+    //Errors are reported
+    EXPECT_EQ(5, pool.parallelFor(100, 4, [](int job, int){ return job == 42 ? 5 : 0; }));
+
+    //Nested calls run serially instead of deadlocking
+    std::atomic<int> nested{0};
+    EXPECT_EQ(0, pool.parallelFor(8, 4, [&](int, int){
+        return pool.parallelFor(10, 4, [&](int, int){ nested++; return 0; });
+    }));
+    EXPECT_EQ(80, nested);
+}
 
 TEST_F(PFData_test, fileReadPoint1){
     PFData test("tests/inputs/press.init.pfb");
@@ -134,6 +299,64 @@ TEST_F(PFData_test, fileReadPoint1){
     test.close();
 }
 
+TEST_F(PFData_test, mapFile){
+    PFData base("tests/inputs/press.init.pfb");
+    base.loadHeader();
+    base.loadData();
+
+    PFData test("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, test.loadHeader());
+    ASSERT_EQ(0, test.loadPQR());
+    EXPECT_FALSE(test.isMapped());
+    ASSERT_EQ(0, test.mapFile());
+    EXPECT_TRUE(test.isMapped());
+
+    //Point reads from the mapping
+    for(int z = 0; z < test.getNZ(); z += 7){
+        for(int y = 0; y < test.getNY(); ++y){
+            for(int x = 0; x < test.getNX(); ++x){
+                EXPECT_EQ(base(z, y, x), test.fileReadPoint(z, y, x));
+            }
+        }
+    }
+
+    //Subgrid reads and zero-copy views
+    for(int i = 0; i < test.getNumSubgrids(); ++i){
+        const std::array<int, 3> grid = test.unflattenGridIndex(i);
+        const std::vector<double> subgrid = test.fileReadSubgridAtGridIndex(grid[0], grid[1], grid[2]);
+        const PFSubgridView view = test.getMappedSubgrid(grid[0], grid[1], grid[2]);
+        ASSERT_TRUE(view.isValid());
+        ASSERT_EQ(subgrid.size(), static_cast<std::size_t>(view.nz * view.ny * view.nx));
+        for(int z = 0; z < view.nz; ++z){
+            for(int y = 0; y < view.ny; ++y){
+                for(int x = 0; x < view.nx; ++x){
+                    const double expected = base(view.startZ + z, view.startY + y, view.startX + x);
+                    EXPECT_EQ(expected, view(z, y, x));
+                    EXPECT_EQ(expected, subgrid[(z * view.ny + y) * view.nx + x]);
+                }
+            }
+        }
+    }
+    EXPECT_FALSE(test.getMappedSubgrid(0, 0, 4).isValid());
+
+    //Full loads from the mapping
+    ASSERT_EQ(0, test.loadData());
+    EXPECT_EQ(base.compare(test, nullptr), PFData::differenceType::none);
+
+    PFData threaded("tests/inputs/press.init.pfb");
+    threaded.loadHeader();
+    threaded.loadPQR();
+    ASSERT_EQ(0, threaded.mapFile());
+    ASSERT_EQ(0, threaded.loadDataThreaded(4));
+    EXPECT_EQ(base.compare(threaded, nullptr), PFData::differenceType::none);
+
+    test.unmapFile();
+    EXPECT_FALSE(test.isMapped());
+    EXPECT_FALSE(test.getMappedSubgrid(0, 0, 0).isValid());
+    EXPECT_EQ(base(2, 1, 21), test.fileReadPoint(2, 1, 21));
+    test.close();
+}
+
 TEST_F(PFData_test, helperFunctions){
     PFData test("tests/inputs/press.init.pfb");
     int retval = test.loadHeader();
@@ -237,6 +460,1145 @@ TEST_F(PFData_test, loadPQR){
     EXPECT_NEAR(97.30205516102234,test(0,1,22),1E-12);
 }
 
+TEST_F(PFData_test, unevenTopology){
+    //Remainder blocks in every direction, and P != Q != R
+    const int nz = 5, ny = 7, nx = 11;
+    std::vector<double> data(nz * ny * nx);
+    for(std::size_t i = 0; i < data.size(); ++i){
+        data[i] = 0.5 * i;
+    }
+    PFData source(data.data(), nz, ny, nx);
+    source.setP(3);
+    source.setQ(2);
+    source.setR(2);
+    ASSERT_EQ(0, source.writeFile("tests/uneven_topology.pfb"));
+
+    PFData test("tests/uneven_topology.pfb");
+    ASSERT_EQ(0, test.loadHeader());
+    ASSERT_EQ(0, test.loadPQR());
+    EXPECT_EQ(3, test.getP());
+    EXPECT_EQ(2, test.getQ());
+    EXPECT_EQ(2, test.getR());
+    EXPECT_EQ(3, test.getNormalBlockSizeY());
+    EXPECT_EQ(3, test.getSubgridStartZ(1));
+
+    for(int z = 0; z < nz; ++z){
+        for(int y = 0; y < ny; ++y){
+            for(int x = 0; x < nx; ++x){
+                EXPECT_EQ(data[(z * ny + y) * nx + x], test.fileReadPoint(z, y, x));
+            }
+        }
+    }
+    test.close();
+    ASSERT_EQ(0, remove("tests/uneven_topology.pfb"));
+}
+
+TEST_F(PFData_test, loadHyperslab){
+    const int nz = 5, ny = 7, nx = 11;
+    std::vector<double> data(nz * ny * nx);
+    for(std::size_t i = 0; i < data.size(); ++i){
+        data[i] = 0.25 * i;
+    }
+    PFData source(data.data(), nz, ny, nx);
+    source.setP(3);
+    source.setQ(2);
+    source.setR(2);
+    ASSERT_EQ(0, source.writeFile("tests/hyperslab.pfb"));
+
+    PFData test("tests/hyperslab.pfb");
+    ASSERT_EQ(0, test.loadHeader());
+    ASSERT_EQ(0, test.loadPQR());
+
+    //{z0, y0, x0, nz, ny, nx, strideZ, strideY, strideX}
+    const int cases[][9] = {
+        {0, 0, 0, nz, ny, nx, 1, 1, 1},    //Whole file
+        {1, 2, 3, 3, 4, 6, 1, 1, 1},       //Crosses subgrid boundaries
+        {0, 0, 4, nz, ny, 3, 1, 1, 1},     //Whole rows of the middle subgrid only
+        {0, 1, 0, 3, 2, 4, 2, 3, 3},       //Strided
+        {4, 6, 10, 1, 1, 1, 1, 1, 1},      //Last point
+    };
+    for(const auto& c : cases){
+        std::vector<double> slab = test.loadHyperslab(c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], c[8]);
+        ASSERT_EQ(static_cast<std::size_t>(c[3]) * c[4] * c[5], slab.size());
+        for(int k = 0; k < c[3]; ++k){
+            for(int j = 0; j < c[4]; ++j){
+                for(int i = 0; i < c[5]; ++i){
+                    const int z = c[0] + k * c[6], y = c[1] + j * c[7], x = c[2] + i * c[8];
+                    EXPECT_EQ(data[(z * ny + y) * nx + x], slab[(k * c[4] + j) * c[5] + i]);
+                }
+            }
+        }
+        //The subgrids of the hyperslab read on the thread pool
+        EXPECT_EQ(slab, test.loadHyperslab(c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], c[8], 4));
+    }
+
+    //Out of bounds
+    std::vector<double> buffer(64);
+    EXPECT_EQ(EINVAL, test.readHyperslab(buffer.data(), 0, 0, 0, nz + 1, 1, 1));
+    EXPECT_EQ(EINVAL, test.readHyperslab(buffer.data(), 0, 0, 0, 1, 1, 7, 1, 1, 2));
+    EXPECT_EQ(EINVAL, test.readHyperslab(buffer.data(), 0, 0, 0, 1, 1, 1, 0, 1, 1));
+    EXPECT_TRUE(test.loadHyperslab(0, 0, -1, 1, 1, 1).empty());
+
+    //Same results out of the mapping
+    ASSERT_EQ(0, test.mapFile());
+    std::vector<double> mapped = test.loadHyperslab(1, 2, 3, 3, 4, 6);
+    ASSERT_EQ(72u, mapped.size());
+    EXPECT_EQ(data[(1 * ny + 2) * nx + 3], mapped[0]);
+    EXPECT_EQ(data[(3 * ny + 5) * nx + 8], mapped[71]);
+
+    //Clips read on the thread pool
+    PFData clip("tests/hyperslab.pfb");
+    ASSERT_EQ(0, clip.loadHeader());
+    ASSERT_EQ(0, clip.loadPQR());
+    ASSERT_EQ(0, clip.loadClipOfData(2, 1, 8, 5, 3));
+    for(int z = 0; z < nz; ++z){
+        for(int y = 0; y < 5; ++y){
+            for(int x = 0; x < 8; ++x){
+                EXPECT_EQ(data[(z * ny + y + 1) * nx + x + 2], clip(z, y, x));
+            }
+        }
+    }
+
+    test.close();
+    ASSERT_EQ(0, remove("tests/hyperslab.pfb"));
+}
+
+TEST_F(PFData_test, fileReadPoints){
+    PFData test("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, test.loadHeader());
+    ASSERT_EQ(0, test.loadPQR());
+
+    //Unsorted, duplicated, spread over several subgrids, plus runs of neighbours
+    std::vector<std::array<int, 3>> points;
+    unsigned int seed = 12345;
+    for(int i = 0; i < 500; ++i){
+        seed = seed * 1103515245u + 12345u;
+        points.push_back({{static_cast<int>((seed >> 8) % test.getNZ()), static_cast<int>((seed >> 12) % test.getNY()),
+                           static_cast<int>((seed >> 16) % test.getNX())}});
+    }
+    for(int x = 0; x < 20; ++x){
+        points.push_back({{2, 3, x}});
+    }
+    points.push_back(points.front());
+    points.push_back({{test.getNZ() - 1, test.getNY() - 1, test.getNX() - 1}});
+
+    std::vector<double> values = test.fileReadPoints(points);
+    ASSERT_EQ(points.size(), values.size());
+    for(std::size_t i = 0; i < points.size(); ++i){
+        EXPECT_EQ(test.fileReadPoint(points[i][0], points[i][1], points[i][2]), values[i]);
+    }
+
+    ASSERT_EQ(0, test.mapFile());
+    EXPECT_EQ(values, test.fileReadPoints(points));
+
+    EXPECT_TRUE(test.fileReadPoints(std::vector<std::array<int, 3>>()).empty());
+    EXPECT_TRUE(test.fileReadPoints({{{0, 0, test.getNX()}}}).empty());
+    test.close();
+}
+
+TEST_F(PFData_test, series){
+    //Three timesteps sharing a layout, and one written with a different topology
+    const int nz = 4, ny = 6, nx = 9, numFiles = 4;
+    std::vector<std::vector<double>> data(numFiles, std::vector<double>(nz * ny * nx));
+    char filename[64];
+    for(int t = 0; t < numFiles; ++t){
+        for(std::size_t i = 0; i < data[t].size(); ++i){
+            data[t][i] = 1000.0 * t + i;
+        }
+        PFData source(data[t].data(), nz, ny, nx);
+        source.setP(t == 2 ? 2 : 3);
+        source.setQ(2);
+        source.setR(t == 2 ? 1 : 2);
+        std::snprintf(filename, sizeof(filename), "tests/series.%05d.pfb", t);
+        ASSERT_EQ(0, source.writeFile(filename));
+    }
+
+    PFSeries series("tests/series.%05d.pfb", 0, numFiles - 1);
+    ASSERT_EQ(numFiles, series.getNumFiles());
+    EXPECT_EQ("tests/series.00003.pfb", series.getFilename(3));
+    ASSERT_EQ(0, series.loadHeader());
+    EXPECT_EQ(nx, series.getHeader().getNX());
+
+    for(int numThreads : {1, 3}){
+        std::vector<double> point = series.readPoint(3, 5, 7, numThreads);
+        ASSERT_EQ(static_cast<std::size_t>(numFiles), point.size());
+        for(int t = 0; t < numFiles; ++t){
+            EXPECT_EQ(data[t][(3 * ny + 5) * nx + 7], point[t]);
+        }
+
+        std::vector<double> column = series.readColumn(2, 4, numThreads);
+        ASSERT_EQ(static_cast<std::size_t>(numFiles * nz), column.size());
+        for(int t = 0; t < numFiles; ++t){
+            for(int z = 0; z < nz; ++z){
+                EXPECT_EQ(data[t][(z * ny + 2) * nx + 4], column[t * nz + z]);
+            }
+        }
+    }
+
+    EXPECT_TRUE(series.readPoint(nz, 0, 0).empty());
+
+    //A missing file fails the whole read
+    PFSeries missing("tests/series.%05d.pfb", 0, numFiles);
+    ASSERT_EQ(0, missing.loadHeader());
+    EXPECT_TRUE(missing.readPoint(0, 0, 0, 2).empty());
+
+    for(int t = 0; t < numFiles; ++t){
+        std::snprintf(filename, sizeof(filename), "tests/series.%05d.pfb", t);
+        ASSERT_EQ(0, remove(filename));
+    }
+}
+
+TEST_F(PFData_test, seriesSamePrefix){
+    //Both topologies start with a 2x2 subgrid and give files of the same size, only the last subgrid tells them apart
+    const int nz = 1, ny = 4, nx = 4;
+    std::vector<double> data(nz * ny * nx);
+    for(std::size_t i = 0; i < data.size(); ++i){
+        data[i] = static_cast<double>(i);
+    }
+    PFData source(data.data(), nz, ny, nx);
+    source.setP(2);
+    source.setQ(3);
+    source.setR(1);
+    ASSERT_EQ(0, source.writeFile("tests/series_prefix.00000.pfb"));
+    source.setP(3);
+    source.setQ(2);
+    ASSERT_EQ(0, source.writeFile("tests/series_prefix.00001.pfb"));
+
+    PFSeries series("tests/series_prefix.%05d.pfb", 0, 1);
+    ASSERT_EQ(0, series.loadHeader());
+    for(int y = 0; y < ny; ++y){
+        for(int x = 0; x < nx; ++x){
+            const std::vector<double> point = series.readPoint(0, y, x);
+            ASSERT_EQ(2u, point.size());
+            EXPECT_EQ(data[y * nx + x], point[0]);
+            EXPECT_EQ(data[y * nx + x], point[1]);
+        }
+    }
+
+    ASSERT_EQ(0, remove("tests/series_prefix.00000.pfb"));
+    ASSERT_EQ(0, remove("tests/series_prefix.00001.pfb"));
+}
+
+TEST_F(PFData_test, seriesCompressed){
+    PFData reference("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, reference.loadHeader());
+    ASSERT_EQ(0, reference.loadPQR());
+    ASSERT_EQ(0, reference.loadData());
+    ASSERT_EQ(0, reference.writeCompressedFile("tests/series_compressed.00000.pfbz"));
+    ASSERT_EQ(0, reference.writeCompressedFile("tests/series_compressed.00001.pfbz"));
+
+    const int nz = reference.getNZ(), ny = reference.getNY(), nx = reference.getNX();
+    const std::vector<std::array<int, 3>> points = {{{0, 0, 0}}, {{nz - 1, ny - 1, nx - 1}}, {{2, 1, 21}}};
+
+    //A compressed sequence, and compressed files following a pfb
+    for(const std::vector<std::string>& filenames : {
+            std::vector<std::string>{"tests/series_compressed.00000.pfbz", "tests/series_compressed.00001.pfbz"},
+            std::vector<std::string>{"tests/inputs/press.init.pfb", "tests/series_compressed.00000.pfbz"}}){
+        PFSeries series(filenames);
+        ASSERT_EQ(0, series.loadHeader());
+        for(int numThreads : {1, 2}){
+            const std::vector<double> values = series.readPoints(points, numThreads);
+            ASSERT_EQ(2 * points.size(), values.size());
+            for(std::size_t file = 0; file < 2; ++file){
+                for(std::size_t i = 0; i < points.size(); ++i){
+                    EXPECT_EQ(reference(points[i][0], points[i][1], points[i][2]), values[file * points.size() + i]);
+                }
+            }
+        }
+    }
+
+    reference.close();
+    ASSERT_EQ(0, remove("tests/series_compressed.00000.pfbz"));
+    ASSERT_EQ(0, remove("tests/series_compressed.00001.pfbz"));
+}
+
+TEST_F(PFData_test, clmVariables){
+    //13 surface variables and 10 soil layers, written with a Z topology splitting the stack
+    const int nz = 23, ny = 5, nx = 7;
+    std::vector<double> data(nz * ny * nx);
+    for(std::size_t i = 0; i < data.size(); ++i){
+        data[i] = static_cast<double>(i);
+    }
+    PFData source(data.data(), nz, ny, nx);
+    source.setP(3);
+    source.setQ(2);
+    source.setR(2);
+    ASSERT_EQ(0, source.writeFile("tests/clm.c.pfb"));
+
+    PFClmData clm("tests/clm.c.pfb");
+    ASSERT_EQ(0, clm.loadHeader());
+    ASSERT_EQ(nz, clm.getNumVariables());
+    EXPECT_EQ("eflx_lh_tot", clm.getVariableNames().front());
+    EXPECT_EQ(11, clm.getVariableIndex("t_grnd"));
+    EXPECT_EQ(13, clm.getVariableIndex("t_soil_1"));
+    EXPECT_EQ("t_soil_10", clm.getVariableNames().back());
+    EXPECT_EQ(-1, clm.getVariableIndex("t_soil_11"));
+
+    const std::size_t layerSize = static_cast<std::size_t>(ny) * nx;
+    std::vector<double> tGrnd = clm.loadVariable("t_grnd");
+    ASSERT_EQ(layerSize, tGrnd.size());
+    EXPECT_TRUE(std::equal(tGrnd.begin(), tGrnd.end(), data.begin() + 11 * layerSize));
+
+    //A run of consecutive layers crossing the Z subgrid boundary, and layers out of order
+    const std::vector<std::string> names = {"t_soil_1", "t_soil_2", "t_soil_3", "eflx_lh_tot", "swe_out", "qflx_infl"};
+    const int layers[] = {13, 14, 15, 0, 10, 9};
+    std::vector<double> subset = clm.loadVariables(names);
+    ASSERT_EQ(names.size() * layerSize, subset.size());
+    for(std::size_t i = 0; i < names.size(); ++i){
+        EXPECT_TRUE(std::equal(subset.begin() + i * layerSize, subset.begin() + (i + 1) * layerSize, data.begin() + layers[i] * layerSize)) << names[i];
+    }
+
+    EXPECT_TRUE(clm.loadVariable("no_such_variable").empty());
+
+    //Custom layouts
+    EXPECT_NE(0, clm.setVariableNames({"a", "b"}));
+    std::vector<std::string> custom(nz);
+    for(int z = 0; z < nz; ++z){
+        custom[z] = "layer" + std::to_string(z);
+    }
+    ASSERT_EQ(0, clm.setVariableNames(custom));
+    std::vector<double> layer22 = clm.loadVariable("layer22");
+    ASSERT_EQ(layerSize, layer22.size());
+    EXPECT_EQ(data[22 * layerSize + layerSize - 1], layer22.back());
+
+    ASSERT_EQ(0, remove("tests/clm.c.pfb"));
+}
+
+TEST_F(PFData_test, generatePfbFile){
+    //Remainder blocks in every direction
+    const int nz = 7, ny = 13, nx = 29;
+    ASSERT_EQ(0, generatePfbFile("tests/generated.pfb", nz, ny, nx, 4, 3, 2, 5, 3));
+
+    PFData test("tests/generated.pfb");
+    ASSERT_EQ(0, test.loadHeader());
+    ASSERT_EQ(0, test.loadPQR());
+    EXPECT_EQ(4, test.getP());
+    EXPECT_EQ(3, test.getQ());
+    EXPECT_EQ(2, test.getR());
+    ASSERT_EQ(0, test.loadData());
+
+    const double* data = test.getData();
+    for(int z = 0; z < nz; ++z){
+        for(int y = 0; y < ny; ++y){
+            for(int x = 0; x < nx; ++x){
+                const double value = generatePfbValue(z, y, x, ny, nx, 5);
+                ASSERT_EQ(value, data[(z * ny + y) * nx + x]);
+                //Rounding recovers the index of the point
+                ASSERT_EQ((z * ny + y) * nx + x, std::lround(value));
+            }
+        }
+    }
+    test.close();
+
+    //Another seed gives another field
+    EXPECT_NE(generatePfbValue(1, 2, 3, ny, nx, 5), generatePfbValue(1, 2, 3, ny, nx, 6));
+
+    EXPECT_EQ(EINVAL, generatePfbFile("tests/generated.pfb", nz, ny, nx, nx + 1, 1, 1));
+    ASSERT_EQ(0, remove("tests/generated.pfb"));
+}
+
+TEST_F(PFData_test, loadAsFloat){
+    PFData reference("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, reference.loadHeader());
+    ASSERT_EQ(0, reference.loadPQR());
+    ASSERT_EQ(0, reference.loadData());
+    const double* expected = reference.getData();
+    const int nz = reference.getNZ(), ny = reference.getNY(), nx = reference.getNX();
+    const std::size_t count = static_cast<std::size_t>(nz) * ny * nx;
+
+    //Sequential, threaded, and mapped loads
+    for(int mode = 0; mode < 3; ++mode){
+        PFData test("tests/inputs/press.init.pfb");
+        test.setLoadAsFloat(true);
+        EXPECT_TRUE(test.getLoadAsFloat());
+        ASSERT_EQ(0, test.loadHeader());
+        ASSERT_EQ(0, test.loadPQR());
+        if(mode == 2){
+            ASSERT_EQ(0, test.mapFile());
+        }
+        ASSERT_EQ(0, mode == 1 ? test.loadDataThreaded(3) : test.loadData());
+        EXPECT_EQ(nullptr, test.getData());
+
+        const float* data = test.getFloatData();
+        ASSERT_NE(nullptr, data);
+        for(std::size_t i = 0; i < count; ++i){
+            ASSERT_EQ(static_cast<float>(expected[i]), data[i]);
+        }
+        test.close();
+    }
+
+    //Hyperslabs
+    PFData test("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, test.loadHeader());
+    ASSERT_EQ(0, test.loadPQR());
+    std::vector<float> slab = test.loadHyperslabFloat(1, 3, 5, 4, 19, 30, 2, 2, 1);
+    ASSERT_EQ(4u * 19 * 30, slab.size());
+    for(int k = 0; k < 4; ++k){
+        for(int j = 0; j < 19; ++j){
+            for(int i = 0; i < 30; ++i){
+                const int z = 1 + 2 * k, y = 3 + 2 * j, x = 5 + i;
+                ASSERT_EQ(static_cast<float>(expected[(z * ny + y) * nx + x]), slab[(k * 19 + j) * 30 + i]);
+            }
+        }
+    }
+
+    //Clip
+    test.setLoadAsFloat(true);
+    ASSERT_EQ(0, test.loadClipOfData(10, 12, 15, 7));
+    const float* clip = test.getFloatData();
+    for(int z = 0; z < nz; ++z){
+        for(int y = 0; y < 7; ++y){
+            for(int x = 0; x < 15; ++x){
+                ASSERT_EQ(static_cast<float>(expected[(z * ny + y + 12) * nx + x + 10]), clip[(z * 7 + y) * 15 + x]);
+            }
+        }
+    }
+
+    float* released = test.releaseFloatData();
+    EXPECT_EQ(nullptr, test.getFloatData());
+    PFBufferPool::shared().release(released);
+    reference.close();
+}
+
+TEST_F(PFData_test, lazyGet){
+    PFData reference("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, reference.loadHeader());
+    ASSERT_EQ(0, reference.loadPQR());
+    ASSERT_EQ(0, reference.loadData());
+
+    PFData test("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, test.loadHeader());
+    ASSERT_EQ(0, test.loadPQR());
+    EXPECT_EQ(0u, test.getSubgridCacheSize());
+
+    //First touch pages in exactly one subgrid
+    EXPECT_EQ(reference(3, 4, 5), test.get(3, 4, 5));
+    const std::size_t firstSubgrid = 8u * test.getSubgridSizeZ(0) * test.getSubgridSizeY(0) * test.getSubgridSizeX(0);
+    EXPECT_EQ(firstSubgrid, test.getSubgridCacheSize());
+
+    //A budget of about two subgrids keeps the cache bounded while every point is visited
+    test.setSubgridCacheBudget(2 * firstSubgrid);
+    for(int z = 0; z < test.getNZ(); ++z){
+        for(int y = 0; y < test.getNY(); ++y){
+            for(int x = 0; x < test.getNX(); ++x){
+                ASSERT_EQ(reference(z, y, x), test(z, y, x));
+            }
+        }
+    }
+    EXPECT_LE(test.getSubgridCacheSize(), 2 * firstSubgrid);
+    EXPECT_GT(test.getSubgridCacheSize(), 0u);
+
+    //A budget smaller than a subgrid still works, keeping only the last one
+    test.setSubgridCacheBudget(1);
+    EXPECT_EQ(reference(20, 30, 40), test.get(20, 30, 40));
+    EXPECT_EQ(reference(0, 0, 0), test.get(0, 0, 0));
+    EXPECT_EQ(firstSubgrid, test.getSubgridCacheSize());
+
+    //Through the mapping
+    PFData mapped("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, mapped.loadHeader());
+    ASSERT_EQ(0, mapped.loadPQR());
+    ASSERT_EQ(0, mapped.mapFile());
+    EXPECT_EQ(reference(49, 40, 40), mapped.get(49, 40, 40));
+
+    //Reading a different file drops the cached subgrids
+    ASSERT_EQ(0, test.loadHeader());
+    EXPECT_EQ(0u, test.getSubgridCacheSize());
+
+    mapped.close();
+    test.close();
+    reference.close();
+}
+
+TEST_F(PFData_test, concurrentReaders){
+    PFData reference("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, reference.loadHeader());
+    ASSERT_EQ(0, reference.loadPQR());
+    ASSERT_EQ(0, reference.loadData());
+
+    //One object shared by every thread, without loading the data
+    PFData shared("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, shared.loadHeader());
+    ASSERT_EQ(0, shared.loadPQR());
+    shared.setSubgridCacheBudget(8u * shared.getSubgridSizeZ(0) * shared.getSubgridSizeY(0) * shared.getSubgridSizeX(0));
+    const PFData& reader = shared;
+
+    const int nz = reader.getNZ();
+    const int ny = reader.getNY();
+    const int nx = reader.getNX();
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; ++t){
+        threads.emplace_back([&, t]{
+            for(int i = 0; i < 200; ++i){
+                const int z = (i * 7 + t * 13) % nz;
+                const int y = (i * 11 + t * 5) % ny;
+                const int x = (i * 3 + t * 17) % nx;
+                const double expected = reference(z, y, x);
+
+                if(reader.fileReadPoint(z, y, x) != expected || reader.get(z, y, x) != expected){
+                    mismatches++;
+                }
+
+                const int gridZ = reader.getSubgridIndexZ(z);
+                const int gridY = reader.getSubgridIndexY(y);
+                const int gridX = reader.getSubgridIndexX(x);
+                const std::vector<double> subgrid = reader.fileReadSubgridAtGridIndex(gridZ, gridY, gridX);
+                const int localZ = z - reader.getSubgridStartZ(gridZ);
+                const int localY = y - reader.getSubgridStartY(gridY);
+                const int localX = x - reader.getSubgridStartX(gridX);
+                const std::size_t local = (static_cast<std::size_t>(localZ) * reader.getSubgridSizeY(gridY) + localY) * reader.getSubgridSizeX(gridX) + localX;
+                if(subgrid.size() <= local || subgrid[local] != expected){
+                    mismatches++;
+                }
+
+                double slab[2 * 2 * 2];
+                const int z0 = std::min(z, nz - 2);
+                const int y0 = std::min(y, ny - 2);
+                const int x0 = std::min(x, nx - 2);
+                if(reader.readHyperslab(slab, z0, y0, x0, 2, 2, 2) != 0 || slab[7] != reference(z0 + 1, y0 + 1, x0 + 1)){
+                    mismatches++;
+                }
+            }
+        });
+    }
+    for(std::thread& thread : threads){
+        thread.join();
+    }
+    EXPECT_EQ(0, mismatches.load());
+
+    //The const readers never move the stdio position, so a sequential load afterwards still works
+    ASSERT_EQ(0, shared.loadData());
+    EXPECT_EQ(reference(20, 30, 40), shared(20, 30, 40));
+
+    shared.close();
+    reference.close();
+}
+
+TEST(SubgridCache, lru){
+    SubgridCache cache;
+    cache.setBudget(3 * 8 * 10);
+    for(int i = 0; i < 3; ++i){
+        cache.insert(i, std::vector<double>(10, i));
+    }
+    EXPECT_EQ(3, cache.getNumEntries());
+
+    //0 becomes the most recently used, so 1 is evicted next
+    ASSERT_NE(nullptr, cache.find(0));
+    cache.insert(3, std::vector<double>(10, 3));
+    EXPECT_EQ(3, cache.getNumEntries());
+    EXPECT_EQ(nullptr, cache.find(1));
+    ASSERT_NE(nullptr, cache.find(0));
+    EXPECT_EQ(0.0, (*cache.find(0))[0]);
+    EXPECT_EQ(3.0, (*cache.find(3))[9]);
+
+    cache.setBudget(8 * 10);
+    EXPECT_EQ(1, cache.getNumEntries());
+    EXPECT_EQ(80u, cache.getSize());
+
+    cache.clear();
+    EXPECT_EQ(0, cache.getNumEntries());
+    EXPECT_EQ(0u, cache.getSize());
+}
+
+TEST_F(PFData_test, bufferOwnership){
+    PFBufferPool& pool = PFBufferPool::shared();
+    pool.setCapacity(64u << 20);
+
+    //Reloading, and loading the next timestep into a new object, reuse the same buffer
+    const double* first = nullptr;
+    for(int i = 0; i < 3; ++i){
+        PFData test("tests/inputs/press.init.pfb");
+        ASSERT_EQ(0, test.loadHeader());
+        ASSERT_EQ(0, test.loadPQR());
+        ASSERT_EQ(0, test.loadData());
+        ASSERT_EQ(0, test.loadDataThreaded(2));
+        EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(test.getData()) % PFBufferPool::ALIGNMENT);
+        if(first == nullptr){
+            first = test.getData();
+        }
+        EXPECT_EQ(first, test.getData());
+    }
+    EXPECT_EQ(8u * 41 * 41 * 50, pool.getIdleBytes());
+
+    //Moving transfers the file and the data
+    PFData source("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, source.loadHeader());
+    ASSERT_EQ(0, source.loadPQR());
+    ASSERT_EQ(0, source.loadData());
+    const double value = source(1, 2, 3);
+
+    std::vector<PFData> moved;
+    moved.push_back(std::move(source));
+    EXPECT_EQ(nullptr, source.getData());
+    EXPECT_EQ(0, source.getNX());
+    EXPECT_EQ(value, moved[0](1, 2, 3));
+    EXPECT_EQ(value, moved[0].fileReadPoint(1, 2, 3));
+
+    PFData assigned;
+    assigned = std::move(moved[0]);
+    EXPECT_EQ(value, assigned(1, 2, 3));
+    EXPECT_EQ(41, assigned.getNX());
+
+    //Arrays from std::malloc can be owned too, once adopted by the pool
+    PFData external;
+    double* values = static_cast<double*>(std::malloc(8 * sizeof(double)));
+    pool.adopt(values, 8 * sizeof(double));
+    external.setData(values);
+    external.setIsDataOwner(true);
+
+    pool.setCapacity(0);
+    EXPECT_EQ(0u, pool.getIdleBytes());
+}
+
+TEST(PFBufferPool, reuse){
+    PFBufferPool pool;
+    void* a = pool.allocate(1000);
+    ASSERT_NE(nullptr, a);
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(a) % PFBufferPool::ALIGNMENT);
+
+    //No pooling by default
+    pool.release(a);
+    EXPECT_EQ(0u, pool.getIdleBytes());
+
+    pool.setCapacity(3000);
+    a = pool.allocate(1000);
+    void* b = pool.allocate(2000);
+    pool.release(a);
+    pool.release(b);
+    EXPECT_EQ(3000u, pool.getIdleBytes());
+
+    //Same size reuses, other sizes allocate
+    EXPECT_EQ(a, pool.allocate(1000));
+    void* c = pool.allocate(500);
+    EXPECT_NE(b, c);
+    pool.release(c);
+    EXPECT_EQ(2500u, pool.getIdleBytes());
+
+    //Over capacity, the buffer is freed instead
+    void* d = pool.allocate(4000);
+    pool.release(d);
+    EXPECT_EQ(2500u, pool.getIdleBytes());
+
+    pool.setHugePages(true);
+    void* huge = pool.allocate(4u << 20);
+    ASSERT_NE(nullptr, huge);
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(huge) % PFBufferPool::ALIGNMENT);
+    static_cast<char*>(huge)[(4u << 20) - 1] = 1;
+    pool.release(huge);
+
+    pool.release(a);
+    pool.trim();
+    EXPECT_EQ(0u, pool.getIdleBytes());
+}
+
+TEST(PFBufferPool, foreignBuffers){
+    PFBufferPool pool;
+    pool.setCapacity(1u << 20);
+
+    //Memory the pool does not own is left alone
+    double local[4] = {1.0, 2.0, 3.0, 4.0};
+    pool.release(local);
+    EXPECT_EQ(0u, pool.getIdleBytes());
+    EXPECT_EQ(4.0, local[3]);
+
+    //Adopted malloc arrays are freed, never pooled
+    void* adopted = std::malloc(1000);
+    ASSERT_NE(nullptr, adopted);
+    pool.adopt(adopted, 1000);
+    pool.release(adopted);
+    EXPECT_EQ(0u, pool.getIdleBytes());
+}
+
+TEST_F(PFData_test, subgridIndex){
+    PFData test("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, test.loadHeader());
+    EXPECT_TRUE(test.getSubgridIndex().empty());
+    ASSERT_EQ(0, test.loadPQR());
+
+    const SubgridIndex& index = test.getSubgridIndex();
+    ASSERT_EQ(16, index.size());
+    EXPECT_EQ(4, index.getP());
+    EXPECT_EQ(4, index.getQ());
+    EXPECT_EQ(1, index.getR());
+    EXPECT_EQ(64, index.at(0).offset);
+    EXPECT_EQ(11, index.at(0).nx);
+    EXPECT_EQ(11, index.at(0, 1, 1).ix);
+    EXPECT_EQ(11, index.at(0, 1, 1).iy);
+    EXPECT_EQ(10, index.at(0, 1, 1).nx);
+    EXPECT_EQ(&index.at(5), &index.at(0, 1, 1));
+
+    //Offsets agree with the arithmetic for the regular layout
+    const long long offset = 64 + 36 + 8LL * 11 * 11 * 50;
+    EXPECT_EQ(offset, index.at(1).offset);
+
+    //Round trip through the sidecar
+    ASSERT_EQ(0, test.saveSubgridIndex());
+    PFData fromSidecar("tests/inputs/press.init.pfb");
+    fromSidecar.loadHeader();
+    ASSERT_EQ(0, fromSidecar.loadSubgridIndex());
+    EXPECT_EQ(4, fromSidecar.getP());
+    EXPECT_EQ(4, fromSidecar.getQ());
+    EXPECT_EQ(1, fromSidecar.getR());
+    ASSERT_EQ(16, fromSidecar.getSubgridIndex().size());
+    for(int i = 0; i < 16; ++i){
+        EXPECT_EQ(index.at(i).offset, fromSidecar.getSubgridIndex().at(i).offset);
+        EXPECT_EQ(index.at(i).ny, fromSidecar.getSubgridIndex().at(i).ny);
+    }
+    EXPECT_NEAR(92.61370155558751, fromSidecar.fileReadPoint(2,1,21), 1E-12);
+    ASSERT_EQ(0, remove("tests/inputs/press.init.pfb.pfidx"));
+}
+
+TEST_F(PFData_test, subgridIndexStale){
+    const int nz = 2, ny = 4, nx = 4;
+    std::vector<double> data(nz * ny * nx);
+    for(std::size_t i = 0; i < data.size(); ++i){
+        data[i] = static_cast<double>(i);
+    }
+    PFData source(data.data(), nz, ny, nx);
+    source.setP(2);
+    source.setQ(1);
+    source.setR(1);
+    ASSERT_EQ(0, source.writeFile("tests/stale_index.pfb"));
+    {
+        PFData indexed("tests/stale_index.pfb");
+        ASSERT_EQ(0, indexed.loadHeader());
+        ASSERT_EQ(0, indexed.loadPQR());
+        ASSERT_EQ(0, indexed.saveSubgridIndex());
+    }
+
+    //Same size and number of subgrids, another topology
+    source.setP(1);
+    source.setQ(2);
+    ASSERT_EQ(0, source.writeFile("tests/stale_index.pfb"));
+
+    PFData test("tests/stale_index.pfb");
+    ASSERT_EQ(0, test.loadHeader());
+    ASSERT_EQ(0, test.loadSubgridIndex());
+    EXPECT_EQ(1, test.getP());
+    EXPECT_EQ(2, test.getQ());
+    for(int z = 0; z < nz; ++z){
+        for(int y = 0; y < ny; ++y){
+            for(int x = 0; x < nx; ++x){
+                EXPECT_EQ(data[(z * ny + y) * nx + x], test.fileReadPoint(z, y, x));
+            }
+        }
+    }
+
+    test.close();
+    ASSERT_EQ(0, remove("tests/stale_index.pfb"));
+    ASSERT_EQ(0, remove("tests/stale_index.pfb.pfidx"));
+}
+
+TEST_F(PFData_test, nativeCache){
+    const std::string filename = "tests/native_cache.pfb";
+    {
+        std::ifstream src("tests/inputs/press.init.pfb", std::ios::binary);
+        std::ofstream dst(filename, std::ios::binary | std::ios::trunc);
+        dst << src.rdbuf();
+    }
+
+    PFData reference("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, reference.loadHeader());
+    ASSERT_EQ(0, reference.loadPQR());
+    ASSERT_EQ(0, reference.loadData());
+    const std::size_t count = static_cast<std::size_t>(reference.getNX()) * reference.getNY() * reference.getNZ();
+
+    //The first load reads the pfb and writes the sidecar
+    PFData first(filename);
+    first.setNativeCache(true);
+    ASSERT_EQ(0, first.loadHeader());
+    EXPECT_NE(0, first.loadNativeCache());
+    ASSERT_EQ(0, first.loadPQR());
+    ASSERT_EQ(0, first.loadData());
+    EXPECT_FALSE(first.isNativeCacheLoaded());
+    EXPECT_TRUE(first.isDataOwner());
+    std::ifstream sidecar(filename + ".pfbn", std::ios::binary | std::ios::ate);
+    ASSERT_TRUE(sidecar.good());
+    EXPECT_EQ(static_cast<std::streamoff>(4096 + 8 * count), static_cast<std::streamoff>(sidecar.tellg()));
+    sidecar.close();
+
+    //The second one maps it, and does not need the subgrid layout
+    PFData second(filename);
+    second.setNativeCache(true);
+    ASSERT_EQ(0, second.loadHeader());
+    ASSERT_EQ(0, second.loadDataThreaded(2));
+    ASSERT_TRUE(second.isNativeCacheLoaded());
+    EXPECT_FALSE(second.isDataOwner());
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(second.getData()) % 4096);
+    EXPECT_EQ(0, std::memcmp(reference.getData(), second.getData(), 8 * count));
+    EXPECT_EQ(reference(2, 1, 21), second(2, 1, 21));
+
+    //Writes stay private to the object
+    second.getData()[0] = -1.0;
+    PFData third(filename);
+    ASSERT_EQ(0, third.loadHeader());
+    ASSERT_EQ(0, third.loadNativeCache());
+    EXPECT_EQ(reference.getData()[0], third.getData()[0]);
+
+    //Moves carry the mapping along
+    PFData moved(std::move(third));
+    ASSERT_TRUE(moved.isNativeCacheLoaded());
+    EXPECT_EQ(reference.getData()[count - 1], moved.getData()[count - 1]);
+    EXPECT_FALSE(third.isNativeCacheLoaded());
+
+    //Changing the pfb invalidates the sidecar
+    {
+        std::ofstream append(filename, std::ios::binary | std::ios::app);
+        append.put('\0');
+    }
+    PFData stale(filename);
+    ASSERT_EQ(0, stale.loadHeader());
+    EXPECT_NE(0, stale.loadNativeCache());
+    EXPECT_EQ(nullptr, stale.getData());
+
+    ASSERT_EQ(0, remove((filename + ".pfbn").c_str()));
+    ASSERT_EQ(0, remove(filename.c_str()));
+}
+
+TEST_F(PFData_test, sparseFile){
+    PFData dense("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, dense.loadHeader());
+    ASSERT_EQ(0, dense.loadPQR());
+    ASSERT_EQ(0, dense.loadData());
+    const int nx = dense.getNX(), ny = dense.getNY(), nz = dense.getNZ();
+    const std::size_t count = static_cast<std::size_t>(nx) * ny * nz;
+
+    //Keep roughly the upper layers only, plus a NaN, which is never dropped
+    const double tolerance = 50.0;
+    dense.getData()[7] = std::nan("");
+    std::size_t numKept = 0;
+    for(std::size_t i = 0; i < count; ++i){
+        numKept += !(std::fabs(dense.getData()[i]) <= tolerance);
+    }
+    ASSERT_GT(numKept, 0u);
+    ASSERT_LT(numKept, count);
+    ASSERT_EQ(0, dense.writeSparseFile("tests/press.init.pfsb", tolerance));
+
+    //Header, 16 subgrids of 40 bytes, and 20 bytes per point
+    std::ifstream written("tests/press.init.pfsb", std::ios::binary | std::ios::ate);
+    EXPECT_EQ(static_cast<std::streamoff>(64 + 16 * 40 + 20 * numKept), static_cast<std::streamoff>(written.tellg()));
+    written.close();
+
+    //Dense expansion
+    PFData scattered("tests/press.init.pfsb");
+    ASSERT_EQ(0, scattered.loadHeader());
+    ASSERT_EQ(0, scattered.loadSparseData());
+    EXPECT_EQ(4, scattered.getP());
+    EXPECT_EQ(4, scattered.getQ());
+    EXPECT_EQ(1, scattered.getR());
+    EXPECT_TRUE(std::isnan(scattered.getData()[7]));
+    for(std::size_t i = 0; i < count; ++i){
+        const double expected = std::fabs(dense.getData()[i]) <= tolerance ? 0.0 : dense.getData()[i];
+        if(i != 7){
+            ASSERT_EQ(expected, scattered.getData()[i]) << "at " << i;
+        }
+    }
+
+    //Points, ordered by subgrid and then by index
+    PFData points("tests/press.init.pfsb");
+    ASSERT_EQ(0, points.loadHeader());
+    PFSparseData sparse;
+    ASSERT_EQ(0, points.loadSparse(sparse));
+    ASSERT_EQ(numKept, sparse.indices.size());
+    ASSERT_EQ(numKept, sparse.values.size());
+    for(std::size_t i = 0; i < sparse.indices.size(); ++i){
+        if(sparse.indices[i] != 7){
+            ASSERT_EQ(dense.getData()[sparse.indices[i]], sparse.values[i]);
+        }
+    }
+
+    //Writing the points back, in any order, gives the same file
+    std::reverse(sparse.indices.begin(), sparse.indices.end());
+    std::reverse(sparse.values.begin(), sparse.values.end());
+    ASSERT_EQ(0, points.writeSparseFile("tests/press.init.copy.pfsb", sparse));
+    std::ifstream a("tests/press.init.pfsb", std::ios::binary), b("tests/press.init.copy.pfsb", std::ios::binary);
+    const std::string original((std::istreambuf_iterator<char>(a)), std::istreambuf_iterator<char>());
+    const std::string copy((std::istreambuf_iterator<char>(b)), std::istreambuf_iterator<char>());
+    EXPECT_TRUE(original == copy);
+
+    //Points outside of the grid are rejected
+    sparse.indices.push_back(static_cast<long long>(count));
+    sparse.values.push_back(1.0);
+    EXPECT_NE(0, points.writeSparseFile("tests/press.init.bad.pfsb", sparse));
+
+    ASSERT_EQ(0, remove("tests/press.init.pfsb"));
+    ASSERT_EQ(0, remove("tests/press.init.copy.pfsb"));
+    remove("tests/press.init.bad.pfsb");
+}
+
+TEST_F(PFData_test, compressDoubles){
+    std::vector<std::vector<double>> inputs;
+    inputs.push_back({});
+    inputs.push_back(std::vector<double>(1000, 3.25));
+    std::vector<double> smooth(5000), noise(5000), special = {0.0, -0.0, std::nan(""), INFINITY, -INFINITY, 1e-310, 1.0};
+    for(std::size_t i = 0; i < smooth.size(); ++i){
+        smooth[i] = 100.0 + std::sin(0.01 * i);
+        noise[i] = static_cast<double>(rand()) / RAND_MAX * 1e6 - 5e5;
+    }
+    inputs.push_back(smooth);
+    inputs.push_back(noise);
+    inputs.push_back(special);
+
+    for(const std::vector<double>& input : inputs){
+        std::vector<unsigned char> compressed;
+        const int n = static_cast<int>(input.size());
+        compressDoubles(input.data(), 1, 1, n, compressed);
+        std::vector<double> output(input.size());
+        ASSERT_EQ(0, decompressDoubles(compressed.data(), compressed.size(), output.data(), 1, 1, n));
+        EXPECT_EQ(0, std::memcmp(input.data(), output.data(), 8 * input.size()));
+
+        //Incompressible data costs little more than the raw planes
+        EXPECT_LE(compressed.size(), 8 * input.size() + 17);
+
+        if(!compressed.empty()){
+            EXPECT_NE(0, decompressDoubles(compressed.data(), compressed.size() - 1, output.data(), 1, 1, n));
+        }
+    }
+
+    std::vector<unsigned char> compressed;
+    compressDoubles(inputs[1].data(), 1, 1, 1000, compressed);
+    EXPECT_LT(compressed.size(), 128u);
+    compressed.clear();
+    compressDoubles(smooth.data(), 1, 1, 5000, compressed);
+    EXPECT_LT(compressed.size(), 8 * smooth.size() * 3 / 5);
+
+    //Noise in X and Y but linear in Z, the predictor follows Z
+    std::vector<double> layered(10 * 20 * 25);
+    for(std::size_t i = 0; i < layered.size(); ++i){
+        layered[i] = noise[i % 500] + 0.25 * (i / 500);
+    }
+    compressed.clear();
+    compressDoubles(layered.data(), 10, 20, 25, compressed);
+    EXPECT_LT(compressed.size(), 8 * layered.size() / 2);
+    std::vector<double> output(layered.size());
+    ASSERT_EQ(0, decompressDoubles(compressed.data(), compressed.size(), output.data(), 10, 20, 25));
+    EXPECT_EQ(layered, output);
+}
+
+TEST_F(PFData_test, compressedFile){
+    PFData reference("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, reference.loadHeader());
+    ASSERT_EQ(0, reference.loadPQR());
+    ASSERT_EQ(0, reference.loadData());
+    const std::size_t count = static_cast<std::size_t>(reference.getNX()) * reference.getNY() * reference.getNZ();
+    ASSERT_EQ(0, reference.writeCompressedFile("tests/press.init.pfbz", 3));
+
+    std::ifstream written("tests/press.init.pfbz", std::ios::binary | std::ios::ate);
+    EXPECT_LT(static_cast<std::size_t>(written.tellg()), 8 * count * 2 / 3);
+    written.close();
+
+    //The topology comes with the header
+    PFData compressed("tests/press.init.pfbz");
+    ASSERT_EQ(0, compressed.loadHeader());
+    ASSERT_TRUE(compressed.isCompressed());
+    EXPECT_EQ(reference.getNX(), compressed.getNX());
+    EXPECT_EQ(reference.getDZ(), compressed.getDZ());
+    EXPECT_EQ(4, compressed.getP());
+    EXPECT_EQ(4, compressed.getQ());
+    EXPECT_EQ(1, compressed.getR());
+    EXPECT_EQ(0, compressed.loadPQR());
+
+    //Random access without loading
+    EXPECT_EQ(reference(2, 1, 21), compressed.fileReadPoint(2, 1, 21));
+    EXPECT_EQ(reference(49, 40, 40), compressed.get(49, 40, 40));
+    EXPECT_EQ(reference.fileReadSubgridAtGridIndex(0, 2, 3), compressed.fileReadSubgridAtGridIndex(0, 2, 3));
+    const std::vector<double> points = compressed.fileReadPoints({{{0, 0, 0}}, {{10, 20, 30}}});
+    ASSERT_EQ(2u, points.size());
+    EXPECT_EQ(reference(10, 20, 30), points[1]);
+    EXPECT_EQ(reference.loadHyperslab(3, 5, 7, 10, 9, 7, 4, 4, 5), compressed.loadHyperslab(3, 5, 7, 10, 9, 7, 4, 4, 5));
+
+    ASSERT_EQ(0, compressed.loadDataThreaded(2));
+    EXPECT_EQ(0, std::memcmp(reference.getData(), compressed.getData(), 8 * count));
+
+    PFData single("tests/press.init.pfbz");
+    single.setLoadAsFloat(true);
+    ASSERT_EQ(0, single.loadHeader());
+    ASSERT_EQ(0, single.loadData());
+    EXPECT_EQ(static_cast<float>(reference.getData()[count - 1]), single.getFloatData()[count - 1]);
+
+    //A truncated file is rejected by loadHeader()
+    {
+        std::ifstream src("tests/press.init.pfbz", std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(src)), std::istreambuf_iterator<char>());
+        std::ofstream dst("tests/press.init.truncated.pfbz", std::ios::binary | std::ios::trunc);
+        dst.write(bytes.data(), bytes.size() - 1);
+    }
+    PFData truncated("tests/press.init.truncated.pfbz");
+    EXPECT_NE(0, truncated.loadHeader());
+
+    ASSERT_EQ(0, remove("tests/press.init.pfbz"));
+    ASSERT_EQ(0, remove("tests/press.init.truncated.pfbz"));
+}
+
+TEST_F(PFData_test, compressedFileErrorBound){
+    PFData reference("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, reference.loadHeader());
+    ASSERT_EQ(0, reference.loadPQR());
+    ASSERT_EQ(0, reference.loadData());
+    const std::size_t count = static_cast<std::size_t>(reference.getNX()) * reference.getNY() * reference.getNZ();
+
+    //Values that cannot be rounded are kept as they are
+    std::vector<double> values(reference.getData(), reference.getData() + count);
+    values[5] = std::nan("");
+    values[6] = INFINITY;
+    values[7] = 1e300;
+    PFData modified(values.data(), reference.getNZ(), reference.getNY(), reference.getNX());
+    modified.setP(reference.getP());
+    modified.setQ(reference.getQ());
+    modified.setR(reference.getR());
+
+    const double bound = 1e-6;
+    EXPECT_NE(0, modified.writeCompressedFile("tests/press.init.pfbz", 1, -1.0));
+    ASSERT_EQ(0, modified.writeCompressedFile("tests/press.init.pfbz", 3, bound));
+    std::ifstream written("tests/press.init.pfbz", std::ios::binary | std::ios::ate);
+    EXPECT_LT(static_cast<std::size_t>(written.tellg()), 8 * count / 3);
+    written.close();
+
+    PFData compressed("tests/press.init.pfbz");
+    ASSERT_EQ(0, compressed.loadHeader());
+    EXPECT_EQ(bound, compressed.getErrorBound());
+    EXPECT_EQ(0.0, reference.getErrorBound());
+    ASSERT_EQ(0, compressed.loadDataThreaded(2));
+    const double* data = compressed.getData();
+    EXPECT_TRUE(std::isnan(data[5]));
+    EXPECT_EQ(INFINITY, data[6]);
+    EXPECT_EQ(1e300, data[7]);
+    double maxError = 0.0;
+    for(std::size_t i = 8; i < count; ++i){
+        maxError = std::max(maxError, std::fabs(data[i] - values[i]));
+    }
+    EXPECT_LE(maxError, bound);
+    EXPECT_GT(maxError, 0.0);
+
+    //Partial reads decompress the same values
+    EXPECT_EQ(data[(10 * reference.getNY() + 20) * reference.getNX() + 30], compressed.fileReadPoint(10, 20, 30));
+    const std::vector<double> slab = compressed.loadHyperslab(3, 5, 7, 10, 9, 7, 4, 4, 5);
+    PFData loaded("tests/press.init.pfbz");
+    ASSERT_EQ(0, loaded.loadHeader());
+    EXPECT_EQ(slab, loaded.loadHyperslab(3, 5, 7, 10, 9, 7, 4, 4, 5));
+    EXPECT_EQ(data[count - 1], loaded.fileReadPoint(reference.getNZ() - 1, reference.getNY() - 1, reference.getNX() - 1));
+
+    ASSERT_EQ(0, remove("tests/press.init.pfbz"));
+}
+
+TEST_F(PFData_test, typedData){
+    PFData reference("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, reference.loadHeader());
+    ASSERT_EQ(0, reference.loadPQR());
+    ASSERT_EQ(0, reference.loadData());
+    const std::size_t count = static_cast<std::size_t>(reference.getNX()) * reference.getNY() * reference.getNZ();
+
+    //Pressures do not fit a mask, a saturated indicator does
+    PFTypedData<uint8_t> mask;
+    EXPECT_EQ(ERANGE, mask.assign(reference));
+    std::vector<double> saturated(count);
+    for(std::size_t i = 0; i < count; ++i){
+        saturated[i] = reference.getData()[i] > 0.0 ? 1.0 : 0.0;
+    }
+    PFData indicator(saturated.data(), reference.getNZ(), reference.getNY(), reference.getNX());
+    indicator.setP(reference.getP());
+    indicator.setQ(reference.getQ());
+    indicator.setR(reference.getR());
+    indicator.setDZ(reference.getDZ());
+    ASSERT_EQ(0, mask.assign(indicator));
+    ASSERT_EQ(0, mask.writeFile("tests/press.init.mask.pfbt"));
+
+    //One byte per value
+    std::ifstream written("tests/press.init.mask.pfbt", std::ios::binary | std::ios::ate);
+    EXPECT_EQ(static_cast<std::streamoff>(96 + count), static_cast<std::streamoff>(written.tellg()));
+    written.close();
+
+    PFTypedData<uint8_t> loaded("tests/press.init.mask.pfbt");
+    ASSERT_EQ(0, loaded.loadHeader());
+    EXPECT_EQ(nullptr, loaded.getData());
+    EXPECT_EQ(reference.getNX(), loaded.getHeader().getNX());
+    EXPECT_EQ(reference.getDZ(), loaded.getHeader().getDZ());
+    EXPECT_EQ(reference.getP(), loaded.getHeader().getP());
+    EXPECT_EQ(reference.getSubgridSizeX(1), loaded.getHeader().getSubgridSizeX(1));
+    ASSERT_EQ(0, loaded.loadData());
+    EXPECT_EQ(0, std::memcmp(mask.getData(), loaded.getData(), count));
+    EXPECT_EQ(reference(49, 40, 40) > 0.0 ? 1 : 0, loaded(49, 40, 40));
+
+    //The element type is checked
+    PFTypedData<float> wrongType("tests/press.init.mask.pfbt");
+    EXPECT_EQ(EINVAL, wrongType.loadHeader());
+    PFTypedData<float> notTyped("tests/inputs/press.init.pfb");
+    EXPECT_EQ(EINVAL, notTyped.loadHeader());
+
+    //Single precision rounds like setLoadAsFloat()
+    PFTypedData<float> single;
+    ASSERT_EQ(0, single.assign(reference));
+    ASSERT_EQ(0, single.writeFile("tests/press.init.float.pfbt"));
+    PFTypedData<float> singleLoaded("tests/press.init.float.pfbt");
+    ASSERT_EQ(0, singleLoaded.loadHeader());
+    ASSERT_EQ(0, singleLoaded.loadData());
+    EXPECT_EQ(static_cast<float>(reference.getData()[count - 1]), singleLoaded.getData()[count - 1]);
+
+    //Negative integers
+    std::vector<double> labels(count);
+    for(std::size_t i = 0; i < count; ++i){
+        labels[i] = static_cast<double>(static_cast<int>(i % 7) - 3);
+    }
+    PFData labelData(labels.data(), reference.getNZ(), reference.getNY(), reference.getNX());
+    labelData.setP(1);
+    labelData.setQ(1);
+    labelData.setR(1);
+    PFTypedData<int32_t> labelTyped;
+    ASSERT_EQ(0, labelTyped.assign(labelData));
+    ASSERT_EQ(0, labelTyped.writeFile("tests/press.init.int.pfbt"));
+    PFTypedData<int32_t> labelLoaded("tests/press.init.int.pfbt");
+    ASSERT_EQ(0, labelLoaded.loadHeader());
+    ASSERT_EQ(0, labelLoaded.loadData());
+    EXPECT_EQ(-3, labelLoaded.getData()[0]);
+    EXPECT_EQ(3, labelLoaded.getData()[6]);
+
+    ASSERT_EQ(0, remove("tests/press.init.mask.pfbt"));
+    ASSERT_EQ(0, remove("tests/press.init.float.pfbt"));
+    ASSERT_EQ(0, remove("tests/press.init.int.pfbt"));
+}
+
+TEST_F(PFData_test, subgridIndexFromDist){
+    PFData dist("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, dist.distFile(3, 2, 1, "tests/press.init.dist.pfb"));
+
+    PFData scanned("tests/press.init.dist.pfb");
+    scanned.loadHeader();
+    ASSERT_EQ(0, scanned.loadPQR());
+
+    PFData test("tests/press.init.dist.pfb");
+    test.loadHeader();
+    ASSERT_EQ(0, test.loadSubgridIndex());
+    EXPECT_EQ(3, test.getP());
+    EXPECT_EQ(2, test.getQ());
+    EXPECT_EQ(1, test.getR());
+
+    const SubgridIndex& expected = scanned.getSubgridIndex();
+    const SubgridIndex& index = test.getSubgridIndex();
+    ASSERT_EQ(expected.size(), index.size());
+    for(int i = 0; i < index.size(); ++i){
+        EXPECT_EQ(expected.at(i).offset, index.at(i).offset);
+        EXPECT_EQ(expected.at(i).ix, index.at(i).ix);
+        EXPECT_EQ(expected.at(i).iy, index.at(i).iy);
+        EXPECT_EQ(expected.at(i).iz, index.at(i).iz);
+        EXPECT_EQ(expected.at(i).nx, index.at(i).nx);
+        EXPECT_EQ(expected.at(i).ny, index.at(i).ny);
+        EXPECT_EQ(expected.at(i).nz, index.at(i).nz);
+        EXPECT_EQ(expected.at(i).rx, index.at(i).rx);
+    }
+
+    PFData base("tests/inputs/press.init.pfb");
+    base.loadHeader();
+    base.loadData();
+    EXPECT_EQ(base(45, 40, 0), test.fileReadPoint(45, 40, 0));
+    EXPECT_EQ(base(3, 20, 29), test.fileReadPoint(3, 20, 29));
+
+    test.close();
+    scanned.close();
+    ASSERT_EQ(0, remove("tests/press.init.dist.pfb"));
+    ASSERT_EQ(0, remove("tests/press.init.dist.pfb.dist"));
+}
+
 TEST_F(PFData_test, compareFuncSame){
     PFData test1("tests/inputs/press.init.pfb");
     test1.loadHeader();
@@ -304,6 +1666,255 @@ TEST_F(PFData_test, compareFuncSame){
     test2.close();
 }
 
+TEST_F(PFData_test, compareTolerance){
+    PFData test1("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, test1.loadHeader());
+    ASSERT_EQ(0, test1.loadPQR());
+    ASSERT_EQ(0, test1.loadData());
+    PFData test2("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, test2.loadHeader());
+    ASSERT_EQ(0, test2.loadPQR());
+    ASSERT_EQ(0, test2.loadData());
+
+    PFCompareTolerance exact;
+    PFCompareReport report;
+    EXPECT_EQ(PFData::differenceType::none, test1.compare(test2, exact, &report, 4));
+    EXPECT_EQ(static_cast<long long>(test1.getNZ()) * test1.getNY() * test1.getNX(), report.numCompared);
+    EXPECT_EQ(0, report.numDifferent);
+    EXPECT_EQ((std::array<int, 3>{{-1, -1, -1}}), report.firstDifferenceIndex);
+    EXPECT_EQ(static_cast<std::size_t>(test1.getNZ()), report.layers.size());
+    EXPECT_EQ(static_cast<std::size_t>(test1.getNumSubgrids()), report.subgrids.size());
+
+    //A tiny error, a large error, and NaNs
+    double* data = test1.getData();
+    const int nx = test1.getNX();
+    const int ny = test1.getNY();
+    const long long small = (10LL * ny + 20) * nx + 30;
+    const long long large = (40LL * ny + 5) * nx + 7;
+    const long long nanBoth = (2LL * ny + 3) * nx + 4;
+    const long long nanOne = (45LL * ny + 40) * nx + 40;
+    data[small] = std::nextafter(data[small], 1e300);
+    data[large] += 0.5;
+    data[nanBoth] = std::nan("");
+    test2.getData()[nanBoth] = std::nan("1");
+    data[nanOne] = std::nan("");
+
+    for(int numThreads : {1, 3}){
+        EXPECT_EQ(PFData::differenceType::data, test1.compare(test2, exact, &report, numThreads));
+        EXPECT_EQ(3, report.numDifferent);
+        EXPECT_EQ(1, report.numNaNMismatches);
+        EXPECT_EQ(test1.unflattenIndex(small), report.firstDifferenceIndex);
+        EXPECT_DOUBLE_EQ(0.5, report.maxAbsError);
+        EXPECT_EQ(test1.unflattenIndex(large), report.maxAbsErrorIndex);
+        EXPECT_GT(report.maxUlpError, 1u);
+        EXPECT_EQ(1, report.layers[10].numDifferent);
+        EXPECT_EQ(1, report.layers[40].numDifferent);
+        EXPECT_EQ(0, report.layers[2].numDifferent);
+        EXPECT_DOUBLE_EQ(0.5, report.layers[40].maxAbsError);
+
+        long long subgridTotal = 0;
+        for(const PFDifferenceSummary& summary : report.subgrids){
+            subgridTotal += summary.numDifferent;
+        }
+        EXPECT_EQ(3, subgridTotal);
+        const int largeSubgrid = (test1.getSubgridIndexZ(40) * test1.getQ() + test1.getSubgridIndexY(5)) * test1.getP() + test1.getSubgridIndexX(7);
+        EXPECT_EQ(1, report.subgrids[largeSubgrid].numDifferent);
+    }
+
+    //Tolerances accept the small error but not the large one, and never the NaN mismatch
+    PFCompareTolerance ulps;
+    ulps.ulps = 1;
+    EXPECT_EQ(PFData::differenceType::data, test1.compare(test2, ulps, &report, 2));
+    EXPECT_EQ(2, report.numDifferent);
+
+    PFCompareTolerance loose;
+    loose.absolute = 1.0;
+    EXPECT_EQ(PFData::differenceType::data, test1.compare(test2, loose, &report, 2));
+    EXPECT_EQ(1, report.numDifferent);
+    EXPECT_EQ(test1.unflattenIndex(nanOne), report.firstDifferenceIndex);
+
+    data[nanOne] = test2.getData()[nanOne];
+    PFCompareTolerance relative;
+    relative.relative = 1.0;
+    EXPECT_EQ(PFData::differenceType::none, test1.compare(test2, relative, nullptr, 2));
+
+    //Headers are still compared exactly
+    test1.setDX(test1.getDX() + 1.0);
+    EXPECT_EQ(PFData::differenceType::dX, test1.compare(test2, loose, &report, 2));
+
+    test1.close();
+    test2.close();
+}
+
+TEST_F(PFData_test, findFirstDifference64){
+    std::vector<uint64_t> a(37);
+    for(std::size_t i = 0; i < a.size(); ++i){
+        a[i] = i * 0x0101010101010101ULL;
+    }
+
+    //Every length and position, covering the tails of the vector kernels
+    for(std::size_t n = 0; n <= a.size(); ++n){
+        EXPECT_EQ(n, find_first_difference64(a.data(), a.data(), n));
+        for(std::size_t i = 0; i < n; ++i){
+            std::vector<uint64_t> b(a);
+            b[i] ^= 1ULL << 63;
+            ASSERT_EQ(i, find_first_difference64(a.data(), b.data(), n));
+        }
+    }
+}
+
+TEST_F(PFData_test, computeStatistics){
+    PFData reference("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, reference.loadHeader());
+    ASSERT_EQ(0, reference.loadPQR());
+    ASSERT_EQ(0, reference.loadData());
+    const int nz = reference.getNZ();
+    const int ny = reference.getNY();
+    const int nx = reference.getNX();
+    const double* data = reference.getData();
+
+    //Brute force over the loaded data
+    double min = data[0];
+    double max = data[0];
+    double sum = 0.0;
+    for(long long i = 0; i < static_cast<long long>(nz) * ny * nx; ++i){
+        min = std::min(min, data[i]);
+        max = std::max(max, data[i]);
+        sum += data[i];
+    }
+    const double mean = sum / (static_cast<double>(nz) * ny * nx);
+    double variance = 0.0;
+    double layerSum = 0.0;
+    for(long long i = 0; i < static_cast<long long>(nz) * ny * nx; ++i){
+        variance += (data[i] - mean) * (data[i] - mean);
+        if(i / (ny * nx) == 7){
+            layerSum += data[i];
+        }
+    }
+    variance /= static_cast<double>(nz) * ny * nx;
+
+    //Streamed from the file, without loading it
+    PFData test("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, test.loadHeader());
+    ASSERT_EQ(0, test.loadPQR());
+    PFStatisticsReport single;
+    PFStatisticsReport threaded;
+    ASSERT_EQ(0, test.computeStatistics(single, 1, 10, min, max));
+    ASSERT_EQ(0, test.computeStatistics(threaded, 3, 10, min, max));
+    EXPECT_EQ(nullptr, test.getData());
+
+    const PFStatistics& total = single.total;
+    EXPECT_EQ(static_cast<long long>(nz) * ny * nx, total.count);
+    EXPECT_EQ(0, total.numNaN);
+    EXPECT_EQ(min, total.min);
+    EXPECT_EQ(max, total.max);
+    EXPECT_NEAR(sum, total.sum, 1e-9 * std::fabs(sum) + 1e-9);
+    EXPECT_NEAR(mean, total.mean, 1e-12 * std::fabs(mean) + 1e-12);
+    EXPECT_NEAR(variance, total.variance, 1e-9 * variance);
+
+    //The same bits regardless of the number of threads
+    EXPECT_EQ(total.sum, threaded.total.sum);
+    EXPECT_EQ(total.variance, threaded.total.variance);
+    EXPECT_EQ(total.histogram, threaded.total.histogram);
+
+    long long binned = 0;
+    ASSERT_EQ(10u, total.histogram.size());
+    for(long long count : total.histogram){
+        binned += count;
+    }
+    EXPECT_EQ(total.count, binned);
+
+    ASSERT_EQ(static_cast<std::size_t>(nz), single.layers.size());
+    EXPECT_EQ(static_cast<long long>(ny) * nx, single.layers[7].count);
+    EXPECT_NEAR(layerSum, single.layers[7].sum, 1e-9 * std::fabs(layerSum) + 1e-9);
+
+    ASSERT_EQ(static_cast<std::size_t>(test.getNumSubgrids()), single.subgrids.size());
+    long long subgridCount = 0;
+    for(const PFStatistics& subgrid : single.subgrids){
+        subgridCount += subgrid.count;
+    }
+    EXPECT_EQ(total.count, subgridCount);
+    EXPECT_EQ(static_cast<long long>(test.getSubgridSizeZ(0)) * test.getSubgridSizeY(0) * test.getSubgridSizeX(0), single.subgrids[0].count);
+
+    //Loaded data gives the same results, and NaNs are only counted
+    reference.getData()[5] = std::nan("");
+    PFStatisticsReport loaded;
+    ASSERT_EQ(0, reference.computeStatistics(loaded, 2));
+    EXPECT_EQ(1, loaded.total.numNaN);
+    EXPECT_EQ(total.count - 1, loaded.total.count);
+    EXPECT_EQ(1, loaded.layers[0].numNaN);
+    EXPECT_TRUE(loaded.total.histogram.empty());
+
+    EXPECT_NE(0, test.computeStatistics(loaded, 1, 4, 1.0, 1.0));
+
+    test.close();
+    reference.close();
+}
+
+TEST_F(PFData_test, forEachSubgrid){
+    PFData reference("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, reference.loadHeader());
+    ASSERT_EQ(0, reference.loadPQR());
+    ASSERT_EQ(0, reference.loadData());
+
+    PFData test("tests/inputs/press.init.pfb");
+    ASSERT_EQ(0, test.loadHeader());
+    ASSERT_EQ(0, test.loadPQR());
+
+    //Every subgrid is visited once, with the values of the loaded data at its extents
+    const int numThreads = 3;
+    std::vector<int> visits(test.getNumSubgrids(), 0);
+    std::vector<long long> cellsPerWorker(numThreads, 0);
+    std::atomic<int> mismatches{0};
+    ASSERT_EQ(0, test.forEachSubgrid([&](const PFSubgridExtent& extent, const double* values, int worker) -> int{
+        visits[extent.index]++;
+        cellsPerWorker[worker] += static_cast<long long>(extent.nz) * extent.ny * extent.nx;
+        if(extent.nx != test.getSubgridSizeX(extent.gridX) || extent.startY != test.getSubgridStartY(extent.gridY)){
+            mismatches++;
+        }
+        for(int z = 0; z < extent.nz; ++z){
+            for(int y = 0; y < extent.ny; ++y){
+                for(int x = 0; x < extent.nx; ++x){
+                    if(*values++ != reference(extent.startZ + z, extent.startY + y, extent.startX + x)){
+                        mismatches++;
+                    }
+                }
+            }
+        }
+        return 0;
+    }, numThreads));
+    EXPECT_EQ(0, mismatches.load());
+    EXPECT_EQ(std::vector<int>(test.getNumSubgrids(), 1), visits);
+    long long cells = 0;
+    for(long long count : cellsPerWorker){
+        cells += count;
+    }
+    EXPECT_EQ(static_cast<long long>(test.getNZ()) * test.getNY() * test.getNX(), cells);
+    EXPECT_EQ(nullptr, test.getData());
+
+    //A non-zero return stops the visit and is passed through
+    std::atomic<int> calls{0};
+    EXPECT_EQ(42, test.forEachSubgrid([&](const PFSubgridExtent&, const double*, int) -> int{
+        calls++;
+        return 42;
+    }));
+    EXPECT_EQ(1, calls.load());
+
+    //Loaded data without a topology is a single subgrid
+    PFData fromData(reference.getData(), reference.getNZ(), reference.getNY(), reference.getNX());
+    int numVisited = 0;
+    ASSERT_EQ(0, fromData.forEachSubgrid([&](const PFSubgridExtent& extent, const double* values, int) -> int{
+        numVisited++;
+        EXPECT_EQ(reference.getNX(), extent.nx);
+        EXPECT_EQ(reference(1, 2, 3), values[(1 * extent.ny + 2) * extent.nx + 3]);
+        return 0;
+    }, 4));
+    EXPECT_EQ(1, numVisited);
+
+    test.close();
+    reference.close();
+}
+
 TEST_F(PFData_test, unflattenIndex){
     PFData test("tests/inputs/press.init.pfb");
     test.loadHeader();
@@ -537,9 +2148,84 @@ TEST_F(PFData_test, dist_press){
     fclose(f1);
     fclose(f2);
     ASSERT_EQ(0,remove("tests/press.init.pfb"));
+    ASSERT_EQ(0, remove("tests/press.init.pfb.dist"));
 }
 
 
+TEST_F(PFData_test, distFileStreaming){
+    PFData base("tests/inputs/press.init.pfb");
+    base.loadHeader();
+    base.loadData();
+    base.setP(3);
+    base.setQ(2);
+    base.setR(4);
+    ASSERT_EQ(0, base.writeFile("tests/press.init.expected.pfb"));
+    std::ifstream expectedFile("tests/press.init.expected.pfb", std::ios::binary);
+    const std::string expected((std::istreambuf_iterator<char>(expectedFile)), std::istreambuf_iterator<char>());
+
+    //Budgets forcing tiles of a few Y rows, of a few Z planes, and of the whole domain
+    const std::array<long long, 3> budgets = {{16 * 8 * 41 * 3, 16 * 8 * 41 * 41 * 7, 1LL << 30}};
+    for(long long budget : budgets){
+        PFData test("tests/inputs/press.init.pfb");
+        ASSERT_EQ(0, test.distFile(3, 2, 4, "tests/press.init.streamed.pfb", budget));
+        EXPECT_EQ(24, test.getNumSubgrids());
+        EXPECT_EQ(nullptr, test.getData());
+        test.close();
+
+        std::ifstream streamedFile("tests/press.init.streamed.pfb", std::ios::binary);
+        const std::string streamed((std::istreambuf_iterator<char>(streamedFile)), std::istreambuf_iterator<char>());
+        EXPECT_TRUE(expected == streamed) << "budget " << budget;
+    }
+
+    //And back again, from an uneven source topology
+    PFData back("tests/press.init.streamed.pfb");
+    ASSERT_EQ(0, back.distFile(4, 4, 1, "tests/press.init.back.pfb", 16 * 8 * 41 * 5));
+    std::ifstream original("tests/inputs/press.init.pfb", std::ios::binary);
+    std::ifstream roundTrip("tests/press.init.back.pfb", std::ios::binary);
+    const std::string originalBytes((std::istreambuf_iterator<char>(original)), std::istreambuf_iterator<char>());
+    const std::string roundTripBytes((std::istreambuf_iterator<char>(roundTrip)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(originalBytes.size(), roundTripBytes.size());
+    //Only the subgrid refinement fields differ (ParFlow writes 0, writeFile writes 1), compare the data of the last subgrid
+    const std::size_t lastSubgrid = originalBytes.size() - 8 * 10 * 10 * 50;
+    EXPECT_EQ(0, originalBytes.compare(lastSubgrid, std::string::npos, roundTripBytes, lastSubgrid, std::string::npos));
+
+    PFData check("tests/press.init.back.pfb");
+    check.loadHeader();
+    ASSERT_EQ(0, check.loadData());
+    PFData orig("tests/inputs/press.init.pfb");
+    orig.loadHeader();
+    orig.loadData();
+    EXPECT_EQ(orig.compare(check, nullptr), PFData::differenceType::none);
+    check.close();
+
+    //In place, the source is only replaced once the new file is complete
+    {
+        std::ifstream src("tests/inputs/press.init.pfb", std::ios::binary);
+        std::ofstream dst("tests/press.init.inplace.pfb", std::ios::binary | std::ios::trunc);
+        dst << src.rdbuf();
+    }
+    PFData inPlace("tests/press.init.inplace.pfb");
+    ASSERT_EQ(0, inPlace.distFile(3, 2, 4, "tests/press.init.inplace.pfb", 16 * 8 * 41 * 3));
+    std::ifstream inPlaceFile("tests/press.init.inplace.pfb", std::ios::binary);
+    const std::string inPlaceBytes((std::istreambuf_iterator<char>(inPlaceFile)), std::istreambuf_iterator<char>());
+    EXPECT_TRUE(expected == inPlaceBytes);
+    //The object reopened the new file
+    EXPECT_EQ(3, inPlace.getP());
+    EXPECT_EQ(2, inPlace.getQ());
+    EXPECT_EQ(4, inPlace.getR());
+    EXPECT_EQ(24, inPlace.getSubgridIndex().size());
+    EXPECT_EQ(orig(7, 30, 12), inPlace.fileReadPoint(7, 30, 12));
+    inPlace.close();
+
+    ASSERT_EQ(0, remove("tests/press.init.inplace.pfb"));
+    ASSERT_EQ(0, remove("tests/press.init.inplace.pfb.dist"));
+    ASSERT_EQ(0, remove("tests/press.init.expected.pfb"));
+    ASSERT_EQ(0, remove("tests/press.init.streamed.pfb"));
+    ASSERT_EQ(0, remove("tests/press.init.streamed.pfb.dist"));
+    ASSERT_EQ(0, remove("tests/press.init.back.pfb"));
+    ASSERT_EQ(0, remove("tests/press.init.back.pfb.dist"));
+}
+
 TEST_F(PFData_test, dist_lw_nldas){
     char buf1[1024];
     char buf2[1024];
@@ -599,6 +2285,70 @@ TEST_F(PFData_test, idxCalcs){
 
 }
 
+TEST_F(PFData_test, bswap64Array){
+    //Cover every tail length of the vector kernels, and unaligned arrays
+    std::vector<uint64_t> src(75);
+    for(std::size_t i = 0; i < src.size(); ++i){
+        src[i] = 0x0102030405060708ull * (i + 1) + i;
+    }
+
+    for(std::size_t offset = 0; offset < 3; ++offset){
+        for(std::size_t n = 0; n + offset <= src.size(); ++n){
+            std::vector<uint64_t> dst(src.size(), 0);
+            bswap64_array(src.data() + offset, dst.data() + offset, n);
+
+            std::vector<uint64_t> inplace(src);
+            bswap64_array_inplace(inplace.data() + offset, n);
+
+            for(std::size_t i = 0; i < n; ++i){
+                ASSERT_EQ(bswap64(src[offset + i]), dst[offset + i]);
+                ASSERT_EQ(bswap64(src[offset + i]), inplace[offset + i]);
+            }
+            //Nothing past the end is touched
+            for(std::size_t i = offset + n; i < dst.size(); ++i){
+                ASSERT_EQ(0u, dst[i]);
+                ASSERT_EQ(src[i], inplace[i]);
+            }
+        }
+    }
+
+    if(isLittleEndian()){
+        EXPECT_EQ(0x0807060504030201ull, bswap64(0x0102030405060708ull));
+        EXPECT_EQ(0x04030201u, bswap32(0x01020304u));
+    }
+}
+
+TEST_F(PFData_test, bswap64ToFloatArray){
+    //Big endian doubles, covering every tail length of the vector kernels
+    std::vector<uint64_t> src(37);
+    std::vector<float> expected(src.size());
+    for(std::size_t i = 0; i < src.size(); ++i){
+        const double value = 1.0 / (i + 1) - 0.3 * i;
+        expected[i] = static_cast<float>(value);
+        uint64_t raw;
+        std::memcpy(&raw, &value, 8);
+        src[i] = bswap64(raw);
+    }
+
+    for(std::size_t n = 0; n <= src.size(); ++n){
+        std::vector<float> dst(src.size(), -1.0f);
+        bswap64_to_float_array(src.data(), dst.data(), n);
+
+        //In place, the floats are written over the doubles already read
+        std::vector<uint64_t> inplace(src);
+        bswap64_to_float_array(inplace.data(), reinterpret_cast<float*>(inplace.data()), n);
+        const float* inplaceFloats = reinterpret_cast<const float*>(inplace.data());
+
+        for(std::size_t i = 0; i < n; ++i){
+            ASSERT_EQ(expected[i], dst[i]);
+            ASSERT_EQ(expected[i], inplaceFloats[i]);
+        }
+        for(std::size_t i = n; i < dst.size(); ++i){
+            ASSERT_EQ(-1.0f, dst[i]);
+        }
+    }
+}
+
 TEST_F(PFData_test, emptyFile){
 	std::ofstream MyFile("emptyFile");
 	MyFile.close();
@@ -0,0 +1,89 @@
+/**
+ * pfb-gen
+ * Writes a synthetic pfb file of any size and processor topology, filled with generatePfbValue(), for tests and benchmarks.
+ */
+#include "parflow/pfgenerator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+static void printUsage(const char* program){
+    std::fprintf(stderr,
+        "Usage: %s [options] <output.pfb>\n"
+        "  --nx N, --ny N, --nz N   Grid size (default 100 x 100 x 10)\n"
+        "  --p N, --q N, --r N      Number of subgrids along X, Y, Z (default 1)\n"
+        "  --seed N                 Seed of the generated field (default 0)\n"
+        "  --threads N              Number of threads (default: all hardware threads)\n",
+        program);
+}
+
+//Parses an integer in [minimum, INT_MAX], returns false on error
+static bool parseInt(const char* text, long long minimum, long long& value){
+    char* end = nullptr;
+    value = std::strtoll(text, &end, 10);
+    return end != text && *end == '\0' && value >= minimum && value <= INT_MAX;
+}
+
+int main(int argc, char** argv){
+    long long nx = 100, ny = 100, nz = 10;
+    long long p = 1, q = 1, r = 1;
+    long long seed = 0;
+    long long numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::string output;
+
+    for(int i = 1; i < argc; ++i){
+        const std::string arg = argv[i];
+        long long* target = nullptr;
+        if(arg == "--nx") target = &nx;
+        else if(arg == "--ny") target = &ny;
+        else if(arg == "--nz") target = &nz;
+        else if(arg == "--p") target = &p;
+        else if(arg == "--q") target = &q;
+        else if(arg == "--r") target = &r;
+        else if(arg == "--seed") target = &seed;
+        else if(arg == "--threads") target = &numThreads;
+        else if(arg == "-h" || arg == "--help"){
+            printUsage(argv[0]);
+            return 0;
+        }else if(!arg.empty() && arg[0] != '-' && output.empty()){
+            output = arg;
+            continue;
+        }else{
+            std::fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        //The seed may be 0, everything else must be positive
+        if(i + 1 >= argc || !parseInt(argv[i + 1], target == &seed ? 0 : 1, *target)){
+            std::fprintf(stderr, "Missing or invalid value for %s\n", arg.c_str());
+            return 1;
+        }
+        ++i;
+    }
+
+    if(output.empty()){
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const int err = generatePfbFile(output, static_cast<int>(nz), static_cast<int>(ny), static_cast<int>(nx),
+                                    static_cast<int>(p), static_cast<int>(q), static_cast<int>(r),
+                                    static_cast<unsigned int>(seed), static_cast<int>(numThreads));
+    if(err){
+        std::fprintf(stderr, "Failed to write %s (error %d)\n", output.c_str(), err);
+        return 1;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const double gigabytes = 8.0 * nx * ny * nz / 1e9;
+    std::printf("Wrote %s: %lld x %lld x %lld (ZYX), P=%lld Q=%lld R=%lld, %.3f GB in %.3f s (%.2f GB/s)\n",
+                output.c_str(), nz, ny, nx, p, q, r, gigabytes, seconds, seconds > 0 ? gigabytes / seconds : 0.0);
+    return 0;
+}